@@ -0,0 +1,111 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <QDir>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+#include <kio/copyjob.h>
+
+/*
+   Copying a tree of many small files, one file at a time, with several
+   copies at once (CopyJob::setMaxConcurrentFileCopies), and by the slave
+   in one go, as by default for local trees.
+   Uses tmpfs when available, so that the disk doesn't hide the cost of
+   the jobs themselves.
+*/
+
+static const int s_dirCount = 20;
+static const int s_filesPerDir = 100;
+
+class CopyJobBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void serialCopy();
+    void concurrentCopy();
+    void treeCopy();
+
+private:
+    void copyTree(const char *what, int concurrentCopies, bool byTheSlave);
+
+    QScopedPointer<QTemporaryDir> m_dir;
+    QString m_srcDir;
+};
+
+void CopyJobBenchmark::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    // To avoid a runtime dependency on klauncher
+    qputenv("KDE_FORK_SLAVES", "yes");
+
+    if (QFileInfo(QStringLiteral("/dev/shm")).isWritable()) {
+        m_dir.reset(new QTemporaryDir(QStringLiteral("/dev/shm/copyjob_benchmark-XXXXXX")));
+    } else {
+        m_dir.reset(new QTemporaryDir);
+    }
+    QVERIFY(m_dir->isValid());
+    m_srcDir = m_dir->filePath(QStringLiteral("src"));
+    const QByteArray data(1024, 'x');
+    for (int dir = 0; dir < s_dirCount; ++dir) {
+        const QString dirPath = m_srcDir + QStringLiteral("/dir%1").arg(dir);
+        QVERIFY(QDir().mkpath(dirPath));
+        for (int i = 0; i < s_filesPerDir; ++i) {
+            QFile file(dirPath + QStringLiteral("/file%1").arg(i));
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write(data);
+        }
+    }
+}
+
+void CopyJobBenchmark::copyTree(const char *what, int concurrentCopies, bool byTheSlave)
+{
+    if (byTheSlave) {
+        qunsetenv("KIO_DISABLE_COPY_TREE");
+    } else {
+        qputenv("KIO_DISABLE_COPY_TREE", "1");
+    }
+    const QString destDir = m_dir->filePath(QString::fromLatin1(what).replace(QLatin1Char(' '), QLatin1Char('_')));
+    QBENCHMARK {
+        QDir(destDir).removeRecursively();
+        KIO::CopyJob *job = KIO::copyAs(QUrl::fromLocalFile(m_srcDir), QUrl::fromLocalFile(destDir), KIO::HideProgressInfo);
+        job->setUiDelegate(nullptr);
+        job->setUiDelegateExtension(nullptr);
+        job->setMaxConcurrentFileCopies(concurrentCopies);
+        int copied = 0;
+        connect(job, &KIO::CopyJob::copyingDone, this, [&copied](KIO::Job *, const QUrl &, const QUrl &, const QDateTime &, bool directory, bool) {
+            if (!directory) {
+                ++copied;
+            }
+        });
+        QVERIFY2(job->exec(), qPrintable(job->errorString()));
+        QCOMPARE(copied, s_dirCount * s_filesPerDir);
+    }
+    QCOMPARE(QDir(destDir + QStringLiteral("/dir0")).entryList(QDir::Files).count(), s_filesPerDir);
+}
+
+void CopyJobBenchmark::serialCopy()
+{
+    copyTree("one file at a time", 1, false);
+}
+
+void CopyJobBenchmark::concurrentCopy()
+{
+    copyTree("five files at once", 5, false);
+}
+
+void CopyJobBenchmark::treeCopy()
+{
+    copyTree("whole tree by the slave", 1, true);
+}
+
+QTEST_GUILESS_MAIN(CopyJobBenchmark)
+
+#include "copyjob_benchmark.moc"
@@ -0,0 +1,114 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+#include <QTemporaryDir>
+
+#include <KIO/DetermineMimeTypesJob>
+#include <KFileItemListProperties>
+
+class DetermineMimeTypesJobTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        QStandardPaths::setTestModeEnabled(true);
+    }
+
+    void testDetermineMimeTypes()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+
+        // Extension-less files, only their contents tell their MIME type
+        KFileItemList items;
+        for (int i = 0; i < 100; ++i) {
+            const QString path = dir.path() + QLatin1String("/file") + QString::number(i);
+            QFile file(path);
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write(i % 2 ? "#!/bin/sh\necho hello\n" : "%PDF-1.4\n");
+            file.close();
+            items.append(KFileItem(QUrl::fromLocalFile(path)));
+        }
+        QDir(dir.path()).mkdir(QStringLiteral("subdir"));
+        items.append(KFileItem(QUrl::fromLocalFile(dir.path() + QLatin1String("/subdir"))));
+        for (const KFileItem &item : qAsConst(items)) {
+            QVERIFY(!item.isMimeTypeKnown());
+        }
+
+        KIO::DetermineMimeTypesJob *job = new KIO::DetermineMimeTypesJob(items);
+        int determined = 0;
+        connect(job, &KIO::DetermineMimeTypesJob::mimeTypesDetermined, this, [&determined](const KFileItemList &determinedItems) {
+            determined += determinedItems.count();
+        });
+        QVERIFY(job->exec());
+        QCOMPARE(determined, items.count());
+
+        // The copies in the list got the MIME types too
+        for (int i = 0; i < 100; ++i) {
+            const KFileItem &item = items.at(i);
+            QVERIFY(item.isMimeTypeKnown());
+            QCOMPARE(item.currentMimeType().name(), i % 2 ? QStringLiteral("application/x-shellscript") : QStringLiteral("application/pdf"));
+        }
+        QVERIFY(items.last().isMimeTypeKnown());
+        QCOMPARE(items.last().currentMimeType().name(), QStringLiteral("inode/directory"));
+    }
+
+    void testKnownMimeTypes()
+    {
+        KFileItemList items;
+        items.append(KFileItem(QUrl::fromLocalFile(QStringLiteral("/doesnotexist.txt")), QStringLiteral("text/plain")));
+        QVERIFY(items.first().isMimeTypeKnown());
+
+        KIO::DetermineMimeTypesJob *job = new KIO::DetermineMimeTypesJob(items);
+        int determined = 0;
+        connect(job, &KIO::DetermineMimeTypesJob::mimeTypesDetermined, this, [&determined](const KFileItemList &determinedItems) {
+            determined += determinedItems.count();
+        });
+        QVERIFY(job->exec());
+        QCOMPARE(determined, 0);
+    }
+
+    void testListProperties()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+
+        KFileItemList items;
+        for (int i = 0; i < 100; ++i) {
+            const QString path = dir.path() + QLatin1String("/script") + QString::number(i);
+            QFile file(path);
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write("#!/bin/sh\necho hello\n");
+            file.close();
+            items.append(KFileItem(QUrl::fromLocalFile(path)));
+        }
+
+        KFileItemListProperties properties(items);
+        QCOMPARE(properties.mimeType(), QStringLiteral("application/x-shellscript"));
+        QCOMPARE(properties.mimeGroup(), QStringLiteral("application"));
+        for (const KFileItem &item : qAsConst(items)) {
+            QVERIFY(item.isMimeTypeKnown());
+        }
+
+        const QString pdfPath = dir.path() + QLatin1String("/document");
+        QFile pdf(pdfPath);
+        QVERIFY(pdf.open(QIODevice::WriteOnly));
+        pdf.write("%PDF-1.4\n");
+        pdf.close();
+        items.append(KFileItem(QUrl::fromLocalFile(pdfPath)));
+        properties.setItems(items);
+        QCOMPARE(properties.mimeType(), QString());
+        QCOMPARE(properties.mimeGroup(), QStringLiteral("application"));
+    }
+};
+
+QTEST_GUILESS_MAIN(DetermineMimeTypesJobTest)
+
+#include "determinemimetypesjobtest.moc"
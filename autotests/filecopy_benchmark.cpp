@@ -0,0 +1,161 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+#include <kio/filecopyjob.h>
+
+#include <qplatformdefs.h>
+
+/*
+   Compares the ways kio_file can copy a file:
+   - same directory: reflink (FICLONE) where the filesystem supports it,
+     copy_file_range otherwise
+   - /tmp, usually another filesystem: copy_file_range (Linux >= 5.3), sendfile
+   - a plain read/write loop with a 512 kB buffer, done in-process, which is
+     what kio_file falls back to
+
+   The sparse file case checks that holes are preserved.
+*/
+
+static const qint64 s_fileSize = 64 * 1024 * 1024;
+
+class FileCopyBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void copySamePartition();
+    void copyOtherPartition();
+    void copyBufferLoop();
+    void copySparseFile();
+
+private:
+    void copy(const QString &dest);
+
+    QString m_src;
+    QTemporaryDir m_otherDir{QDir::tempPath() + QStringLiteral("/filecopybenchmark")};
+};
+
+void FileCopyBenchmark::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    // To avoid a runtime dependency on klauncher
+    qputenv("KDE_FORK_SLAVES", "yes");
+
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QStringLiteral("/filecopybenchmark/");
+    QVERIFY(QDir().mkpath(dir));
+    QVERIFY(m_otherDir.isValid());
+
+    m_src = dir + QStringLiteral("src");
+    QFile f(m_src);
+    QVERIFY(f.open(QIODevice::WriteOnly));
+    QByteArray chunk(1024 * 1024, 'k');
+    for (qint64 written = 0; written < s_fileSize; written += chunk.size()) {
+        chunk[0] = char(written);
+        QCOMPARE(f.write(chunk), qint64(chunk.size()));
+    }
+}
+
+void FileCopyBenchmark::cleanupTestCase()
+{
+    QDir(QFileInfo(m_src).absolutePath()).removeRecursively();
+}
+
+void FileCopyBenchmark::copy(const QString &dest)
+{
+    QFile::remove(dest);
+    KIO::Job *job = KIO::file_copy(QUrl::fromLocalFile(m_src), QUrl::fromLocalFile(dest), -1, KIO::HideProgressInfo);
+    QVERIFY2(job->exec(), qPrintable(job->errorString()));
+    QCOMPARE(QFileInfo(dest).size(), s_fileSize);
+}
+
+void FileCopyBenchmark::copySamePartition()
+{
+    const QString dest = m_src + QStringLiteral("_copy");
+    QBENCHMARK {
+        copy(dest);
+    }
+    QFile::remove(dest);
+}
+
+void FileCopyBenchmark::copyOtherPartition()
+{
+    const QString dest = m_otherDir.path() + QStringLiteral("/dest");
+    QBENCHMARK {
+        copy(dest);
+    }
+    QFile::remove(dest);
+}
+
+void FileCopyBenchmark::copyBufferLoop()
+{
+    const QString dest = m_otherDir.path() + QStringLiteral("/dest_loop");
+    QByteArray buffer(512 * 1024, Qt::Uninitialized);
+    QBENCHMARK {
+        QFile src(m_src);
+        QVERIFY(src.open(QIODevice::ReadOnly | QIODevice::Unbuffered));
+        QFile dst(dest);
+        QVERIFY(dst.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered));
+        qint64 n;
+        while ((n = src.read(buffer.data(), buffer.size())) > 0) {
+            QCOMPARE(dst.write(buffer.constData(), n), n);
+        }
+    }
+    QCOMPARE(QFileInfo(dest).size(), s_fileSize);
+    QFile::remove(dest);
+}
+
+void FileCopyBenchmark::copySparseFile()
+{
+#ifdef Q_OS_UNIX
+    const QString sparse = m_otherDir.path() + QStringLiteral("/sparse");
+    QFile f(sparse);
+    QVERIFY(f.open(QIODevice::WriteOnly));
+    // data, 64 MB hole, data, trailing hole
+    QVERIFY(f.write(QByteArray(4096, 'a')) == 4096);
+    QVERIFY(f.seek(s_fileSize));
+    QVERIFY(f.write(QByteArray(4096, 'b')) == 4096);
+    QVERIFY(f.resize(2 * s_fileSize));
+    f.close();
+
+    QT_STATBUF srcBuf;
+    QCOMPARE(QT_STAT(QFile::encodeName(sparse).constData(), &srcBuf), 0);
+    if (qint64(srcBuf.st_blocks) * 512 >= srcBuf.st_size) {
+        QSKIP("The filesystem doesn't support sparse files");
+    }
+
+    const QString dest = m_otherDir.path() + QStringLiteral("/sparse_copy");
+    QBENCHMARK {
+        QFile::remove(dest);
+        KIO::Job *job = KIO::file_copy(QUrl::fromLocalFile(sparse), QUrl::fromLocalFile(dest), -1, KIO::HideProgressInfo);
+        QVERIFY2(job->exec(), qPrintable(job->errorString()));
+    }
+
+    QT_STATBUF destBuf;
+    QCOMPARE(QT_STAT(QFile::encodeName(dest).constData(), &destBuf), 0);
+    QCOMPARE(destBuf.st_size, srcBuf.st_size);
+    QVERIFY2(destBuf.st_blocks <= srcBuf.st_blocks * 2, "holes were filled in");
+
+    QFile copy(dest);
+    QVERIFY(copy.open(QIODevice::ReadOnly));
+    QCOMPARE(copy.read(4096), QByteArray(4096, 'a'));
+    QVERIFY(copy.seek(s_fileSize));
+    QCOMPARE(copy.read(4096), QByteArray(4096, 'b'));
+    QCOMPARE(copy.read(4096), QByteArray(4096, '\0'));
+#endif
+}
+
+QTEST_GUILESS_MAIN(FileCopyBenchmark)
+
+#include "filecopy_benchmark.moc"
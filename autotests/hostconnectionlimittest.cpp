@@ -0,0 +1,132 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include "commands_p.h"
+#include "hostconnectionlimit_p.h"
+
+using namespace KIO;
+
+class HostConnectionLimitTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testStartsAtMaximum();
+    void testDecreaseOnFailure();
+    void testDecreaseOnLatency();
+    void testLargeTransfersDontCount();
+    void testJobsBeforeDecreaseDontCount();
+    void testIncrease();
+    void testNoIncreaseWithoutQueuedJobs();
+};
+
+void HostConnectionLimitTest::testStartsAtMaximum()
+{
+    HostConnectionLimit limit;
+    limit.setLimits(1, 4);
+    QCOMPARE(limit.maxConnections(), 4);
+
+    // the bounds are sane whatever the configuration
+    limit.setLimits(3, 0);
+    QCOMPARE(limit.maxConnections(), 1);
+}
+
+void HostConnectionLimitTest::testDecreaseOnFailure()
+{
+    HostConnectionLimit limit;
+    limit.setLimits(2, 8);
+    limit.jobDone(CMD_GET, 10, 0, true, 0, true);
+    QCOMPARE(limit.maxConnections(), 4);
+    limit.jobDone(CMD_GET, 10, 0, true, 0, true);
+    QCOMPARE(limit.maxConnections(), 2);
+    // not below the minimum
+    limit.jobDone(CMD_GET, 10, 0, true, 0, true);
+    QCOMPARE(limit.maxConnections(), 2);
+}
+
+void HostConnectionLimitTest::testDecreaseOnLatency()
+{
+    HostConnectionLimit limit;
+    limit.setLimits(1, 8);
+    for (int i = 0; i < 20; ++i) {
+        limit.jobDone(CMD_STAT, 10, 100, false, 0, false);
+    }
+    QCOMPARE(limit.maxConnections(), 8);
+    // a bit slower is noise
+    limit.jobDone(CMD_STAT, 20, 100, false, 0, false);
+    QCOMPARE(limit.maxConnections(), 8);
+    // the smoothed latency gets over twice the usual one
+    limit.jobDone(CMD_STAT, 500, 100, false, 0, false);
+    QCOMPARE(limit.maxConnections(), 4);
+}
+
+void HostConnectionLimitTest::testLargeTransfersDontCount()
+{
+    HostConnectionLimit limit;
+    limit.setLimits(1, 8);
+    limit.jobDone(CMD_STAT, 10, 100, false, 0, false);
+    // these take long because of what they transfer, not because of the host
+    limit.jobDone(CMD_GET, 5000, 10 * 1024 * 1024, false, 0, false);
+    limit.jobDone(CMD_LISTDIR, 5000, 0, false, 0, false);
+    QCOMPARE(limit.maxConnections(), 8);
+}
+
+void HostConnectionLimitTest::testJobsBeforeDecreaseDontCount()
+{
+    HostConnectionLimit limit;
+    limit.setLimits(1, 8);
+    // three jobs still run with the old limit
+    limit.jobDone(CMD_GET, 10, 0, true, 3, true);
+    QCOMPARE(limit.maxConnections(), 4);
+    for (int i = 0; i < 3; ++i) {
+        limit.jobDone(CMD_GET, 10, 0, true, 0, true);
+        QCOMPARE(limit.maxConnections(), 4);
+    }
+    limit.jobDone(CMD_GET, 10, 0, true, 0, true);
+    QCOMPARE(limit.maxConnections(), 2);
+}
+
+void HostConnectionLimitTest::testIncrease()
+{
+    HostConnectionLimit limit;
+    limit.setLimits(1, 4);
+    limit.jobDone(CMD_GET, 10, 0, true, 0, true);
+    QCOMPARE(limit.maxConnections(), 2);
+
+    // one more after a round of as many good jobs as the limit
+    limit.jobDone(CMD_STAT, 10, 100, false, 0, true);
+    QCOMPARE(limit.maxConnections(), 2);
+    limit.jobDone(CMD_STAT, 10, 100, false, 0, true);
+    QCOMPARE(limit.maxConnections(), 3);
+    for (int i = 0; i < 3; ++i) {
+        limit.jobDone(CMD_STAT, 10, 100, false, 0, true);
+    }
+    QCOMPARE(limit.maxConnections(), 4);
+
+    // never over the maximum
+    for (int i = 0; i < 10; ++i) {
+        limit.jobDone(CMD_STAT, 10, 100, false, 0, true);
+    }
+    QCOMPARE(limit.maxConnections(), 4);
+}
+
+void HostConnectionLimitTest::testNoIncreaseWithoutQueuedJobs()
+{
+    HostConnectionLimit limit;
+    limit.setLimits(1, 4);
+    limit.jobDone(CMD_GET, 10, 0, true, 0, true);
+    QCOMPARE(limit.maxConnections(), 2);
+    for (int i = 0; i < 10; ++i) {
+        limit.jobDone(CMD_STAT, 10, 100, false, 0, false);
+    }
+    QCOMPARE(limit.maxConnections(), 2);
+}
+
+QTEST_GUILESS_MAIN(HostConnectionLimitTest)
+
+#include "hostconnectionlimittest.moc"
@@ -0,0 +1,238 @@
+/*
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QtEndian>
+
+#ifndef Q_OS_WIN
+#include <unistd.h>
+#endif
+
+#include "httpcacheindex.h"
+
+class HttpCacheIndexTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testInsertFind();
+    void testRemove();
+    void testRebuild();
+    void testRebuildFailure();
+    void testSharedBetweenInstances();
+    void testStuckSlot();
+
+private:
+    static QByteArray key(int i)
+    {
+        return QCryptographicHash::hash(QByteArray::number(i), QCryptographicHash::Sha1);
+    }
+    static HttpCacheIndex::Entry entry(int i)
+    {
+        HttpCacheIndex::Entry e;
+        e.lastUsedDate = 3000 + i;
+        e.size = i * 10;
+        e.useCount = i;
+        return e;
+    }
+};
+
+void HttpCacheIndexTest::testInsertFind()
+{
+    QTemporaryDir dir;
+    HttpCacheIndex index;
+    QVERIFY(!index.open(dir.path()));
+    QVERIFY(!index.isComplete());
+    QVERIFY(index.rebuild(dir.path(), 0));
+    QVERIFY(index.isOpen());
+    QVERIFY(index.isComplete());
+    QCOMPARE(index.count(), 0);
+
+    for (int i = 0; i < 500; ++i) {
+        QVERIFY(index.insert(key(i), entry(i)));
+    }
+    QCOMPARE(index.count(), 500);
+    HttpCacheIndex::Entry e;
+    QVERIFY(index.find(key(42), &e));
+    QCOMPARE(e.size, qint64(420));
+    QCOMPARE(e.lastUsedDate, qint64(3042));
+    QVERIFY(!index.find(key(1000)));
+
+    QVERIFY(index.touch(key(42), 5000));
+    QVERIFY(index.find(key(42), &e));
+    QCOMPARE(e.useCount, 43);
+    QCOMPARE(e.lastUsedDate, qint64(5000));
+
+    // replacing doesn't add an entry
+    QVERIFY(index.insert(key(42), entry(1)));
+    QCOMPARE(index.count(), 500);
+    QCOMPARE(index.items().size(), 500);
+
+    const QString baseName = HttpCacheIndex::baseNameFromKey(key(7));
+    QCOMPARE(baseName.length(), 40);
+    QCOMPARE(HttpCacheIndex::keyFromBaseName(baseName), key(7));
+    QVERIFY(HttpCacheIndex::keyFromBaseName(baseName + QLatin1String(".tmp")).isEmpty());
+}
+
+void HttpCacheIndexTest::testRemove()
+{
+    QTemporaryDir dir;
+    HttpCacheIndex index;
+    QVERIFY(index.rebuild(dir.path(), 0));
+    for (int i = 0; i < 100; ++i) {
+        QVERIFY(index.insert(key(i), entry(i)));
+    }
+    for (int i = 0; i < 100; i += 2) {
+        QVERIFY(index.remove(key(i)));
+    }
+    QVERIFY(!index.remove(key(0)));
+    QCOMPARE(index.count(), 50);
+    QCOMPARE(index.usedSlots(), 100);
+    for (int i = 0; i < 100; ++i) {
+        QCOMPARE(index.find(key(i)), bool(i % 2));
+    }
+    // removed slots get reused
+    QVERIFY(index.insert(key(0), entry(0)));
+    QCOMPARE(index.count(), 51);
+    QVERIFY(index.find(key(0)));
+}
+
+void HttpCacheIndexTest::testRebuild()
+{
+    QTemporaryDir dir;
+    HttpCacheIndex index;
+    QVERIFY(index.rebuild(dir.path(), 0));
+    const int capacity = index.capacity();
+    for (int i = 0; i < capacity / 2; ++i) {
+        QVERIFY(index.insert(key(i), entry(i)));
+    }
+    QVERIFY(index.rebuild(dir.path(), capacity * 2));
+    QCOMPARE(index.capacity(), capacity * 2);
+    QCOMPARE(index.count(), capacity / 2);
+    HttpCacheIndex::Entry e;
+    QVERIFY(index.find(key(17), &e));
+    QCOMPARE(e.size, qint64(170));
+
+    QVector<HttpCacheIndex::Item> items;
+    items.append({key(1), entry(1)});
+    QVERIFY(index.rebuild(dir.path(), 0, &items));
+    QCOMPARE(index.count(), 1);
+    QVERIFY(index.find(key(1)));
+    QVERIFY(!index.find(key(17)));
+}
+
+void HttpCacheIndexTest::testRebuildFailure()
+{
+#ifdef Q_OS_WIN
+    QSKIP("Can't make a directory read-only on Windows");
+#else
+    if (::geteuid() == 0) {
+        QSKIP("Permissions are not enforced for root");
+    }
+#endif
+    QTemporaryDir dir;
+    HttpCacheIndex cleaner;
+    QVERIFY(cleaner.rebuild(dir.path(), 0));
+    HttpCacheIndex slave;
+    QVERIFY(slave.open(dir.path()));
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(slave.insert(key(i), entry(i)));
+    }
+    QVERIFY(slave.remove(key(3)));
+
+    // The new index can't be saved next to the current one
+    const QFile::Permissions permissions = QFile::permissions(dir.path());
+    QVERIFY(QFile::setPermissions(dir.path(), QFile::ReadOwner | QFile::ExeOwner));
+    const bool rebuilt = cleaner.rebuild(dir.path(), cleaner.capacity() * 4);
+    QVERIFY(QFile::setPermissions(dir.path(), permissions));
+    QVERIFY(!rebuilt);
+
+    // The current index is still in use, without waiting for a new one
+    QVERIFY(cleaner.isOpen());
+    QVERIFY(slave.isComplete());
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(slave.find(key(1)));
+    QVERIFY(!slave.find(key(3)));
+    QVERIFY(!slave.find(key(100)));
+    QVERIFY(timer.elapsed() < 500);
+    QCOMPARE(slave.count(), 9);
+    QVERIFY(slave.insert(key(100), entry(100)));
+    QVERIFY(cleaner.find(key(100)));
+    QCOMPARE(cleaner.items().size(), 10);
+}
+
+void HttpCacheIndexTest::testSharedBetweenInstances()
+{
+    QTemporaryDir dir;
+    HttpCacheIndex cleaner;
+    QVERIFY(cleaner.rebuild(dir.path(), 0));
+
+    HttpCacheIndex slave;
+    QVERIFY(slave.open(dir.path()));
+    QVERIFY(slave.insert(key(1), entry(1)));
+    QVERIFY(cleaner.find(key(1)));
+
+    // the slave notices that the index was replaced, and follows
+    QVERIFY(cleaner.rebuild(dir.path(), cleaner.capacity() * 4));
+    QVERIFY(!slave.isComplete());
+    QVERIFY(slave.find(key(1)));
+    QVERIFY(slave.isComplete());
+    QCOMPARE(slave.capacity(), cleaner.capacity());
+    QVERIFY(slave.insert(key(2), entry(2)));
+    QVERIFY(cleaner.find(key(2)));
+}
+
+void HttpCacheIndexTest::testStuckSlot()
+{
+    QTemporaryDir dir;
+    HttpCacheIndex index;
+    QVERIFY(index.rebuild(dir.path(), 0));
+    QVERIFY(index.insert(key(1), entry(1)));
+    QVERIFY(index.insert(key(2), entry(2)));
+
+    // A slave died while writing the slot of key(1): its sequence counter stays odd
+    QFile file(dir.path() + QLatin1String("/index"));
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    const int headerSize = 64;
+    const int slotSize = 48;
+    const quint32 slot = qFromUnaligned<quint32>(key(1).constData()) % quint32(index.capacity());
+    QVERIFY(file.seek(headerSize + qint64(slot) * slotSize));
+    const quint32 seq = 1;
+    QCOMPARE(file.write(reinterpret_cast<const char *>(&seq), sizeof(seq)), qint64(sizeof(seq)));
+    file.close();
+
+    // given up on instead of waiting forever, the index isn't trusted anymore
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(!index.find(key(1)));
+    QVERIFY(!index.touch(key(1), 5000));
+    QVERIFY(timer.elapsed() < 5000);
+    QVERIFY(!index.isComplete());
+    QVERIFY(index.find(key(2)));
+
+    // the cleaner takes the slot over; what it held is lost, so the new index is incomplete too
+    QVERIFY(index.rebuild(dir.path(), 0));
+    QVERIFY(!index.isComplete());
+    QVERIFY(!index.find(key(1)));
+    QVERIFY(index.find(key(2)));
+
+    // until it is rebuilt from the cache files
+    QVector<HttpCacheIndex::Item> items;
+    items.append({key(1), entry(1)});
+    items.append({key(2), entry(2)});
+    QVERIFY(index.rebuild(dir.path(), 0, &items));
+    QVERIFY(index.isComplete());
+    QVERIFY(index.find(key(1)));
+}
+
+QTEST_GUILESS_MAIN(HttpCacheIndexTest)
+
+#include "httpcacheindextest.moc"
@@ -6,6 +6,7 @@
 */
 
 #include <kio/job.h>
+#include <kio/multigetjob.h>
 
 #include <QTest>
 #include <QSignalSpy>
@@ -22,6 +23,15 @@ private Q_SLOTS:
     void testBasicGet();
     void testErrorPage();
     void testMimeTypeDetermination();
+    void testMultiGet();
+    void testMultiGetBrokenPipelining();
+    void testMultiGetNoKeepAlive();
+
+private:
+    void multiGet(const QString &endPoint, int count);
+
+    QMap<long, QByteArray> m_multiGetData;
+    QList<long> m_multiGetResults;
 };
 
 void HTTPJobTest::initTestCase()
@@ -107,5 +117,72 @@ void HTTPJobTest::testMimeTypeDetermination()
     QCOMPARE(mimeTypeFoundSpy.at(0).at(1).toString(), QStringLiteral("text/html"));
 }
 
+void HTTPJobTest::multiGet(const QString &endPoint, int count)
+{
+    m_multiGetData.clear();
+    m_multiGetResults.clear();
+    KIO::MetaData metaData;
+    metaData.insert(QStringLiteral("cache"), QStringLiteral("reload"));
+    KIO::MultiGetJob *job = nullptr;
+    for (int i = 0; i < count; ++i) {
+        // not starting at 0, to check that the ids of the job are used
+        const long id = 100 + i;
+        const QUrl url(endPoint + QLatin1Char('/') + QString::number(i));
+        if (job) {
+            job->get(id, url, metaData);
+        } else {
+            job = KIO::multi_get(id, url, metaData);
+        }
+    }
+    job->setUiDelegate(nullptr);
+    connect(job, &KIO::MultiGetJob::data, this, [this](long id, const QByteArray &data) {
+        m_multiGetData[id] += data;
+    });
+    connect(job, QOverload<long>::of(&KIO::MultiGetJob::result), this, [this](long id) {
+        m_multiGetResults.append(id);
+    });
+    QVERIFY2(job->exec(), qPrintable(job->errorString()));
+}
+
+void HTTPJobTest::testMultiGet()
+{
+    HttpServerThread server(QByteArray(), HttpServerThread::KeepAlive | HttpServerThread::EchoPath);
+    multiGet(server.endPoint(), 20);
+    QCOMPARE(m_multiGetResults.size(), 20);
+    for (int i = 0; i < 20; ++i) {
+        QCOMPARE(m_multiGetData.value(100 + i), QByteArray("/path/" + QByteArray::number(i)));
+        QVERIFY(m_multiGetResults.contains(100 + i));
+    }
+    QCOMPARE(server.requestCount(), 20);
+}
+
+void HTTPJobTest::testMultiGetBrokenPipelining()
+{
+    // The server drops the requests pipelined after the first one, kio_http has to send them again
+    HttpServerThread server(QByteArray(), HttpServerThread::KeepAlive | HttpServerThread::BreakPipelining | HttpServerThread::EchoPath);
+    multiGet(server.endPoint(), 20);
+    QCOMPARE(m_multiGetResults.size(), 20);
+    for (int i = 0; i < 20; ++i) {
+        QCOMPARE(m_multiGetData.value(100 + i), QByteArray("/path/" + QByteArray::number(i)));
+    }
+    // responses lost with the connection are asked for again
+    QVERIFY(server.requestCount() >= 20);
+    // after the first broken connection, one request at a time on the next one
+    QCOMPARE(server.connectionCount(), 2);
+}
+
+void HTTPJobTest::testMultiGetNoKeepAlive()
+{
+    // The server closes the connection after each response, kio_http has
+    // to send the requests which were pipelined after it again
+    HttpServerThread server(QByteArray(), HttpServerThread::EchoPath);
+    multiGet(server.endPoint(), 5);
+    QCOMPARE(m_multiGetResults.size(), 5);
+    for (int i = 0; i < 5; ++i) {
+        QCOMPARE(m_multiGetData.value(100 + i), QByteArray("/path/" + QByteArray::number(i)));
+    }
+    QCOMPARE(server.connectionCount(), 5);
+}
+
 QTEST_MAIN(HTTPJobTest)
 #include "http_jobtest.moc"
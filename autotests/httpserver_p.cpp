@@ -99,13 +99,20 @@ QByteArray HttpServerThread::makeHttpResponse(const QByteArray &responseData) co
     httpResponse += "\r\n";
 
     // We don't support multiple connections so let's ask the client
-    // to close the connection every time.
-    httpResponse += "Connection: close\r\n";
+    // to close the connection every time, unless it can stay on this one.
+    if (!(m_features & KeepAlive)) {
+        httpResponse += "Connection: close\r\n";
+    }
     httpResponse += "\r\n";
     httpResponse += responseData;
     return httpResponse;
 }
 
+bool HttpServerThread::hasCompleteRequest() const
+{
+    return m_partialRequest.contains("\r\n\r\n");
+}
+
 void HttpServerThread::disableSsl()
 {
     m_server->disableSsl();
@@ -135,29 +142,41 @@ void HttpServerThread::run()
     // Wait for first connection (we'll wait for further ones inside the loop)
     QTcpSocket *clientSocket = m_server->waitForNextConnectionSocket();
     Q_ASSERT(clientSocket);
+    lock.relock();
+    ++m_connectionCount;
+    lock.unlock();
 
     Q_FOREVER {
-        // get the "request" packet
-        if (doDebug) {
-            qDebug() << "HttpServerThread: waiting for read";
-        }
-        if (clientSocket->state() == QAbstractSocket::UnconnectedState ||
-                !clientSocket->waitForReadyRead(2000)) {
-            if (clientSocket->state() == QAbstractSocket::UnconnectedState) {
-                delete clientSocket;
-                if (doDebug) {
-                    qDebug() << "Waiting for next connection...";
+        QByteArray request;
+        if ((m_features & KeepAlive) && hasCompleteRequest()) {
+            // pipelined, the client didn't wait for the previous response
+            request = m_partialRequest;
+        } else {
+            // get the "request" packet
+            if (doDebug) {
+                qDebug() << "HttpServerThread: waiting for read";
+            }
+            if (clientSocket->state() == QAbstractSocket::UnconnectedState ||
+                    !clientSocket->waitForReadyRead(2000)) {
+                if (clientSocket->state() == QAbstractSocket::UnconnectedState) {
+                    delete clientSocket;
+                    if (doDebug) {
+                        qDebug() << "Waiting for next connection...";
+                    }
+                    clientSocket = m_server->waitForNextConnectionSocket();
+                    Q_ASSERT(clientSocket);
+                    lock.relock();
+                    ++m_connectionCount;
+                    lock.unlock();
+                    continue; // go to "waitForReadyRead"
+                } else {
+                    const auto clientSocketError = clientSocket->error();
+                    qDebug() << "HttpServerThread:" << clientSocketError << "waiting for \"request\" packet";
+                    break;
                 }
-                clientSocket = m_server->waitForNextConnectionSocket();
-                Q_ASSERT(clientSocket);
-                continue; // go to "waitForReadyRead"
-            } else {
-                const auto clientSocketError = clientSocket->error();
-                qDebug() << "HttpServerThread:" << clientSocketError << "waiting for \"request\" packet";
-                break;
             }
+            request = m_partialRequest + clientSocket->readAll();
         }
-        const QByteArray request = m_partialRequest + clientSocket->readAll();
         if (doDebug) {
             qDebug() << "HttpServerThread: request:" << request;
         }
@@ -182,11 +201,20 @@ void HttpServerThread::run()
         }
 
         m_partialRequest.clear();
+        if (m_features & KeepAlive) {
+            // keep what follows the body, the next requests
+            const int contentLength = m_headers.value("Content-Length").toInt();
+            m_partialRequest = m_receivedData.mid(contentLength);
+            m_receivedData.truncate(contentLength);
+        }
 
         if (m_headers.value("_path").endsWith("terminateThread")) { // we're asked to exit
             break;    // normal exit
         }
 
+        ++m_requestCount;
+        const QByteArray path = m_headers.value("_path");
+        const int responseDelay = m_responseDelay;
         lock.unlock();
 
         //qDebug() << "headers received:" << m_receivedHeaders;
@@ -235,14 +263,30 @@ void HttpServerThread::run()
             }
         }
 
+        if (responseDelay > 0) {
+            QThread::msleep(responseDelay);
+        }
+
         // send response
-        const QByteArray response = makeHttpResponse(m_dataToSend);
+        const QByteArray response = makeHttpResponse((m_features & EchoPath) ? path : m_dataToSend);
         if (doDebug) {
             qDebug() << "HttpServerThread: writing" << response;
         }
         clientSocket->write(response);
 
         clientSocket->flush();
+
+        if ((m_features & BreakPipelining) && hasCompleteRequest()) {
+            // like some broken servers: the pipelined requests get lost
+            if (doDebug) {
+                qDebug() << "HttpServerThread: dropping pipelined requests";
+            }
+            clientSocket->disconnectFromHost();
+            if (clientSocket->state() != QAbstractSocket::UnconnectedState) {
+                clientSocket->waitForDisconnected(2000);
+            }
+            m_partialRequest.clear();
+        }
     }
     // all done...
     delete clientSocket;
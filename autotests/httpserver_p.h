@@ -27,8 +27,11 @@ public:
         Public = 0,    // HTTP with no ssl and no authentication needed
         Ssl = 1,       // HTTPS
         BasicAuth = 2,  // Requires authentication
-        Error404 = 4   // Return "404 not found"
-                   // bitfield, next item is 8
+        Error404 = 4,  // Return "404 not found"
+        KeepAlive = 8, // Keep the connection open, answer pipelined requests in order
+        BreakPipelining = 16, // With KeepAlive: close the connection after the first of several pipelined requests
+        EchoPath = 32  // Send the path of the request instead of the response data
+                   // bitfield, next item is 64
     };
     Q_DECLARE_FLAGS(Features, Feature)
 
@@ -63,6 +66,13 @@ public:
         m_features = features;
     }
 
+    // Wait that long before each response, like a busy server
+    void setResponseDelay(int msecs)
+    {
+        QMutexLocker lock(&m_mutex);
+        m_responseDelay = msecs;
+    }
+
     void disableSsl();
     inline int serverPort() const
     {
@@ -101,11 +111,24 @@ public:
         return m_headers.value(value);
     }
 
+    int requestCount() const
+    {
+        QMutexLocker lock(&m_mutex);
+        return m_requestCount;
+    }
+
+    int connectionCount() const
+    {
+        QMutexLocker lock(&m_mutex);
+        return m_connectionCount;
+    }
+
 protected:
     /* \reimp */ void run() override;
 
 private:
     QByteArray makeHttpResponse(const QByteArray &responseData) const;
+    bool hasCompleteRequest() const;
 
 private:
     QByteArray m_partialRequest;
@@ -113,11 +136,14 @@ private:
     QByteArray m_dataToSend;
     QByteArray m_contentType;
 
-    mutable QMutex m_mutex; // protects the 4 vars below
+    mutable QMutex m_mutex; // protects the 7 vars below
     QByteArray m_receivedData;
     QByteArray m_receivedHeaders;
     QMap<QByteArray, QByteArray> m_headers;
     int m_port;
+    int m_requestCount = 0;
+    int m_connectionCount = 0;
+    int m_responseDelay = 0;
 
     Features m_features;
     BlockingHttpServer *m_server;
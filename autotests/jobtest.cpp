@@ -775,6 +775,108 @@ void JobTest::copyDirectoryToExistingDirectory()
     copyLocalDirectory(src, dest, AlreadyExists);
 }
 
+void JobTest::copyDirectoryConcurrently()
+{
+    const QString src = homeTmpDir() + "dirWithManyFiles";
+    const QString dest = homeTmpDir() + "dirWithManyFiles_copied";
+    QDir(src).removeRecursively();
+    QDir(dest).removeRecursively();
+    QVERIFY(QDir().mkpath(src));
+    QVERIFY(QDir().mkpath(dest));
+    QStringList names;
+    QList<QUrl> urls;
+    for (int i = 0; i < 20; ++i) {
+        names.append(QStringLiteral("file%1").arg(i, 2, 10, QLatin1Char('0')));
+        urls.append(QUrl::fromLocalFile(src + QLatin1Char('/') + names.last()));
+        createTestFile(urls.last().toLocalFile());
+    }
+
+    KIO::CopyJob *job = KIO::copy(urls, QUrl::fromLocalFile(dest), KIO::HideProgressInfo);
+    job->setUiDelegate(nullptr);
+    job->setUiDelegateExtension(nullptr);
+    job->setMaxConcurrentFileCopies(4);
+    QStringList copied;
+    connect(job, &KIO::CopyJob::copyingDone, this, [&copied](KIO::Job *, const QUrl &from) {
+        copied.append(from.fileName());
+    });
+    QVERIFY2(job->exec(), qPrintable(job->errorString()));
+    // reported in the order of the files, whichever copy finished first
+    QCOMPARE(copied, names);
+    QCOMPARE(job->processedAmount(KJob::Files), 20);
+    for (const QString &name : qAsConst(names)) {
+        QVERIFY(QFileInfo(dest + QLatin1Char('/') + name).isFile());
+    }
+
+    // A conflict stops the concurrent copies, the file is retried alone and
+    // fails as it does without them
+    QFile::remove(dest + "/file05");
+    QFile::remove(dest + "/file15");
+    job = KIO::copy(urls, QUrl::fromLocalFile(dest), KIO::HideProgressInfo);
+    job->setUiDelegate(nullptr);
+    job->setUiDelegateExtension(nullptr);
+    job->setMaxConcurrentFileCopies(4);
+    QVERIFY(!job->exec());
+    QCOMPARE(job->error(), int(KIO::ERR_FILE_ALREADY_EXIST));
+
+    // With auto-skip, the missing files get copied
+    job = KIO::copy(urls, QUrl::fromLocalFile(dest), KIO::HideProgressInfo);
+    job->setUiDelegate(nullptr);
+    job->setUiDelegateExtension(nullptr);
+    job->setAutoSkip(true);
+    job->setMaxConcurrentFileCopies(4);
+    QVERIFY2(job->exec(), qPrintable(job->errorString()));
+    QVERIFY(QFile::exists(dest + "/file05"));
+    QVERIFY(QFile::exists(dest + "/file15"));
+}
+
+void JobTest::copyDirectoryTree()
+{
+    // A local tree is copied by kio_file in one go (CMD_COPY_TREE),
+    // the job still reports every item
+    const QString src = homeTmpDir() + "dirTree";
+    const QString dest = homeTmpDir() + "dirTree_copied";
+    QDir(src).removeRecursively();
+    QDir(dest).removeRecursively();
+    createTestDirectory(src);
+    createTestDirectory(src + "/subdir");
+    createTestDirectory(src + "/subdir/subsubdir", NoSymlink);
+    setTimeStamp(src + "/subdir", s_referenceTimeStamp);
+    setTimeStamp(src, s_referenceTimeStamp);
+
+    KIO::CopyJob *job = KIO::copyAs(QUrl::fromLocalFile(src), QUrl::fromLocalFile(dest), KIO::HideProgressInfo);
+    job->setUiDelegate(nullptr);
+    job->setUiDelegateExtension(nullptr);
+    int copiedDirs = 0;
+    int copiedFiles = 0;
+    int copiedLinks = 0;
+    connect(job, &KIO::CopyJob::copyingDone, this, [&](KIO::Job *, const QUrl &, const QUrl &, const QDateTime &, bool directory) {
+        ++(directory ? copiedDirs : copiedFiles);
+    });
+    connect(job, &KIO::CopyJob::copyingLinkDone, this, [&copiedLinks]() {
+        ++copiedLinks;
+    });
+    QVERIFY2(job->exec(), qPrintable(job->errorString()));
+    QCOMPARE(copiedDirs, 3);
+    QCOMPARE(copiedFiles, 3);
+#ifndef Q_OS_WIN
+    QCOMPARE(copiedLinks, 2);
+    QVERIFY(QFileInfo(dest + "/subdir/testlink").isSymLink());
+#endif
+    QVERIFY(QFileInfo(dest + "/subdir/subsubdir/testfile").isFile());
+    QCOMPARE(QFileInfo(dest + "/subdir/testfile").lastModified(), s_referenceTimeStamp);
+    QCOMPARE(QFileInfo(dest + "/subdir").lastModified(), s_referenceTimeStamp);
+    QCOMPARE(QFileInfo(dest).lastModified(), s_referenceTimeStamp);
+
+    // The destination exists now: the job falls back to copying item by item
+    QVERIFY(QFile::remove(dest + "/subdir/testfile"));
+    job = KIO::copyAs(QUrl::fromLocalFile(src), QUrl::fromLocalFile(dest), KIO::Overwrite | KIO::HideProgressInfo);
+    job->setUiDelegate(nullptr);
+    job->setUiDelegateExtension(nullptr);
+    job->setWriteIntoExistingDirectories(true);
+    QVERIFY2(job->exec(), qPrintable(job->errorString()));
+    QVERIFY(QFileInfo(dest + "/subdir/testfile").isFile());
+}
+
 void JobTest::copyDirectoryToExistingSymlinkedDirectory()
 {
     // qDebug();
@@ -1294,6 +1396,29 @@ void JobTest::listFile()
     QCOMPARE(job->error(), static_cast<int>(KIO::ERR_DOES_NOT_EXIST));
 }
 
+void JobTest::listDirNotSearchable()
+{
+#ifdef Q_OS_WIN
+    QSKIP("Skipping unaccessible folder test on Windows, cannot remove all permissions from a folder");
+#else
+    if (::geteuid() == 0) {
+        QSKIP("Permissions are not enforced for root");
+    }
+#endif
+    // Given a dir that can be read but not searched
+    const QString subdir = homeTmpDir() + "notsearchable";
+    QVERIFY(QDir().mkpath(subdir));
+    createTestFile(subdir + "/thefile");
+    QVERIFY(QFile(subdir).setPermissions(QFile::ReadOwner));
+    CleanupInaccessibleSubdir c(subdir);
+
+    // Listing it should fail, as its entries can't be stat'ed
+    KIO::ListJob *job = KIO::listDir(QUrl::fromLocalFile(subdir), KIO::HideProgressInfo);
+    job->setUiDelegate(nullptr);
+    QVERIFY(!job->exec());
+    QCOMPARE(job->error(), static_cast<int>(KIO::ERR_CANNOT_ENTER_DIRECTORY));
+}
+
 void JobTest::killJob()
 {
     const QString src = homeTmpDir();
@@ -38,6 +38,8 @@ private Q_SLOTS:
     void copyDirectoryToSamePartition();
     void copyDirectoryToExistingDirectory();
     void copyDirectoryToExistingSymlinkedDirectory();
+    void copyDirectoryConcurrently();
+    void copyDirectoryTree();
     void copyFileToOtherPartition();
     void copyDirectoryToOtherPartition();
     void copyRelativeSymlinkToSamePartition();
@@ -48,6 +50,7 @@ private Q_SLOTS:
     void suspendCopy();
     void listRecursive();
     void listFile();
+    void listDirNotSearchable();
     void killJob();
     void killJobBeforeStart();
     void deleteJobBeforeStart();
@@ -0,0 +1,113 @@
+/*
+    This file is part of KDE
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+#include <QStandardPaths>
+
+#include "../../src/ioslaves/http/kcookiejar/kcookiejar.cpp"
+
+/*
+   Lookups and saves in a jar holding many cookies, spread over many
+   domains, like after months of browsing.
+*/
+
+static const int s_domainCount = 2000;
+static const int s_cookiesPerDomain = 10;
+
+class KCookieJarBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void benchmarkFindCookies();
+    void benchmarkSaveOneChange();
+    void benchmarkSaveAll();
+
+private:
+    void addCookie(int domain, int cookie);
+
+    KCookieJar *m_jar = nullptr;
+    KConfig *m_config = nullptr;
+    QString m_file;
+    QByteArray m_nextYear;
+};
+
+void KCookieJarBenchmark::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation);
+    m_file = dir + QLatin1String("/kcookiejar-benchmarkcookies");
+    QFile::remove(m_file);
+    QFile::remove(m_file + QLatin1String(".journal"));
+    QFile::remove(dir + QLatin1String("/kcookiejar-benchmarkconfig"));
+    m_config = new KConfig(dir + QLatin1String("/kcookiejar-benchmarkconfig"));
+    KConfigGroup(m_config, "Cookie Policy").writeEntry("CookieGlobalAdvice", "Accept");
+
+    m_jar = new KCookieJar;
+    m_jar->loadConfig(m_config, false);
+    m_nextYear = QDateTime::currentDateTime().addYears(1).toString(Qt::RFC2822Date).toLatin1();
+    for (int domain = 0; domain < s_domainCount; ++domain) {
+        for (int cookie = 0; cookie < s_cookiesPerDomain; ++cookie) {
+            addCookie(domain, cookie);
+        }
+    }
+    QVERIFY(m_jar->saveCookies(m_file));
+}
+
+void KCookieJarBenchmark::cleanupTestCase()
+{
+    delete m_jar;
+    delete m_config;
+    QFile::remove(m_file);
+    QFile::remove(m_file + QLatin1String(".journal"));
+}
+
+void KCookieJarBenchmark::addCookie(int domain, int cookie)
+{
+    const QString url = QStringLiteral("http://www%1.domain%2.test/").arg(cookie % 3).arg(domain);
+    const QByteArray header = "Set-Cookie: cookie" + QByteArray::number(cookie) + "=value; Domain=.domain"
+                              + QByteArray::number(domain) + ".test; expires=" + m_nextYear;
+    KHttpCookieList list = m_jar->makeCookies(url, header, 0);
+    QCOMPARE(list.count(), 1);
+    m_jar->addCookie(list.first());
+}
+
+void KCookieJarBenchmark::benchmarkFindCookies()
+{
+    int domain = 0;
+    QBENCHMARK {
+        const QString url = QStringLiteral("http://www1.domain%1.test/some/path").arg(domain);
+        const QString cookies = m_jar->findCookies(url, false, 0);
+        QVERIFY(!cookies.isEmpty());
+        domain = (domain + 97) % s_domainCount;
+    }
+}
+
+void KCookieJarBenchmark::benchmarkSaveOneChange()
+{
+    int domain = 0;
+    QBENCHMARK {
+        addCookie(domain, 0); // replaces the cookie
+        QVERIFY(m_jar->saveCookies(m_file));
+        domain = (domain + 1) % s_domainCount;
+    }
+}
+
+void KCookieJarBenchmark::benchmarkSaveAll()
+{
+    QBENCHMARK {
+        // A policy change can't be journaled
+        m_jar->setGlobalAdvice(KCookieAsk);
+        m_jar->setGlobalAdvice(KCookieAccept);
+        QVERIFY(m_jar->saveCookies(m_file));
+    }
+}
+
+QTEST_GUILESS_MAIN(KCookieJarBenchmark)
+
+#include "kcookiejar_benchmark.moc"
@@ -238,6 +238,90 @@ private Q_SLOTS:
         }
     }
 
+    void testJournal()
+    {
+        const QString file = QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation) + QLatin1String("/kcookiejar-testjournal");
+        const QString journal = file + QLatin1String(".journal");
+        QFile::remove(file);
+        QFile::remove(journal);
+        clearConfig();
+        clearCookies();
+        KConfigGroup(config, "Cookie Policy").writeEntry("CookieGlobalAdvice", "Accept");
+        jar->loadConfig(config, false);
+
+        const QString url = QStringLiteral("http://www.journal.test/");
+        const auto addCookie = [&](const char *header) {
+            KHttpCookieList list = jar->makeCookies(url, QByteArray(header).replace("%NEXTYEAR%", nextYear->toLatin1()), 0);
+            QCOMPARE(list.count(), 1);
+            jar->addCookie(list.first());
+        };
+        addCookie("Set-Cookie: a=1; expires=%NEXTYEAR%");
+        addCookie("Set-Cookie: b=2; expires=%NEXTYEAR%");
+        QVERIFY(jar->saveCookies(file));
+        QVERIFY(!QFile::exists(journal));
+
+        // Changes only go to the journal
+        addCookie("Set-Cookie: c=3; expires=%NEXTYEAR%");
+        addCookie("Set-Cookie: b=4; expires=%NEXTYEAR%");
+        KHttpCookieList *list = jar->getCookieList(QString(), QStringLiteral("www.journal.test"));
+        QVERIFY(list);
+        auto it = std::find_if(list->begin(), list->end(), [](const KHttpCookie &cookie) {
+            return cookie.name() == QLatin1String("a");
+        });
+        QVERIFY(it != list->end());
+        jar->eatCookie(it);
+        QVERIFY(jar->saveCookies(file));
+        QVERIFY(QFile::exists(journal));
+        QVERIFY(!(QFile::permissions(journal) & (QFile::ReadGroup | QFile::WriteGroup | QFile::ReadOther | QFile::WriteOther)));
+
+        KCookieJar reloaded;
+        reloaded.loadConfig(config, false);
+        QVERIFY(reloaded.loadCookies(file));
+        QCOMPARE(reloaded.findCookies(url, false, 0), jar->findCookies(url, false, 0));
+        QCOMPARE(reloaded.findCookies(url, false, 0), QStringLiteral("Cookie: c=3; b=4"));
+
+        // A policy change rewrites the whole file
+        jar->setGlobalAdvice(KCookieAcceptForSession);
+        QVERIFY(jar->saveCookies(file));
+        QVERIFY(!QFile::exists(journal));
+        clearCookies();
+        clearConfig();
+    }
+
+    void testFindHostCookies()
+    {
+        clearConfig();
+        clearCookies();
+        KConfigGroup(config, "Cookie Policy").writeEntry("CookieGlobalAdvice", "Accept");
+        jar->loadConfig(config, false);
+
+        const QString url = QStringLiteral("https://www.host.test/a/b");
+        const auto addCookie = [&](const char *header) {
+            KHttpCookieList list = jar->makeCookies(url, QByteArray(header).replace("%NEXTYEAR%", nextYear->toLatin1()), 0);
+            QCOMPARE(list.count(), 1);
+            jar->addCookie(list.first());
+        };
+        addCookie("Set-Cookie: root=1; path=/; expires=%NEXTYEAR%");
+        addCookie("Set-Cookie: sub=2; path=/a; expires=%NEXTYEAR%");
+        addCookie("Set-Cookie: other=3; path=/c; expires=%NEXTYEAR%");
+        addCookie("Set-Cookie: secure=4; path=/; secure; expires=%NEXTYEAR%");
+
+        // All the cookies of the host, whatever the path of the url
+        qint64 validUntil = -1;
+        const KHttpCookieList cookies = jar->findHostCookies(QStringLiteral("http://www.host.test/c"), windowId, &validUntil);
+        QStringList names;
+        for (const KHttpCookie &cookie : cookies) {
+            names << cookie.name();
+        }
+        names.sort();
+        QCOMPARE(names, QStringList({QStringLiteral("other"), QStringLiteral("root"), QStringLiteral("secure"), QStringLiteral("sub")}));
+        QVERIFY(validUntil > QDateTime::currentSecsSinceEpoch());
+        QVERIFY(jar->findHostCookies(QStringLiteral("http://elsewhere.test/"), windowId).isEmpty());
+
+        clearCookies();
+        clearConfig();
+    }
+
     void testParseUrl_data()
     {
         QTest::addColumn<QString>("url");
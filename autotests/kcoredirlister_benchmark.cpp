@@ -8,10 +8,16 @@
 #include <QTest>
 
 #include <kfileitem.h>
+#include <kcoredirlister.h>
 
 #include <QList>
 #include <QHash>
 #include <QMap>
+#include <QDir>
+#include <QFile>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QLoggingCategory>
 
 #include <algorithm>
 #include <random>
@@ -93,6 +99,8 @@ private Q_SLOTS:
     void testFindByUrlFiles_Binary();
     void testFindByUrlAllFiles_Binary_data();
     void testFindByUrlAllFiles_Binary();
+
+    void testDirectoryCache();
 };
 
 
@@ -532,6 +540,58 @@ void kcoreDirListerEntryBenchmark::testFindByUrlAllFiles_Binary()
     findByUrlAll<BinaryListImplementation>(numberOfFiles);
 }
 
+//BEGIN Directory cache
+// QT_LOGGING_RULES="kf.kio.core.dirlister.benchmark.debug=true" shows how the cache did
+Q_LOGGING_CATEGORY(KIO_DIRLISTER_BENCHMARK, "kf.kio.core.dirlister.benchmark", QtInfoMsg)
+
+// Lists directories with real dir listers, going back and forth between
+// them like a user would, and checks that the shared directory cache keeps
+// within its size
+void kcoreDirListerEntryBenchmark::testDirectoryCache()
+{
+    // To avoid a runtime dependency on klauncher
+    qputenv("KDE_FORK_SLAVES", "yes");
+
+    const int numberOfDirs = 50;
+    const int filesPerDir = 200;
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    QList<QUrl> dirs;
+    for (int i = 0; i < numberOfDirs; ++i) {
+        const QString dir = tempDir.path() + QStringLiteral("/dir%1").arg(i);
+        QVERIFY(QDir().mkdir(dir));
+        for (int j = 0; j < filesPerDir; ++j) {
+            QFile file(dir + QStringLiteral("/file%1.txt").arg(j));
+            QVERIFY(file.open(QIODevice::WriteOnly));
+        }
+        dirs.append(QUrl::fromLocalFile(dir));
+    }
+
+    QBENCHMARK_ONCE {
+        KCoreDirLister lister;
+        QSignalSpy spyCompleted(&lister, QOverload<>::of(&KCoreDirLister::completed));
+        for (int pass = 0; pass < 3; ++pass) {
+            for (const QUrl &dir : qAsConst(dirs)) {
+                lister.openUrl(dir);
+                if (!lister.isFinished()) {
+                    QVERIFY(spyCompleted.wait());
+                }
+            }
+        }
+    }
+
+    const KCoreDirLister::CacheStatistics statistics = KCoreDirLister::cacheStatistics();
+    qCDebug(KIO_DIRLISTER_BENCHMARK) << "hits:" << statistics.hits
+                                     << "misses:" << statistics.misses
+                                     << "evictions:" << statistics.evictions
+                                     << "cached directories:" << statistics.cachedDirectories
+                                     << "cached KiB:" << statistics.cachedBytes / 1024
+                                     << "of" << statistics.maxCachedBytes / 1024;
+    QCOMPARE(statistics.hits + statistics.misses, quint64(3 * numberOfDirs));
+    QVERIFY(statistics.cachedBytes <= statistics.maxCachedBytes);
+}
+//END Directory cache
+
 //END tests
 
 QTEST_MAIN(kcoreDirListerEntryBenchmark)
@@ -165,6 +165,38 @@ void KDirListerTest::testOpenUrlFromCache()
     disconnect(&m_dirLister, nullptr, this, nullptr);
 }
 
+void KDirListerTest::testCacheStatistics()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    createTestFile(tempDir.path() + "/file_1");
+    createTestFile(tempDir.path() + "/file_2");
+    const QUrl url = QUrl::fromLocalFile(tempDir.path());
+
+    const KCoreDirLister::CacheStatistics before = KCoreDirLister::cacheStatistics();
+    {
+        MyDirLister dirLister;
+        dirLister.openUrl(url, KDirLister::NoFlags);
+        QTRY_COMPARE(dirLister.spyCompleted.count(), 1);
+    } // the directory moves into the cache
+
+    const KCoreDirLister::CacheStatistics cached = KCoreDirLister::cacheStatistics();
+    QCOMPARE(cached.misses, before.misses + 1);
+    QCOMPARE(cached.hits, before.hits);
+    QVERIFY(cached.cachedDirectories > 0);
+    QVERIFY(cached.cachedBytes > 0);
+    QVERIFY(cached.cachedBytes <= cached.maxCachedBytes);
+
+    {
+        MyDirLister dirLister;
+        dirLister.openUrl(url, KDirLister::NoFlags);
+        QTRY_COMPARE(dirLister.spyCompleted.count(), 1);
+    }
+    const KCoreDirLister::CacheStatistics after = KCoreDirLister::cacheStatistics();
+    QCOMPARE(after.hits, cached.hits + 1);
+    QCOMPARE(after.misses, cached.misses);
+}
+
 // This test assumes testOpenUrl was run before. So m_dirLister is holding the items already.
 // This test creates 1 file in the temporary directory
 void KDirListerTest::testNewItem()
@@ -1230,6 +1262,115 @@ void KDirListerTest::testDirPermissionChange()
     QVERIFY(QDir().rmdir(subdir));
 }
 
+// An unchanged entry must still get hidden/shown on relist when ".hidden" changed
+void KDirListerTest::testDotHiddenOnRelist()
+{
+    QTemporaryDir tempDir;
+    const QString path = tempDir.path() + '/';
+    const QString fileName = path + QLatin1String("file");
+    createSimpleFile(fileName);
+
+    MyDirLister mylister;
+    mylister.setShowingDotFiles(true);
+    mylister.openUrl(QUrl::fromLocalFile(tempDir.path()));
+    QTRY_VERIFY(mylister.isFinished());
+    QVERIFY(!mylister.findByUrl(QUrl::fromLocalFile(fileName)).isHidden());
+
+    QFile dotHidden(path + QLatin1String(".hidden"));
+    QVERIFY(dotHidden.open(QIODevice::WriteOnly));
+    dotHidden.write("file\n");
+    dotHidden.close();
+
+    QSignalSpy spyCompleted(&mylister, QOverload<>::of(&KCoreDirLister::completed));
+    mylister.updateDirectory(QUrl::fromLocalFile(tempDir.path()));
+    QVERIFY(spyCompleted.wait(2000));
+    QTRY_VERIFY(mylister.isFinished());
+    QVERIFY(mylister.findByUrl(QUrl::fromLocalFile(fileName)).isHidden());
+
+    const QDateTime mtime = QFileInfo(dotHidden).lastModified();
+    QVERIFY(dotHidden.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    // .hidden is cached by mtime, make sure it changes
+    QVERIFY(dotHidden.setFileTime(mtime.addSecs(1), QFileDevice::FileModificationTime));
+    dotHidden.close();
+
+    spyCompleted.clear();
+    mylister.updateDirectory(QUrl::fromLocalFile(tempDir.path()));
+    QVERIFY(spyCompleted.wait(2000));
+    QTRY_VERIFY(mylister.isFinished());
+    QVERIFY(!mylister.findByUrl(QUrl::fromLocalFile(fileName)).isHidden());
+}
+
+// A created entry is added without listing the directory, and the same way
+// as a listing would, so that the next listing doesn't refresh it
+void KDirListerTest::testNewEntryStatedAlone()
+{
+    QTemporaryDir tempDir;
+    const QString path = tempDir.path() + '/';
+
+    MyDirLister mylister;
+    // Only the KDirWatch::setCreated() below, no dirty() from the real watch
+    mylister.setAutoUpdate(false);
+    mylister.openUrl(QUrl::fromLocalFile(tempDir.path()));
+    QTRY_VERIFY(mylister.isFinished());
+    QCOMPARE(mylister.items().count(), 0);
+    mylister.clearSpies();
+
+    QSignalSpy spyNewItems(&mylister, &KCoreDirLister::newItems);
+    const QString fileName = path + QLatin1String("newfile");
+    createSimpleFile(fileName);
+    KDirWatch::self()->setCreated(fileName);
+    QVERIFY(spyNewItems.wait(2000));
+    QCOMPARE(mylister.spyStarted.count(), 0);
+    const KFileItem item = mylister.findByUrl(QUrl::fromLocalFile(fileName));
+    QVERIFY(!item.isNull());
+    QCOMPARE(item.size(), KIO::filesize_t(3));
+
+    QSignalSpy spyRefreshItems(&mylister, &KCoreDirLister::refreshItems);
+    QSignalSpy spyCompleted(&mylister, QOverload<>::of(&KCoreDirLister::completed));
+    mylister.updateDirectory(QUrl::fromLocalFile(tempDir.path()));
+    QVERIFY(spyCompleted.wait(2000));
+    QCOMPARE(spyRefreshItems.count(), 0);
+    QCOMPARE(mylister.items().count(), 1);
+}
+
+// A dirty directory is compared with its items, only the entries that
+// differ are stat'ed or removed, without listing the directory
+void KDirListerTest::testDirtyDirectoryDelta()
+{
+    QTemporaryDir tempDir;
+    const QString path = tempDir.path() + '/';
+    createSimpleFile(path + QLatin1String("unchanged"));
+    createSimpleFile(path + QLatin1String("modified"));
+    createSimpleFile(path + QLatin1String("removed"));
+
+    MyDirLister mylister;
+    // Only the KDirWatch::setDirty() below, no dirty() from the real watch
+    mylister.setAutoUpdate(false);
+    mylister.openUrl(QUrl::fromLocalFile(tempDir.path()));
+    QTRY_VERIFY(mylister.isFinished());
+    QCOMPARE(mylister.items().count(), 3);
+    const KFileItem unchangedItem = mylister.findByUrl(QUrl::fromLocalFile(path + QLatin1String("unchanged")));
+    mylister.clearSpies();
+
+    QSignalSpy spyNewItems(&mylister, &KCoreDirLister::newItems);
+    QFile modified(path + QLatin1String("modified"));
+    QVERIFY(modified.open(QIODevice::Append));
+    modified.write("more");
+    modified.close();
+    QVERIFY(QFile::remove(path + QLatin1String("removed")));
+    createSimpleFile(path + QLatin1String("added"));
+    KDirWatch::self()->setDirty(tempDir.path());
+
+    QTRY_COMPARE(mylister.spyItemsDeleted.count(), 1);
+    QTRY_COMPARE(spyNewItems.count(), 1);
+    QTRY_COMPARE(mylister.findByUrl(QUrl::fromLocalFile(path + QLatin1String("modified"))).size(), KIO::filesize_t(7));
+    QCOMPARE(mylister.spyStarted.count(), 0);
+    QCOMPARE(mylister.items().count(), 3);
+    QVERIFY(mylister.findByUrl(QUrl::fromLocalFile(path + QLatin1String("removed"))).isNull());
+    QVERIFY(!mylister.findByUrl(QUrl::fromLocalFile(path + QLatin1String("added"))).isNull());
+    QVERIFY(mylister.findByUrl(QUrl::fromLocalFile(path + QLatin1String("unchanged"))).cmp(unchangedItem));
+}
+
 void KDirListerTest::slotNewItems(const KFileItemList &lst)
 {
     m_items += lst;
@@ -76,6 +76,7 @@ private Q_SLOTS:
     void cleanup();
     void testOpenUrl();
     void testOpenUrlFromCache();
+    void testCacheStatistics();
     void testNewItem();
     void testNewItems();
     void benchFindByUrl();
@@ -104,6 +105,9 @@ private Q_SLOTS:
     void testDirPermissionChange();
     void testCopyAfterListingAndMove(); // #353195
     void testRenameDirectory(); // #401552
+    void testDotHiddenOnRelist();
+    void testNewEntryStatedAlone();
+    void testDirtyDirectoryDelta();
     void testDeleteCurrentDir(); // must be last!
 
 protected Q_SLOTS: // 'more private than private slots' - i.e. not seen by qtestlib
@@ -16,6 +16,8 @@
 #include <QTest>
 #include <QMimeData>
 #include <QSignalSpy>
+#include <QSet>
+#include <qplatformdefs.h>
 
 #ifdef Q_OS_UNIX
 #include <utime.h>
@@ -462,6 +464,31 @@ void KDirModelTest::testModifyFile()
                &m_eventLoop, &QTestEventLoop::exitLoop);
 }
 
+void KDirModelTest::testItemsChanged()
+{
+    QVERIFY(m_dirModel->rowCount() >= 4);
+    const QModelIndex row0 = m_dirModel->index(0, 0);
+    const QModelIndex row1 = m_dirModel->index(1, 0);
+    const QModelIndex row3 = m_dirModel->index(3, 0);
+
+    QSignalSpy spyDataChanged(m_dirModel, &QAbstractItemModel::dataChanged);
+    // Unsorted, with a duplicate, an invalid index and a row of a subdirectory
+    m_dirModel->itemsChanged({row3, row1, m_fileInDirIndex, QModelIndex(), row0, row1});
+
+    // One signal per range of adjacent rows of the same directory
+    QCOMPARE(spyDataChanged.count(), 3);
+    QSet<QString> ranges;
+    for (const QVariantList &args : qAsConst(spyDataChanged)) {
+        const QModelIndex topLeft = args[0].value<QModelIndex>();
+        const QModelIndex bottomRight = args[1].value<QModelIndex>();
+        QCOMPARE(topLeft.parent(), bottomRight.parent());
+        const QString parentName = m_dirModel->itemForIndex(topLeft.parent()).name();
+        ranges.insert(parentName + QLatin1Char(':') + QString::number(topLeft.row()) + QLatin1Char('-') + QString::number(bottomRight.row()));
+    }
+    const QString fileInDirRow = QString::number(m_fileInDirIndex.row());
+    QCOMPARE(ranges, QSet<QString>({QStringLiteral(".:0-1"), QStringLiteral(".:3-3"), QStringLiteral("subdir:") + fileInDirRow + QLatin1Char('-') + fileInDirRow}));
+}
+
 void KDirModelTest::testRenameFile()
 {
     const QUrl url = QUrl::fromLocalFile(m_tempDir->path() + "/toplevelfile_2");
@@ -1103,10 +1130,18 @@ void KDirModelTest::testSmb()
 class MyDirLister : public KDirLister
 {
 public:
+    void emitItemsAdded(const QUrl &directoryUrl, const KFileItemList &items)
+    {
+        emit itemsAdded(directoryUrl, items);
+    }
     void emitItemsDeleted(const KFileItemList &items)
     {
         emit itemsDeleted(items);
     }
+    void emitRefreshItems(const QList<QPair<KFileItem, KFileItem> > &items)
+    {
+        emit refreshItems(items);
+    }
 };
 
 void KDirModelTest::testBug196695()
@@ -1637,6 +1672,139 @@ void KDirModelTest::testDeleteCurrentDirectory()
     QVERIFY(!fileIndex.isValid());
 }
 
+// Like a build directory with many files, most of them changing or going away at once
+static const int s_manyItemsCount = 100000;
+
+KFileItemList KDirModelTest::fillModelWithManyItems(KDirModel *model, const QString &path)
+{
+    MyDirLister *dirLister = new MyDirLister;
+    model->setDirLister(dirLister);
+    QSignalSpy spyCompleted(dirLister, QOverload<>::of(&KCoreDirLister::completed));
+    dirLister->openUrl(QUrl::fromLocalFile(path), KDirLister::NoFlags);
+    if (spyCompleted.isEmpty()) {
+        spyCompleted.wait(10000);
+    }
+
+    // The items don't exist, only the signals of the lister are emitted
+    KFileItemList items;
+    items.reserve(s_manyItemsCount);
+    for (int i = 0; i < s_manyItemsCount; ++i) {
+        items.append(KFileItem(QUrl::fromLocalFile(path + "/file" + QString::number(i)), QStringLiteral("text/plain"), QT_STAT_REG));
+    }
+    dirLister->emitItemsAdded(dirLister->url(), items);
+    return items;
+}
+
+void KDirModelTest::benchmarkRefreshManyItems()
+{
+    QTemporaryDir tempDir;
+    KDirModel model;
+    const KFileItemList items = fillModelWithManyItems(&model, tempDir.path());
+    QCOMPARE(model.rowCount(), s_manyItemsCount);
+
+    QList<QPair<KFileItem, KFileItem> > changes;
+    for (int i = 0; i < items.count(); i += 2) {
+        changes.append(qMakePair(items.at(i), items.at(i)));
+    }
+    QSignalSpy spyDataChanged(&model, &QAbstractItemModel::dataChanged);
+    MyDirLister *dirLister = static_cast<MyDirLister *>(model.dirLister());
+    QBENCHMARK_ONCE {
+        dirLister->emitRefreshItems(changes);
+    }
+    QCOMPARE(spyDataChanged.count(), 1);
+    QCOMPARE(spyDataChanged.at(0).at(0).toModelIndex().row(), 0);
+    QCOMPARE(spyDataChanged.at(0).at(1).toModelIndex().row(), s_manyItemsCount - 2);
+}
+
+void KDirModelTest::benchmarkDeleteManyItems()
+{
+    QTemporaryDir tempDir;
+    KDirModel model;
+    const KFileItemList items = fillModelWithManyItems(&model, tempDir.path());
+    QCOMPARE(model.rowCount(), s_manyItemsCount);
+
+    // Every other item, so that each one is a range of removed rows
+    KFileItemList deleted;
+    for (int i = 0; i < items.count(); i += 2) {
+        deleted.append(items.at(i));
+    }
+    MyDirLister *dirLister = static_cast<MyDirLister *>(model.dirLister());
+    QBENCHMARK_ONCE {
+        dirLister->emitItemsDeleted(deleted);
+    }
+    QCOMPARE(model.rowCount(), s_manyItemsCount / 2);
+    // The remaining rows are numbered right
+    const QModelIndex index = model.indexForItem(items.at(s_manyItemsCount - 1));
+    QCOMPARE(index.row(), s_manyItemsCount / 2 - 1);
+    QCOMPARE(model.itemForIndex(model.index(1, 0)).url(), items.at(3).url());
+}
+
+void KDirModelTest::testIncrementalInsertion()
+{
+    QTemporaryDir tempDir;
+    KDirModel model;
+    model.setIncrementalInsertion(true);
+    QSignalSpy spyRowsInserted(&model, &QAbstractItemModel::rowsInserted);
+    const KFileItemList items = fillModelWithManyItems(&model, tempDir.path());
+    // The first rows are there right away, the others come from the event loop
+    QVERIFY(model.rowCount() > 0);
+    QVERIFY(model.rowCount() < s_manyItemsCount);
+    QTRY_COMPARE_WITH_TIMEOUT(model.rowCount(), s_manyItemsCount, 30000);
+    QVERIFY(spyRowsInserted.count() > 1);
+    QCOMPARE(model.itemForIndex(model.index(s_manyItemsCount - 1, 0)).url(), items.last().url());
+
+    // Looking up an item which isn't inserted yet doesn't insert it
+    QTemporaryDir otherTempDir;
+    KDirModel otherModel;
+    otherModel.setIncrementalInsertion(true);
+    const KFileItemList otherItems = fillModelWithManyItems(&otherModel, otherTempDir.path());
+    QVERIFY(otherModel.rowCount() < s_manyItemsCount);
+    QVERIFY(!otherModel.indexForItem(otherItems.last()).isValid());
+    QVERIFY(otherModel.rowCount() < s_manyItemsCount);
+    QTRY_COMPARE_WITH_TIMEOUT(otherModel.indexForItem(otherItems.last()).row(), s_manyItemsCount - 1, 30000);
+}
+
+void KDirModelTest::testIncrementalInsertionDeleteItem()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(QDir(tempDir.path()).mkdir(QStringLiteral("a")));
+    QVERIFY(QDir(tempDir.path()).mkdir(QStringLiteral("b")));
+    KDirModel model;
+    model.setIncrementalInsertion(true);
+    MyDirLister *dirLister = new MyDirLister;
+    model.setDirLister(dirLister);
+    QSignalSpy spyCompleted(dirLister, QOverload<>::of(&KCoreDirLister::completed));
+    dirLister->openUrl(QUrl::fromLocalFile(tempDir.path()), KDirLister::NoFlags);
+    if (spyCompleted.isEmpty()) {
+        QVERIFY(spyCompleted.wait(10000));
+    }
+    const QModelIndex indexA = model.indexForUrl(QUrl::fromLocalFile(tempDir.path() + "/a"));
+    const QModelIndex indexB = model.indexForUrl(QUrl::fromLocalFile(tempDir.path() + "/b"));
+    QVERIFY(indexA.isValid());
+    QVERIFY(indexB.isValid());
+
+    // The items don't exist, only the signals of the lister are emitted
+    const int count = 2000;
+    KFileItemList itemsA, itemsB;
+    for (int i = 0; i < count; ++i) {
+        itemsA.append(KFileItem(QUrl::fromLocalFile(tempDir.path() + "/a/file" + QString::number(i)), QStringLiteral("text/plain"), QT_STAT_REG));
+        itemsB.append(KFileItem(QUrl::fromLocalFile(tempDir.path() + "/b/file" + QString::number(i)), QStringLiteral("text/plain"), QT_STAT_REG));
+    }
+    dirLister->emitItemsAdded(QUrl::fromLocalFile(tempDir.path() + "/a"), itemsA);
+    dirLister->emitItemsAdded(QUrl::fromLocalFile(tempDir.path() + "/b"), itemsB);
+    const int rowCountA = model.rowCount(indexA);
+    QVERIFY(rowCountA < count);
+    QVERIFY(model.rowCount(indexB) < count);
+
+    // Only the items of the directory of the deleted item get inserted first
+    dirLister->emitItemsDeleted({itemsB.at(count - 1)});
+    QCOMPARE(model.rowCount(indexB), count - 1);
+    QVERIFY(!model.indexForItem(itemsB.at(count - 1)).isValid());
+    QCOMPARE(model.rowCount(indexA), rowCountA);
+    QTRY_COMPARE_WITH_TIMEOUT(model.rowCount(indexA), count, 30000);
+    QCOMPARE(model.rowCount(indexB), count - 1);
+}
+
 void KDirModelTest::testQUrlHash()
 {
     const int count = 3000;
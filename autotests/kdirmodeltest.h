@@ -32,6 +32,7 @@ private Q_SLOTS:
     void testData();
     void testReload();
     void testModifyFile();
+    void testItemsChanged();
     void testRenameFile();
     void testMoveDirectory();
     void testRenameDirectory();
@@ -56,6 +57,10 @@ private Q_SLOTS:
     void testShowRootAndExpandToUrl();
     void testHasChildren_data();
     void testHasChildren();
+    void benchmarkRefreshManyItems();
+    void benchmarkDeleteManyItems();
+    void testIncrementalInsertion();
+    void testIncrementalInsertionDeleteItem();
 
     // These tests must be done last
     void testDeleteFile();
@@ -78,6 +83,7 @@ private:
     void recreateTestData();
     void enterLoop();
     void fillModel(bool reload, bool expectAllIndexes = true);
+    KFileItemList fillModelWithManyItems(KDirModel *model, const QString &path);
     void collectKnownIndexes();
     void testMoveDirectory(const QString &srcdir);
     void testUpdateParentAfterExpand();
@@ -0,0 +1,156 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <QCollator>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <qplatformdefs.h>
+
+#include <KConfigGroup>
+#include <KSharedConfig>
+#include <kdirlister.h>
+#include <kdirmodel.h>
+#include <kdirsortfilterproxymodel.h>
+
+// More than one chunk of sort keys, see KDirSortFilterProxyModel::setSourceModel()
+static const int s_itemCount = 3000;
+
+class ItemsDirLister : public KDirLister
+{
+public:
+    void emitItemsAdded(const QUrl &directoryUrl, const KFileItemList &items)
+    {
+        emit itemsAdded(directoryUrl, items);
+    }
+    void emitRefreshItems(const QList<QPair<KFileItem, KFileItem> > &items)
+    {
+        emit refreshItems(items);
+    }
+};
+
+class KDirSortFilterProxyModelTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+    void cleanup();
+    void testSortListedItems();
+    void testSortAfterRename();
+    void testNaturalSortingChanged();
+
+private:
+    KFileItem fileItem(const QString &name) const;
+    void verifySorted(bool naturalSorting);
+    void setNaturalSorting(bool naturalSorting);
+
+    QTemporaryDir m_tempDir;
+    KDirModel *m_dirModel = nullptr;
+    KDirSortFilterProxyModel *m_proxyModel = nullptr;
+    ItemsDirLister *m_dirLister = nullptr;
+    KFileItemList m_items;
+};
+
+void KDirSortFilterProxyModelTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    setNaturalSorting(true);
+
+    // Shuffled, with numbers for the natural sorting; the items don't exist
+    m_items.reserve(s_itemCount);
+    for (int i = 0; i < s_itemCount; ++i) {
+        const int number = (i * 7919) % s_itemCount;
+        m_items.append(fileItem(QStringLiteral("Photo %1.jpg").arg(number)));
+    }
+}
+
+void KDirSortFilterProxyModelTest::init()
+{
+    m_dirModel = new KDirModel;
+    m_proxyModel = new KDirSortFilterProxyModel;
+    m_dirLister = new ItemsDirLister;
+    m_dirModel->setDirLister(m_dirLister);
+    m_proxyModel->setSourceModel(m_dirModel);
+    QSignalSpy spyCompleted(m_dirLister, QOverload<>::of(&KCoreDirLister::completed));
+    m_dirLister->openUrl(QUrl::fromLocalFile(m_tempDir.path()), KDirLister::NoFlags);
+    if (spyCompleted.isEmpty()) {
+        QVERIFY(spyCompleted.wait(10000));
+    }
+    m_dirLister->emitItemsAdded(m_dirLister->url(), m_items);
+    QCOMPARE(m_proxyModel->rowCount(), s_itemCount);
+}
+
+void KDirSortFilterProxyModelTest::cleanup()
+{
+    delete m_proxyModel;
+    delete m_dirModel;
+    m_proxyModel = nullptr;
+    m_dirModel = nullptr;
+    m_dirLister = nullptr;
+    setNaturalSorting(true);
+}
+
+KFileItem KDirSortFilterProxyModelTest::fileItem(const QString &name) const
+{
+    return KFileItem(QUrl::fromLocalFile(m_tempDir.path() + QLatin1Char('/') + name), QStringLiteral("image/jpeg"), QT_STAT_REG);
+}
+
+void KDirSortFilterProxyModelTest::verifySorted(bool naturalSorting)
+{
+    QCollator collator;
+    collator.setNumericMode(true);
+    collator.setCaseSensitivity(Qt::CaseInsensitive);
+    QString previous = m_proxyModel->index(0, 0).data().toString();
+    for (int row = 1; row < m_proxyModel->rowCount(); ++row) {
+        const QString name = m_proxyModel->index(row, 0).data().toString();
+        const int result = naturalSorting ? collator.compare(previous, name) : QString::compare(previous, name, Qt::CaseInsensitive);
+        QVERIFY2(result <= 0, qPrintable(previous + QLatin1String(" vs ") + name));
+        previous = name;
+    }
+}
+
+void KDirSortFilterProxyModelTest::setNaturalSorting(bool naturalSorting)
+{
+    KConfigGroup group(KSharedConfig::openConfig(), "KDE");
+    group.writeEntry("NaturalSorting", naturalSorting);
+}
+
+void KDirSortFilterProxyModelTest::testSortListedItems()
+{
+    verifySorted(true);
+    QCOMPARE(m_proxyModel->index(0, 0).data().toString(), QStringLiteral("Photo 0.jpg"));
+    QCOMPARE(m_proxyModel->index(10, 0).data().toString(), QStringLiteral("Photo 10.jpg"));
+}
+
+void KDirSortFilterProxyModelTest::testSortAfterRename()
+{
+    const KFileItem oldItem = fileItem(QStringLiteral("Photo 5.jpg"));
+    const KFileItem newItem = fileItem(QStringLiteral("Photo 50000.jpg"));
+    m_dirLister->emitRefreshItems({qMakePair(oldItem, newItem)});
+
+    verifySorted(true);
+    QCOMPARE(m_proxyModel->index(s_itemCount - 1, 0).data().toString(), QStringLiteral("Photo 50000.jpg"));
+    QCOMPARE(m_proxyModel->index(5, 0).data().toString(), QStringLiteral("Photo 6.jpg"));
+}
+
+void KDirSortFilterProxyModelTest::testNaturalSortingChanged()
+{
+    setNaturalSorting(false);
+    QVERIFY(QMetaObject::invokeMethod(m_proxyModel, "slotNaturalSortingChanged"));
+    m_proxyModel->invalidate();
+
+    verifySorted(false);
+    QCOMPARE(m_proxyModel->index(1, 0).data().toString(), QStringLiteral("Photo 1.jpg"));
+    QCOMPARE(m_proxyModel->index(2, 0).data().toString(), QStringLiteral("Photo 10.jpg"));
+}
+
+QTEST_MAIN(KDirSortFilterProxyModelTest)
+
+#include "kdirsortfilterproxymodeltest.moc"
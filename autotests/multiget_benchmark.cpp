@@ -0,0 +1,102 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <QStandardPaths>
+
+#include <kio/multigetjob.h>
+#include <kio/storedtransferjob.h>
+
+#include "httpserver_p.h"
+
+/*
+   Time taken by many small GETs against one server on localhost:
+   - one MultiGetJob, which kio_http pipelines on a keep-alive connection
+   - the same against a server that breaks pipelining, so kio_http falls
+     back to one request at a time
+   - one StoredTransferJob per file, on a new connection each, for comparison
+
+   Real servers add a network round trip per request, which is what
+   pipelining saves; on localhost this mostly shows the overhead.
+*/
+
+static const int s_requestCount = 500;
+
+class MultiGetBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void multiGetPipelined();
+    void multiGetNoPipelining();
+    void separateGets();
+
+private:
+    void multiGet(HttpServerThread::Features features);
+};
+
+void MultiGetBenchmark::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    // To avoid a runtime dependency on klauncher
+    qputenv("KDE_FORK_SLAVES", "yes");
+    // To let ctest exit, we shouldn't start kio_http_cache_cleaner
+    qputenv("KIO_DISABLE_CACHE_CLEANER", "yes");
+}
+
+void MultiGetBenchmark::multiGet(HttpServerThread::Features features)
+{
+    HttpServerThread server("Hello world", features | HttpServerThread::KeepAlive);
+    KIO::MetaData metaData;
+    metaData.insert(QStringLiteral("cache"), QStringLiteral("reload"));
+
+    QBENCHMARK {
+        KIO::MultiGetJob *job = nullptr;
+        for (int i = 0; i < s_requestCount; ++i) {
+            const QUrl url(server.endPoint() + QLatin1Char('/') + QString::number(i));
+            if (job) {
+                job->get(i, url, metaData);
+            } else {
+                job = KIO::multi_get(i, url, metaData);
+            }
+        }
+        job->setUiDelegate(nullptr);
+        int results = 0;
+        connect(job, QOverload<long>::of(&KIO::MultiGetJob::result), this, [&results]() {
+            ++results;
+        });
+        QVERIFY2(job->exec(), qPrintable(job->errorString()));
+        QCOMPARE(results, s_requestCount);
+    }
+}
+
+void MultiGetBenchmark::multiGetPipelined()
+{
+    multiGet(HttpServerThread::Public);
+}
+
+void MultiGetBenchmark::multiGetNoPipelining()
+{
+    multiGet(HttpServerThread::BreakPipelining);
+}
+
+void MultiGetBenchmark::separateGets()
+{
+    HttpServerThread server("Hello world", HttpServerThread::Public);
+    QBENCHMARK {
+        for (int i = 0; i < s_requestCount; ++i) {
+            KIO::StoredTransferJob *job = KIO::storedGet(QUrl(server.endPoint() + QLatin1Char('/') + QString::number(i)), KIO::Reload, KIO::HideProgressInfo);
+            job->setUiDelegate(nullptr);
+            QVERIFY2(job->exec(), qPrintable(job->errorString()));
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(MultiGetBenchmark)
+
+#include "multiget_benchmark.moc"
@@ -0,0 +1,132 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <QDebug>
+#include <QDir>
+#include <QHash>
+#include <QImage>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+#include <KProtocolInfo>
+#include <kio/previewjob.h>
+
+using namespace KIO;
+
+class PreviewJobTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void testWithoutPlugin();
+    void testAddItemsToRunningJob();
+
+private:
+    KFileItemList createImages(const QString &prefix, int count);
+    void countResults(PreviewJob *job);
+
+    QTemporaryDir m_tempDir;
+    QHash<QUrl, int> m_results;
+};
+
+void PreviewJobTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    // Generate the previews rather than finding them in the cache
+    QDir(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/thumbnails")).removeRecursively();
+    QVERIFY(m_tempDir.isValid());
+}
+
+KFileItemList PreviewJobTest::createImages(const QString &prefix, int count)
+{
+    KFileItemList items;
+    for (int i = 0; i < count; ++i) {
+        const QString path = m_tempDir.path() + QLatin1Char('/') + prefix + QString::number(i) + QLatin1String(".png");
+        QImage image(64, 64, QImage::Format_RGB32);
+        image.fill(qRgb(i * 4, 128, 255 - i * 4));
+        if (!image.save(path, "PNG")) {
+            qWarning() << "Could not save" << path;
+        }
+        items.append(KFileItem(QUrl::fromLocalFile(path), QStringLiteral("image/png"), KFileItem::Unknown));
+    }
+    return items;
+}
+
+// Each item must get exactly one gotPreview() or failed()
+void PreviewJobTest::countResults(PreviewJob *job)
+{
+    m_results.clear();
+    connect(job, &PreviewJob::gotPreview, this, [this](const KFileItem &item) {
+        m_results[item.url()]++;
+    });
+    connect(job, &PreviewJob::failed, this, [this](const KFileItem &item) {
+        m_results[item.url()]++;
+    });
+}
+
+void PreviewJobTest::testWithoutPlugin()
+{
+    const KFileItemList items = createImages(QStringLiteral("noplugin"), 10);
+    const QStringList enabledPlugins;
+    PreviewJob *job = KIO::filePreview(items.mid(0, 5), QSize(64, 64), &enabledPlugins);
+    countResults(job);
+    QSignalSpy spyResult(job, &KJob::result);
+
+    // Before the job started
+    job->addItems(items.mid(5));
+    job->prioritizeItems({items.at(9).url(), items.at(2).url()});
+
+    QVERIFY(spyResult.wait(10000));
+    QCOMPARE(m_results.count(), items.count());
+    for (const KFileItem &item : items) {
+        QCOMPARE(m_results.value(item.url()), 1);
+    }
+}
+
+void PreviewJobTest::testAddItemsToRunningJob()
+{
+    if (!KProtocolInfo::isKnownProtocol(QStringLiteral("thumbnail"))
+            || !PreviewJob::availablePlugins().contains(QLatin1String("imagethumbnail"))) {
+        QSKIP("kio-extras not installed");
+    }
+
+    // More items than tasks running at once, so that some of them wait
+    const KFileItemList firstItems = createImages(QStringLiteral("first"), 20);
+    const KFileItemList laterItems = createImages(QStringLiteral("later"), 20);
+    const QStringList enabledPlugins{QStringLiteral("imagethumbnail")};
+    PreviewJob *job = KIO::filePreview(firstItems, QSize(64, 64), &enabledPlugins);
+    countResults(job);
+    QSignalSpy spyResult(job, &KJob::result);
+
+    // As soon as the job is running, i.e. delivered its first result
+    bool added = false;
+    auto addItems = [&]() {
+        if (added) {
+            return;
+        }
+        added = true;
+        job->addItems(laterItems);
+        // Some of the items not started yet, and the ones added
+        job->prioritizeItems({laterItems.at(19).url(), firstItems.at(19).url(), laterItems.at(0).url(), firstItems.at(10).url()});
+    };
+    connect(job, &PreviewJob::gotPreview, this, addItems);
+    connect(job, &PreviewJob::failed, this, addItems);
+
+    QVERIFY(spyResult.wait(60000));
+    QVERIFY(added);
+    QCOMPARE(m_results.count(), firstItems.count() + laterItems.count());
+    for (const KFileItem &item : firstItems + laterItems) {
+        QCOMPARE(m_results.value(item.url()), 1);
+    }
+}
+
+QTEST_MAIN(PreviewJobTest)
+
+#include "previewjobtest.moc"
@@ -0,0 +1,115 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <QElapsedTimer>
+#include <QStandardPaths>
+
+#include <kio/slaveconfig.h>
+#include <kio/storedtransferjob.h>
+
+#include "httpserver_p.h"
+
+/*
+   A slow server, reached under several host names, and a fast one. The jobs
+   for the slow hosts are queued first, enough of them to use all the http
+   slaves. Measures when the jobs of the fast host are done:
+   - fixed: MinConnections pins the connections per host to the maximum, so
+     the slow hosts keep all the slaves until their queues are empty
+   - adaptive: the scheduler notices that the slow hosts answer later when
+     given more connections, lowers their limit, and the fast host gets slaves
+
+   The host names 127.0.0.x all reach the loopback interface on Linux.
+*/
+
+static const int s_slowHosts = 4;
+static const int s_jobsPerSlowHost = 15;
+static const int s_fastJobs = 40;
+static const int s_slowResponseMsecs = 30;
+
+class SchedulerBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void fixedLimits();
+    void adaptiveLimits();
+
+private:
+    void run(int minConnections);
+};
+
+void SchedulerBenchmark::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    // To avoid a runtime dependency on klauncher
+    qputenv("KDE_FORK_SLAVES", "yes");
+    // To let ctest exit, we shouldn't start kio_http_cache_cleaner
+    qputenv("KIO_DISABLE_CACHE_CLEANER", "yes");
+}
+
+void SchedulerBenchmark::run(int minConnections)
+{
+    HttpServerThread slowServer("Hello world", HttpServerThread::Public);
+    slowServer.setResponseDelay(s_slowResponseMsecs);
+    HttpServerThread fastServer("Hello world", HttpServerThread::Public);
+
+    QStringList slowHosts;
+    for (int i = 1; i <= s_slowHosts; ++i) {
+        slowHosts.append(QStringLiteral("127.0.0.%1").arg(i));
+        KIO::SlaveConfig::self()->setConfigData(QStringLiteral("http"), slowHosts.last(),
+                                                QStringLiteral("MinConnections"), QString::number(minConnections));
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    int slowResults = 0;
+    int fastResults = 0;
+    qint64 fastDone = 0;
+    for (int i = 0; i < s_jobsPerSlowHost; ++i) {
+        for (const QString &host : qAsConst(slowHosts)) {
+            const QUrl url(QStringLiteral("http://%1:%2/slow/%3").arg(host).arg(slowServer.serverPort()).arg(i));
+            KIO::StoredTransferJob *job = KIO::storedGet(url, KIO::Reload, KIO::HideProgressInfo);
+            job->setUiDelegate(nullptr);
+            connect(job, &KJob::result, this, [&slowResults](KJob *job) {
+                QCOMPARE(job->error(), 0);
+                ++slowResults;
+            });
+        }
+    }
+    for (int i = 0; i < s_fastJobs; ++i) {
+        const QUrl url(QStringLiteral("http://localhost:%1/fast/%2").arg(fastServer.serverPort()).arg(i));
+        KIO::StoredTransferJob *job = KIO::storedGet(url, KIO::Reload, KIO::HideProgressInfo);
+        job->setUiDelegate(nullptr);
+        connect(job, &KJob::result, this, [&fastResults, &fastDone, &timer](KJob *job) {
+            QCOMPARE(job->error(), 0);
+            if (++fastResults == s_fastJobs) {
+                fastDone = timer.elapsed();
+            }
+        });
+    }
+    QTRY_COMPARE_WITH_TIMEOUT(fastResults + slowResults, s_fastJobs + s_slowHosts * s_jobsPerSlowHost, 60000);
+    // the fast host is the one waiting behind the others
+    QTest::setBenchmarkResult(fastDone, QTest::WalltimeMilliseconds);
+
+    KIO::SlaveConfig::self()->reset();
+}
+
+void SchedulerBenchmark::fixedLimits()
+{
+    run(100);
+}
+
+void SchedulerBenchmark::adaptiveLimits()
+{
+    run(1);
+}
+
+QTEST_GUILESS_MAIN(SchedulerBenchmark)
+
+#include "scheduler_benchmark.moc"
@@ -0,0 +1,94 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <QStandardPaths>
+
+#include <KProtocolInfo>
+
+#include <kio/scheduler.h>
+#include <kio/slaveconfig.h>
+#include <kio/storedtransferjob.h>
+
+#include "httpserver_p.h"
+
+class SchedulerTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void testLowestSerialNotStarved();
+};
+
+void SchedulerTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    // To avoid a runtime dependency on klauncher
+    qputenv("KDE_FORK_SLAVES", "yes");
+    // To let ctest exit, we shouldn't start kio_http_cache_cleaner
+    qputenv("KIO_DISABLE_CACHE_CLEANER", "yes");
+}
+
+// The host names 127.0.0.x all reach the loopback interface on Linux
+void SchedulerTest::testLowestSerialNotStarved()
+{
+    HttpServerThread server("Hello world", HttpServerThread::Public);
+    server.setResponseDelay(10);
+
+    // A busy host which may use all the http slaves by itself
+    const QString busyHost = QStringLiteral("127.0.0.2");
+    const int maxSlaves = KProtocolInfo::maxSlaves(QStringLiteral("http"));
+    KIO::SlaveConfig::self()->setConfigData(QStringLiteral("http"), busyHost,
+                                            QStringLiteral("MaxConnections"), QString::number(maxSlaves));
+    KIO::SlaveConfig::self()->setConfigData(QStringLiteral("http"), busyHost,
+                                            QStringLiteral("MinConnections"), QString::number(maxSlaves));
+
+    const int busyJobs = 5 * maxSlaves;
+    int busyResults = 0;
+    for (int i = 0; i < busyJobs; ++i) {
+        const QUrl url(QStringLiteral("http://%1:%2/busy/%3").arg(busyHost).arg(server.serverPort()).arg(i));
+        KIO::StoredTransferJob *job = KIO::storedGet(url, KIO::Reload, KIO::HideProgressInfo);
+        job->setUiDelegate(nullptr);
+        connect(job, &KJob::result, this, [&busyResults](KJob *job) {
+            QCOMPARE(job->error(), 0);
+            ++busyResults;
+        });
+    }
+    // Let the busy host take all the slaves
+    QTRY_VERIFY(busyResults > 0);
+
+    // The jobs of the other host come first, yet each slave which finishes a
+    // job of the busy host is idle for that host
+    const int otherJobs = 5;
+    int otherResults = 0;
+    int busyResultsWhenOtherDone = -1;
+    for (int i = 0; i < otherJobs; ++i) {
+        const QUrl url(QStringLiteral("http://127.0.0.3:%1/other/%2").arg(server.serverPort()).arg(i));
+        KIO::StoredTransferJob *job = KIO::storedGet(url, KIO::Reload, KIO::HideProgressInfo);
+        job->setUiDelegate(nullptr);
+        KIO::Scheduler::setJobPriority(job, -10);
+        connect(job, &KJob::result, this, [&otherResults, &busyResults, &busyResultsWhenOtherDone](KJob *job) {
+            QCOMPARE(job->error(), 0);
+            if (++otherResults == otherJobs) {
+                busyResultsWhenOtherDone = busyResults;
+            }
+        });
+    }
+    QTRY_COMPARE_WITH_TIMEOUT(otherResults + busyResults, otherJobs + busyJobs, 60000);
+
+    // They must not wait until the queue of the busy host is empty, that is
+    // until the last round of its jobs is done
+    QVERIFY(busyResultsWhenOtherDone >= 0);
+    QVERIFY2(busyResultsWhenOtherDone < busyJobs - maxSlaves, qPrintable(QString::number(busyResultsWhenOtherDone)));
+
+    KIO::SlaveConfig::self()->reset();
+}
+
+QTEST_GUILESS_MAIN(SchedulerTest)
+
+#include "schedulertest.moc"
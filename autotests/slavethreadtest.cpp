@@ -0,0 +1,113 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+#include <kio/copyjob.h>
+#include <kio/listjob.h>
+#include <kio/statjob.h>
+
+/*
+   Jobs with KIO_ENABLE_SLAVE_THREADS=1: stats and listings run on file
+   slaves in threads of this process, the other jobs on slave processes.
+*/
+
+class SlaveThreadTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void testRunsInThread();
+    void testStat();
+    void testListDir();
+    void testManyStats();
+    void testCopyInSlaveProcess();
+
+private:
+    QTemporaryDir m_dir;
+};
+
+void SlaveThreadTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    // To avoid a runtime dependency on klauncher
+    qputenv("KDE_FORK_SLAVES", "yes");
+    qputenv("KIO_ENABLE_SLAVE_THREADS", "1");
+
+    QVERIFY(m_dir.isValid());
+    for (int i = 0; i < 10; ++i) {
+        QFile file(m_dir.filePath(QStringLiteral("file%1").arg(i)));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("Hello world");
+    }
+}
+
+void SlaveThreadTest::testRunsInThread()
+{
+    // "/proc/self" points to the process of whoever looks at it
+    if (!QFileInfo(QStringLiteral("/proc/self")).isSymLink()) {
+        QSKIP("needs /proc");
+    }
+    KIO::StatJob *job = KIO::stat(QUrl::fromLocalFile(QStringLiteral("/proc/self")), KIO::HideProgressInfo);
+    QVERIFY2(job->exec(), qPrintable(job->errorString()));
+    QCOMPARE(job->statResult().stringValue(KIO::UDSEntry::UDS_LINK_DEST), QString::number(QCoreApplication::applicationPid()));
+}
+
+void SlaveThreadTest::testStat()
+{
+    KIO::StatJob *job = KIO::stat(QUrl::fromLocalFile(m_dir.filePath(QStringLiteral("file0"))), KIO::HideProgressInfo);
+    QVERIFY2(job->exec(), qPrintable(job->errorString()));
+    QCOMPARE(job->statResult().numberValue(KIO::UDSEntry::UDS_SIZE), 11LL);
+
+    job = KIO::stat(QUrl::fromLocalFile(m_dir.filePath(QStringLiteral("doesnotexist"))), KIO::HideProgressInfo);
+    QVERIFY(!job->exec());
+    QCOMPARE(job->error(), int(KIO::ERR_DOES_NOT_EXIST));
+}
+
+void SlaveThreadTest::testListDir()
+{
+    KIO::ListJob *job = KIO::listDir(QUrl::fromLocalFile(m_dir.path()), KIO::HideProgressInfo);
+    QStringList names;
+    connect(job, &KIO::ListJob::entries, this, [&names](KIO::Job *, const KIO::UDSEntryList &entries) {
+        for (const KIO::UDSEntry &entry : entries) {
+            names.append(entry.stringValue(KIO::UDSEntry::UDS_NAME));
+        }
+    });
+    QVERIFY2(job->exec(), qPrintable(job->errorString()));
+    QCOMPARE(names.count(), 11); // with "."
+}
+
+void SlaveThreadTest::testManyStats()
+{
+    int results = 0;
+    for (int i = 0; i < 30; ++i) {
+        KIO::StatJob *job = KIO::stat(QUrl::fromLocalFile(m_dir.filePath(QStringLiteral("file%1").arg(i % 10))), KIO::HideProgressInfo);
+        connect(job, &KJob::result, this, [&results](KJob *job) {
+            QCOMPARE(job->error(), 0);
+            ++results;
+        });
+    }
+    QTRY_COMPARE_WITH_TIMEOUT(results, 30, 10000);
+}
+
+// Copies need slave processes, even with slave threads enabled
+void SlaveThreadTest::testCopyInSlaveProcess()
+{
+    const QUrl dest = QUrl::fromLocalFile(m_dir.filePath(QStringLiteral("copy")));
+    KIO::CopyJob *job = KIO::copyAs(QUrl::fromLocalFile(m_dir.filePath(QStringLiteral("file1"))), dest, KIO::HideProgressInfo);
+    job->setUiDelegate(nullptr);
+    QVERIFY2(job->exec(), qPrintable(job->errorString()));
+    QVERIFY(QFile::exists(dest.toLocalFile()));
+}
+
+QTEST_GUILESS_MAIN(SlaveThreadTest)
+
+#include "slavethreadtest.moc"
@@ -15,6 +15,8 @@
 #include <kio/udsentry.h>
 #include <kio/global.h> // filesize_t
 
+#include "udsentrylistcodec_p.h"
+
 /*
    This is to compare the old list-of-lists API vs a QMap/QHash-based API
    in terms of performance.
@@ -52,7 +54,15 @@ private Q_SLOTS:
     void testAnotherV2SlaveFill();
     void testAnotherV2SlaveCompare();
     void testAnotherV2App();
+    void testListEncodeDataStream();
+    void testListDecodeDataStream();
+    void testListEncodeCompact();
+    void testListDecodeCompact();
+    void testUDSEntryFill();
+    void testUDSEntryLookup();
 private:
+    KIO::UDSEntryList listBatch() const;
+
     const QString nameStr;
     const QDateTime now;
     const time_t now_time_t;
@@ -676,6 +686,156 @@ void UdsEntryBenchmark::testAnotherV2App()
     testApp<AnotherV2UDSEntry>(now_time_t, nameStr);
 }
 
+// What kio_file sends for a batch of a directory listing
+KIO::UDSEntryList UdsEntryBenchmark::listBatch() const
+{
+    KIO::UDSEntryList list;
+    list.reserve(200);
+    for (int i = 0; i < 200; ++i) {
+        KIO::UDSEntry entry;
+        entry.reserve(8);
+        entry.fastInsert(KIO::UDSEntry::UDS_NAME, QStringLiteral("file%1.txt").arg(i));
+        entry.fastInsert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG);
+        entry.fastInsert(KIO::UDSEntry::UDS_ACCESS, 0644);
+        entry.fastInsert(KIO::UDSEntry::UDS_SIZE, 123456ULL + i);
+        entry.fastInsert(KIO::UDSEntry::UDS_USER, QStringLiteral("user"));
+        entry.fastInsert(KIO::UDSEntry::UDS_GROUP, QStringLiteral("users"));
+        entry.fastInsert(KIO::UDSEntry::UDS_MODIFICATION_TIME, now_time_t);
+        entry.fastInsert(KIO::UDSEntry::UDS_ACCESS_TIME, now_time_t);
+        list.append(entry);
+    }
+    return list;
+}
+
+void UdsEntryBenchmark::testListEncodeDataStream()
+{
+    const KIO::UDSEntryList list = listBatch();
+    QByteArray data;
+    QBENCHMARK {
+        data.clear();
+        QDataStream stream(&data, QIODevice::WriteOnly);
+        for (const KIO::UDSEntry &entry : list) {
+            stream << entry;
+        }
+    }
+}
+
+void UdsEntryBenchmark::testListDecodeDataStream()
+{
+    const KIO::UDSEntryList list = listBatch();
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    for (const KIO::UDSEntry &entry : list) {
+        out << entry;
+    }
+    QBENCHMARK {
+        KIO::UDSEntryList decoded;
+        QDataStream stream(data);
+        KIO::UDSEntry entry;
+        while (!stream.atEnd()) {
+            stream >> entry;
+            decoded.append(entry);
+        }
+        QCOMPARE(decoded.size(), list.size());
+    }
+}
+
+void UdsEntryBenchmark::testListEncodeCompact()
+{
+    const KIO::UDSEntryList list = listBatch();
+    KIO::UDSEntryListEncoder encoder;
+    QByteArray data;
+    QBENCHMARK {
+        data = encoder.encode(list);
+    }
+
+    // what the encoding is for: a batch smaller than with QDataStream
+    QByteArray dataStreamData;
+    QDataStream stream(&dataStreamData, QIODevice::WriteOnly);
+    for (const KIO::UDSEntry &entry : list) {
+        stream << entry;
+    }
+    QVERIFY(data.size() < dataStreamData.size());
+}
+
+void UdsEntryBenchmark::testListDecodeCompact()
+{
+    const KIO::UDSEntryList list = listBatch();
+    KIO::UDSEntryListEncoder encoder;
+    const QByteArray firstBatch = encoder.encode(list);
+    // user and group now come from the dictionary, like in a long listing
+    const QByteArray nextBatch = encoder.encode(list);
+
+    KIO::UDSEntryListDecoder decoder;
+    KIO::UDSEntryList decoded;
+    QVERIFY(decoder.decode(firstBatch, decoded));
+    QBENCHMARK {
+        decoded.clear();
+        QVERIFY(decoder.decode(nextBatch, decoded));
+    }
+    QCOMPARE(decoded.size(), list.size());
+    for (int i = 0; i < list.size(); ++i) {
+        QVERIFY(decoded.at(i) == list.at(i));
+    }
+}
+
+// The real thing, on as many entries as a very large directory
+static const int s_manyEntries = 1000000;
+
+void UdsEntryBenchmark::testUDSEntryFill()
+{
+    QVector<KIO::UDSEntry> entries;
+    QBENCHMARK_ONCE {
+        entries.resize(s_manyEntries);
+        for (int i = 0; i < s_manyEntries; ++i) {
+            KIO::UDSEntry &entry = entries[i];
+            entry.reserve(8);
+            // not in field id order, like most slaves fill them
+            entry.fastInsert(KIO::UDSEntry::UDS_NAME, nameStr);
+            entry.fastInsert(KIO::UDSEntry::UDS_SIZE, 123456ULL + i);
+            entry.fastInsert(KIO::UDSEntry::UDS_MODIFICATION_TIME, now_time_t);
+            entry.fastInsert(KIO::UDSEntry::UDS_ACCESS_TIME, now_time_t);
+            entry.fastInsert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG);
+            entry.fastInsert(KIO::UDSEntry::UDS_ACCESS, 0644);
+            entry.fastInsert(KIO::UDSEntry::UDS_USER, nameStr);
+            entry.fastInsert(KIO::UDSEntry::UDS_GROUP, nameStr);
+        }
+    }
+    QCOMPARE(entries.at(s_manyEntries - 1).count(), 8);
+}
+
+void UdsEntryBenchmark::testUDSEntryLookup()
+{
+    QVector<KIO::UDSEntry> entries(s_manyEntries);
+    for (int i = 0; i < s_manyEntries; ++i) {
+        KIO::UDSEntry &entry = entries[i];
+        entry.reserve(8);
+        entry.fastInsert(KIO::UDSEntry::UDS_NAME, nameStr);
+        entry.fastInsert(KIO::UDSEntry::UDS_SIZE, 123456ULL + i);
+        entry.fastInsert(KIO::UDSEntry::UDS_MODIFICATION_TIME, now_time_t);
+        entry.fastInsert(KIO::UDSEntry::UDS_ACCESS_TIME, now_time_t);
+        entry.fastInsert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG);
+        entry.fastInsert(KIO::UDSEntry::UDS_ACCESS, 0644);
+        entry.fastInsert(KIO::UDSEntry::UDS_USER, nameStr);
+        entry.fastInsert(KIO::UDSEntry::UDS_GROUP, nameStr);
+    }
+
+    // Roughly what KFileItem and the dir listers ask for every item
+    long long sum = 0;
+    QBENCHMARK_ONCE {
+        for (const KIO::UDSEntry &entry : qAsConst(entries)) {
+            sum += entry.numberValue(KIO::UDSEntry::UDS_SIZE);
+            sum += entry.numberValue(KIO::UDSEntry::UDS_FILE_TYPE);
+            sum += entry.numberValue(KIO::UDSEntry::UDS_ACCESS);
+            sum += entry.numberValue(KIO::UDSEntry::UDS_MODIFICATION_TIME);
+            sum += entry.stringValue(KIO::UDSEntry::UDS_NAME).size();
+            sum += entry.stringValue(KIO::UDSEntry::UDS_USER).size();
+            sum += entry.contains(KIO::UDSEntry::UDS_LOCAL_PATH);
+            sum += entry.numberValue(KIO::UDSEntry::UDS_HIDDEN, 0);
+        }
+    }
+    QVERIFY(sum > 0);
+}
 
 QTEST_MAIN(UdsEntryBenchmark)
 
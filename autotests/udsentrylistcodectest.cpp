@@ -0,0 +1,114 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <kio/udsentry.h>
+
+#include "udsentrylistcodec_p.h"
+
+using namespace KIO;
+
+class UDSEntryListCodecTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testRoundTrip();
+    void testDictionaryReuse();
+    void testTruncatedBatch();
+
+private:
+    static UDSEntryList entries(const QString &prefix, const QString &user, int count);
+};
+
+UDSEntryList UDSEntryListCodecTest::entries(const QString &prefix, const QString &user, int count)
+{
+    UDSEntryList list;
+    for (int i = 0; i < count; ++i) {
+        UDSEntry entry;
+        entry.fastInsert(UDSEntry::UDS_NAME, prefix + QString::number(i));
+        entry.fastInsert(UDSEntry::UDS_SIZE, i * 1000);
+        entry.fastInsert(UDSEntry::UDS_MODIFICATION_TIME, -i);
+        entry.fastInsert(UDSEntry::UDS_USER, user);
+        entry.fastInsert(UDSEntry::UDS_GROUP, QStringLiteral("users"));
+        if (i % 2) {
+            entry.fastInsert(UDSEntry::UDS_MIME_TYPE, QStringLiteral("text/plain"));
+        }
+        list.append(entry);
+    }
+    return list;
+}
+
+void UDSEntryListCodecTest::testRoundTrip()
+{
+    UDSEntryListEncoder encoder;
+    UDSEntryListDecoder decoder;
+    const UDSEntryList list = entries(QStringLiteral("file"), QStringLiteral("alice"), 10);
+
+    UDSEntryList decoded;
+    QVERIFY(decoder.decode(encoder.encode(list), decoded));
+    QCOMPARE(decoded, list);
+    QCOMPARE(decoded.at(3).stringValue(UDSEntry::UDS_MIME_TYPE), QStringLiteral("text/plain"));
+    QCOMPARE(decoded.at(3).numberValue(UDSEntry::UDS_MODIFICATION_TIME), -3LL);
+}
+
+void UDSEntryListCodecTest::testDictionaryReuse()
+{
+    UDSEntryListEncoder encoder;
+    UDSEntryListDecoder decoder;
+    const UDSEntryList first = entries(QStringLiteral("first"), QStringLiteral("alice"), 10);
+    const UDSEntryList second = entries(QStringLiteral("secnd"), QStringLiteral("alice"), 10);
+
+    const QByteArray firstBatch = encoder.encode(first);
+    const QByteArray secondBatch = encoder.encode(second);
+    // Same entries but for the names, only the first batch carries the strings of the dictionary
+    QVERIFY(secondBatch.size() < firstBatch.size());
+
+    UDSEntryList decoded;
+    QVERIFY(decoder.decode(firstBatch, decoded));
+    QVERIFY(decoder.decode(secondBatch, decoded));
+    QCOMPARE(decoded, first + second);
+
+    // A decoder which missed the first batch can't resolve the dictionary indexes
+    UDSEntryListDecoder otherDecoder;
+    UDSEntryList otherDecoded;
+    QVERIFY(!otherDecoder.decode(secondBatch, otherDecoded));
+    QVERIFY(otherDecoded.isEmpty());
+}
+
+void UDSEntryListCodecTest::testTruncatedBatch()
+{
+    UDSEntryListEncoder encoder;
+    UDSEntryListDecoder decoder;
+    const UDSEntryList first = entries(QStringLiteral("first"), QStringLiteral("alice"), 10);
+    // New dictionary strings in the broken batch
+    const UDSEntryList second = entries(QStringLiteral("secnd"), QStringLiteral("bob"), 10);
+    const UDSEntryList third = entries(QStringLiteral("third"), QStringLiteral("carol"), 10);
+
+    UDSEntryList decoded;
+    QVERIFY(decoder.decode(encoder.encode(first), decoded));
+    QCOMPARE(decoded, first);
+
+    const QByteArray secondBatch = encoder.encode(second);
+    QVERIFY(!decoder.decode(secondBatch.left(secondBatch.size() - 3), decoded));
+    QCOMPARE(decoded, first);
+
+    // The encoder's dictionary has the strings of the broken batch, the decoder's doesn't
+    QVERIFY(!decoder.decode(encoder.encode(third), decoded));
+    QCOMPARE(decoded, first);
+
+    // Until they both start over
+    encoder.reset();
+    QVERIFY(decoder.decode(encoder.encode(third), decoded));
+    QCOMPARE(decoded, first + third);
+    QVERIFY(decoder.decode(encoder.encode(second), decoded));
+    QCOMPARE(decoded, first + third + second);
+}
+
+QTEST_GUILESS_MAIN(UDSEntryListCodecTest)
+
+#include "udsentrylistcodectest.moc"
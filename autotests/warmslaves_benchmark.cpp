@@ -0,0 +1,130 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <QElapsedTimer>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+
+#include <KConfigGroup>
+#include <KSharedConfig>
+
+#include <kio/scheduler.h>
+#include <kio/transferjob.h>
+
+#include "slavespawnstats_p.h"
+
+/*
+   Time to first byte of a burst of file GETs:
+   - cold: the first jobs of the process, each waits for its slave to start
+   - warm: with the [Warm Slaves] of kioslaverc set, the scheduler started
+     the slaves ahead of the jobs
+   and how long the slaves took to start and connect back.
+*/
+
+static const int s_burstSize = 4;
+
+class WarmSlavesBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void coldFirstByte();
+    void warmFirstByte();
+    void slaveStart();
+
+private:
+    void setWarmSlaves(int count);
+    void burst();
+
+    QTemporaryFile m_file;
+};
+
+void WarmSlavesBenchmark::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    // To avoid a runtime dependency on klauncher
+    qputenv("KDE_FORK_SLAVES", "yes");
+
+    QVERIFY(m_file.open());
+    m_file.write("Hello world");
+    m_file.flush();
+    setWarmSlaves(0);
+}
+
+void WarmSlavesBenchmark::cleanupTestCase()
+{
+    setWarmSlaves(0);
+}
+
+void WarmSlavesBenchmark::setWarmSlaves(int count)
+{
+    KSharedConfig::Ptr config = KSharedConfig::openConfig(QStringLiteral("kioslaverc"), KConfig::NoGlobals);
+    KConfigGroup(config, "Warm Slaves").writeEntry("file", count);
+    config->sync();
+    KIO::Scheduler::emitReparseSlaveConfiguration();
+}
+
+void WarmSlavesBenchmark::burst()
+{
+    QElapsedTimer timer;
+    timer.start();
+    QVector<qint64> firstByte(s_burstSize, -1);
+    int results = 0;
+    for (int i = 0; i < s_burstSize; ++i) {
+        KIO::TransferJob *job = KIO::get(QUrl::fromLocalFile(m_file.fileName()), KIO::NoReload, KIO::HideProgressInfo);
+        job->setUiDelegate(nullptr);
+        connect(job, &KIO::TransferJob::data, this, [&firstByte, &timer, i](KIO::Job *, const QByteArray &data) {
+            if (!data.isEmpty() && firstByte[i] < 0) {
+                firstByte[i] = timer.nsecsElapsed() / 1000;
+            }
+        });
+        connect(job, &KJob::result, this, [&results](KJob *job) {
+            QCOMPARE(job->error(), 0);
+            ++results;
+        });
+    }
+    QTRY_COMPARE_WITH_TIMEOUT(results, s_burstSize, 10000);
+
+    qint64 total = 0;
+    for (qint64 usecs : qAsConst(firstByte)) {
+        QVERIFY(usecs >= 0);
+        total += usecs;
+    }
+    // the average time to first byte
+    QTest::setBenchmarkResult(qreal(total) / s_burstSize / 1000, QTest::WalltimeMilliseconds);
+}
+
+void WarmSlavesBenchmark::coldFirstByte()
+{
+    burst();
+}
+
+void WarmSlavesBenchmark::warmFirstByte()
+{
+    // The slaves of the cold burst are idle now, ask for more than that
+    const int startedSlaves = KIO::slaveSpawnStats(QStringLiteral("file")).startedSlaves;
+    setWarmSlaves(2 * s_burstSize);
+    // Let the scheduler start them, and them connect
+    QTRY_VERIFY_WITH_TIMEOUT(KIO::slaveSpawnStats(QStringLiteral("file")).startedSlaves > startedSlaves, 10000);
+    QTRY_COMPARE_WITH_TIMEOUT(KIO::slaveSpawnStats(QStringLiteral("file")).connectedSlaves,
+                              KIO::slaveSpawnStats(QStringLiteral("file")).startedSlaves, 10000);
+    burst();
+}
+
+void WarmSlavesBenchmark::slaveStart()
+{
+    const KIO::SlaveSpawnStats stats = KIO::slaveSpawnStats(QStringLiteral("file"));
+    QVERIFY(stats.connectedSlaves > 0);
+    QTest::setBenchmarkResult(qreal(stats.connectMsecs) / stats.connectedSlaves, QTest::WalltimeMilliseconds);
+}
+
+QTEST_GUILESS_MAIN(WarmSlavesBenchmark)
+
+#include "warmslaves_benchmark.moc"
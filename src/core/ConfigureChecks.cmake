@@ -22,6 +22,10 @@ check_include_files(sys/param.h   HAVE_SYS_PARAM_H)
 
 check_library_exists(volmgt volmgt_running "" HAVE_VOLMGT)
 
+### DetermineMimeTypesJob
+
+check_function_exists(posix_fadvise HAVE_FADVISE)
+
 check_cxx_source_compiles("
   #include <sys/types.h>
   #include <sys/statvfs.h>
@@ -54,7 +54,8 @@ enum Command {
     CMD_CLOSE = 93,
     CMD_HOST_INFO = 94,
     CMD_FILESYSTEMFREESPACE = 95,
-    CMD_TRUNCATE = 96
+    CMD_TRUNCATE = 96,
+    CMD_COPY_TREE = 97 // see copytree_p.h
                     // Add new ones here once a release is done, to avoid breaking binary compatibility.
                     // Note that protocol-specific commands shouldn't be added here, but should use special.
 };
@@ -5,6 +5,9 @@
 /* Defined if acl/libacl.h exists */
 #cmakedefine01 HAVE_ACL_LIBACL_H
 
+/* Defined if system has posix_fadvise() */
+#cmakedefine01 HAVE_FADVISE
+
 #define CMAKE_INSTALL_FULL_LIBEXECDIR_KF5 "${CMAKE_INSTALL_FULL_LIBEXECDIR_KF5}"
 
 #cmakedefine01 KIO_FORK_SLAVES
@@ -18,24 +18,97 @@
 #include <QElapsedTimer>
 #include <QLocalServer>
 #include <QLocalSocket>
+#include <QDeadlineTimer>
+#include <QHash>
+#include <QMutex>
+#include <QUrlQuery>
+#include <QWaitCondition>
+#include <QtEndian>
 
 #include "kiocoredebug.h"
 
 using namespace KIO;
 
+// The connection between a Slave and a slave running in a thread of the
+// application (see SlaveThread): the tasks go from one end to the other
+// as they are, without being framed, written to a socket and parsed again.
+class KIO::InProcessPipe
+{
+public:
+    QMutex mutex;
+    // tasks were queued or taken, or the pipe was closed
+    QWaitCondition changed;
+    // the tasks for each end, and their size
+    QVector<Task> tasks[2];
+    int queuedBytes[2] = {0, 0};
+    // whether a pipeReadyRead() call is on its way to the end
+    bool notified[2] = {false, false};
+    // nullptr until accepted, and once gone
+    ConnectionBackend *ends[2] = {nullptr, nullptr};
+    bool closed = false;
+
+    // to be called with the mutex locked
+    void notify(int end)
+    {
+        if (ends[end] && !notified[end]) {
+            notified[end] = true;
+            QMetaObject::invokeMethod(ends[end], "pipeReadyRead", Qt::QueuedConnection);
+        }
+    }
+};
+
+namespace
+{
+struct InProcessListeners {
+    QMutex mutex;
+    QHash<QString, ConnectionBackend *> byAddress;
+};
+}
+Q_GLOBAL_STATIC(InProcessListeners, s_inProcessListeners)
+
 ConnectionBackend::ConnectionBackend(QObject *parent)
     : QObject(parent),
       state(Idle),
       socket(nullptr),
       len(-1),
       cmd(0),
-      signalEmitted(false)
+      signalEmitted(false),
+      binaryFraming(false),
+      pipeEnd(0),
+      pipeSuspended(false),
+      inProcessListener(false)
 {
     localServer = nullptr;
 }
 
 ConnectionBackend::~ConnectionBackend()
 {
+    closePipe();
+    if (inProcessListener && !s_inProcessListeners.isDestroyed()) {
+        QMutexLocker locker(&s_inProcessListeners()->mutex);
+        s_inProcessListeners()->byAddress.remove(address.toString());
+        // Connected to, but never accepted
+        for (const QSharedPointer<InProcessPipe> &pending : qAsConst(pendingPipes)) {
+            QMutexLocker pipeLocker(&pending->mutex);
+            pending->closed = true;
+            pending->changed.wakeAll();
+            pending->notify(1);
+        }
+    }
+}
+
+void ConnectionBackend::closePipe()
+{
+    if (!pipe) {
+        return;
+    }
+    QMutexLocker locker(&pipe->mutex);
+    pipe->closed = true;
+    pipe->ends[pipeEnd] = nullptr;
+    pipe->changed.wakeAll();
+    pipe->notify(1 - pipeEnd);
+    locker.unlock();
+    pipe.reset();
 }
 
 void ConnectionBackend::setSuspended(bool enable)
@@ -43,6 +116,14 @@ void ConnectionBackend::setSuspended(bool enable)
     if (state != Connected) {
         return;
     }
+    if (pipe) {
+        QMutexLocker locker(&pipe->mutex);
+        pipeSuspended = enable;
+        if (!enable && (!pipe->tasks[pipeEnd].isEmpty() || pipe->closed)) {
+            pipe->notify(pipeEnd);
+        }
+        return;
+    }
     Q_ASSERT(socket);
     Q_ASSERT(!localServer);     // !tcpServer as well
 
@@ -53,7 +134,7 @@ void ConnectionBackend::setSuspended(bool enable)
         //qCDebug(KIO_CORE) << socket << "resuming";
         // Calling setReadBufferSize from a readyRead slot leads to a bug in Qt, fixed in 13c246ee119
         socket->setReadBufferSize(StandardBufferSize);
-        if (socket->bytesAvailable() >= HeaderSize) {
+        if (socket->bytesAvailable() >= MinimumHeaderSize) {
             // there are bytes available
             QMetaObject::invokeMethod(this, "socketReadyRead", Qt::QueuedConnection);
         }
@@ -76,6 +157,26 @@ bool ConnectionBackend::connectToRemote(const QUrl &url)
     Q_ASSERT(!socket);
     Q_ASSERT(!localServer);     // !tcpServer as well
 
+    if (url.scheme() == QLatin1String("inproc")) {
+        QMutexLocker locker(&s_inProcessListeners()->mutex);
+        ConnectionBackend *listener = s_inProcessListeners()->byAddress.value(url.toString());
+        if (!listener) {
+            return false;
+        }
+        pipe.reset(new InProcessPipe);
+        pipeEnd = 1;
+        pipe->ends[pipeEnd] = this;
+        listener->pendingPipes.append(pipe);
+        QMetaObject::invokeMethod(listener, "newConnection", Qt::QueuedConnection);
+        state = Connected;
+        return true;
+    }
+
+    // The listening side advertises the binary header in the address it hands out,
+    // older applications don't, and we keep talking the text format to them.
+    const QString framing = QUrlQuery(url).queryItemValue(QStringLiteral("framing"));
+    binaryFraming = !framing.isEmpty() && framing.toInt() >= BinaryHeaderVersion;
+
     QLocalSocket *sock = new QLocalSocket(this);
     QString path = url.path();
     sock->connectToServer(path);
@@ -113,6 +214,8 @@ bool ConnectionBackend::listenForRemote()
     address.clear();
     address.setScheme(QStringLiteral("local"));
     address.setPath(sockname);
+    // Older slaves only look at the path and ignore this
+    address.setQuery(QStringLiteral("framing=%1").arg(int(BinaryHeaderVersion)));
     socketfile.setAutoRemove(false);
     socketfile.remove(); // can't bind if there is such a file
 
@@ -130,9 +233,49 @@ bool ConnectionBackend::listenForRemote()
     return true;
 }
 
+bool ConnectionBackend::listenInProcess()
+{
+    Q_ASSERT(state == Idle);
+    Q_ASSERT(!socket);
+    Q_ASSERT(!localServer);     // !tcpServer as well
+
+    static QBasicAtomicInt s_pipeCounter = Q_BASIC_ATOMIC_INITIALIZER(1);
+    address.clear();
+    address.setScheme(QStringLiteral("inproc"));
+    address.setPath(QString::number(s_pipeCounter.fetchAndAddRelaxed(1)));
+
+    QMutexLocker locker(&s_inProcessListeners()->mutex);
+    s_inProcessListeners()->byAddress.insert(address.toString(), this);
+    inProcessListener = true;
+    state = Listening;
+    return true;
+}
+
 bool ConnectionBackend::waitForIncomingTask(int ms)
 {
     Q_ASSERT(state == Connected);
+    if (pipe) {
+        const QSharedPointer<InProcessPipe> p = pipe;
+        QMutexLocker locker(&p->mutex);
+        const QDeadlineTimer deadline(ms);
+        while (p->tasks[pipeEnd].isEmpty() && !p->closed) {
+            if (!p->changed.wait(&p->mutex, deadline)) {
+                break;
+            }
+        }
+        const bool hasTasks = !p->tasks[pipeEnd].isEmpty();
+        const bool closed = p->closed;
+        locker.unlock();
+        if (!hasTasks) {
+            if (closed) {
+                state = Idle;
+            }
+            return false;
+        }
+        signalEmitted = false;
+        pipeReadyRead();
+        return signalEmitted;
+    }
     Q_ASSERT(socket);
     if (socket->state() != QLocalSocket::LocalSocketState::ConnectedState) {
         state = Idle;
@@ -169,18 +312,66 @@ bool ConnectionBackend::waitForIncomingTask(int ms)
 bool ConnectionBackend::sendCommand(int cmd, const QByteArray &data) const
 {
     Q_ASSERT(state == Connected);
+
+    if (pipe) {
+        const int peer = 1 - pipeEnd;
+        QMutexLocker locker(&pipe->mutex);
+        // Like a full socket buffer, a reader which doesn't keep up slows the writer down
+        while (!pipe->closed && pipe->queuedBytes[peer] > InProcessBufferSize) {
+            pipe->changed.wait(&pipe->mutex);
+        }
+        if (pipe->closed) {
+            return false;
+        }
+        pipe->tasks[peer].append(Task{cmd, data});
+        pipe->queuedBytes[peer] += data.size();
+        pipe->changed.wakeAll();
+        pipe->notify(peer);
+        return true;
+    }
     Q_ASSERT(socket);
 
+    // The text header only has six hex digits for the length
+    if (data.size() > (binaryFraming ? MaxMessageSize : 0xffffff)) {
+        qCWarning(KIO_CORE) << "Not sending a message of" << data.size() << "bytes, the other side would reject it";
+        return false;
+    }
+
     char buffer[HeaderSize + 2];
-    sprintf(buffer, "%6x_%2x_", data.size(), cmd);
-    socket->write(buffer, HeaderSize);
-    socket->write(data);
+    int headerSize;
+    if (binaryFraming) {
+        buffer[0] = char(BinaryHeaderMagic);
+        buffer[1] = char(BinaryHeaderVersion);
+        qToLittleEndian<quint16>(quint16(cmd), buffer + 2);
+        qToLittleEndian<quint32>(quint32(data.size()), buffer + 4);
+        headerSize = BinaryHeaderSize;
+    } else {
+        sprintf(buffer, "%6x_%2x_", data.size(), cmd);
+        headerSize = HeaderSize;
+    }
+
+    if (data.size() <= CoalesceLimit) {
+        // Small messages: hand header and payload to the socket in one go,
+        // so that they leave in a single write() instead of two
+        char packet[HeaderSize + CoalesceLimit];
+        memcpy(packet, buffer, headerSize);
+        if (!data.isEmpty()) {
+            memcpy(packet + headerSize, data.constData(), data.size());
+        }
+        socket->write(packet, headerSize + data.size());
+    } else {
+        socket->write(buffer, headerSize);
+        socket->write(data);
+    }
 
     //qCDebug(KIO_CORE) << this << "Sending command" << hex << cmd << "of"
     //         << data.size() << "bytes (" << socket->bytesToWrite()
     //         << "bytes left to write )";
 
     // blocking mode:
+    // try writing right away first, most messages fit in the socket buffer and
+    // then there is no need to poll for writability
+    socket->flush();
     while (socket->bytesToWrite() > 0 && socket->state() == QLocalSocket::LocalSocketState::ConnectedState) {
         socket->waitForBytesWritten(-1);
     }
@@ -191,6 +382,28 @@ bool ConnectionBackend::sendCommand(int cmd, const QByteArray &data) const
 ConnectionBackend *ConnectionBackend::nextPendingConnection()
 {
     Q_ASSERT(state == Listening);
+
+    if (inProcessListener) {
+        QSharedPointer<InProcessPipe> newPipe;
+        {
+            QMutexLocker locker(&s_inProcessListeners()->mutex);
+            if (pendingPipes.isEmpty()) {
+                return nullptr;
+            }
+            newPipe = pendingPipes.takeFirst();
+        }
+        ConnectionBackend *result = new ConnectionBackend();
+        result->state = Connected;
+        result->pipe = newPipe;
+        result->pipeEnd = 0;
+        QMutexLocker locker(&newPipe->mutex);
+        newPipe->ends[0] = result;
+        if (!newPipe->tasks[0].isEmpty() || newPipe->closed) {
+            newPipe->notify(0);
+        }
+        return result;
+    }
+
     Q_ASSERT(localServer);
     Q_ASSERT(!socket);
 
@@ -212,6 +425,42 @@ ConnectionBackend *ConnectionBackend::nextPendingConnection()
     return result;
 }
 
+void ConnectionBackend::pipeReadyRead()
+{
+    const QSharedPointer<InProcessPipe> p = pipe;
+    if (!p) {
+        // might happen if the invokeMethods were delivered after we disconnected
+        return;
+    }
+
+    QPointer<ConnectionBackend> that = this;
+    QMutexLocker locker(&p->mutex);
+    p->notified[pipeEnd] = false;
+    while (!pipeSuspended) {
+        QVector<Task> &tasks = p->tasks[pipeEnd];
+        if (tasks.isEmpty()) {
+            if (p->closed && state == Connected) {
+                locker.unlock();
+                socketDisconnected();
+            }
+            return;
+        }
+        const Task task = tasks.takeFirst();
+        p->queuedBytes[pipeEnd] -= task.data.size();
+        p->changed.wakeAll();
+        locker.unlock();
+
+        signalEmitted = true;
+        emit commandReceived(task);
+
+        // If we're dead, better don't try anything.
+        if (that.isNull()) {
+            return;
+        }
+        locker.relock();
+    }
+}
+
 void ConnectionBackend::socketReadyRead()
 {
     bool shouldReadAnother;
@@ -223,31 +472,15 @@ void ConnectionBackend::socketReadyRead()
         }
 
         //qCDebug(KIO_CORE) << this << "Got" << socket->bytesAvailable() << "bytes";
-        if (len == -1) {
-            // We have to read the header
-            char buffer[HeaderSize];
-
-            if (socket->bytesAvailable() < HeaderSize) {
-                return;             // wait for more data
-            }
-
-            socket->read(buffer, sizeof buffer);
-            buffer[6] = 0;
-            buffer[9] = 0;
-
-            char *p = buffer;
-            while (*p == ' ') {
-                p++;
-            }
-            len = strtol(p, nullptr, 16);
-
-            p = buffer + 7;
-            while (*p == ' ') {
-                p++;
-            }
-            cmd = strtol(p, nullptr, 16);
-
-            //qCDebug(KIO_CORE) << this << "Beginning of command" << hex << cmd << "of size" << len;
+        if (len == -1 && !readHeader()) {
+            return;             // wait for more data
+        }
+        if (len < 0 || len > MaxMessageSize) {
+            // Nothing that follows can be trusted, there is no way to find the next header
+            qCWarning(KIO_CORE) << socket << "Got a message of" << len << "bytes, closing the connection";
+            len = -1;
+            socket->abort();
+            return;
         }
 
         QPointer<ConnectionBackend> that = this;
@@ -276,10 +509,58 @@ void ConnectionBackend::socketReadyRead()
 
         // Do we have enough for an another read?
         if (len == -1) {
-            shouldReadAnother = socket->bytesAvailable() >= HeaderSize;
+            shouldReadAnother = socket->bytesAvailable() >= MinimumHeaderSize;
         } else {
             shouldReadAnother = socket->bytesAvailable() >= len;
         }
     } while (shouldReadAnother);
 }
 
+
+bool ConnectionBackend::readHeader()
+{
+    char buffer[HeaderSize];
+
+    if (socket->bytesAvailable() < MinimumHeaderSize) {
+        return false;
+    }
+
+    // The first byte tells the two formats apart: the text header only
+    // ever starts with a space or a hex digit
+    if (socket->peek(buffer, 1) != 1) {
+        return false;
+    }
+
+    if (quint8(buffer[0]) == BinaryHeaderMagic) {
+        socket->read(buffer, BinaryHeaderSize);
+        cmd = qFromLittleEndian<quint16>(buffer + 2);
+        len = qFromLittleEndian<quint32>(buffer + 4);
+        // The other side understands the binary header, so use it from now on
+        binaryFraming = true;
+        //qCDebug(KIO_CORE) << this << "Beginning of command" << hex << cmd << "of size" << len;
+        return true;
+    }
+
+    if (socket->bytesAvailable() < HeaderSize) {
+        return false;
+    }
+
+    socket->read(buffer, sizeof buffer);
+    buffer[6] = 0;
+    buffer[9] = 0;
+
+    char *p = buffer;
+    while (*p == ' ') {
+        p++;
+    }
+    len = strtol(p, nullptr, 16);
+
+    p = buffer + 7;
+    while (*p == ' ') {
+        p++;
+    }
+    cmd = strtol(p, nullptr, 16);
+
+    //qCDebug(KIO_CORE) << this << "Beginning of command" << hex << cmd << "of size" << len;
+    return true;
+}
@@ -10,6 +10,8 @@
 
 #include <QUrl>
 #include <QObject>
+#include <QSharedPointer>
+#include <QVector>
 
 class QLocalServer;
 class QLocalSocket;
@@ -18,6 +20,8 @@ class QTcpServer;
 
 namespace KIO
 {
+class InProcessPipe;
+
 struct Task {
     int cmd;
     QByteArray data;
@@ -42,9 +46,34 @@ private:
     int port;
     bool signalEmitted;
     quint8 mode;
-
+    bool binaryFraming;
+
+    // In-process connections, see listenInProcess(): instead of a socket,
+    // the two ends share the task queues of a pipe
+    QSharedPointer<InProcessPipe> pipe;
+    int pipeEnd; // 0 for the listening side, 1 for the connecting side
+    bool pipeSuspended;
+    bool inProcessListener;
+    // of an in-process listener, guarded by the mutex of the listeners
+    QVector<QSharedPointer<InProcessPipe>> pendingPipes;
+
+    // Legacy header: "%6x_%2x_", length and command as ASCII hex
     static const int HeaderSize = 10;
+    // Binary header: magic, version, command (quint16 LE), length (quint32 LE)
+    static const int BinaryHeaderSize = 8;
+    static const int MinimumHeaderSize = BinaryHeaderSize;
+    static const quint8 BinaryHeaderMagic = 0xB1;
+    static const quint8 BinaryHeaderVersion = 1;
+    // Messages up to this size are sent with a single write together with their header
+    static const int CoalesceLimit = 16 * 1024;
     static const int StandardBufferSize = 32 * 1024;
+    // Far beyond what slaves send at once, a bigger length means a broken stream
+    static const int MaxMessageSize = 256 * 1024 * 1024;
+    // Beyond this many bytes not read yet by the other end of a pipe, the writer waits
+    static const int InProcessBufferSize = 1024 * 1024;
+
+    bool readHeader();
+    void closePipe();
 
 Q_SIGNALS:
     void disconnected();
@@ -58,6 +87,8 @@ public:
     void setSuspended(bool enable);
     bool connectToRemote(const QUrl &url);
     bool listenForRemote();
+    // For a peer in another thread of this process, see InProcessPipe
+    bool listenInProcess();
     bool waitForIncomingTask(int ms);
     bool sendCommand(int command, const QByteArray &data) const;
     ConnectionBackend *nextPendingConnection();
@@ -65,6 +96,7 @@ public:
 public Q_SLOTS:
     void socketReadyRead();
     void socketDisconnected();
+    void pipeReadyRead();
 };
 }
 
@@ -47,6 +47,13 @@ void ConnectionServer::listenForRemote()
     //qDebug() << "Listening on" << d->backend->address;
 }
 
+void ConnectionServer::listenInProcess()
+{
+    d->backend = new ConnectionBackend(this);
+    d->backend->listenInProcess();
+    connect(d->backend, &ConnectionBackend::newConnection, this, &ConnectionServer::newConnection);
+}
+
 QUrl ConnectionServer::address() const
 {
     if (d->backend) {
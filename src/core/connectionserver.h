@@ -40,6 +40,12 @@ public:
      * address this is listening on.
      */
     void listenForRemote();
+    /**
+     * Like listenForRemote(), for a peer in another thread of this process:
+     * the connection then doesn't go through a socket.
+     * @since 5.78
+     */
+    void listenInProcess();
     bool isListening() const;
     /// Closes the connection.
     void close();
@@ -41,6 +41,7 @@
 #include <utime.h>
 #endif
 
+#include <QDataStream>
 #include <QTemporaryFile>
 #include <QTimer>
 #include <QFile>
@@ -49,11 +50,13 @@
 #include <QPointer>
 
 #include "job_p.h"
+#include "copytree_p.h"
 #include <kdiskfreespaceinfo.h>
 #include <KFileSystemType>
 #include <KFileUtils>
 #include <KIO/FileSystemFreeSpaceJob>
 
+#include <algorithm>
 #include <list>
 
 #include <QLoggingCategory>
@@ -95,6 +98,8 @@ enum DestinationState {
  *         (on already exists, and user chooses rename, TODO: go to STATE_RENAMING again)
  *      STATE_STATING
  *         and then, if dir -> STATE_LISTING (filling 'd->dirs' and 'd->files')
+ *         or STATE_COPYING_TREE if the slave can copy the whole dir itself
+ *         (only filling them with what it left over)
  *     STATE_CREATING_DIRS (createNextDir, iterating over 'd->dirs')
  *          if conflict: STATE_CONFLICT_CREATING_DIRS
  *     STATE_COPYING_FILES (copyNextFile, iterating over 'd->files')
@@ -108,6 +113,7 @@ enum CopyJobState {
     STATE_STATING,
     STATE_RENAMING,
     STATE_LISTING,
+    STATE_COPYING_TREE,
     STATE_CREATING_DIRS,
     STATE_CONFLICT_CREATING_DIRS,
     STATE_COPYING_FILES,
@@ -116,6 +122,19 @@ enum CopyJobState {
     STATE_SETTING_DIR_ATTRIBUTES
 };
 
+// Files up to that size may be copied along with others, see setMaxConcurrentFileCopies();
+// copying bigger files is bound by the transfer rather than by starting the copy
+static const KIO::filesize_t s_concurrentCopyMaxSize = 1024 * 1024;
+
+// A file copy started along with others, see startConcurrentCopies()
+struct ConcurrentCopy {
+    CopyInfo info;
+    KJob *job; // null once finished
+    KIO::filesize_t processedSize;
+    bool failed;
+    bool skipped;
+};
+
 static QUrl addPathToUrl(const QUrl &url, const QString &relPath)
 {
     QUrl u(url);
@@ -159,6 +178,12 @@ public:
         , m_bOverwriteWhenOlder(false)
         , m_conflictError(0)
         , m_reportTimer(nullptr)
+        , m_maxConcurrentCopies(1)
+        , m_concurrentCopiesStalled(false)
+        , m_treeCopyStarted(false)
+        , m_treeCopiedSize(0)
+        , m_treeFiles(0)
+        , m_treeDirs(0)
     {
     }
 
@@ -217,6 +242,25 @@ public:
 
     QTimer *m_reportTimer;
 
+    // The file copies running along with others, in the order of the files,
+    // with the finished ones which wait for the previous ones to be reported
+    QList<ConcurrentCopy> m_concurrentCopies;
+    int m_maxConcurrentCopies;
+    // A concurrent copy failed, wait for the others and retry it alone
+    bool m_concurrentCopiesStalled;
+    // The files to retry alone, see m_concurrentCopiesStalled
+    QSet<QUrl> m_serialCopies;
+
+    // The directory being copied by the slave, see startTreeCopy()
+    QUrl m_treeSrc;
+    CopyInfo m_treeRoot;
+    // Whether the slave copied anything yet, if not it's fine to list instead
+    bool m_treeCopyStarted;
+    KIO::filesize_t m_treeCopiedSize;
+    // What the slaves announced to copy, for the totals
+    int m_treeFiles;
+    int m_treeDirs;
+
     // The current src url being stat'ed or copied
     // During the stat phase, this is initially equal to *m_currentStatSrc but it can be resolved to a local file equivalent (#188903).
     QUrl m_currentSrcURL;
@@ -230,6 +274,10 @@ public:
     // Those aren't slots but submethods for slotResult.
     void slotResultStating(KJob *job);
     void startListing(const QUrl &src);
+    bool canCopyTree(const QUrl &src) const;
+    void startTreeCopy(const QUrl &src);
+    void slotTreeRecords(const QByteArray &data);
+    void slotResultCopyingTree(KJob *job);
 
     void slotResultCreatingDirs(KJob *job);
     void slotResultConflictCreatingDirs(KJob *job);
@@ -237,6 +285,11 @@ public:
 
     void slotResultCopyingFiles(KJob *job);
     void slotResultErrorCopyingFiles(KJob *job);
+    bool startConcurrentCopies();
+    bool canCopyConcurrently(const CopyInfo &info) const;
+    void slotResultConcurrentCopy(KJob *job);
+    void reportConcurrentCopy(const ConcurrentCopy &copy);
+    int destPermissions(const CopyInfo &info) const;
     void processFileRenameDialogResult(const QList<CopyInfo>::Iterator &it, RenameDialog_Result result,
                                  const QUrl &newUrl, const QDateTime &destmtime);
 
@@ -584,7 +637,11 @@ void CopyJobPrivate::sourceStated(const UDSEntry &entry, const QUrl &sourceUrl)
             }
         }
 
-        startListing(srcurl);
+        if (canCopyTree(srcurl)) {
+            startTreeCopy(srcurl);
+        } else {
+            startListing(srcurl);
+        }
     } else {
         qCDebug(KIO_COPYJOB_DEBUG) << "Source is a file (or a symlink), or we are linking -> no recursive listing";
 
@@ -655,6 +712,20 @@ void CopyJobPrivate::slotReport()
         }
         break;
 
+    case STATE_COPYING_TREE:
+        q->setTotalAmount(KJob::Bytes, m_totalSize);
+        q->setTotalAmount(KJob::Files, files.count() + m_filesHandledByDirectRename + m_treeFiles);
+        q->setTotalAmount(KJob::Directories, dirs.count() + m_treeDirs);
+        q->setProcessedAmount(KJob::Files, m_processedFiles);
+        q->setProcessedAmount(KJob::Directories, m_processedDirs);
+        q->setProcessedAmount(KJob::Bytes, m_processedSize + m_fileProcessedSize);
+        if (m_bURLDirty) {
+            m_bURLDirty = false;
+            emitCopying(q, m_currentSrcURL, m_currentDestURL);
+            emit q->copying(q, m_currentSrcURL, m_currentDestURL);
+        }
+        break;
+
     case STATE_CREATING_DIRS:
         q->setProcessedAmount(KJob::Directories, m_processedDirs);
         if (m_bURLDirty) {
@@ -676,8 +747,8 @@ void CopyJobPrivate::slotReport()
         }
         q->setProgressUnit(KJob::Bytes);
         q->setTotalAmount(KJob::Bytes, m_totalSize);
-        q->setTotalAmount(KJob::Files, files.count() + m_filesHandledByDirectRename);
-        q->setTotalAmount(KJob::Directories, dirs.count());
+        q->setTotalAmount(KJob::Files, files.count() + m_filesHandledByDirectRename + m_treeFiles);
+        q->setTotalAmount(KJob::Directories, dirs.count() + m_treeDirs);
         break;
 
     default:
@@ -955,7 +1026,8 @@ void CopyJobPrivate::statCurrentSrc()
 
         qCDebug(KIO_COPYJOB_DEBUG)<<"Stating finished. To copy:"<<m_totalSize<<", available:"<<m_freeSpace;
 
-        if (m_totalSize > m_freeSpace && m_freeSpace != static_cast<KIO::filesize_t>(-1)) {
+        // The trees copied by the slave are done already
+        if (m_totalSize - m_processedSize > m_freeSpace && m_freeSpace != static_cast<KIO::filesize_t>(-1)) {
             q->setError(ERR_DISK_FULL);
             q->setErrorText(m_currentSrcURL.toDisplayString());
             q->emitResult();
@@ -971,7 +1043,7 @@ void CopyJobPrivate::statCurrentSrc()
         }
 #endif
         // Check if we are copying a single file
-        m_bSingleFileCopy = (files.count() == 1 && dirs.isEmpty());
+        m_bSingleFileCopy = (files.count() == 1 && dirs.isEmpty() && m_treeFiles == 0 && m_treeDirs == 0);
         // Then start copying things
         state = STATE_CREATING_DIRS;
         createNextDir();
@@ -1040,6 +1112,163 @@ void CopyJobPrivate::startListing(const QUrl &src)
     q->addSubjob(newjob);
 }
 
+bool CopyJobPrivate::canCopyTree(const QUrl &src) const
+{
+    if (m_mode != CopyJob::Copy || qEnvironmentVariableIntValue("KIO_DISABLE_COPY_TREE") == 1) {
+        return false;
+    }
+    // Both sides have to be on the same slave, which maps them to local
+    // files; otherwise there's nothing to gain
+    if (src.scheme() != m_currentDest.scheme() || src.host() != m_currentDest.host()
+            || src.port() != m_currentDest.port() || src.userName() != m_currentDest.userName()) {
+        return false;
+    }
+    return src.isLocalFile() || KProtocolManager::protocolClass(src.scheme()) == QLatin1String(":local");
+}
+
+// Lets the slave copy the directory and everything below it on its own,
+// which only sends a few messages for the whole tree. What it leaves over
+// goes into 'files' and 'dirs', like the entries of a listing.
+void CopyJobPrivate::startTreeCopy(const QUrl &src)
+{
+    Q_Q(CopyJob);
+    state = STATE_COPYING_TREE;
+    m_bURLDirty = true;
+    m_treeSrc = src;
+    // Created by the slave, unless it falls back to the listing
+    m_treeRoot = dirs.takeLast();
+    m_treeCopyStarted = false;
+    m_treeCopiedSize = 0;
+    m_fileProcessedSize = 0;
+
+    qCDebug(KIO_COPYJOB_DEBUG) << "Copying the tree" << src << "to" << m_currentDest;
+    KIO_ARGS << src << m_currentDest;
+    TransferJob *newJob = TransferJobPrivate::newJob(src, CMD_COPY_TREE, packedArgs, QByteArray(), HideProgressInfo);
+    // Its warnings are ours
+    newJob->setUiDelegate(nullptr);
+    q->connect(newJob, &KJob::warning, q, [q](KJob *, const QString &text) {
+        emit q->warning(q, text);
+    });
+    q->connect(newJob, &TransferJob::data, q, [this](KIO::Job *, const QByteArray &data) {
+        slotTreeRecords(data);
+    });
+    q->connect(newJob, &Job::processedSize, q, [this](KJob *, qulonglong processedSize) {
+        m_fileProcessedSize = processedSize;
+    });
+    q->addSubjob(newJob);
+}
+
+void CopyJobPrivate::slotTreeRecords(const QByteArray &data)
+{
+    Q_Q(CopyJob);
+    m_treeCopyStarted = true;
+    QDataStream stream(data);
+    while (!stream.atEnd()) {
+        quint8 record;
+        stream >> record;
+        switch (record) {
+        case CopyTreeTotals: {
+            quint64 size;
+            quint64 files;
+            quint64 subdirs;
+            stream >> size >> files >> subdirs;
+            m_totalSize += size;
+            m_treeFiles += files;
+            m_treeDirs += subdirs + 1; // and the copied dir itself
+            break;
+        }
+        case CopyTreeCopied: {
+            QString path;
+            qint8 isDir;
+            qint64 mtime;
+            quint64 size;
+            stream >> path >> isDir >> mtime >> size;
+            const QUrl src = path.isEmpty() ? m_treeSrc : addPathToUrl(m_treeSrc, path);
+            const QUrl dest = path.isEmpty() ? m_currentDest : addPathToUrl(m_currentDest, path);
+            const QDateTime modificationTime = mtime == -1 ? QDateTime() : QDateTime::fromMSecsSinceEpoch(1000 * mtime, Qt::UTC);
+            //this is required for the undo feature
+            emit q->copyingDone(q, src, dest, modificationTime, isDir, false);
+            if (isDir) {
+                ++m_processedDirs;
+            } else {
+                ++m_processedFiles;
+                m_treeCopiedSize += size;
+                m_successSrcList.append(src);
+            }
+            m_currentSrcURL = src;
+            m_currentDestURL = dest;
+            m_bURLDirty = true;
+            break;
+        }
+        case CopyTreeLinked: {
+            QString path;
+            QString target;
+            stream >> path >> target;
+            const QUrl src = addPathToUrl(m_treeSrc, path);
+            const QUrl dest = addPathToUrl(m_currentDest, path);
+            //required for the undo feature
+            emit q->copyingLinkDone(q, src, target, dest);
+            ++m_processedFiles;
+            break;
+        }
+        case CopyTreeLeftOver: {
+            UDSEntry entry;
+            stream >> entry;
+            // Already in the totals sent by the slave
+            const KIO::filesize_t totalSize = m_totalSize;
+            addCopyInfoFromUDSEntry(entry, m_treeSrc, true, m_currentDest);
+            m_totalSize = totalSize;
+            if (entry.isDir()) {
+                --m_treeDirs;
+            } else {
+                --m_treeFiles;
+            }
+            break;
+        }
+        default:
+            qCWarning(KIO_CORE) << "Unknown record from the tree copy of" << m_treeSrc << record;
+            return;
+        }
+        if (stream.status() != QDataStream::Ok) {
+            qCWarning(KIO_CORE) << "Truncated record from the tree copy of" << m_treeSrc;
+            return;
+        }
+    }
+}
+
+void CopyJobPrivate::slotResultCopyingTree(KJob *job)
+{
+    Q_Q(CopyJob);
+    if (job->error() && !m_treeCopyStarted) {
+        // The slave can't copy trees, or the destination exists already:
+        // list the tree and copy it item by item, with the usual conflict handling
+        qCDebug(KIO_COPYJOB_DEBUG) << "Can't copy the tree" << m_treeSrc << "at once:" << job->errorString();
+        q->removeSubjob(job);
+        Q_ASSERT(!q->hasSubjobs());
+        dirs.append(m_treeRoot);
+        m_fileProcessedSize = 0;
+        startListing(m_treeSrc);
+        return;
+    }
+    if (job->error()) {
+        q->Job::slotResult(job);   // will set the error and emit result(this)
+        return;
+    }
+    q->removeSubjob(job);
+    Q_ASSERT(!q->hasSubjobs());
+
+    m_processedSize += m_treeCopiedSize;
+    m_fileProcessedSize = 0;
+    if (m_processedSize > m_totalSize) {
+        // Hard links, counted once in the totals
+        m_totalSize = m_processedSize;
+    }
+    if (m_freeSpace != (KIO::filesize_t) - 1) {
+        m_freeSpace -= qMin(m_freeSpace, m_treeCopiedSize);
+    }
+    statNextSrc();
+}
+
 void CopyJobPrivate::skip(const QUrl &sourceUrl, bool isDir)
 {
     QUrl dir(sourceUrl);
@@ -1370,6 +1599,10 @@ void CopyJobPrivate::createNextDir()
 void CopyJobPrivate::slotResultCopyingFiles(KJob *job)
 {
     Q_Q(CopyJob);
+    if (!m_concurrentCopies.isEmpty()) {
+        slotResultConcurrentCopy(job);
+        return;
+    }
     // The file we were trying to copy:
     QList<CopyInfo>::Iterator it = files.begin();
     if (job->error()) {
@@ -1756,11 +1989,169 @@ KIO::Job *CopyJobPrivate::linkNextFile(const QUrl &uSource, const QUrl &uDest, J
     }
 }
 
+int CopyJobPrivate::destPermissions(const CopyInfo &info) const
+{
+    // If source isn't local and target is local, we ignore the original permissions
+    // Otherwise, files downloaded from HTTP end up with -r--r--r--
+    const bool remoteSource = !KProtocolManager::supportsListing(info.uSource) || info.uSource.scheme() == QLatin1String("trash");
+    if (m_defaultPermissions || (remoteSource && info.uDest.isLocalFile())) {
+        return -1;
+    }
+    return info.permissions;
+}
+
+bool CopyJobPrivate::canCopyConcurrently(const CopyInfo &info) const
+{
+    // Moves and links have their own special cases in slotResultCopyingFiles
+    return m_mode == CopyJob::Copy
+           && info.linkDest.isEmpty()
+           && info.uSource != info.uDest
+           && info.size != (KIO::filesize_t) - 1
+           && info.size <= s_concurrentCopyMaxSize
+           && !m_serialCopies.contains(info.uSource);
+}
+
+// Starts copying the next files along with the running copies, as long as
+// they can be. Returns whether copies are running, copyNextFile() is called
+// again once they are all done.
+bool CopyJobPrivate::startConcurrentCopies()
+{
+    Q_Q(CopyJob);
+    KIO::filesize_t runningSize = 0;
+    for (const ConcurrentCopy &copy : qAsConst(m_concurrentCopies)) {
+        runningSize += copy.info.size;
+    }
+
+    while (!m_concurrentCopiesStalled && m_concurrentCopies.count() < m_maxConcurrentCopies && !files.isEmpty()) {
+        const CopyInfo info = files.first();
+        if (shouldSkip(info.uDest.path())) {
+            files.removeFirst();
+            continue;
+        }
+        if (!canCopyConcurrently(info)) {
+            break;
+        }
+        if (m_freeSpace != (KIO::filesize_t) - 1 && m_freeSpace < runningSize + info.size) {
+            // let copyNextFile() report it, once the running copies are done
+            break;
+        }
+
+        const JobFlags flags = shouldOverwriteFile(info.uDest.path()) ? Overwrite : DefaultFlags;
+        KIO::FileCopyJob *copyJob = KIO::file_copy(info.uSource, info.uDest, destPermissions(info), flags | HideProgressInfo/*no GUI*/);
+        copyJob->setParentJob(q);   // in case of rename dialog
+        copyJob->setSourceSize(info.size);
+        copyJob->setModificationTime(info.mtime);
+        qCDebug(KIO_COPYJOB_DEBUG) << "Copying" << info.uSource << "to" << info.uDest << "along with" << m_concurrentCopies.count() << "others";
+        m_currentSrcURL = info.uSource;
+        m_currentDestURL = info.uDest;
+        m_bURLDirty = true;
+        q->addSubjob(copyJob);
+        q->connect(copyJob, &Job::processedSize, q, [this](KJob *job, qulonglong processedSize) {
+            m_fileProcessedSize = 0;
+            for (ConcurrentCopy &copy : m_concurrentCopies) {
+                if (copy.job == job) {
+                    copy.processedSize = processedSize;
+                }
+                if (copy.job) {
+                    m_fileProcessedSize += copy.processedSize;
+                }
+            }
+        });
+
+        m_concurrentCopies.append(ConcurrentCopy{info, copyJob, 0, false, false});
+        runningSize += info.size;
+        files.removeFirst();
+    }
+    return !m_concurrentCopies.isEmpty();
+}
+
+void CopyJobPrivate::reportConcurrentCopy(const ConcurrentCopy &copy)
+{
+    Q_Q(CopyJob);
+    m_processedSize += copy.info.size;
+    if (copy.skipped) {
+        skip(copy.info.uSource, false);
+        return;
+    }
+    const QUrl finalUrl = finalDestUrl(copy.info.uSource, copy.info.uDest);
+    //required for the undo feature
+    emit q->copyingDone(q, copy.info.uSource, finalUrl, copy.info.mtime, false, false);
+    m_successSrcList.append(copy.info.uSource);
+    if (m_freeSpace != (KIO::filesize_t) - 1) {
+        m_freeSpace -= copy.info.size;
+    }
+    ++m_processedFiles;
+}
+
+void CopyJobPrivate::slotResultConcurrentCopy(KJob *job)
+{
+    Q_Q(CopyJob);
+    auto it = std::find_if(m_concurrentCopies.begin(), m_concurrentCopies.end(), [job](const ConcurrentCopy &copy) {
+        return copy.job == job;
+    });
+    Q_ASSERT(it != m_concurrentCopies.end());
+    (*it).job = nullptr;
+    if (job->error()) {
+        if (m_bAutoSkipFiles) {
+            (*it).skipped = true;
+        } else {
+            // Retried alone, for the usual conflict and error handling
+            (*it).failed = true;
+            m_serialCopies.insert((*it).info.uSource);
+            m_concurrentCopiesStalled = true;
+        }
+    }
+
+    // Merge metadata from subjob
+    m_incomingMetaData += static_cast<KIO::Job *>(job)->metaData();
+    q->removeSubjob(job);
+
+    // Report the finished copies in the order of the files
+    while (!m_concurrentCopies.isEmpty() && !m_concurrentCopies.first().job && !m_concurrentCopies.first().failed) {
+        reportConcurrentCopy(m_concurrentCopies.takeFirst());
+    }
+    m_fileProcessedSize = 0;
+    for (const ConcurrentCopy &copy : qAsConst(m_concurrentCopies)) {
+        if (copy.job) {
+            m_fileProcessedSize += copy.processedSize;
+        }
+    }
+
+    const bool running = std::any_of(m_concurrentCopies.cbegin(), m_concurrentCopies.cend(), [](const ConcurrentCopy &copy) {
+        return copy.job != nullptr;
+    });
+    if (running) {
+        startConcurrentCopies();
+        return;
+    }
+
+    if (m_concurrentCopiesStalled) {
+        // Put the failed copies back in front of the files, and report the
+        // ones done after them already
+        QList<CopyInfo> failed;
+        for (const ConcurrentCopy &copy : qAsConst(m_concurrentCopies)) {
+            if (copy.failed) {
+                failed.append(copy.info);
+            } else {
+                reportConcurrentCopy(copy);
+            }
+        }
+        m_concurrentCopies.clear();
+        files = failed + files;
+        m_concurrentCopiesStalled = false;
+    }
+    qCDebug(KIO_COPYJOB_DEBUG) << files.count() << "files remaining";
+    copyNextFile();
+}
+
 void CopyJobPrivate::copyNextFile()
 {
     Q_Q(CopyJob);
     bool bCopyFile = false;
     qCDebug(KIO_COPYJOB_DEBUG);
+    if (m_maxConcurrentCopies > 1 && startConcurrentCopies()) {
+        return;
+    }
     // Take the first file in the list
     QList<CopyInfo>::Iterator it = files.begin();
     // Is this URL on the skip list ?
@@ -1804,13 +2195,7 @@ void CopyJobPrivate::copyNextFile()
             bOverwrite = shouldOverwriteFile(destFile);
         }
 
-        // If source isn't local and target is local, we ignore the original permissions
-        // Otherwise, files downloaded from HTTP end up with -r--r--r--
-        const bool remoteSource = !KProtocolManager::supportsListing(uSource) || uSource.scheme() == QLatin1String("trash");
-        int permissions = (*it).permissions;
-        if (m_defaultPermissions || (remoteSource && uDest.isLocalFile())) {
-            permissions = -1;
-        }
+        const int permissions = destPermissions(*it);
         const JobFlags flags = bOverwrite ? Overwrite : DefaultFlags;
 
         m_bCurrentOperationIsLink = false;
@@ -2315,6 +2700,9 @@ void CopyJob::slotResult(KJob *job)
 
         d->statNextSrc();
         break;
+    case STATE_COPYING_TREE:
+        d->slotResultCopyingTree(job);
+        break;
     case STATE_CREATING_DIRS:
         d->slotResultCreatingDirs(job);
         break;
@@ -2365,6 +2753,11 @@ void KIO::CopyJob::setWriteIntoExistingDirectories(bool overwriteAll) // #65926
     d_func()->m_bOverwriteAllDirs = overwriteAll;
 }
 
+void KIO::CopyJob::setMaxConcurrentFileCopies(int count)
+{
+    d_func()->m_maxConcurrentCopies = qMax(1, count);
+}
+
 CopyJob *KIO::copy(const QUrl &src, const QUrl &dest, JobFlags flags)
 {
     qCDebug(KIO_COPYJOB_DEBUG) << "src=" << src << "dest=" << dest;
@@ -117,6 +117,23 @@ public:
      */
     void setWriteIntoExistingDirectories(bool overwriteAllDirs);
 
+    /**
+     * Copy up to @p count small files at once, each with its own FileCopyJob
+     * (and thus slave), instead of one after the other. This helps when
+     * copying many small files, where the time goes into starting a copy
+     * rather than into transferring data.
+     *
+     * The copies are still reported in the order of the files, with
+     * copyingDone() and the number of processed files. When one of them
+     * fails, the job waits for the others, then retries the failed ones one
+     * at a time, asking about conflicts and errors as usual.
+     *
+     * Only applies to copying, not to moving or linking, and not to
+     * symlinks. The default is 1, one file at a time.
+     * @since 5.78
+     */
+    void setMaxConcurrentFileCopies(int count);
+
     /**
      * Reimplemented for internal reasons
      */
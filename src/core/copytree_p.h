@@ -0,0 +1,55 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KIO_COPYTREE_P_H
+#define KIO_COPYTREE_P_H
+
+#include <QUrl>
+
+namespace KIO
+{
+/**
+ * @internal
+ * Arguments of CMD_COPY_TREE, given to SlaveBase::virtual_hook() with the
+ * CopyTree id.
+ *
+ * The slave copies the directory @p src and everything below it to @p dest,
+ * which must not exist yet; before copying anything, it fails if it does.
+ * The items it doesn't copy itself, like special files or files it can't
+ * read, are left over to the job, which copies them one by one with its
+ * usual error handling.
+ *
+ * Instead of a message per item, the slave sends the records below with
+ * data(), many at once, and the bytes copied so far with processedSize().
+ */
+struct CopyTreeArgs {
+    QUrl src;
+    QUrl dest;
+};
+
+/**
+ * @internal
+ * The records sent during CMD_COPY_TREE. Paths are relative to the copied
+ * directory, the directory itself having an empty path.
+ */
+enum CopyTreeRecord {
+    // quint64 bytes, files and subdirectories to copy; sent once, before
+    // the first item is copied
+    CopyTreeTotals = 1,
+    // QString path, qint8 isDir, qint64 mtime in seconds or -1, quint64 size;
+    // directories are sent before their contents
+    CopyTreeCopied = 2,
+    // UDSEntry of the source, with the path as UDS_NAME, like in a
+    // recursive listing
+    CopyTreeLeftOver = 3,
+    // QString path, QString target of the symlink
+    CopyTreeLinked = 4,
+};
+
+} // namespace KIO
+
+#endif
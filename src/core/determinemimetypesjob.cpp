@@ -0,0 +1,221 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "determinemimetypesjob.h"
+#include "determinemimetypesjob_p.h"
+#include <config-kiocore.h>
+
+#include <QFile>
+#include <QFutureWatcher>
+#include <QMimeDatabase>
+#include <QThreadPool>
+#include <QTimer>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
+#include <qplatformdefs.h>
+
+#include <fcntl.h>
+
+using namespace KIO;
+
+// Files whose MIME type is determined by one thread in one go
+static const int s_batchSize = 32;
+// Enough for the magic rules of the shared-mime-info database
+static const int s_readAheadSize = 16384;
+
+class KIO::DetermineMimeTypesJobPrivate
+{
+public:
+    explicit DetermineMimeTypesJobPrivate(DetermineMimeTypesJob *qq, const KFileItemList &items)
+        : q(qq),
+          m_items(items),
+          m_nextItem(0),
+          m_runningBatches(0),
+          m_maxRunningBatches(qMax(1, QThreadPool::globalInstance()->maxThreadCount())),
+          m_suspended(false),
+          m_killed(false)
+    {
+    }
+
+    void startBatches();
+    void batchFinished(QFutureWatcher<QVector<QMimeType>> *watcher, const KFileItemList &items);
+    static QVector<QMimeType> determineMimeTypes(const QStringList &paths);
+
+    DetermineMimeTypesJob *const q;
+    KFileItemList m_items;
+    int m_nextItem;
+    int m_runningBatches;
+    int m_maxRunningBatches;
+    bool m_suspended;
+    bool m_killed;
+};
+
+// Runs in a thread of the global thread pool
+QVector<QMimeType> DetermineMimeTypesJobPrivate::determineMimeTypes(const QStringList &paths)
+{
+#if HAVE_FADVISE
+    // Have the beginning of all the files read at once, rather than
+    // waiting for the disk for each of them in turn
+    for (const QString &path : paths) {
+        const int fd = QT_OPEN(QFile::encodeName(path).constData(), O_RDONLY);
+        if (fd != -1) {
+            posix_fadvise(fd, 0, s_readAheadSize, POSIX_FADV_WILLNEED);
+            QT_CLOSE(fd);
+        }
+    }
+#endif
+
+    QMimeDatabase db;
+    QVector<QMimeType> mimeTypes;
+    mimeTypes.reserve(paths.count());
+    for (const QString &path : paths) {
+        mimeTypes.append(db.mimeTypeForFile(path));
+    }
+    return mimeTypes;
+}
+
+void DetermineMimeTypesJobPrivate::startBatches()
+{
+    KFileItemList determined;
+    while (!m_suspended && !m_killed && m_runningBatches < m_maxRunningBatches && m_nextItem < m_items.count()) {
+        KFileItemList batchItems;
+        QStringList paths;
+        while (m_nextItem < m_items.count() && paths.count() < s_batchSize) {
+            const KFileItem &item = m_items.at(m_nextItem++);
+            const QString path = item.mimeTypeContentPath();
+            if (!path.isEmpty()) {
+                batchItems.append(item);
+                paths.append(path);
+            } else if (!item.isMimeTypeKnown()) {
+                // Only the name matters, no need for a thread
+                item.determineMimeType();
+                determined.append(item);
+            }
+        }
+        if (paths.isEmpty()) {
+            continue;
+        }
+
+        auto *watcher = new QFutureWatcher<QVector<QMimeType>>(q);
+        QObject::connect(watcher, &QFutureWatcherBase::finished, q, [this, watcher, batchItems]() {
+            batchFinished(watcher, batchItems);
+        });
+        watcher->setFuture(QtConcurrent::run(&DetermineMimeTypesJobPrivate::determineMimeTypes, paths));
+        ++m_runningBatches;
+    }
+
+    if (!determined.isEmpty()) {
+        emit q->mimeTypesDetermined(determined);
+    }
+    if (!m_killed && m_runningBatches == 0 && m_nextItem >= m_items.count()) {
+        q->emitResult();
+    }
+}
+
+void DetermineMimeTypesJobPrivate::batchFinished(QFutureWatcher<QVector<QMimeType>> *watcher, const KFileItemList &items)
+{
+    const QVector<QMimeType> mimeTypes = watcher->result();
+    watcher->deleteLater();
+    --m_runningBatches;
+    if (m_killed) {
+        return;
+    }
+
+    KFileItemList determined;
+    determined.reserve(items.count());
+    for (int i = 0; i < items.count(); ++i) {
+        const KFileItem &item = items.at(i);
+        // Another copy of the item may have been determined meanwhile
+        if (!item.isMimeTypeKnown()) {
+            item.setDeterminedMimeType(mimeTypes.at(i));
+        }
+        determined.append(item);
+    }
+    emit q->mimeTypesDetermined(determined);
+
+    startBatches();
+}
+
+DetermineMimeTypesJob::DetermineMimeTypesJob(const KFileItemList &items, QObject *parent)
+    : KJob(parent),
+      d(new DetermineMimeTypesJobPrivate(this, items))
+{
+    setCapabilities(Killable | Suspendable);
+}
+
+DetermineMimeTypesJob::~DetermineMimeTypesJob()
+{
+}
+
+void DetermineMimeTypesJob::start()
+{
+    QTimer::singleShot(0, this, [this]() {
+        d->startBatches();
+    });
+}
+
+bool DetermineMimeTypesJob::doKill()
+{
+    // The running batches finish in their thread, their results are dropped
+    d->m_killed = true;
+    return true;
+}
+
+bool DetermineMimeTypesJob::doSuspend()
+{
+    d->m_suspended = true;
+    return true;
+}
+
+bool DetermineMimeTypesJob::doResume()
+{
+    d->m_suspended = false;
+    QTimer::singleShot(0, this, [this]() {
+        d->startBatches();
+    });
+    return true;
+}
+
+void KIO::determineMimeTypesBlocking(const KFileItemList &items)
+{
+    struct Batch {
+        KFileItemList items;
+        QStringList paths;
+        QVector<QMimeType> mimeTypes;
+    };
+    QVector<Batch> batches;
+    int count = 0;
+    for (const KFileItem &item : items) {
+        const QString path = item.mimeTypeContentPath();
+        if (path.isEmpty()) {
+            continue;
+        }
+        if (batches.isEmpty() || batches.last().paths.count() == s_batchSize) {
+            batches.append(Batch());
+        }
+        batches.last().items.append(item);
+        batches.last().paths.append(path);
+        ++count;
+    }
+    if (count < 2) {
+        // Not worth a thread
+        return;
+    }
+
+    QtConcurrent::blockingMap(batches, [](Batch &batch) {
+        batch.mimeTypes = DetermineMimeTypesJobPrivate::determineMimeTypes(batch.paths);
+    });
+
+    for (const Batch &batch : qAsConst(batches)) {
+        for (int i = 0; i < batch.items.count(); ++i) {
+            const KFileItem &item = batch.items.at(i);
+            if (!item.isMimeTypeKnown()) {
+                item.setDeterminedMimeType(batch.mimeTypes.at(i));
+            }
+        }
+    }
+}
@@ -0,0 +1,87 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KIO_DETERMINEMIMETYPESJOB_H
+#define KIO_DETERMINEMIMETYPESJOB_H
+
+#include "kiocore_export.h"
+#include <kfileitem.h>
+
+#include <KJob>
+#include <QScopedPointer>
+
+namespace KIO {
+
+class DetermineMimeTypesJobPrivate;
+
+/**
+ * @class DetermineMimeTypesJob determinemimetypesjob.h <KIO/DetermineMimeTypesJob>
+ *
+ * Determines the final MIME type of many items, like KFileItem::determineMimeType()
+ * does for one item, without blocking the caller.
+ *
+ * The MIME types which have to be found from the contents of local files are
+ * determined by a pool of threads, a batch of files at a time, reading ahead
+ * the beginning of all the files of a batch before looking at them. The others
+ * only depend on the name of the item and are determined right away.
+ *
+ * The results are applied to the items in the thread of the job, and reported
+ * with mimeTypesDetermined() a batch at a time, so that a view can update all
+ * of them at once. Since KFileItem is implicitly shared, this also updates the
+ * copies held by KCoreDirLister and KDirModel.
+ *
+ * @code
+ *    auto *job = new KIO::DetermineMimeTypesJob(lister->items());
+ *    connect(job, &KIO::DetermineMimeTypesJob::mimeTypesDetermined, this, &MyView::refreshItems);
+ *    job->start();
+ * @endcode
+ *
+ * @since 5.78
+ */
+class KIOCORE_EXPORT DetermineMimeTypesJob : public KJob
+{
+    Q_OBJECT
+public:
+    /**
+     * Creates a job determining the MIME type of @p items, in this order.
+     * The items whose MIME type is already known are skipped.
+     */
+    explicit DetermineMimeTypesJob(const KFileItemList &items, QObject *parent = nullptr);
+
+    /**
+     * Destructor
+     *
+     * Note that by default jobs auto-delete themselves after emitting result.
+     */
+    ~DetermineMimeTypesJob() override;
+
+    /**
+     * Starts the job. The results are delivered asynchronously,
+     * even if none of the items needs a thread.
+     */
+    void start() override;
+
+Q_SIGNALS:
+    /**
+     * Emitted when the MIME type of @p items has been determined,
+     * i.e. KFileItem::isMimeTypeKnown() returns true for them now.
+     */
+    void mimeTypesDetermined(const KFileItemList &items);
+
+protected:
+    bool doKill() override;
+    bool doSuspend() override;
+    bool doResume() override;
+
+private:
+    friend class DetermineMimeTypesJobPrivate;
+    QScopedPointer<DetermineMimeTypesJobPrivate> d;
+};
+
+} // namespace KIO
+
+#endif // KIO_DETERMINEMIMETYPESJOB_H
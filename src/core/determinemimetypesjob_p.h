@@ -0,0 +1,28 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KIO_DETERMINEMIMETYPESJOB_P_H
+#define KIO_DETERMINEMIMETYPESJOB_P_H
+
+#include "kfileitem.h"
+
+namespace KIO
+{
+
+/**
+ * @internal
+ *
+ * Determines the MIME types which have to be found from the contents of
+ * local files, in threads and a batch at a time like DetermineMimeTypesJob,
+ * but waits for them. For callers needing the MIME type of many items
+ * right away, like KFileItemListProperties::mimeType().
+ */
+void determineMimeTypesBlocking(const KFileItemList &items);
+
+}
+
+#endif
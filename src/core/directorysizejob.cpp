@@ -8,7 +8,9 @@
 #include "global.h"
 #include "directorysizejob.h"
 #include "listjob.h"
+#include "specialjob.h"
 #include <kio/jobuidelegatefactory.h>
+#include <QDataStream>
 #include <QDebug>
 #include <QTimer>
 
@@ -41,8 +43,17 @@ public:
     int m_currentItem;
     QHash<long, QSet<long> > m_visitedInodes; // device -> set of inodes
 
+    // Local directories are walked by kio_file itself, which sends running totals
+    QUrl m_walkedUrl;
+    KIO::filesize_t m_walkedSize = 0;
+    KIO::filesize_t m_walkedFiles = 0;
+    KIO::filesize_t m_walkedSubdirs = 0;
+
     void startNextJob(const QUrl &url);
+    void startListJob(const QUrl &url);
     void slotEntries(KIO::Job *, const KIO::UDSEntryList &);
+    void slotTotals(KIO::Job *, const QByteArray &);
+    void addWalkedTotals(KIO::filesize_t size, KIO::filesize_t files, KIO::filesize_t subdirs);
     void processNextItem();
 
     Q_DECLARE_PUBLIC(DirectorySizeJob)
@@ -122,6 +133,29 @@ void DirectorySizeJobPrivate::startNextJob(const QUrl &url)
 {
     Q_Q(DirectorySizeJob);
     //qDebug() << url;
+    if (!url.isLocalFile()) {
+        startListJob(url);
+        return;
+    }
+
+    // Let kio_file walk the tree, with several threads and without
+    // sending every single entry over; see FileProtocol::special
+    QByteArray packedArgs;
+    QDataStream stream(&packedArgs, QIODevice::WriteOnly);
+    stream << int(3) << url;
+    KIO::SpecialJob *sizeJob = KIO::special(url, packedArgs, KIO::HideProgressInfo);
+    m_walkedUrl = url;
+    m_walkedSize = 0;
+    m_walkedFiles = 0;
+    m_walkedSubdirs = 0;
+    q->connect(sizeJob, SIGNAL(data(KIO::Job*,QByteArray)),
+               SLOT(slotTotals(KIO::Job*,QByteArray)));
+    q->addSubjob(sizeJob);
+}
+
+void DirectorySizeJobPrivate::startListJob(const QUrl &url)
+{
+    Q_Q(DirectorySizeJob);
     KIO::ListJob *listJob = KIO::listRecursive(url, KIO::HideProgressInfo);
 #if KIOCORE_BUILD_DEPRECATED_SINCE(5, 69)
     // TODO KF6: remove legacy details code path
@@ -134,6 +168,34 @@ void DirectorySizeJobPrivate::startNextJob(const QUrl &url)
     q->addSubjob(listJob);
 }
 
+void DirectorySizeJobPrivate::slotTotals(KIO::Job *, const QByteArray &data)
+{
+    QDataStream stream(data);
+    quint64 size;
+    quint64 files;
+    quint64 subdirs;
+    stream >> size >> files >> subdirs;
+    if (stream.status() != QDataStream::Ok) {
+        return;
+    }
+    // Each message has the totals so far, not what was added since the last one
+    addWalkedTotals(size - m_walkedSize, files - m_walkedFiles, subdirs - m_walkedSubdirs);
+}
+
+void DirectorySizeJobPrivate::addWalkedTotals(KIO::filesize_t size, KIO::filesize_t files, KIO::filesize_t subdirs)
+{
+    Q_Q(DirectorySizeJob);
+    m_walkedSize += size;
+    m_walkedFiles += files;
+    m_walkedSubdirs += subdirs;
+    m_totalSize += size;
+    m_totalFiles += files;
+    m_totalSubdirs += subdirs;
+    q->setProcessedAmount(KJob::Bytes, m_totalSize);
+    q->setProcessedAmount(KJob::Files, m_totalFiles);
+    q->setProcessedAmount(KJob::Directories, m_totalSubdirs);
+}
+
 void DirectorySizeJobPrivate::slotEntries(KIO::Job *, const KIO::UDSEntryList &list)
 {
     KIO::UDSEntryList::ConstIterator it = list.begin();
@@ -176,6 +238,14 @@ void DirectorySizeJob::slotResult(KJob *job)
     Q_D(DirectorySizeJob);
     //qDebug() << d->m_totalSize;
     removeSubjob(job);
+    if (job->error() == KIO::ERR_UNSUPPORTED_ACTION && qobject_cast<KIO::SpecialJob *>(job)) {
+        // kio_file can't walk the tree on this platform, list it instead
+        d->m_totalSize -= d->m_walkedSize;
+        d->m_totalFiles -= d->m_walkedFiles;
+        d->m_totalSubdirs -= d->m_walkedSubdirs;
+        d->startListJob(d->m_walkedUrl);
+        return;
+    }
     if (d->m_currentItem < d->m_lstItems.count()) {
         d->processNextItem();
     } else {
@@ -58,6 +58,7 @@ protected:
 
 private:
     Q_PRIVATE_SLOT(d_func(), void slotEntries(KIO::Job *, const KIO::UDSEntryList &))
+    Q_PRIVATE_SLOT(d_func(), void slotTotals(KIO::Job *, const QByteArray &))
     Q_PRIVATE_SLOT(d_func(), void processNextItem())
     Q_DECLARE_PRIVATE(DirectorySizeJob)
 };
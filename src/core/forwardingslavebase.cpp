@@ -7,6 +7,9 @@
 
 #include "forwardingslavebase.h"
 #include "../pathhelpers_p.h"
+#include "commands_p.h"
+#include "copytree_p.h"
+#include "job_p.h"
 
 #include "deletejob.h"
 #include "mkdirjob.h"
@@ -321,6 +324,34 @@ void ForwardingSlaveBase::del(const QUrl &url, bool isfile)
     }
 }
 
+void ForwardingSlaveBase::virtual_hook(int id, void *data)
+{
+    if (id != CopyTree) {
+        SlaveBase::virtual_hook(id, data);
+        return;
+    }
+
+    const CopyTreeArgs *args = static_cast<CopyTreeArgs *>(data);
+    qCDebug(KIO_CORE) << "copyTree" << args->src << args->dest;
+
+    QUrl new_src, new_dest;
+    if (!d->internalRewriteUrl(args->src, new_src)) {
+        error(KIO::ERR_DOES_NOT_EXIST, args->src.toDisplayString());
+    } else if (!d->internalRewriteUrl(args->dest, new_dest)) {
+        error(KIO::ERR_MALFORMED_URL, args->dest.toDisplayString());
+    } else if (!new_src.isLocalFile() || !new_dest.isLocalFile()) {
+        // The job copies the items one by one then
+        error(KIO::ERR_UNSUPPORTED_ACTION, unsupportedActionErrorString(QString::fromLatin1(mProtocol), CMD_COPY_TREE));
+    } else {
+        // The paths in the records are relative, they need no rewriting
+        KIO_ARGS << new_src << new_dest;
+        KIO::TransferJob *job = TransferJobPrivate::newJob(new_src, CMD_COPY_TREE, packedArgs, QByteArray(), HideProgressInfo);
+        d->connectTransferJob(job);
+
+        d->eventLoop.exec();
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
 void ForwardingSlaveBasePrivate::connectJob(KIO::Job *job)
@@ -152,6 +152,14 @@ protected:
      */
     QUrl requestedUrl() const;
 
+    /**
+     * @reimp
+     * Forwards the copy of a whole directory tree, when both sides
+     * are rewritten to local files.
+     * @since 5.78
+     */
+    void virtual_hook(int id, void *data) override;
+
 private:
     // KIO::Job
     Q_PRIVATE_SLOT(d, void _k_slotResult(KJob *job))
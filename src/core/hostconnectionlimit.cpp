@@ -0,0 +1,106 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-only
+*/
+
+#include "hostconnectionlimit_p.h"
+
+#include "commands_p.h"
+#include "kiocoredebug.h"
+
+// Jobs transferring less than that mostly wait for the host, their duration
+// tells how loaded it is
+static const qint64 s_smallTransferSize = 64 * 1024;
+// Latency variations below that are noise, even if the host answers in no time
+static const qint64 s_latencySlackMsecs = 20;
+
+using namespace KIO;
+
+HostConnectionLimit::HostConnectionLimit()
+{
+    m_lastUsed.start();
+    m_throughputTimer.start();
+}
+
+void HostConnectionLimit::setLimits(int minConnections, int maxConnections)
+{
+    m_connectionsCeiling = qMax(1, maxConnections);
+    m_minConnections = qBound(1, minConnections, m_connectionsCeiling);
+    // start as before the limit adapted, at the configured maximum
+    m_maxConnections = m_connectionsCeiling;
+    m_goodJobs = 0;
+    m_jobsBeforeDecrease = 0;
+    resetThroughput();
+}
+
+void HostConnectionLimit::jobDone(int command, qint64 msecs, qint64 bytes, bool failed, int runningJobs, bool jobsQueued)
+{
+    markUsed();
+    ++m_doneJobs;
+    m_doneBytes += qMax<qint64>(bytes, 0);
+    if (m_jobsBeforeDecrease > 0) {
+        // ran with the old limit, so it doesn't tell how the new one fares
+        --m_jobsBeforeDecrease;
+        return;
+    }
+
+    if (failed) {
+        decreaseConnections("connection failures", runningJobs);
+        return;
+    }
+
+    const bool waitsForHost = bytes < s_smallTransferSize && command != CMD_LISTDIR
+                              && command != CMD_OPEN && command != CMD_MULTI_GET
+                              && command != CMD_COPY_TREE;
+    if (waitsForHost) {
+        if (m_smoothedLatency < 0) {
+            m_smoothedLatency = msecs;
+        } else {
+            m_smoothedLatency = (7 * m_smoothedLatency + msecs) / 8;
+        }
+        if (m_baseLatency < 0 || m_smoothedLatency < m_baseLatency) {
+            m_baseLatency = m_smoothedLatency;
+        } else {
+            // follow a host which got slower for good, slowly
+            m_baseLatency += (m_smoothedLatency - m_baseLatency) / 64;
+        }
+        if (m_smoothedLatency > 2 * m_baseLatency + s_latencySlackMsecs) {
+            decreaseConnections("latency", runningJobs);
+            return;
+        }
+    }
+
+    // only grow while there are jobs waiting for the limit
+    if (++m_goodJobs >= m_maxConnections && m_maxConnections < m_connectionsCeiling && jobsQueued) {
+        ++m_maxConnections;
+        m_goodJobs = 0;
+        qCDebug(KIO_CORE) << "raising the connections to" << m_hostName << "to" << m_maxConnections
+                          << ", latency" << m_smoothedLatency << "ms, throughput"
+                          << m_doneJobs * 1000 / qMax<qint64>(m_throughputTimer.elapsed(), 1) << "jobs/s"
+                          << m_doneBytes * 1000 / qMax<qint64>(m_throughputTimer.elapsed(), 1) << "bytes/s";
+        resetThroughput();
+    }
+}
+
+void HostConnectionLimit::decreaseConnections(const char *reason, int runningJobs)
+{
+    m_goodJobs = 0;
+    m_jobsBeforeDecrease = runningJobs;
+    if (m_maxConnections == m_minConnections) {
+        return;
+    }
+    m_maxConnections = qMax(m_minConnections, m_maxConnections / 2);
+    qCDebug(KIO_CORE) << "lowering the connections to" << m_hostName << "to" << m_maxConnections << "because of" << reason
+                      << ", latency" << m_smoothedLatency << "ms, base" << m_baseLatency << "ms, throughput"
+                      << m_doneJobs * 1000 / qMax<qint64>(m_throughputTimer.elapsed(), 1) << "jobs/s";
+    resetThroughput();
+}
+
+void HostConnectionLimit::resetThroughput()
+{
+    m_throughputTimer.start();
+    m_doneJobs = 0;
+    m_doneBytes = 0;
+}
@@ -0,0 +1,86 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-only
+*/
+
+#ifndef HOSTCONNECTIONLIMIT_P_H
+#define HOSTCONNECTIONLIMIT_P_H
+
+#include <QElapsedTimer>
+#include <QString>
+
+#include <kiocore_export.h>
+
+namespace KIO
+{
+
+/**
+ * @internal
+ * How many jobs the scheduler runs at once on one host. It adapts to how
+ * the host copes with them, AIMD style: one more job at once after each
+ * round of jobs served as fast as usual, half as many when they slow down
+ * or the connection fails.
+ * The scheduler keeps it for a while after the jobs of the host are done,
+ * so that the next burst of jobs starts from what was learnt.
+ * Exported for the unit test.
+ */
+class KIOCORE_EXPORT HostConnectionLimit
+{
+public:
+    HostConnectionLimit();
+
+    void setHostName(const QString &host)
+    {
+        m_hostName = host;
+    }
+    // the number of jobs run at once varies between these bounds, and
+    // starts at the maximum
+    void setLimits(int minConnections, int maxConnections);
+    // how many jobs may run at once now
+    int maxConnections() const
+    {
+        return m_maxConnections;
+    }
+
+    // @p runningJobs is the number of jobs of the host still running,
+    // @p jobsQueued whether some of its jobs wait for the limit
+    void jobDone(int command, qint64 msecs, qint64 bytes, bool failed, int runningJobs, bool jobsQueued);
+
+    // whether the limit wasn't used for @p msecs
+    bool isUnusedFor(qint64 msecs) const
+    {
+        return m_lastUsed.hasExpired(msecs);
+    }
+    void markUsed()
+    {
+        m_lastUsed.start();
+    }
+
+private:
+    void decreaseConnections(const char *reason, int runningJobs);
+    void resetThroughput();
+
+    QString m_hostName;
+    QElapsedTimer m_lastUsed;
+
+    int m_minConnections = 1;
+    int m_connectionsCeiling = 1;
+    int m_maxConnections = 1;
+    // jobs served as fast as usual since the last change of m_maxConnections
+    int m_goodJobs = 0;
+    // jobs started before the last decrease, which don't tell about it yet
+    int m_jobsBeforeDecrease = 0;
+    // of the jobs which mostly wait for the host, in ms
+    qint64 m_smoothedLatency = -1;
+    qint64 m_baseLatency = -1;
+    // throughput since the last change of m_maxConnections, for the debug output
+    QElapsedTimer m_throughputTimer;
+    int m_doneJobs = 0;
+    qint64 m_doneBytes = 0;
+};
+
+} // namespace KIO
+
+#endif // HOSTCONNECTIONLIMIT_P_H
@@ -11,8 +11,12 @@
 #include "kcoredirlister.h"
 #include "kcoredirlister_p.h"
 
+#include <KConfigGroup>
 #include <KLocalizedString>
+#include <KSharedConfig>
+#include <KUser>
 #include <kio/listjob.h>
+#include "statjob.h"
 #include "kprotocolmanager.h"
 #include "kmountpoint.h"
 #include "kiocoredebug.h"
@@ -24,9 +28,17 @@
 #include <QTextStream>
 #include <QDir>
 #include <QMimeDatabase>
+#include <QFutureWatcher>
+#include <QtConcurrentRun>
+#include <qplatformdefs.h>
 
 #include <list>
 
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
 #include <QLoggingCategory>
 Q_DECLARE_LOGGING_CATEGORY(KIO_CORE_DIRLISTER)
 Q_LOGGING_CATEGORY(KIO_CORE_DIRLISTER, "kf.kio.core.dirlister", QtWarningMsg)
@@ -41,11 +53,23 @@ Q_LOGGING_CATEGORY(KIO_CORE_DIRLISTER, "kf.kio.core.dirlister", QtWarningMsg)
 
 Q_GLOBAL_STATIC(KCoreDirListerCache, kDirListerCache)
 
+// Past that many created, changed or removed entries in a directory, listing
+// it again is cheaper than stat'ing them one by one
+static const int s_maxPendingEntryUpdates = 256;
+
+// The size of itemsCached, in bytes
+static int cacheSizeFromConfig()
+{
+    const KConfigGroup group(KSharedConfig::openConfig(), "KDirLister");
+    const int sizeKiB = group.readEntry("CacheSize", 16 * 1024);
+    return qBound(0, sizeKiB, 1024 * 1024) * 1024;
+}
+
 KCoreDirListerCache::KCoreDirListerCache()
-    : itemsCached(10),       // keep the last 10 directories around
+    : itemsCached(cacheSizeFromConfig()),
       m_cacheHiddenFiles(10) // keep the last 10 ".hidden" files around
 {
-    qCDebug(KIO_CORE_DIRLISTER);
+    qCDebug(KIO_CORE_DIRLISTER) << "cache size" << itemsCached.maxCost();
 
     connect(&pendingUpdateTimer, &QTimer::timeout, this, &KCoreDirListerCache::processPendingUpdates);
     pendingUpdateTimer.setSingleShot(true);
@@ -167,6 +191,7 @@ bool KCoreDirListerCache::listDir(KCoreDirLister *lister, const QUrl &_u,
                 // if _reload is set, then we'll emit cached items and then updateDirectory.
             } else {
                 qCDebug(KIO_CORE_DIRLISTER) << "Entry in cache:" << _url;
+                ++m_cacheStatistics.hits;
                 itemsInUse.insert(_url, itemFromCache);
                 itemU = itemFromCache;
             }
@@ -191,6 +216,7 @@ bool KCoreDirListerCache::listDir(KCoreDirLister *lister, const QUrl &_u,
                 itemsCached.remove(_url);
             } else {
                 qCDebug(KIO_CORE_DIRLISTER) << "Listing directory:" << _url;
+                ++m_cacheStatistics.misses;
             }
 
             itemU = new DirItem(_url, resolved);
@@ -597,7 +623,11 @@ void KCoreDirListerCache::forgetDirs(KCoreDirLister *lister, const QUrl &_url, b
     // Inserting into QCache must be done last, since it might delete the item
     if (item && insertIntoCache) {
         qCDebug(KIO_CORE_DIRLISTER) << lister << "item moved into cache:" << url;
-        itemsCached.insert(url, item);
+        // QCache drops the least recently used directories to make room, or
+        // the new one right away if it is bigger than the whole cache
+        const int count = itemsCached.count() + (itemsCached.contains(url) ? 0 : 1);
+        itemsCached.insert(url, item, item->cost());
+        m_cacheStatistics.evictions += count - itemsCached.count();
     }
 }
 
@@ -1063,6 +1093,7 @@ void KCoreDirListerCache::handleDirDirty(const QUrl &url)
     if (!dirPath.endsWith(QLatin1Char('/'))) {
         dirPath += QLatin1Char('/');
     }
+    pendingEntryUpdates.remove(dir);
     QMutableSetIterator<QString> pendingIt(pendingUpdates);
     while (pendingIt.hasNext()) {
         const QString updPath = pendingIt.next();
@@ -1106,10 +1137,289 @@ void KCoreDirListerCache::handleFileDirty(const QUrl &url)
 void KCoreDirListerCache::slotFileCreated(const QString &path)   // from KDirWatch
 {
     qCDebug(KIO_CORE_DIRLISTER) << path;
-    // XXX: how to avoid a complete rescan here?
-    // We'd need to stat that one file separately and refresh the item(s) for it.
-    QUrl fileUrl(QUrl::fromLocalFile(path));
-    itemsAddedInDirectory(fileUrl.adjusted(QUrl::RemoveFilename | QUrl::StripTrailingSlash));
+    const QUrl fileUrl(QUrl::fromLocalFile(path));
+    const QString fileName = fileUrl.fileName();
+    const QList<QUrl> urls = directoriesForCanonicalPath(fileUrl.adjusted(QUrl::RemoveFilename | QUrl::StripTrailingSlash));
+    for (const QUrl &dir : urls) {
+        handleEntryCreated(dir, fileName);
+    }
+}
+
+// Called by slotFileCreated
+void KCoreDirListerCache::handleEntryCreated(const QUrl &url, const QString &name)
+{
+    const QString dir = url.toLocalFile();
+    if (name.isEmpty() || dir.isEmpty() || !checkUpdate(url)) {
+        return;
+    }
+    if (pendingDirectoryUpdates.contains(dir)) {
+        return; // the whole directory gets compared with its items anyway
+    }
+
+    QSet<QString> &names = pendingEntryUpdates[dir]; // find or insert
+    names.insert(name);
+    if (names.count() > s_maxPendingEntryUpdates) {
+        qCDebug(KIO_CORE_DIRLISTER) << "too many new entries in" << dir << ", updating the whole directory";
+        handleDirDirty(url);
+        return;
+    }
+    if (!pendingUpdateTimer.isActive()) {
+        pendingUpdateTimer.start(200);
+    }
+}
+
+// Called by processPendingUpdates
+void KCoreDirListerCache::updateEntries(const QUrl &dirUrl, const QSet<QString> &names)
+{
+    DirItem *dir = itemsInUse.value(dirUrl);
+    if (!dir || !dir->complete || jobForUrl(dirUrl)) {
+        // Still being listed: make sure the listing starts over and sees the new entries
+        updateDirectory(dirUrl);
+        return;
+    }
+
+    for (const QString &name : names) {
+        QUrl url(dirUrl);
+        url.setPath(concatPaths(url.path(), name));
+        // The same details as the listing, so that the entry compares equal
+        // to the listed one when the directory gets listed again
+        KIO::StatJob *job = KIO::statDetails(url, KIO::StatJob::SourceSide, KIO::StatDefaultDetails, KIO::HideProgressInfo);
+        connect(job, &KJob::result, this, [this, dirUrl, job]() {
+            slotEntryStatResult(dirUrl, job);
+        });
+    }
+}
+
+void KCoreDirListerCache::slotEntryStatResult(const QUrl &dirUrl, KIO::StatJob *job)
+{
+    if (job->error()) {
+        return; // already gone again, slotFileDeleted takes care of it
+    }
+    DirItem *dir = itemsInUse.value(dirUrl);
+    if (!dir || !dir->complete) {
+        return; // not listed anymore, or being listed again
+    }
+
+    const QList<KCoreDirLister *> listers = directoryData.value(dirUrl).listersCurrentlyHolding;
+    bool delayedMimeTypes = true;
+    for (const KCoreDirLister *kdl : listers) {
+        delayedMimeTypes &= kdl->d->delayedMimeTypes;
+    }
+
+    KFileItem item(job->statResult(), dirUrl, delayedMimeTypes, true);
+    const QString name = item.name();
+    if (name.isEmpty() || name == QLatin1Char('.') || name == QLatin1String("..")) {
+        return;
+    }
+    if (filesInDotHiddenForDir(dirUrl.toLocalFile()).contains(name)) {
+        item.setHidden();
+    }
+
+    const QUrl url = item.url();
+    auto it = std::lower_bound(dir->lstItems.begin(), dir->lstItems.end(), url);
+    if (it != dir->lstItems.end() && it->url() == url) {
+        const KFileItem oldItem = *it;
+        if (!oldItem.cmp(item)) {
+            reinsert(item, oldItem.url());
+            const QSet<KCoreDirLister *> listersToNotify = emitRefreshItem(oldItem, item);
+            for (KCoreDirLister *kdl : listersToNotify) {
+                kdl->d->emitItems();
+            }
+        }
+        return;
+    }
+
+    qCDebug(KIO_CORE_DIRLISTER) << "new file:" << name;
+    dir->insert(item);
+    for (KCoreDirLister *kdl : listers) {
+        kdl->d->addNewItem(dirUrl, item);
+        kdl->d->emitItems();
+    }
+}
+
+KCoreDirListerCache::LocalScan KCoreDirListerCache::scanLocalDirectory(const QString &path)
+{
+    LocalScan scan;
+#ifdef Q_OS_UNIX
+    const QByteArray encodedPath = QFile::encodeName(path);
+    DIR *dp = ::opendir(encodedPath.constData());
+    if (!dp) {
+        return scan;
+    }
+
+    QT_DIRENT *ep;
+    while ((ep = QT_READDIR(dp)) != nullptr) {
+        const QByteArray name(ep->d_name);
+        if (name == "." || name == "..") {
+            continue;
+        }
+        const QByteArray filePath = encodedPath + '/' + name;
+        QT_STATBUF buff;
+        if (QT_LSTAT(filePath.constData(), &buff) == -1) {
+            continue; // already gone again
+        }
+
+        LocalEntry entry;
+        entry.name = QFile::decodeName(name);
+        entry.isLink = S_ISLNK(buff.st_mode);
+        bool isBrokenLink = false;
+        if (entry.isLink) {
+            QByteArray linkTarget(qMax<qint64>(buff.st_size, 255) + 1, Qt::Uninitialized);
+            const ssize_t n = ::readlink(filePath.constData(), linkTarget.data(), linkTarget.size());
+            if (n >= 0 && n < linkTarget.size()) { // otherwise it doesn't match the item, which gets stat'ed
+                linkTarget.truncate(n);
+                entry.linkDest = QFile::decodeName(linkTarget);
+            }
+            // Like the file ioslave, use the details of the link target
+            QT_STATBUF targetBuff;
+            if (QT_STAT(filePath.constData(), &targetBuff) == -1) {
+                isBrokenLink = true;
+            } else {
+                buff = targetBuff;
+            }
+        }
+        if (isBrokenLink) {
+            entry.type = S_IFMT - 1;
+            entry.access = S_IRWXU | S_IRWXG | S_IRWXO;
+        } else {
+            entry.type = buff.st_mode & S_IFMT;
+            entry.access = buff.st_mode & 07777;
+            entry.size = buff.st_size;
+        }
+        entry.mtime = buff.st_mtime;
+        entry.uid = buff.st_uid;
+        entry.gid = buff.st_gid;
+        scan.entries.append(entry);
+    }
+    ::closedir(dp);
+    scan.ok = true;
+#else
+    Q_UNUSED(path)
+#endif
+    return scan;
+}
+
+// Called by processPendingUpdates
+void KCoreDirListerCache::updateLocalDirectory(const QUrl &dirUrl)
+{
+    DirItem *dir = itemsInUse.value(dirUrl);
+    if (!dir || !dir->complete || jobForUrl(dirUrl)) {
+        updateDirectory(dirUrl);
+        return;
+    }
+
+    const QString path = dirUrl.toLocalFile();
+    auto it = localDirectoryScans.find(path);
+    if (it != localDirectoryScans.end()) {
+        *it = true; // compare it again once the running scan is done
+        return;
+    }
+    localDirectoryScans.insert(path, false);
+
+    auto *watcher = new QFutureWatcher<LocalScan>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, dirUrl, watcher]() {
+        watcher->deleteLater();
+        slotLocalDirectoryScanned(dirUrl, watcher->result());
+    });
+    watcher->setFuture(QtConcurrent::run(&KCoreDirListerCache::scanLocalDirectory, path));
+}
+
+void KCoreDirListerCache::slotLocalDirectoryScanned(const QUrl &dirUrl, const LocalScan &scan)
+{
+    const bool changedAgain = localDirectoryScans.take(dirUrl.toLocalFile());
+    DirItem *dir = itemsInUse.value(dirUrl);
+    if (!dir) {
+        return; // not listed anymore
+    }
+    if (!scan.ok || !dir->complete || jobForUrl(dirUrl)) {
+        if (!scan.ok || changedAgain) {
+            updateDirectory(dirUrl);
+        }
+        return;
+    }
+
+    // lstItems is sorted by url, see DirItem::insert
+    QSet<QString> namesToStat;
+    QVector<bool> found(dir->lstItems.count(), false);
+    QHash<uint, QString> userNames;
+    QHash<uint, QString> groupNames;
+    for (const LocalEntry &entry : scan.entries) {
+        QUrl url(dirUrl);
+        url.setPath(concatPaths(url.path(), entry.name));
+        auto it = std::lower_bound(dir->lstItems.begin(), dir->lstItems.end(), url);
+        if (it != dir->lstItems.end() && it->url() == url) {
+            found[it - dir->lstItems.begin()] = true;
+            if (isListedAs(*it, entry, userNames, groupNames)) {
+                continue;
+            }
+        }
+        namesToStat.insert(entry.name);
+    }
+    QList<QUrl> removedUrls;
+    for (int i = 0; i < found.count(); ++i) {
+        if (!found.at(i)) {
+            removedUrls.append(dir->lstItems.at(i).url());
+        }
+    }
+
+    const QString dotHidden = QStringLiteral(".hidden");
+    const bool dotHiddenChanged = namesToStat.contains(dotHidden)
+                                  || std::any_of(removedUrls.cbegin(), removedUrls.cend(), [&dotHidden](const QUrl &url) {
+                                         return url.fileName() == dotHidden;
+                                     });
+    if (dotHiddenChanged || namesToStat.count() + removedUrls.count() > s_maxPendingEntryUpdates) {
+        // Every item may need to be hidden or shown, or too many entries to stat them one by one
+        updateDirectory(dirUrl);
+        return;
+    }
+
+    qCDebug(KIO_CORE_DIRLISTER) << dirUrl << namesToStat.count() << "entries to stat," << removedUrls.count() << "removed";
+    if (!removedUrls.isEmpty()) {
+        slotFilesRemoved(removedUrls);
+    }
+    if (!namesToStat.isEmpty()) {
+        updateEntries(dirUrl, namesToStat);
+    }
+    if (changedAgain) {
+        updateLocalDirectory(dirUrl);
+    }
+}
+
+// Whether @p item, as listed, still matches the local @p entry
+bool KCoreDirListerCache::isListedAs(const KFileItem &item, const LocalEntry &entry,
+                                     QHash<uint, QString> &userNames, QHash<uint, QString> &groupNames)
+{
+    const KIO::UDSEntry &udsEntry = item.entry();
+    if (udsEntry.numberValue(KIO::UDSEntry::UDS_FILE_TYPE) != entry.type
+            || udsEntry.numberValue(KIO::UDSEntry::UDS_ACCESS) != entry.access
+            || udsEntry.numberValue(KIO::UDSEntry::UDS_SIZE) != entry.size
+            || udsEntry.numberValue(KIO::UDSEntry::UDS_MODIFICATION_TIME) != entry.mtime
+            || udsEntry.stringValue(KIO::UDSEntry::UDS_LINK_DEST) != entry.linkDest) {
+        return false;
+    }
+
+    // The same names as the file ioslave, which falls back to the ids
+    if (udsEntry.contains(KIO::UDSEntry::UDS_USER)) {
+        auto it = userNames.find(entry.uid);
+        if (it == userNames.end()) {
+            const QString name = KUser(KUserId(entry.uid)).loginName();
+            it = userNames.insert(entry.uid, name.isEmpty() ? QString::number(entry.uid) : name);
+        }
+        if (udsEntry.stringValue(KIO::UDSEntry::UDS_USER) != *it) {
+            return false;
+        }
+    }
+    if (udsEntry.contains(KIO::UDSEntry::UDS_GROUP)) {
+        auto it = groupNames.find(entry.gid);
+        if (it == groupNames.end()) {
+            const QString name = KUserGroup(KGroupId(entry.gid)).name();
+            it = groupNames.insert(entry.gid, name.isEmpty() ? QString::number(entry.gid) : name);
+        }
+        if (udsEntry.stringValue(KIO::UDSEntry::UDS_GROUP) != *it) {
+            return false;
+        }
+    }
+    return true;
 }
 
 void KCoreDirListerCache::slotFileDeleted(const QString &path)   // from KDirWatch
@@ -1649,6 +1959,20 @@ void KCoreDirListerCache::slotUpdateEntries(KIO::Job *job, const KIO::UDSEntryLi
     runningListJobs[static_cast<KIO::ListJob *>(job)] += list;
 }
 
+// Whether the item for @p entry is hidden, the same way as KFileItem::isHidden()
+// for an item created from @p entry and hidden if listed in ".hidden"
+static bool isEntryHidden(const KIO::UDSEntry &entry, const QString &name, const QSet<QString> &filesToHide)
+{
+    if (filesToHide.contains(name)) {
+        return true;
+    }
+    const int hiddenVal = entry.numberValue(KIO::UDSEntry::UDS_HIDDEN, -1);
+    if (hiddenVal != -1) {
+        return hiddenVal == 1;
+    }
+    return name.length() > 1 && name[0] == QLatin1Char('.');
+}
+
 void KCoreDirListerCache::slotUpdateResult(KJob *j)
 {
     Q_ASSERT(j);
@@ -1728,6 +2052,35 @@ void KCoreDirListerCache::slotUpdateResult(KJob *j)
     KIO::UDSEntryList::const_iterator it = buf.constBegin();
     const KIO::UDSEntryList::const_iterator end = buf.constEnd();
     for (; it != end; ++it) {
+        const QString entryName = (*it).stringValue(KIO::UDSEntry::UDS_NAME);
+        const bool isDotOrDotDot = (entryName == QLatin1Char('.') || entryName == QLatin1String(".."));
+
+        // get the names of the files listed in ".hidden", if it exists and is a local file
+        if (!dotHiddenChecked && !isDotOrDotDot && !entryName.isEmpty()) {
+            QString localPath = (*it).stringValue(KIO::UDSEntry::UDS_LOCAL_PATH);
+            if (localPath.isEmpty() && jobUrl.isLocalFile()) {
+                localPath = concatPaths(jobUrl.toLocalFile(), entryName);
+            }
+            if (!localPath.isEmpty()) {
+                const QString rootItemPath = QFileInfo(localPath).absolutePath();
+                filesToHide = filesInDotHiddenForDir(rootItemPath);
+            }
+            dotHiddenChecked = true;
+        }
+
+        // Most entries didn't change at all: in that case the item listed
+        // before has the very same UDSEntry, and there is no need to build
+        // a new KFileItem (and its url) just to compare them.
+        // Unless the file was added to or removed from ".hidden" meanwhile.
+        if (pendingRemoteUpdates.isEmpty() && !isDotOrDotDot) {
+            FileItemHash::iterator fiit = fileItems.find(entryName);
+            if (fiit != fileItems.end() && fiit.value().entry() == *it
+                && fiit.value().isHidden() == isEntryHidden(*it, entryName, filesToHide)) {
+                fileItems.erase(fiit);
+                continue;
+            }
+        }
+
         // Form the complete url
         KFileItem item(*it, jobUrl, delayedMimeTypes, true);
 
@@ -1753,16 +2106,6 @@ void KCoreDirListerCache::slotUpdateResult(KJob *j)
                 }
             }
             continue;
-        } else {
-            // get the names of the files listed in ".hidden", if it exists and is a local file
-            if (!dotHiddenChecked) {
-                const QString localPath = item.localPath();
-                if (!localPath.isEmpty()) {
-                    const QString rootItemPath = QFileInfo(localPath).absolutePath();
-                    filesToHide = filesInDotHiddenForDir(rootItemPath);
-                }
-                dotHiddenChecked = true;
-            }
         }
 
         // hide file if listed in ".hidden"
@@ -1990,9 +2333,17 @@ void KCoreDirListerCache::processPendingUpdates()
         kdl->d->emitItems();
     }
 
+    // Directories with new entries, which are not compared with their items anyway
+    for (auto it = pendingEntryUpdates.cbegin(), end = pendingEntryUpdates.cend(); it != end; ++it) {
+        if (!pendingDirectoryUpdates.contains(it.key())) {
+            updateEntries(QUrl::fromLocalFile(it.key()), it.value());
+        }
+    }
+    pendingEntryUpdates.clear();
+
     // Directories in need of updating
     for (const QString &dir : qAsConst(pendingDirectoryUpdates)) {
-        updateDirectory(QUrl::fromLocalFile(dir));
+        updateLocalDirectory(QUrl::fromLocalFile(dir));
     }
     pendingDirectoryUpdates.clear();
 }
@@ -2737,6 +3088,24 @@ KFileItem KCoreDirLister::cachedItemForUrl(const QUrl &url)
     }
 }
 
+KCoreDirLister::CacheStatistics KCoreDirLister::cacheStatistics()
+{
+    if (kDirListerCache.exists()) {
+        return kDirListerCache()->cacheStatistics();
+    } else {
+        return {};
+    }
+}
+
+KCoreDirLister::CacheStatistics KCoreDirListerCache::cacheStatistics() const
+{
+    KCoreDirLister::CacheStatistics statistics = m_cacheStatistics;
+    statistics.cachedDirectories = itemsCached.count();
+    statistics.cachedBytes = itemsCached.totalCost();
+    statistics.maxCachedBytes = itemsCached.maxCost();
+    return statistics;
+}
+
 QSet<QString> KCoreDirListerCache::filesInDotHiddenForDir(const QString& dir)
 {
     const QString path = dir + QLatin1String("/.hidden");
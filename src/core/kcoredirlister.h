@@ -405,6 +405,31 @@ public:
      */
     static KFileItem cachedItemForUrl(const QUrl &url);
 
+    /**
+     * Statistics about the cache of recently listed directories, shared by
+     * all the dir listers of the process.
+     *
+     * The size of the cache is set in bytes by the "CacheSize" entry (in KiB)
+     * of the "KDirLister" group of the application config, 16 MiB by default.
+     * The least recently used directories are dropped first.
+     *
+     * @since 5.78
+     */
+    struct CacheStatistics {
+        quint64 hits = 0; ///< directories listed from the cache
+        quint64 misses = 0; ///< directories that had to be listed by a slave
+        quint64 evictions = 0; ///< directories dropped from the cache to stay in its size
+        int cachedDirectories = 0; ///< directories currently in the cache
+        qint64 cachedBytes = 0; ///< estimated memory used by these directories
+        qint64 maxCachedBytes = 0; ///< the size of the cache
+    };
+
+    /**
+     * @return the statistics of the directory cache so far
+     * @since 5.78
+     */
+    static CacheStatistics cacheStatistics();
+
 Q_SIGNALS:
 
     /**
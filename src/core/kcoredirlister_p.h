@@ -29,6 +29,7 @@ namespace KIO
 {
 class Job;
 class ListJob;
+class StatJob;
 }
 class OrgKdeKDirNotifyInterface;
 struct KCoreDirListerCacheDirectoryData;
@@ -167,6 +168,7 @@ public:
     void updateDirectory(const QUrl &dir);
 
     KFileItem itemForUrl(const QUrl &url) const;
+    KCoreDirLister::CacheStatistics cacheStatistics() const;
     QList<KFileItem> *itemsForDir(const QUrl &dir) const;
 
     bool listDir(KCoreDirLister *lister, const QUrl &_url, bool _keep, bool _reload);
@@ -258,6 +260,34 @@ private:
     // Helper method for slotFileDirty
     void handleFileDirty(const QUrl &url);
     void handleDirDirty(const QUrl &url);
+    void handleEntryCreated(const QUrl &dir, const QString &name);
+    void updateEntries(const QUrl &dir, const QSet<QString> &names);
+    void slotEntryStatResult(const QUrl &dir, KIO::StatJob *job);
+
+    // An entry of a local directory, with what the file ioslave would list for it
+    struct LocalEntry {
+        QString name;
+        QString linkDest;
+        qint64 size = 0;
+        qint64 mtime = 0;
+        uint type = 0;
+        uint access = 0;
+        uint uid = 0;
+        uint gid = 0;
+        bool isLink = false;
+    };
+    struct LocalScan {
+        QVector<LocalEntry> entries;
+        bool ok = false;
+    };
+    // Runs in a thread: reads the local directory @p path and lstat's its entries
+    static LocalScan scanLocalDirectory(const QString &path);
+    // Called by processPendingUpdates instead of updateDirectory for a dirty
+    // local directory: only the entries that differ from the items get updated
+    void updateLocalDirectory(const QUrl &dir);
+    void slotLocalDirectoryScanned(const QUrl &dir, const LocalScan &scan);
+    static bool isListedAs(const KFileItem &item, const LocalEntry &entry,
+                           QHash<uint, QString> &userNames, QHash<uint, QString> &groupNames);
 
     // when there were items deleted from the filesystem all the listers holding
     // the parent directory need to be notified, the items have to be deleted
@@ -408,6 +438,18 @@ private:
             }
         }
 
+        // Rough estimate of the memory used by this directory, its cost in itemsCached
+        int cost() const
+        {
+            // KFileItemPrivate, the list node and the UDSEntry fields; the other
+            // strings (user, group, MIME type...) are mostly implicitly shared
+            int bytes = int(sizeof(DirItem)) + 2 * m_canonicalPath.size();
+            for (const KFileItem &item : lstItems) {
+                bytes += 256 + 16 * item.entry().count() + 2 * item.name().size();
+            }
+            return bytes;
+        }
+
         // Insert the item in the sorted list
         void insert(const KFileItem &item)
         {
@@ -451,7 +493,9 @@ private:
 
     // an item is a complete directory
     QHash<QUrl, DirItem *> itemsInUse;
+    // least recently used directories, the cost is DirItem::cost()
     QCache<QUrl, DirItem> itemsCached;
+    KCoreDirLister::CacheStatistics m_cacheStatistics;
 
     // cache of ".hidden" files
     QCache<QString /*dot hidden file*/, CacheHiddenFile> m_cacheHiddenFiles;
@@ -468,6 +512,12 @@ private:
     // We temporize the notifications by keeping them 500ms in this list.
     QSet<QString /*path*/> pendingUpdates;
     QSet<QString /*path*/> pendingDirectoryUpdates;
+    // Entries KDirWatch told us were created, by local directory; only those
+    // get stat'ed instead of listing the whole directory again
+    QHash<QString /*dir path*/, QSet<QString> /*names*/> pendingEntryUpdates;
+    // Local directories being compared with their items by updateLocalDirectory(),
+    // and whether they changed again meanwhile
+    QHash<QString /*dir path*/, bool /*changed again*/> localDirectoryScans;
     // The timer for doing the delayed updates
     QTimer pendingUpdateTimer;
 
@@ -830,6 +830,31 @@ QMimeType KFileItem::determineMimeType() const
     return d->m_mimeType;
 }
 
+QString KFileItem::mimeTypeContentPath() const
+{
+    if (!d || (d->m_mimeType.isValid() && d->m_bMimeTypeKnown) || isDir() || d->m_bSkipMimeTypeFromContent) {
+        return QString();
+    }
+    bool isLocalUrl;
+    const QUrl url = mostLocalUrl(&isLocalUrl);
+    return isLocalUrl ? url.toLocalFile() : QString();
+}
+
+void KFileItem::setDeterminedMimeType(const QMimeType &mimeType) const
+{
+    if (!d || !mimeType.isValid()) {
+        return;
+    }
+    d->m_mimeType = mimeType;
+    d->m_bMimeTypeKnown = true;
+    // as in determineMimeType()
+    if (d->m_delayedMimeTypes) {
+        d->m_delayedMimeTypes = false;
+        d->m_useIconNameCache = false;
+        (void)iconName();
+    }
+}
+
 bool KFileItem::isMimeTypeKnown() const
 {
     if (!d) {
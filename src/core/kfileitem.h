@@ -22,6 +22,11 @@
 
 class KFileItemPrivate;
 
+namespace KIO
+{
+class DetermineMimeTypesJobPrivate;
+}
+
 /**
  * @class KFileItem kfileitem.h <KFileItem>
  *
@@ -562,12 +567,24 @@ private:
      */
     void setHidden();
 
+    /**
+     * @return the local file whose contents are needed to determine the
+     * MIME type, or an empty string if determineMimeType() doesn't read any
+     */
+    QString mimeTypeContentPath() const;
+
+    /**
+     * Sets the result of determineMimeType(), found from mimeTypeContentPath().
+     */
+    void setDeterminedMimeType(const QMimeType &mimeType) const;
+
 private:
     KIOCORE_EXPORT friend QDataStream &operator<< (QDataStream &s, const KFileItem &a);
     KIOCORE_EXPORT friend QDataStream &operator>> (QDataStream &s, KFileItem &a);
 
     friend class KFileItemTest;
     friend class KCoreDirListerCache;
+    friend class KIO::DetermineMimeTypesJobPrivate;
 };
 
 Q_DECLARE_METATYPE(KFileItem)
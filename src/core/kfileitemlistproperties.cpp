@@ -8,6 +8,7 @@
 */
 
 #include "kfileitemlistproperties.h"
+#include "determinemimetypesjob_p.h"
 
 #include <kfileitem.h>
 #include <kprotocolmanager.h>
@@ -188,6 +189,9 @@ QString KFileItemListProperties::mimeGroup() const
 
 void KFileItemListPropertiesPrivate::determineMimeTypeAndGroup() const
 {
+    // Sniffs the contents of the local files in parallel, rather than one by one below
+    KIO::determineMimeTypesBlocking(m_items);
+
     if (!m_items.isEmpty()) {
         m_mimeType = m_items.first().mimetype();
         m_mimeGroup = m_mimeType.left(m_mimeType.indexOf(QLatin1Char('/')));
@@ -12,6 +12,8 @@
 #include "slave.h"
 #include <kurlauthorized.h>
 
+#include <algorithm>
+
 using namespace KIO;
 
 class KIO::MultiGetJobPrivate: public KIO::TransferJobPrivate
@@ -49,6 +51,7 @@ public:
     void start(Slave *slave) override;
 
     bool findCurrentEntry();
+    void finishCurrentEntry();
     void flushQueue(RequestQueue &queue);
 
     Q_DECLARE_PUBLIC(MultiGetJob)
@@ -155,6 +158,17 @@ bool MultiGetJobPrivate::findCurrentEntry()
     }
 }
 
+void MultiGetJobPrivate::finishCurrentEntry()
+{
+    Q_Q(MultiGetJob);
+    if (m_redirectionURL.isEmpty()) {
+        // No redirection, tell the world that we are finished.
+        emit q->result(m_currentEntry.id);
+    }
+    m_redirectionURL = QUrl();
+    m_activeQueue.remove(m_currentEntry);
+}
+
 void MultiGetJob::slotRedirection(const QUrl &url)
 {
     Q_D(MultiGetJob);
@@ -165,6 +179,13 @@ void MultiGetJob::slotRedirection(const QUrl &url)
         qCWarning(KIO_CORE) << "Redirection from" << d->m_currentEntry.url << "to" << url << "REJECTED!";
         return;
     }
+    if (d->b_multiGetActive) {
+        // The slave goes on with the next response right away, and a redirection
+        // has no end of data: the entry is done here, and queued again.
+        d->m_activeQueue.remove(d->m_currentEntry);
+        get(d->m_currentEntry.id, url, d->m_currentEntry.metaData);
+        return;
+    }
     d->m_redirectionURL = url;
     get(d->m_currentEntry.id, d->m_redirectionURL, d->m_currentEntry.metaData); // Try again
 }
@@ -172,17 +193,20 @@ void MultiGetJob::slotRedirection(const QUrl &url)
 void MultiGetJob::slotFinished()
 {
     Q_D(MultiGetJob);
-    if (!d->findCurrentEntry()) {
-        return;
-    }
-    if (d->m_redirectionURL.isEmpty()) {
-        // No redirection, tell the world that we are finished.
-        emit result(d->m_currentEntry.id);
+    if (d->b_multiGetActive) {
+        // every entry ended with its end of data already
+        if (!d->m_activeQueue.empty()) {
+            // the slave still has to process the requests sent from slotMimetype
+            return;
+        }
+    } else {
+        if (!d->findCurrentEntry()) {
+            return;
+        }
+        d->finishCurrentEntry();
     }
-    d->m_redirectionURL = QUrl();
     setError(0);
     d->m_incomingMetaData.clear();
-    d->m_activeQueue.remove(d->m_currentEntry);
     if (d->m_activeQueue.empty()) {
         if (d->m_waitQueue.empty()) {
             // All done
@@ -207,6 +231,11 @@ void MultiGetJob::slotData(const QByteArray &_data)
     if (d->m_redirectionURL.isEmpty() || !d->m_redirectionURL.isValid() || error()) {
         emit data(d->m_currentEntry.id, _data);
     }
+    if (d->b_multiGetActive && _data.isEmpty()
+        && std::find(d->m_activeQueue.cbegin(), d->m_activeQueue.cend(), d->m_currentEntry) != d->m_activeQueue.cend()) {
+        // end of this response, the next one follows on the same connection
+        d->finishCurrentEntry();
+    }
 }
 
 void MultiGetJob::slotMimetype(const QString &_mimetype)
@@ -19,15 +19,26 @@
 #include <kprotocolmanager.h>
 #include <kprotocolinfo.h>
 //#include <KJobWidgets>
+#include <KConfigGroup>
+#include <KSharedConfig>
 
+#include <QElapsedTimer>
 #include <QHash>
 #include <QThread>
 #include <QThreadStorage>
 #include <QDBusConnection>
 #include <QDBusMessage>
 
+#include <iterator>
+
 // Slaves may be idle for a certain time (3 minutes) before they are killed.
 static const int s_idleSlaveLifetime = 3 * 60;
+// What was learnt about the connections a host copes with is forgotten
+// after that much time (10 minutes) without jobs for the host.
+static const qint64 s_connectionLimitLifetime = 10 * 60 * 1000;
+// How many times the job with the lowest serial may let an idle slave go to
+// the next job of the host of that slave, see startAJob()
+static const int s_maxSkips = 2;
 
 using namespace KIO;
 
@@ -41,6 +52,41 @@ static inline int jobCommand(SimpleJob *job)
     return SimpleJobPrivate::get(job)->m_command;
 }
 
+// Whether @p job runs on a slave in a thread of the application, when the
+// slave supports it. Opt-in with KIO_ENABLE_SLAVE_THREADS=1, and only for
+// the commands which only read, since the others may need the privilege
+// escalation helper, which is only set up for slave processes.
+static bool runsInThread(SimpleJob *job)
+{
+    static const bool enabled = qEnvironmentVariableIntValue("KIO_ENABLE_SLAVE_THREADS") == 1;
+    if (!enabled) {
+        return false;
+    }
+    switch (jobCommand(job)) {
+    case CMD_STAT:
+    case CMD_LISTDIR:
+    case CMD_MIMETYPE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Whether @p error tells that the host couldn't cope with a job
+static bool isConnectionError(int error)
+{
+    switch (error) {
+    case ERR_CANNOT_CONNECT:
+    case ERR_CONNECTION_BROKEN:
+    case ERR_SERVER_TIMEOUT:
+    case ERR_INTERNAL_SERVER:
+    case ERR_SLAVE_DIED:
+        return true;
+    default:
+        return false;
+    }
+}
+
 static inline void startJob(SimpleJob *job, Slave *slave)
 {
     SimpleJobPrivate::get(job)->start(slave);
@@ -54,6 +100,15 @@ static void setupSlave(KIO::Slave *slave, const QUrl &url, const QString &protoc
 static Scheduler *scheduler();
 static Slave *heldSlaveForJob(SimpleJob *job);
 
+// Idle slaves kept ready for the jobs of @p protocol, so that a burst of jobs
+// doesn't wait for slaves to start. Configured in the [Warm Slaves] group of
+// kioslaverc, e.g. "file=2"; none by default.
+static int warmSlavesFor(const QString &protocol, int maxSlaves)
+{
+    KConfigGroup cg(KSharedConfig::openConfig(QStringLiteral("kioslaverc"), KConfig::NoGlobals), "Warm Slaves");
+    return qBound(0, cg.readEntry(protocol, 0), maxSlaves);
+}
+
 int SerialPicker::changedPrioritySerial(int oldSerial, int newPriority) const
 {
     Q_ASSERT(newPriority >= -10 && newPriority <= 10);
@@ -89,10 +144,17 @@ Slave *SlaveKeeper::takeSlaveForJob(SimpleJob *job)
     }
 
     QUrl url = SimpleJobPrivate::get(job)->m_url;
+    const bool inThread = runsInThread(job);
     // TODO take port, username and password into account
     QMultiHash<QString, Slave *>::Iterator it = m_idleSlaves.find(url.host());
-    if (it == m_idleSlaves.end()) {
+    while (it != m_idleSlaves.end() && it.key() == url.host() && it.value()->isInThread() != inThread) {
+        ++it;
+    }
+    if (it == m_idleSlaves.end() || it.key() != url.host()) {
         it = m_idleSlaves.begin();
+        while (it != m_idleSlaves.end() && it.value()->isInThread() != inThread) {
+            ++it;
+        }
     }
     if (it == m_idleSlaves.end()) {
         return nullptr;
@@ -138,7 +200,7 @@ void SlaveKeeper::grimReaper()
     QMultiHash<QString, Slave *>::Iterator it = m_idleSlaves.begin();
     while (it != m_idleSlaves.end()) {
         Slave *slave = it.value();
-        if (slave->idleTime() >= s_idleSlaveLifetime) {
+        if (slave->idleTime() >= s_idleSlaveLifetime && m_idleSlaves.count() > m_minIdleSlaves) {
             it = m_idleSlaves.erase(it);
             if (slave->job()) {
                 //qDebug() << "Idle slave" << slave << "still has job" << slave->job();
@@ -150,7 +212,7 @@ void SlaveKeeper::grimReaper()
             ++it;
         }
     }
-    if (!m_idleSlaves.isEmpty()) {
+    if (m_idleSlaves.count() > m_minIdleSlaves) {
         scheduleGrimReaper();
     }
 }
@@ -179,15 +241,25 @@ SimpleJob *HostQueue::takeFirstInQueue()
     QMap<int, SimpleJob *>::iterator first = m_queuedJobs.begin();
     SimpleJob *job = first.value();
     m_queuedJobs.erase(first);
-    m_runningJobs.insert(job);
+    QElapsedTimer timer;
+    timer.start();
+    m_runningJobs.insert(job, timer);
     return job;
 }
 
-bool HostQueue::removeJob(SimpleJob *job)
+bool HostQueue::removeJob(SimpleJob *job, qint64 *runMsecs)
 {
+    if (runMsecs) {
+        *runMsecs = -1;
+    }
     const int serial = SimpleJobPrivate::get(job)->m_schedSerial;
-    if (m_runningJobs.remove(job)) {
+    auto it = m_runningJobs.find(job);
+    if (it != m_runningJobs.end()) {
         Q_ASSERT(!m_queuedJobs.contains(serial));
+        if (runMsecs) {
+            *runMsecs = it.value().elapsed();
+        }
+        m_runningJobs.erase(it);
         return true;
     }
     if (m_queuedJobs.remove(serial)) {
@@ -196,12 +268,17 @@ bool HostQueue::removeJob(SimpleJob *job)
     return false;
 }
 
+void HostQueue::jobDone(int command, qint64 msecs, qint64 bytes, bool failed)
+{
+    m_limit->jobDone(command, msecs, bytes, failed, m_runningJobs.count(), !m_queuedJobs.isEmpty());
+}
+
 QList<Slave *> HostQueue::allSlaves() const
 {
     QList<Slave *> ret;
     ret.reserve(m_runningJobs.size());
-    for (SimpleJob *job : m_runningJobs) {
-        Slave *slave = jobSlave(job);
+    for (auto it = m_runningJobs.cbegin(); it != m_runningJobs.cend(); ++it) {
+        Slave *slave = jobSlave(it.key());
         Q_ASSERT(slave);
         ret.append(slave);
     }
@@ -385,11 +462,14 @@ static void verifyRunningJobsCount(QHash<QString, HostQueue> *queues, int runnin
 #endif
 }
 
-ProtoQueue::ProtoQueue(int maxSlaves, int maxSlavesPerHost)
-    : m_maxConnectionsPerHost(maxSlavesPerHost ? maxSlavesPerHost : maxSlaves),
+ProtoQueue::ProtoQueue(const QString &protocol, int maxSlaves, int maxSlavesPerHost)
+    : m_protocol(protocol),
+      m_maxConnectionsPerHost(maxSlavesPerHost ? maxSlavesPerHost : maxSlaves),
       m_maxConnectionsTotal(qMax(maxSlaves, maxSlavesPerHost)),
-      m_runningJobsCount(0)
-
+      m_runningJobsCount(0),
+      m_warmSlaves(0),
+      m_skippedSerial(0),
+      m_skipCount(0)
 {
     /*qDebug() << "m_maxConnectionsTotal:" << m_maxConnectionsTotal
                  << "m_maxConnectionsPerHost:" << m_maxConnectionsPerHost;*/
@@ -397,6 +477,9 @@ ProtoQueue::ProtoQueue(int maxSlaves, int maxSlavesPerHost)
     Q_ASSERT(maxSlaves >= maxSlavesPerHost);
     m_startJobTimer.setSingleShot(true);
     connect(&m_startJobTimer, &QTimer::timeout, this, &ProtoQueue::startAJob);
+    m_spawnTimer.setSingleShot(true);
+    connect(&m_spawnTimer, &QTimer::timeout, this, &ProtoQueue::spawnASlave);
+    setWarmSlaves(warmSlavesFor(protocol, m_maxConnectionsTotal));
 }
 
 ProtoQueue::~ProtoQueue()
@@ -412,12 +495,70 @@ ProtoQueue::~ProtoQueue()
     }
 }
 
+HostQueue &ProtoQueue::hostQueue(const QString &host)
+{
+    QHash<QString, HostQueue>::Iterator it = m_queuesByHostname.find(host);
+    if (it != m_queuesByHostname.end()) {
+        return it.value();
+    }
+    HostQueue &hq = m_queuesByHostname[host];
+    hq.setHostName(host);
+    hq.setConnectionLimit(&connectionLimit(host));
+    return hq;
+}
+
+HostConnectionLimit &ProtoQueue::connectionLimit(const QString &host)
+{
+    QHash<QString, HostConnectionLimit>::Iterator it = m_connectionLimits.find(host);
+    if (it != m_connectionLimits.end() && !it->isUnusedFor(s_connectionLimitLifetime)) {
+        it->markUsed();
+        return it.value();
+    }
+    HostConnectionLimit &limit = m_connectionLimits[host];
+    limit = HostConnectionLimit();
+    limit.setHostName(host);
+    applyConnectionLimits(host, &limit);
+    return limit;
+}
+
+void ProtoQueue::applyConnectionLimits(const QString &host, HostConnectionLimit *limit) const
+{
+    // MaxConnections of a host overrides the limit of the protocol,
+    // MinConnections is how low adapting the limit may go
+    int maxConnections = m_maxConnectionsPerHost;
+    bool ok = false;
+    const int configuredMax = SlaveConfig::self()->configData(m_protocol, host, QStringLiteral("MaxConnections")).toInt(&ok);
+    if (ok && configuredMax > 0) {
+        maxConnections = qMin(configuredMax, m_maxConnectionsTotal);
+    }
+    const int minConnections = SlaveConfig::self()->configData(m_protocol, host, QStringLiteral("MinConnections")).toInt(&ok);
+    limit->setLimits(ok ? minConnections : 1, maxConnections);
+}
+
+void ProtoQueue::reparseConnectionLimits()
+{
+    for (auto it = m_connectionLimits.begin(); it != m_connectionLimits.end(); ++it) {
+        applyConnectionLimits(it.key(), &it.value());
+    }
+}
+
+void ProtoQueue::expireConnectionLimits()
+{
+    for (auto it = m_connectionLimits.begin(); it != m_connectionLimits.end();) {
+        // the limit of a host with jobs is in use, whatever its age
+        if (it->isUnusedFor(s_connectionLimitLifetime) && !m_queuesByHostname.contains(it.key())) {
+            it = m_connectionLimits.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 void ProtoQueue::queueJob(SimpleJob *job)
 {
     QString hostname = SimpleJobPrivate::get(job)->m_url.host();
-    HostQueue &hq = m_queuesByHostname[hostname];
+    HostQueue &hq = hostQueue(hostname);
     const int prevLowestSerial = hq.lowestSerial();
-    Q_ASSERT(hq.runningJobsCount() <= m_maxConnectionsPerHost);
 
     // nevert insert a job twice
     Q_ASSERT(SimpleJobPrivate::get(job)->m_schedSerial == 0);
@@ -429,7 +570,7 @@ void ProtoQueue::queueJob(SimpleJob *job)
     // the queue's lowest serial job may have changed, so update the ordered list of queues.
     // however, we ignore all jobs that would cause more connections to a host than allowed.
     if (prevLowestSerial != hq.lowestSerial()) {
-        if (hq.runningJobsCount() < m_maxConnectionsPerHost) {
+        if (hq.runningJobsCount() < hq.maxConnections()) {
             // if the connection limit didn't keep the HQ unscheduled it must have been lack of jobs
             if (m_queuesBySerial.remove(prevLowestSerial) == 0) {
                 Q_UNUSED(wasQueueEmpty);
@@ -477,37 +618,54 @@ void ProtoQueue::changeJobPriority(SimpleJob *job, int newPrio)
 void ProtoQueue::removeJob(SimpleJob *job)
 {
     SimpleJobPrivate *jobPriv = SimpleJobPrivate::get(job);
-    HostQueue &hq = m_queuesByHostname[jobPriv->m_url.host()];
-    const int prevLowestSerial = hq.lowestSerial();
-    const int prevRunningJobs = hq.runningJobsCount();
+    QHash<QString, HostQueue>::Iterator hqIt = m_queuesByHostname.find(jobPriv->m_url.host());
+    HostQueue *hq = hqIt != m_queuesByHostname.end() ? &hqIt.value() : nullptr;
+    const int prevLowestSerial = hq ? hq->lowestSerial() : SerialPicker::maxSerial;
+    const int prevRunningJobs = hq ? hq->runningJobsCount() : 0;
 
-    Q_ASSERT(hq.runningJobsCount() <= m_maxConnectionsPerHost);
+    Q_ASSERT(!hq || hq->runningJobsCount() <= m_maxConnectionsTotal);
 
-    if (hq.removeJob(job)) {
-        if (hq.lowestSerial() != prevLowestSerial) {
+    qint64 runMsecs;
+    if (hq && hq->removeJob(job, &runMsecs)) {
+        if (hq->lowestSerial() != prevLowestSerial) {
             // we have dequeued the not yet running job with the lowest serial
             Q_ASSERT(!jobPriv->m_slave);
-            Q_ASSERT(prevRunningJobs == hq.runningJobsCount());
+            Q_ASSERT(prevRunningJobs == hq->runningJobsCount());
             if (m_queuesBySerial.remove(prevLowestSerial) == 0) {
                 // make sure that the queue was not scheduled for a good reason
-                Q_ASSERT(hq.runningJobsCount() == m_maxConnectionsPerHost);
+                Q_ASSERT(hq->runningJobsCount() >= hq->maxConnections());
             }
         } else {
-            if (prevRunningJobs != hq.runningJobsCount()) {
+            if (prevRunningJobs != hq->runningJobsCount()) {
                 // we have dequeued a previously running job
-                Q_ASSERT(prevRunningJobs - 1 == hq.runningJobsCount());
+                Q_ASSERT(prevRunningJobs - 1 == hq->runningJobsCount());
                 m_runningJobsCount--;
                 Q_ASSERT(m_runningJobsCount >= 0);
             }
         }
-        if (!hq.isQueueEmpty() && hq.runningJobsCount() < m_maxConnectionsPerHost) {
-            // this may be a no-op, but it's faster than first checking if it's already in.
-            m_queuesBySerial.insert(hq.lowestSerial(), &hq);
+
+        if (runMsecs >= 0 && jobPriv->m_slave) {
+            const bool failed = isConnectionError(job->error());
+            // a killed job doesn't tell anything about the host
+            if (failed || jobPriv->m_slave->isAlive()) {
+                hq->jobDone(jobPriv->m_command, runMsecs, job->processedAmount(KJob::Bytes), failed);
+            }
+        }
+        if (!hq->isQueueEmpty()) {
+            if (hq->runningJobsCount() < hq->maxConnections()) {
+                // this may be a no-op, but it's faster than first checking if it's already in.
+                m_queuesBySerial.insert(hq->lowestSerial(), hq);
+            } else {
+                // jobDone() may have lowered the limit
+                m_queuesBySerial.remove(hq->lowestSerial());
+            }
         }
 
-        if (hq.isEmpty()) {
+        if (hq->isEmpty()) {
             // no queued jobs, no running jobs. this destroys hq from above.
-            m_queuesByHostname.remove(jobPriv->m_url.host());
+            // The connection limit of the host stays for the next jobs.
+            m_queuesByHostname.erase(hqIt);
+            expireConnectionLimits();
         }
 
         if (jobPriv->m_slave && jobPriv->m_slave->isAlive()) {
@@ -531,8 +689,23 @@ Slave *ProtoQueue::createSlave(const QString &protocol, SimpleJob *job, const QU
 {
     int error;
     QString errortext;
-    Slave *slave = Slave::createSlave(protocol, url, error, errortext);
+    QElapsedTimer timer;
+    timer.start();
+    Slave *slave = nullptr;
+    if (job && runsInThread(job)) {
+        slave = Slave::createThreadSlave(protocol);
+    }
+    if (!slave) {
+        slave = Slave::createSlave(protocol, url, error, errortext);
+    }
     if (slave) {
+        m_spawnStats.startedSlaves++;
+        // starting the process or thread is most of the time until the
+        // slave can take a job, so count until it connected back
+        connect(slave, &Slave::slaveConnected, this, [this, timer]() {
+            m_spawnStats.connectedSlaves++;
+            m_spawnStats.connectMsecs += timer.elapsed();
+        });
         scheduler()->connect(slave, SIGNAL(slaveDied(KIO::Slave*)),
                              SLOT(slotSlaveDied(KIO::Slave*)));
         scheduler()->connect(slave, SIGNAL(slaveStatus(qint64,QByteArray,QString,bool)),
@@ -546,6 +719,50 @@ Slave *ProtoQueue::createSlave(const QString &protocol, SimpleJob *job, const QU
     return slave;
 }
 
+void ProtoQueue::setWarmSlaves(int count)
+{
+    m_warmSlaves = count;
+    m_slaveKeeper.setMinIdleSlaves(count);
+    scheduleSpawn();
+}
+
+void ProtoQueue::scheduleSpawn()
+{
+    if (m_warmSlaves > 0 && !m_spawnTimer.isActive()) {
+        m_spawnTimer.start();
+    }
+}
+
+//private slot
+void ProtoQueue::spawnASlave()
+{
+    // Keep m_warmSlaves idle slaves, plus one for each job waiting in the
+    // queues, within the limit of slaves which may be busy at once
+    int queuedJobsCount = 0;
+    for (auto it = m_queuesByHostname.cbegin(); it != m_queuesByHostname.cend(); ++it) {
+        queuedJobsCount += it.value().queuedJobsCount();
+    }
+    const int wanted = qMin(m_warmSlaves + queuedJobsCount, m_maxConnectionsTotal - m_runningJobsCount);
+    if (m_slaveKeeper.idleSlavesCount() >= wanted) {
+        return;
+    }
+
+    QUrl url;
+    url.setScheme(m_protocol);
+    Slave *slave = createSlave(m_protocol, /* job */nullptr, url);
+    if (!slave) {
+        return;
+    }
+    // so that setupSlave() sends the configuration when a job gets it
+    slave->resetHost();
+    m_slaveKeeper.returnSlave(slave);
+    qCDebug(KIO_CORE) << "spawned a warm" << m_protocol << "slave, jobs started on warm/new slaves:"
+                      << m_spawnStats.jobsOnWarmSlaves << "/" << m_spawnStats.jobsOnNewSlaves;
+    if (m_slaveKeeper.idleSlavesCount() < wanted) {
+        m_spawnTimer.start();
+    }
+}
+
 bool ProtoQueue::removeSlave(KIO::Slave *slave)
 {
     const bool removedConnected = m_connectedSlaveQueue.removeSlave(slave);
@@ -589,6 +806,26 @@ void ProtoQueue::startAJob()
     }
 
     QMap<int, HostQueue *>::iterator first = m_queuesBySerial.begin();
+    if (first != m_queuesBySerial.end() && !m_slaveKeeper.hasIdleSlaveFor(first.value()->hostName())) {
+        // Work stealing: rather than have the next job connect an idle slave
+        // away from its host, let that slave take the next job of its host.
+        // When all the slaves are busy, the idle ones are always those of the
+        // hosts which just finished a job: skip the job with the lowest serial
+        // only a few times, else it would wait until those hosts are done.
+        if (first.key() != m_skippedSerial) {
+            m_skippedSerial = first.key();
+            m_skipCount = 0;
+        }
+        if (m_skipCount < s_maxSkips) {
+            for (auto it = std::next(first); it != m_queuesBySerial.end(); ++it) {
+                if (m_slaveKeeper.hasIdleSlaveFor(it.value()->hostName())) {
+                    first = it;
+                    ++m_skipCount;
+                    break;
+                }
+            }
+        }
+    }
     if (first != m_queuesBySerial.end()) {
         // pick a job and maintain the queue invariant: lower serials first
         HostQueue *hq = first.value();
@@ -597,15 +834,15 @@ void ProtoQueue::startAJob()
         Q_ASSERT(hq->lowestSerial() == prevLowestSerial);
         // the following assertions should hold due to queueJob(), takeFirstInQueue() and
         // removeJob() being correct
-        Q_ASSERT(hq->runningJobsCount() < m_maxConnectionsPerHost);
+        Q_ASSERT(hq->runningJobsCount() < hq->maxConnections());
         SimpleJob *startingJob = hq->takeFirstInQueue();
-        Q_ASSERT(hq->runningJobsCount() <= m_maxConnectionsPerHost);
+        Q_ASSERT(hq->runningJobsCount() <= hq->maxConnections());
         Q_ASSERT(hq->lowestSerial() != prevLowestSerial);
 
         m_queuesBySerial.erase(first);
         // we've increased hq's runningJobsCount() by calling nexStartingJob()
         // so we need to check again.
-        if (!hq->isQueueEmpty() && hq->runningJobsCount() < m_maxConnectionsPerHost) {
+        if (!hq->isQueueEmpty() && hq->runningJobsCount() < hq->maxConnections()) {
             m_queuesBySerial.insert(hq->lowestSerial(), hq);
         }
 
@@ -622,7 +859,12 @@ void ProtoQueue::startAJob()
         if (!slave) {
             isNewSlave = true;
             slave = createSlave(jobPriv->m_protocol, startingJob, jobPriv->m_url);
+            m_spawnStats.jobsOnNewSlaves++;
+        } else {
+            m_spawnStats.jobsOnWarmSlaves++;
         }
+        // replace the idle slave taken, or prepare for the jobs still queued
+        scheduleSpawn();
 
         if (slave) {
             jobPriv->m_slave = slave;
@@ -717,6 +959,12 @@ public:
     void slotSlaveConnected();
     void slotSlaveError(int error, const QString &errorMsg);
 
+    SlaveSpawnStats spawnStats(const QString &protocol) const
+    {
+        const ProtoQueue *pq = m_protocols.value(protocol, nullptr);
+        return pq ? pq->spawnStats() : SlaveSpawnStats();
+    }
+
     ProtoQueue *protoQ(const QString &protocol, const QString &host)
     {
         ProtoQueue *pq = m_protocols.value(protocol, nullptr);
@@ -736,7 +984,7 @@ public:
                 maxSlavesPerHost = KProtocolInfo::maxSlavesPerHost(protocol);
             }
             // Never allow maxSlavesPerHost to exceed maxSlaves.
-            pq = new ProtoQueue(maxSlaves, qMin(maxSlaves, maxSlavesPerHost));
+            pq = new ProtoQueue(protocol, maxSlaves, qMin(maxSlaves, maxSlavesPerHost));
             m_protocols.insert(protocol, pq);
         }
         return pq;
@@ -770,6 +1018,11 @@ Scheduler *scheduler()
     return schedulerPrivate()->q;
 }
 
+SlaveSpawnStats KIO::slaveSpawnStats(const QString &protocol)
+{
+    return schedulerPrivate()->spawnStats(protocol);
+}
+
 //static
 Slave *heldSlaveForJob(SimpleJob *job)
 {
@@ -932,6 +1185,8 @@ void SchedulerPrivate::slotReparseSlaveConfiguration(const QString &proto, const
     }
 
     for (; it != endIt; ++it) {
+        it.value()->setWarmSlaves(warmSlavesFor(it.key(), KProtocolInfo::maxSlaves(it.key())));
+        it.value()->reparseConnectionLimits();
         const QList<KIO::Slave *> list = it.value()->allSlaves();
         for (Slave *slave : list) {
             slave->send(CMD_REPARSECONFIGURATION);
@@ -7,8 +7,11 @@
 
 #ifndef SCHEDULER_P_H
 #define SCHEDULER_P_H
+#include <QElapsedTimer>
 #include <QSet>
 #include <QTimer>
+#include "hostconnectionlimit_p.h"
+#include "slavespawnstats_p.h"
 // #define SCHEDULER_DEBUG
 
 namespace KIO
@@ -30,6 +33,19 @@ public:
     // remove all slaves from keeper
     void clear();
     QList<KIO::Slave *> allSlaves() const;
+    int idleSlavesCount() const
+    {
+        return m_idleSlaves.count();
+    }
+    bool hasIdleSlaveFor(const QString &host) const
+    {
+        return m_idleSlaves.contains(host);
+    }
+    // keep that many idle slaves alive, even when they're idle for long
+    void setMinIdleSlaves(int count)
+    {
+        m_minIdleSlaves = count;
+    }
 
 private:
     void scheduleGrimReaper();
@@ -40,8 +56,11 @@ private Q_SLOTS:
 private:
     QMultiHash<QString, KIO::Slave *> m_idleSlaves;
     QTimer m_grimTimer;
+    int m_minIdleSlaves = 0;
 };
 
+// The jobs of one host. The number of jobs it runs at once adapts to how
+// the host copes with them, see HostConnectionLimit.
 class HostQueue
 {
 public:
@@ -51,6 +70,10 @@ public:
     {
         return m_queuedJobs.isEmpty();
     }
+    int queuedJobsCount() const
+    {
+        return m_queuedJobs.count();
+    }
     bool isEmpty() const
     {
         return m_queuedJobs.isEmpty() && m_runningJobs.isEmpty();
@@ -62,7 +85,7 @@ public:
 #ifdef SCHEDULER_DEBUG
     QList<KIO::SimpleJob *> runningJobs() const
     {
-        return QList<KIO::SimpleJob *>(m_runningJobs.cbegin(), m_runningJobs.cend());
+        return m_runningJobs.keys();
     }
 #endif
     bool isJobRunning(KIO::SimpleJob *job) const
@@ -72,12 +95,36 @@ public:
 
     void queueJob(KIO::SimpleJob *job);
     KIO::SimpleJob *takeFirstInQueue();
-    bool removeJob(KIO::SimpleJob *job);
+    // @p runMsecs is set to how long the job ran, or -1 if it was only queued
+    bool removeJob(KIO::SimpleJob *job, qint64 *runMsecs = nullptr);
+
+    void setHostName(const QString &host)
+    {
+        m_hostName = host;
+    }
+    QString hostName() const
+    {
+        return m_hostName;
+    }
+    // owned by the ProtoQueue, which keeps it after this queue is gone
+    void setConnectionLimit(HostConnectionLimit *limit)
+    {
+        m_limit = limit;
+    }
+    // how many jobs may run at once now
+    int maxConnections() const
+    {
+        return m_limit->maxConnections();
+    }
+    // lets the limit adapt to how long the job took
+    void jobDone(int command, qint64 msecs, qint64 bytes, bool failed);
 
     QList<KIO::Slave *> allSlaves() const;
 private:
+    QString m_hostName;
     QMap<int, KIO::SimpleJob *> m_queuedJobs;
-    QSet<KIO::SimpleJob *> m_runningJobs;
+    QHash<KIO::SimpleJob *, QElapsedTimer> m_runningJobs;
+    HostConnectionLimit *m_limit = nullptr;
 };
 
 struct PerSlaveQueue {
@@ -148,7 +195,7 @@ class ProtoQueue : public QObject
 {
     Q_OBJECT
 public:
-    ProtoQueue(int maxSlaves, int maxSlavesPerHost);
+    ProtoQueue(const QString &protocol, int maxSlaves, int maxSlavesPerHost);
     ~ProtoQueue();
 
     void queueJob(KIO::SimpleJob *job);
@@ -157,21 +204,47 @@ public:
     KIO::Slave *createSlave(const QString &protocol, KIO::SimpleJob *job, const QUrl &url);
     bool removeSlave(KIO::Slave *slave);
     QList<KIO::Slave *> allSlaves() const;
+    // idle slaves to keep ready for new jobs, see warmSlavesFor()
+    void setWarmSlaves(int count);
+    // applies the configured connection limits again
+    void reparseConnectionLimits();
+    const SlaveSpawnStats &spawnStats() const
+    {
+        return m_spawnStats;
+    }
     ConnectedSlaveQueue m_connectedSlaveQueue;
 
 private Q_SLOTS:
     // start max one (non-connected) job and return
     void startAJob();
+    // create max one idle slave ahead of demand and return
+    void spawnASlave();
 
 private:
+    void scheduleSpawn();
+    HostQueue &hostQueue(const QString &host);
+    HostConnectionLimit &connectionLimit(const QString &host);
+    void applyConnectionLimits(const QString &host, HostConnectionLimit *limit) const;
+    void expireConnectionLimits();
+
     SerialPicker m_serialPicker;
     QTimer m_startJobTimer;
+    QTimer m_spawnTimer;
+    QString m_protocol;
     QMap<int, HostQueue *> m_queuesBySerial;
     QHash<QString, HostQueue> m_queuesByHostname;
+    // outlive the host queues, see s_connectionLimitLifetime
+    QHash<QString, HostConnectionLimit> m_connectionLimits;
     SlaveKeeper m_slaveKeeper;
     int m_maxConnectionsPerHost;
     int m_maxConnectionsTotal;
     int m_runningJobsCount;
+    int m_warmSlaves;
+    // the lowest serial when a job of another host got its idle slave
+    int m_skippedSerial;
+    int m_skipCount;
+    // to tell how much the warm slaves save
+    SlaveSpawnStats m_spawnStats;
 };
 
 } // namespace KIO
@@ -33,6 +33,7 @@
 #include <config-kiocore.h> // CMAKE_INSTALL_FULL_LIBEXECDIR_KF5
 
 #include "slaveinterface_p.h"
+#include "slavethread_p.h"
 #include "kiocoredebug.h"
 
 using namespace KIO;
@@ -113,7 +114,7 @@ namespace KIO
 class SlavePrivate: public SlaveInterfacePrivate
 {
 public:
-    explicit SlavePrivate(const QString &protocol) :
+    explicit SlavePrivate(const QString &protocol, bool inThread = false) :
         m_protocol(protocol),
         m_slaveProtocol(protocol),
         slaveconnserver(new KIO::ConnectionServer),
@@ -122,10 +123,15 @@ public:
         m_port(0),
         contacted(false),
         dead(false),
+        m_inThread(inThread),
         m_refCount(1)
     {
         contact_started.start();
-        slaveconnserver->listenForRemote();
+        if (m_inThread) {
+            slaveconnserver->listenInProcess();
+        } else {
+            slaveconnserver->listenForRemote();
+        }
         if (!slaveconnserver->isListening()) {
             qCWarning(KIO_CORE) << "KIO Connection server not listening, could not connect";
         }
@@ -146,6 +152,7 @@ public:
     quint16 m_port;
     bool contacted;
     bool dead;
+    bool m_inThread; // the slave runs in a SlaveThread, m_pid is 0
     QElapsedTimer contact_started;
     QElapsedTimer m_idleSince;
     int m_refCount;
@@ -160,6 +167,7 @@ void Slave::accept()
     d->slaveconnserver = nullptr;
 
     connect(d->connection, &Connection::readyRead, this, &Slave::gotInput);
+    emit slaveConnected(this);
 }
 
 void Slave::timeout()
@@ -201,7 +209,12 @@ void Slave::timeout()
 }
 
 Slave::Slave(const QString &protocol, QObject *parent)
-    : SlaveInterface(*new SlavePrivate(protocol), parent)
+    : Slave(*new SlavePrivate(protocol), parent)
+{
+}
+
+Slave::Slave(SlavePrivate &dd, QObject *parent)
+    : SlaveInterface(dd, parent)
 {
     Q_D(Slave);
     d->slaveconnserver->setParent(this);
@@ -417,9 +430,18 @@ void Slave::kill()
     if (d->m_pid) {
         KIOPrivate::sendTerminateSignal(d->m_pid);
         d->m_pid = 0;
+    } else if (d->m_inThread) {
+        // Makes the slave leave its dispatch loop, and its thread finish
+        d->connection->close();
     }
 }
 
+bool Slave::isInThread() const
+{
+    Q_D(const Slave);
+    return d->m_inThread;
+}
+
 void Slave::setHost(const QString &host, quint16 port,
                     const QString &user, const QString &passwd)
 {
@@ -448,7 +470,10 @@ void Slave::setConfig(const MetaData &config)
     Q_D(Slave);
     QByteArray data;
     QDataStream stream(&data, QIODevice::WriteOnly);
-    stream << config;
+    MetaData slaveConfig = config;
+    // Tell the slave we can decode MSG_LIST_ENTRIES_V2
+    slaveConfig.insert(QStringLiteral("CompactListEntries"), QStringLiteral("true"));
+    stream << slaveConfig;
     d->connection->send(CMD_CONFIG, data);
 }
 
@@ -542,6 +567,24 @@ Slave *Slave::createSlave(const QString &protocol, const QUrl &url, int &error,
     return slave;
 }
 
+Slave *Slave::createThreadSlave(const QString &protocol)
+{
+    SlaveThread::Factory factory = SlaveThread::factory(protocol);
+    if (!factory) {
+        return nullptr;
+    }
+    // The slave and the application talk through an InProcessPipe
+    Slave *slave = new Slave(*new SlavePrivate(protocol, true));
+    const QUrl slaveAddress = slave->d_func()->slaveconnserver->address();
+    if (slaveAddress.isEmpty()) {
+        delete slave;
+        return nullptr;
+    }
+    SlaveThread *thread = new SlaveThread(factory, protocol, slaveAddress.toString());
+    thread->start();
+    return slave;
+}
+
 Slave *Slave::holdSlave(const QString &protocol, const QUrl &url)
 {
     //qDebug() << "holdSlave" << protocol << "for" << url;
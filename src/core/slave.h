@@ -146,6 +146,16 @@ private:
     void setPID(qint64);
     qint64 slave_pid();
 
+    /**
+     * Creates a slave running in a thread of the application, if the
+     * slave plugin of @p protocol supports it.
+     *
+     * @return 0 if the slave can only run in its own process
+     */
+    static Slave *createThreadSlave(const QString &protocol);
+    bool isInThread() const;
+    Slave(SlavePrivate &dd, QObject *parent = nullptr);
+
     void setJob(KIO::SimpleJob *job);
     KIO::SimpleJob *job() const;
 
@@ -226,6 +236,11 @@ public Q_SLOTS:
 
 Q_SIGNALS:
     void slaveDied(KIO::Slave *slave);
+    /**
+     * Emitted when the slave, just started, connected back to the application.
+     * @since 5.78
+     */
+    void slaveConnected(KIO::Slave *slave);
 
 private:
     Q_DECLARE_PRIVATE(Slave)
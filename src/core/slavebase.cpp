@@ -38,10 +38,13 @@
 #include "kioglobal_p.h"
 #include "connection_p.h"
 #include "commands_p.h"
+#include "copytree_p.h"
 #include "ioslave_defaults.h"
 #include "slaveinterface.h"
+#include "udsentrylistcodec_p.h"
 #include "kpasswdserverclient.h"
 #include "kiocoredebug.h"
+#include "slavethread_p.h"
 
 #ifdef Q_OS_UNIX
 #include <KAuth>
@@ -92,10 +95,14 @@ public:
     }
 
     UDSEntryList pendingListEntries;
+    UDSEntryListEncoder listEncoder;
+    bool compactListEntries = false;
     QElapsedTimer m_timeSinceLastBatch;
     Connection appConnection;
     QString poolSocket;
     bool isConnectedToApp;
+    // Running in a SlaveThread of the application, rather than in its own process
+    bool inThread = false;
 
     QString slaveid;
     bool resume: 1;
@@ -249,23 +256,28 @@ SlaveBase::SlaveBase(const QByteArray &protocol,
 {
     Q_ASSERT(!app_socket.isEmpty());
     d->poolSocket = QFile::decodeName(pool_socket);
-    s_protocol = protocol.data();
+    d->inThread = qobject_cast<SlaveThread *>(QThread::currentThread()) != nullptr;
 
-    KCrash::initialize();
+    // The process, its crash handler and its signals belong to the application
+    if (!d->inThread) {
+        s_protocol = protocol.data();
+
+        KCrash::initialize();
 
 #ifdef Q_OS_UNIX
-    struct sigaction act;
-    act.sa_handler = sigpipe_handler;
-    sigemptyset(&act.sa_mask);
-    act.sa_flags = 0;
-    sigaction(SIGPIPE, &act, nullptr);
-
-    ::signal(SIGINT, &genericsig_handler);
-    ::signal(SIGQUIT, &genericsig_handler);
-    ::signal(SIGTERM, &genericsig_handler);
+        struct sigaction act;
+        act.sa_handler = sigpipe_handler;
+        sigemptyset(&act.sa_mask);
+        act.sa_flags = 0;
+        sigaction(SIGPIPE, &act, nullptr);
+
+        ::signal(SIGINT, &genericsig_handler);
+        ::signal(SIGQUIT, &genericsig_handler);
+        ::signal(SIGTERM, &genericsig_handler);
 #endif
 
-    globalSlave = this;
+        globalSlave = this;
+    }
 
     d->isConnectedToApp = true;
 
@@ -290,8 +302,11 @@ SlaveBase::~SlaveBase()
     delete d->configGroup;
     delete d->config;
     delete d->remotefile;
+    const bool inThread = d->inThread;
     delete d;
-    s_protocol = "";
+    if (!inThread) {
+        s_protocol = "";
+    }
 }
 
 void SlaveBase::dispatchLoop()
@@ -721,6 +736,12 @@ void SlaveBase::mimeType(const QString &_type)
 void SlaveBase::exit()
 {
     d->exit_loop = true;
+    if (d->inThread) {
+        // Only leave dispatchLoop(), the application keeps running;
+        // the kill flag stops lengthy operations checking wasKilled()
+        d->wasKilled = true;
+        return;
+    }
     // Using ::exit() here is too much (crashes in qdbus's qglobalstatic object),
     // so let's cleanly exit dispatchLoop() instead.
     // Update: we do need to call exit(), otherwise a long download (get()) would
@@ -816,6 +837,11 @@ void SlaveBase::listEntry(const UDSEntry &entry)
 
 void SlaveBase::listEntries(const UDSEntryList &list)
 {
+    if (d->compactListEntries) {
+        send(MSG_LIST_ENTRIES_V2, d->listEncoder.encode(list));
+        return;
+    }
+
     QByteArray data;
     QDataStream stream(&data, QIODevice::WriteOnly);
 
@@ -1161,6 +1187,9 @@ void SlaveBase::dispatch(int command, const QByteArray &data)
         d->appConnection.send(MSG_SLAVE_ACK);
         disconnectSlave();
         d->isConnectedToApp = true;
+        // Until the new application tells us otherwise in its config
+        d->compactListEntries = false;
+        d->listEncoder.reset();
         connectSlave(app_socket);
         virtual_hook(AppConnectionMade, nullptr);
     } break;
@@ -1183,6 +1212,8 @@ void SlaveBase::dispatch(int command, const QByteArray &data)
     } break;
     case CMD_CONFIG: {
         stream >> d->configData;
+        d->compactListEntries = d->configData.value(QStringLiteral("CompactListEntries")) == QLatin1String("true");
+        d->listEncoder.reset();
         d->rebuildConfig();
         delete d->remotefile;
         d->remotefile = nullptr;
@@ -1359,6 +1390,15 @@ void SlaveBase::dispatch(int command, const QByteArray &data)
         d->verifyState("fileSystemFreeSpace()");
         d->m_state = d->Idle;
     } break;
+    case CMD_COPY_TREE: {
+        CopyTreeArgs args;
+        stream >> args.src >> args.dest;
+
+        d->m_state = d->InsideMethod;
+        virtual_hook(CopyTree, &args);
+        d->verifyState("copyTree()");
+        d->m_state = d->Idle;
+    } break;
     default: {
         // Some command we don't understand.
         // Just ignore it, it may come from some future version of KIO.
@@ -1476,6 +1516,13 @@ void SlaveBase::setKillFlag()
 
 void SlaveBase::send(int cmd, const QByteArray &arr)
 {
+    if (d->inThread) {
+        // slaveWriteError is shared by the whole process
+        if (!d->appConnection.send(cmd, arr)) {
+            exit();
+        }
+        return;
+    }
     slaveWriteError = false;
     if (!d->appConnection.send(cmd, arr))
         // Note that slaveWriteError can also be set by sigpipe_handler
@@ -1498,6 +1545,9 @@ void SlaveBase::virtual_hook(int id, void *data)
     case Truncate: {
         error(ERR_UNSUPPORTED_ACTION, unsupportedActionErrorString(protocolName(), CMD_TRUNCATE));
     } break;
+    case CopyTree: {
+        error(ERR_UNSUPPORTED_ACTION, unsupportedActionErrorString(protocolName(), CMD_COPY_TREE));
+    } break;
     }
 }
 
@@ -1035,6 +1035,7 @@ protected:
         AppConnectionMade = 0,
         GetFileSystemFreeSpace = 1,   // KF6 TODO: Turn into a virtual method
         Truncate = 2, // KF6 TODO: Turn into a virtual method
+        CopyTree = 3, // KF6 TODO: Turn into a virtual method, data is a KIO::CopyTreeArgs
     };
     virtual void virtual_hook(int id, void *data);
 
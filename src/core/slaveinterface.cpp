@@ -10,6 +10,7 @@
 #include "usernotificationhandler_p.h"
 
 #include "slavebase.h"
+#include "slave.h"
 #include "connection_p.h"
 #include "commands_p.h"
 #include "hostinfo.h"
@@ -165,6 +166,20 @@ bool SlaveInterface::dispatch(int _cmd, const QByteArray &rawdata)
         emit listEntries(list);
         break;
     }
+    case MSG_LIST_ENTRIES_V2: {
+        UDSEntryList list;
+        if (!d->listDecoder.decode(data, list)) {
+            qCWarning(KIO_CORE) << "Got an invalid list of entries from the slave";
+            // The decoder rejects the next batches until the slave starts a new
+            // dictionary, which it does when it gets its config again
+            if (Slave *slave = qobject_cast<Slave *>(this)) {
+                slave->resetHost();
+            }
+            break;
+        }
+        emit listEntries(list);
+        break;
+    }
     case MSG_RESUME: { // From the put job
         d->offset = readFilesize_t(stream);
         emit canResume(d->offset);
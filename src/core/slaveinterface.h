@@ -88,7 +88,8 @@ enum Message {
     MSG_WRITTEN,
     MSG_HOST_INFO_REQ,
     MSG_PRIVILEGE_EXEC,
-    MSG_SLAVE_STATUS_V2
+    MSG_SLAVE_STATUS_V2,
+    MSG_LIST_ENTRIES_V2 ///< @since 5.78. Compact encoding of MSG_LIST_ENTRIES
     // add new ones here once a release is done, to avoid breaking binary compatibility
 };
 
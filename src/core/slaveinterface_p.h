@@ -15,6 +15,7 @@
 
 #include "global.h"
 #include "connection_p.h"
+#include "udsentrylistcodec_p.h"
 #include <QTimer>
 #include <QHostInfo>
 
@@ -54,6 +55,9 @@ public:
     uint nums;
     bool slave_calcs_speed;
 
+    // Keeps the string dictionary shared with the slave's encoder
+    UDSEntryListDecoder listDecoder;
+
     void slotHostInfo(const QHostInfo &info);
 };
 
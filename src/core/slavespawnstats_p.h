@@ -0,0 +1,42 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-only
+*/
+
+#ifndef SLAVESPAWNSTATS_P_H
+#define SLAVESPAWNSTATS_P_H
+
+#include <QString>
+
+#include <kiocore_export.h>
+
+namespace KIO
+{
+
+/**
+ * @internal
+ * How long the slaves of a protocol took to start, and how many jobs got
+ * a warm slave (see the [Warm Slaves] group of kioslaverc) rather than
+ * one started for them.
+ */
+struct SlaveSpawnStats {
+    int startedSlaves = 0;
+    int connectedSlaves = 0;
+    // from the creation of the slaves until they connected back
+    qint64 connectMsecs = 0;
+    int jobsOnWarmSlaves = 0;
+    int jobsOnNewSlaves = 0;
+};
+
+/**
+ * @internal
+ * @return the statistics of the scheduler of the current thread for
+ * @p protocol, exported for the benchmarks
+ */
+KIOCORE_EXPORT SlaveSpawnStats slaveSpawnStats(const QString &protocol);
+
+}
+
+#endif
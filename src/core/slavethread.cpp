@@ -0,0 +1,70 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "slavethread_p.h"
+#include "slavebase.h"
+#include "kiocoredebug.h"
+
+#include <QFile>
+#include <QHash>
+#include <QLibrary>
+#include <QMutex>
+
+#include <KPluginLoader>
+#include <kprotocolinfo.h>
+
+using namespace KIO;
+
+SlaveThread::Factory SlaveThread::factory(const QString &protocol)
+{
+    // The plugins stay loaded, a later slave thread may need them again
+    static QMutex s_mutex;
+    static QHash<QString, Factory> s_factories;
+
+    QMutexLocker locker(&s_mutex);
+    auto it = s_factories.constFind(protocol);
+    if (it != s_factories.constEnd()) {
+        return it.value();
+    }
+
+    Factory factory = nullptr;
+    const QString name = KProtocolInfo::exec(protocol);
+    const QString libPath = name.isEmpty() ? QString() : KPluginLoader::findPlugin(name);
+    if (!libPath.isEmpty()) {
+        QLibrary lib(libPath);
+        factory = reinterpret_cast<Factory>(lib.resolve("kdecreateslave"));
+        if (!factory && lib.isLoaded()) {
+            lib.unload();
+        }
+    }
+    qCDebug(KIO_CORE) << "slaves for" << protocol << (factory ? "can run in threads" : "need a process");
+    s_factories.insert(protocol, factory);
+    return factory;
+}
+
+SlaveThread::SlaveThread(Factory factory, const QString &protocol, const QString &appSocket)
+    : m_factory(factory),
+      m_protocol(protocol.toLatin1()),
+      m_appSocket(QFile::encodeName(appSocket))
+{
+    setObjectName(QLatin1String("kioslave ") + protocol);
+    connect(this, &QThread::finished, this, &QObject::deleteLater);
+}
+
+SlaveThread::~SlaveThread()
+{
+}
+
+void SlaveThread::run()
+{
+    // No pool socket: once disconnected, the slave is done
+    SlaveBase *slave = m_factory(m_protocol.constData(), "", m_appSocket.constData());
+    if (slave) {
+        slave->dispatchLoop();
+        delete slave;
+    }
+}
@@ -0,0 +1,66 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KIO_SLAVETHREAD_P_H
+#define KIO_SLAVETHREAD_P_H
+
+#include <QByteArray>
+#include <QThread>
+
+namespace KIO
+{
+
+class SlaveBase;
+
+/**
+ * @internal
+ *
+ * Runs a kioslave in a thread of the application instead of in a
+ * kioslave5 process, for the slaves whose plugin exports
+ * @code
+ * extern "C" Q_DECL_EXPORT KIO::SlaveBase *kdecreateslave(const char *protocol,
+ *                                                        const char *pool_socket,
+ *                                                        const char *app_socket);
+ * @endcode
+ * which promises that the slave is thread-safe, doesn't rely on being alone
+ * in its process and creates it without setting up any QCoreApplication.
+ *
+ * The slave talks to its Slave object through a Connection as in a process,
+ * but over an in-process pipe rather than a socket (see
+ * ConnectionServer::listenInProcess()). Its SlaveBase leaves the process-wide
+ * state (signal handlers, crash handler, exit()) alone when it notices that
+ * it runs in this thread.
+ * The thread deletes itself once the slave leaves its dispatch loop, which
+ * happens when the application closes the connection.
+ */
+class SlaveThread : public QThread
+{
+    Q_OBJECT
+public:
+    typedef SlaveBase *(*Factory)(const char *protocol, const char *pool_socket, const char *app_socket);
+
+    /**
+     * @return the factory exported by the slave plugin of @p protocol,
+     * or nullptr if the slave can only run in its own process
+     */
+    static Factory factory(const QString &protocol);
+
+    SlaveThread(Factory factory, const QString &protocol, const QString &appSocket);
+    ~SlaveThread() override;
+
+protected:
+    void run() override;
+
+private:
+    Factory m_factory;
+    QByteArray m_protocol;
+    QByteArray m_appSocket;
+};
+
+}
+
+#endif
@@ -17,6 +17,8 @@
 
 #include <KUser>
 
+#include <algorithm>
+
 using namespace KIO;
 
 //BEGIN UDSEntryPrivate
@@ -49,74 +51,101 @@ public:
     static QString nameOfUdsField(uint field);
 
 private:
-    struct Field
+    // Numbers and strings are kept apart, so that a field only takes the
+    // room its value needs, and both are sorted by field id, so that the
+    // many lookups done by KFileItem and the dir listers are binary searches.
+    struct NumberField
+    {
+        inline NumberField(const uint index, long long value) : m_long(value), m_index(index) {}
+
+        long long m_long;
+        uint m_index;
+    };
+    struct StringField
     {
-        inline Field() {}
-        inline Field(const uint index, const QString &value) : m_str(value), m_index(index) {}
-        inline Field(const uint index, long long value = 0) : m_long(value), m_index(index) {}
+        inline StringField(const uint index, const QString &value) : m_str(value), m_index(index) {}
 
         QString m_str;
-        long long m_long = LLONG_MIN;
-        uint m_index = 0;
+        uint m_index;
     };
-    std::vector<Field> storage;
+
+    template<typename Field>
+    static inline typename std::vector<Field>::const_iterator find(const std::vector<Field> &fields, uint udsField)
+    {
+        auto it = std::lower_bound(fields.cbegin(), fields.cend(), udsField,
+                                   [](const Field &field, uint index) { return field.m_index < index; });
+        if (it != fields.cend() && it->m_index == udsField) {
+            return it;
+        }
+        return fields.cend();
+    }
+    template<typename Field>
+    static inline typename std::vector<Field>::iterator lowerBound(std::vector<Field> &fields, uint udsField)
+    {
+        return std::lower_bound(fields.begin(), fields.end(), udsField,
+                                [](const Field &field, uint index) { return field.m_index < index; });
+    }
+
+    std::vector<NumberField> numbers;
+    std::vector<StringField> strings;
 };
 
 void UDSEntryPrivate::reserve(int size)
 {
-    storage.reserve(size);
+    // Typically about a third of the fields are strings (name, user, group...)
+    // and the rest numbers (size, times, type, access...)
+    const int stringCount = (size + 2) / 3;
+    strings.reserve(stringCount);
+    numbers.reserve(size - stringCount);
 }
 
 void UDSEntryPrivate::insert(uint udsField, const QString &value)
 {
     Q_ASSERT(udsField & KIO::UDSEntry::UDS_STRING);
-    Q_ASSERT(std::find_if(storage.cbegin(), storage.cend(),
-                                [udsField](const Field &entry) {return entry.m_index == udsField;}) == storage.cend());
-    storage.emplace_back(udsField, value);
+    auto it = lowerBound(strings, udsField);
+    Q_ASSERT(it == strings.end() || it->m_index != udsField);
+    strings.emplace(it, udsField, value);
 }
 
 void UDSEntryPrivate::replace(uint udsField, const QString &value)
 {
     Q_ASSERT(udsField & KIO::UDSEntry::UDS_STRING);
-    auto it = std::find_if(storage.begin(), storage.end(),
-                                [udsField](const Field &entry) {return entry.m_index == udsField;});
-    if (it != storage.end()) {
+    auto it = lowerBound(strings, udsField);
+    if (it != strings.end() && it->m_index == udsField) {
         it->m_str = value;
         return;
     }
-    storage.emplace_back(udsField, value);
+    strings.emplace(it, udsField, value);
 }
 
 void UDSEntryPrivate::insert(uint udsField, long long value)
 {
     Q_ASSERT(udsField & KIO::UDSEntry::UDS_NUMBER);
-    Q_ASSERT(std::find_if(storage.cbegin(), storage.cend(),
-                                [udsField](const Field &entry) {return entry.m_index == udsField;}) == storage.cend());
-    storage.emplace_back(udsField, value);
+    auto it = lowerBound(numbers, udsField);
+    Q_ASSERT(it == numbers.end() || it->m_index != udsField);
+    numbers.emplace(it, udsField, value);
 }
 
 void UDSEntryPrivate::replace(uint udsField, long long value)
 {
     Q_ASSERT(udsField & KIO::UDSEntry::UDS_NUMBER);
-    auto it = std::find_if(storage.begin(), storage.end(),
-                                [udsField](const Field &entry) {return entry.m_index == udsField;});
-    if (it != storage.end()) {
+    auto it = lowerBound(numbers, udsField);
+    if (it != numbers.end() && it->m_index == udsField) {
         it->m_long = value;
         return;
     }
-    storage.emplace_back(udsField, value);
+    numbers.emplace(it, udsField, value);
 }
 
 int UDSEntryPrivate::count() const
 {
-    return storage.size();
+    return strings.size() + numbers.size();
 }
 
 QString UDSEntryPrivate::stringValue(uint udsField) const
 {
-    auto it = std::find_if(storage.cbegin(), storage.cend(),
-                                [udsField](const Field &entry) {return entry.m_index == udsField;});
-    if (it != storage.cend()) {
+    auto it = find(strings, udsField);
+    if (it != strings.cend()) {
         return it->m_str;
     }
     return QString();
@@ -124,9 +153,8 @@ QString UDSEntryPrivate::stringValue(uint udsField) const
 
 long long UDSEntryPrivate::numberValue(uint udsField, long long defaultValue) const
 {
-    auto it = std::find_if(storage.cbegin(), storage.cend(),
-                                [udsField](const Field &entry) {return entry.m_index == udsField;});
-    if (it != storage.cend()) {
+    auto it = find(numbers, udsField);
+    if (it != numbers.cend()) {
         return it->m_long;
     }
     return defaultValue;
@@ -135,20 +163,18 @@ long long UDSEntryPrivate::numberValue(uint udsField, long long defaultValue) co
 #if KIOCORE_BUILD_DEPRECATED_SINCE(5, 8)
 QList<uint> UDSEntryPrivate::listFields() const
 {
-    QList<uint> res;
-    res.reserve(storage.size());
-    for (const Field &field : storage) {
-        res.append(field.m_index);
-    }
-    return res;
+    return fields().toList();
 }
 #endif
 
 QVector<uint> UDSEntryPrivate::fields() const
 {
     QVector<uint> res;
-    res.reserve(storage.size());
-    for (const Field &field : storage) {
+    res.reserve(count());
+    for (const StringField &field : strings) {
+        res.append(field.m_index);
+    }
+    for (const NumberField &field : numbers) {
         res.append(field.m_index);
     }
     return res;
@@ -156,31 +182,29 @@ QVector<uint> UDSEntryPrivate::fields() const
 
 bool UDSEntryPrivate::contains(uint udsField) const
 {
-    auto it = std::find_if(storage.cbegin(), storage.cend(),
-                                [udsField](const Field &entry) {return entry.m_index == udsField;});
-    return (it != storage.cend());
+    if (udsField & KIO::UDSEntry::UDS_STRING) {
+        return find(strings, udsField) != strings.cend();
+    }
+    return find(numbers, udsField) != numbers.cend();
 }
 
 void UDSEntryPrivate::clear()
 {
-    storage.clear();
+    strings.clear();
+    numbers.clear();
 }
 
 void UDSEntryPrivate::save(QDataStream &s) const
 {
-    s << static_cast<quint32>(storage.size());
-
-    for (const Field &field : storage) {
-        uint uds = field.m_index;
-        s << uds;
+    s << static_cast<quint32>(count());
 
-        if (uds & KIO::UDSEntry::UDS_STRING) {
-            s << field.m_str;
-        } else if (uds & KIO::UDSEntry::UDS_NUMBER) {
-            s << field.m_long;
-        } else {
-            Q_ASSERT_X(false, "KIO::UDSEntry", "Found a field with an invalid type");
-        }
+    for (const StringField &field : strings) {
+        s << field.m_index;
+        s << field.m_str;
+    }
+    for (const NumberField &field : numbers) {
+        s << field.m_index;
+        s << field.m_long;
     }
 }
 
@@ -298,15 +322,11 @@ void UDSEntryPrivate::debugUDSEntry(QDebug &stream) const
 {
     QDebugStateSaver saver(stream);
     stream.nospace() << "[";
-    for (const Field &field : storage) {
-        stream << " " << nameOfUdsField(field.m_index) << "=";
-        if (field.m_index & KIO::UDSEntry::UDS_STRING) {
-            stream << field.m_str;
-        } else if (field.m_index & KIO::UDSEntry::UDS_NUMBER) {
-            stream << field.m_long;
-        } else {
-            Q_ASSERT_X(false, "KIO::UDSEntry", "Found a field with an invalid type");
-        }
+    for (const StringField &field : strings) {
+        stream << " " << nameOfUdsField(field.m_index) << "=" << field.m_str;
+    }
+    for (const NumberField &field : numbers) {
+        stream << " " << nameOfUdsField(field.m_index) << "=" << field.m_long;
     }
     stream << " ]";
 }
@@ -0,0 +1,285 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "udsentrylistcodec_p.h"
+
+using namespace KIO;
+
+// Batch layout:
+//   quint8 flags
+//   varint schema count, per schema: varint field count, varint field ids
+//   varint entry count, per entry: varint schema index, then per field:
+//     number: zigzag varint
+//     dictionary string: varint 0 followed by a new string, or 1 + dictionary index
+//     other string: varint UTF-8 length, UTF-8 bytes
+
+static const quint8 s_resetDictionary = 0x1;
+static const int s_maxDictionarySize = 4096;
+
+static bool isDictionaryField(uint field)
+{
+    switch (field) {
+    case UDSEntry::UDS_USER:
+    case UDSEntry::UDS_GROUP:
+    case UDSEntry::UDS_MIME_TYPE:
+    case UDSEntry::UDS_GUESSED_MIME_TYPE:
+    case UDSEntry::UDS_ICON_NAME:
+    case UDSEntry::UDS_ICON_OVERLAY_NAMES:
+    case UDSEntry::UDS_DISPLAY_TYPE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static inline void writeVarint(QByteArray &out, quint64 value)
+{
+    while (value >= 0x80) {
+        out.append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+static inline void writeString(QByteArray &out, const QString &str)
+{
+    const QByteArray utf8 = str.toUtf8();
+    writeVarint(out, utf8.size());
+    out.append(utf8);
+}
+
+namespace {
+class Reader
+{
+public:
+    explicit Reader(const QByteArray &data)
+        : m_pos(data.constData()), m_end(data.constData() + data.size())
+    {
+    }
+
+    bool readVarint(quint64 &value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (m_pos == m_end) {
+                return false;
+            }
+            const quint8 byte = quint8(*m_pos++);
+            value |= quint64(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool readString(QString &str)
+    {
+        quint64 size;
+        if (!readVarint(size) || size > quint64(m_end - m_pos)) {
+            return false;
+        }
+        str = QString::fromUtf8(m_pos, int(size));
+        m_pos += size;
+        return true;
+    }
+
+    bool readByte(quint8 &byte)
+    {
+        if (m_pos == m_end) {
+            return false;
+        }
+        byte = quint8(*m_pos++);
+        return true;
+    }
+
+    bool atEnd() const
+    {
+        return m_pos == m_end;
+    }
+
+private:
+    const char *m_pos;
+    const char *m_end;
+};
+}
+
+void UDSEntryListEncoder::reset()
+{
+    m_resetPending = true;
+}
+
+QByteArray UDSEntryListEncoder::encode(const UDSEntryList &list)
+{
+    QByteArray out;
+    out.reserve(list.size() * 48);
+
+    if (m_dictionary.size() > s_maxDictionarySize) {
+        m_resetPending = true;
+    }
+    quint8 flags = 0;
+    if (m_resetPending) {
+        m_dictionary.clear();
+        m_resetPending = false;
+        flags |= s_resetDictionary;
+    }
+    out.append(char(flags));
+
+    QVector<QVector<uint>> schemas;
+    QHash<QVector<uint>, int> schemaIndexes;
+    QVector<int> entrySchemas;
+    entrySchemas.reserve(list.size());
+    for (const UDSEntry &entry : list) {
+        const QVector<uint> fields = entry.fields();
+        auto it = schemaIndexes.constFind(fields);
+        if (it == schemaIndexes.constEnd()) {
+            it = schemaIndexes.insert(fields, schemas.size());
+            schemas.append(fields);
+        }
+        entrySchemas.append(it.value());
+    }
+
+    writeVarint(out, schemas.size());
+    for (const QVector<uint> &fields : qAsConst(schemas)) {
+        writeVarint(out, fields.size());
+        for (uint field : fields) {
+            writeVarint(out, field);
+        }
+    }
+
+    writeVarint(out, list.size());
+    for (int i = 0; i < list.size(); ++i) {
+        const UDSEntry &entry = list.at(i);
+        writeVarint(out, entrySchemas.at(i));
+        const QVector<uint> &fields = schemas.at(entrySchemas.at(i));
+        for (uint field : fields) {
+            if (field & UDSEntry::UDS_STRING) {
+                const QString value = entry.stringValue(field);
+                if (isDictionaryField(field)) {
+                    auto it = m_dictionary.constFind(value);
+                    if (it != m_dictionary.constEnd()) {
+                        writeVarint(out, quint64(it.value()) + 1);
+                        continue;
+                    }
+                    m_dictionary.insert(value, m_dictionary.size());
+                    writeVarint(out, 0);
+                }
+                writeString(out, value);
+            } else {
+                const qint64 value = entry.numberValue(field);
+                // zigzag, so that small negative numbers stay small
+                writeVarint(out, (quint64(value) << 1) ^ quint64(value >> 63));
+            }
+        }
+    }
+    return out;
+}
+
+bool UDSEntryListDecoder::decode(const QByteArray &data, UDSEntryList &list)
+{
+    // Works on copies, committed only once the whole batch was read: a broken
+    // batch must neither add entries nor leave half of its strings in the dictionary
+    QVector<QString> dictionary = m_dictionary;
+    UDSEntryList entries;
+    const bool ok = decode(data, dictionary, entries);
+    if (!ok) {
+        // The encoder added the strings of this batch to its dictionary anyway,
+        // the indexes of the next batches can't be trusted until it starts over
+        m_dictionary.clear();
+        m_resetNeeded = true;
+        return false;
+    }
+    m_dictionary = dictionary;
+    m_resetNeeded = false;
+    list.append(entries);
+    return true;
+}
+
+bool UDSEntryListDecoder::decode(const QByteArray &data, QVector<QString> &dictionary, UDSEntryList &list) const
+{
+    Reader reader(data);
+
+    quint8 flags;
+    if (!reader.readByte(flags)) {
+        return false;
+    }
+    if (flags & s_resetDictionary) {
+        dictionary.clear();
+    } else if (m_resetNeeded) {
+        return false;
+    }
+
+    quint64 schemaCount;
+    if (!reader.readVarint(schemaCount) || schemaCount > quint64(data.size())) {
+        return false;
+    }
+    QVector<QVector<uint>> schemas(int(schemaCount));
+    for (QVector<uint> &fields : schemas) {
+        quint64 fieldCount;
+        if (!reader.readVarint(fieldCount) || fieldCount > quint64(data.size())) {
+            return false;
+        }
+        fields.resize(int(fieldCount));
+        for (uint &field : fields) {
+            quint64 value;
+            if (!reader.readVarint(value)) {
+                return false;
+            }
+            field = uint(value);
+        }
+    }
+
+    quint64 entryCount;
+    if (!reader.readVarint(entryCount) || entryCount > quint64(data.size())) {
+        return false;
+    }
+    list.reserve(list.size() + int(entryCount));
+
+    for (quint64 i = 0; i < entryCount; ++i) {
+        quint64 schemaIndex;
+        if (!reader.readVarint(schemaIndex) || schemaIndex >= schemaCount) {
+            return false;
+        }
+        const QVector<uint> &fields = schemas.at(int(schemaIndex));
+        UDSEntry entry;
+        entry.reserve(fields.size());
+        for (uint field : fields) {
+            if (field & UDSEntry::UDS_STRING) {
+                if (isDictionaryField(field)) {
+                    quint64 index;
+                    if (!reader.readVarint(index)) {
+                        return false;
+                    }
+                    if (index > 0) {
+                        if (index > quint64(dictionary.size())) {
+                            return false;
+                        }
+                        // implicitly shared with all the other entries using it
+                        entry.fastInsert(field, dictionary.at(int(index - 1)));
+                        continue;
+                    }
+                }
+                QString value;
+                if (!reader.readString(value)) {
+                    return false;
+                }
+                if (isDictionaryField(field)) {
+                    dictionary.append(value);
+                }
+                entry.fastInsert(field, value);
+            } else {
+                quint64 value;
+                if (!reader.readVarint(value)) {
+                    return false;
+                }
+                entry.fastInsert(field, static_cast<long long>((value >> 1) ^ (~(value & 1) + 1)));
+            }
+        }
+        list.append(entry);
+    }
+    return reader.atEnd();
+}
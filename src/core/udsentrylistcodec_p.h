@@ -0,0 +1,74 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KIO_UDSENTRYLISTCODEC_P_H
+#define KIO_UDSENTRYLISTCODEC_P_H
+
+#include "udsentry.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+
+namespace KIO
+{
+
+/**
+ * @internal
+ *
+ * Compact encoding of a batch of UDSEntries, sent as MSG_LIST_ENTRIES_V2
+ * to applications announcing support for it (see SlaveBase::listEntries).
+ *
+ * A batch starts with the list of distinct field layouts ("schemas") used
+ * by its entries, each entry then only refers to its schema and carries the
+ * values: numbers as zigzag varints, strings as UTF-8. Strings of fields
+ * that repeat a lot across entries (user, group, MIME type...) go through a
+ * dictionary which lives as long as the connection, so that they are
+ * only sent once.
+ *
+ * Encoder and decoder keep their dictionaries in sync, the encoder tells
+ * the decoder when to drop it (first batch, or when it grew too big).
+ */
+class UDSEntryListEncoder
+{
+public:
+    QByteArray encode(const UDSEntryList &list);
+
+    /**
+     * Starts over with an empty dictionary, e.g. when the slave got a new application.
+     */
+    void reset();
+
+private:
+    QHash<QString, quint32> m_dictionary;
+    bool m_resetPending = true;
+};
+
+class UDSEntryListDecoder
+{
+public:
+    /**
+     * Appends the entries of the batch @p data to @p list.
+     *
+     * Nothing is appended if @p data is not a valid batch, and since the
+     * dictionary of the encoder can't be followed anymore then, the next
+     * batches are rejected until one starts a new dictionary.
+     *
+     * @return false if @p data is not a valid batch
+     */
+    bool decode(const QByteArray &data, UDSEntryList &list);
+
+private:
+    bool decode(const QByteArray &data, QVector<QString> &dictionary, UDSEntryList &list) const;
+
+    QVector<QString> m_dictionary;
+    bool m_resetNeeded = false;
+};
+
+}
+
+#endif
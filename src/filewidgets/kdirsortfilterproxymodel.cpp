@@ -17,6 +17,14 @@
 #include <KSharedConfig>
 
 #include <QCollator>
+#include <QHash>
+#include <QVector>
+#include <QtConcurrentMap>
+
+// Past that, the sort keys of names which aren't shown anymore are dropped
+static const int s_maxSortKeys = 500000;
+// Inserted rows whose sort keys are computed by several threads at once
+static const int s_sortKeysChunkSize = 1000;
 
 class Q_DECL_HIDDEN KDirSortFilterProxyModel::KDirSortFilterProxyModelPrivate
 {
@@ -24,11 +32,17 @@ public:
     KDirSortFilterProxyModelPrivate();
 
     int compare(const QString &, const QString &, Qt::CaseSensitivity caseSensitivity  = Qt::CaseSensitive);
+    QCollatorSortKey sortKey(const QString &string, Qt::CaseSensitivity caseSensitivity);
+    void computeSortKeys(const QStringList &strings, Qt::CaseSensitivity caseSensitivity);
     void slotNaturalSortingChanged();
 
     bool m_sortFoldersFirst;
     bool m_naturalSorting;
     QCollator m_collator;
+    // The collation of a string, computed once rather than at each comparison;
+    // indexed by the case sensitivity
+    QHash<QString, QCollatorSortKey> m_sortKeys[2];
+    QMetaObject::Connection m_rowsInsertedConnection;
 };
 
 KDirSortFilterProxyModel::KDirSortFilterProxyModelPrivate::KDirSortFilterProxyModelPrivate() :
@@ -44,8 +58,7 @@ int KDirSortFilterProxyModel::KDirSortFilterProxyModelPrivate::compare(const QSt
     int result;
 
     if (m_naturalSorting) {
-        m_collator.setCaseSensitivity(caseSensitivity);
-        result = m_collator.compare(a, b);
+        result = sortKey(a, caseSensitivity).compare(sortKey(b, caseSensitivity));
     } else {
         result = QString::compare(a, b, caseSensitivity);
     }
@@ -60,11 +73,74 @@ int KDirSortFilterProxyModel::KDirSortFilterProxyModelPrivate::compare(const QSt
     return QString::compare(a, b, Qt::CaseSensitive);
 }
 
+QCollatorSortKey KDirSortFilterProxyModel::KDirSortFilterProxyModelPrivate::sortKey(const QString &string,
+        Qt::CaseSensitivity caseSensitivity)
+{
+    QHash<QString, QCollatorSortKey> &sortKeys = m_sortKeys[caseSensitivity];
+    auto it = sortKeys.constFind(string);
+    if (it == sortKeys.constEnd()) {
+        if (sortKeys.size() >= s_maxSortKeys) {
+            sortKeys.clear();
+        }
+        m_collator.setCaseSensitivity(caseSensitivity);
+        it = sortKeys.insert(string, m_collator.sortKey(string));
+    }
+    return *it;
+}
+
+// For many strings at once, like the names of a directory being listed
+void KDirSortFilterProxyModel::KDirSortFilterProxyModelPrivate::computeSortKeys(const QStringList &strings,
+        Qt::CaseSensitivity caseSensitivity)
+{
+    struct Chunk {
+        QCollator collator;
+        QStringList strings;
+        QList<QCollatorSortKey> sortKeys;
+    };
+    QHash<QString, QCollatorSortKey> &sortKeys = m_sortKeys[caseSensitivity];
+    QVector<Chunk> chunks;
+    for (const QString &string : strings) {
+        if (sortKeys.contains(string)) {
+            continue;
+        }
+        if (chunks.isEmpty() || chunks.last().strings.count() == s_sortKeysChunkSize) {
+            // QCollator isn't thread-safe, and copies share their data:
+            // a collator of its own for each chunk
+            QCollator collator(m_collator.locale());
+            collator.setNumericMode(m_naturalSorting);
+            collator.setCaseSensitivity(caseSensitivity);
+            chunks.append({collator, QStringList(), QList<QCollatorSortKey>()});
+        }
+        chunks.last().strings.append(string);
+    }
+    if (chunks.count() < 2) {
+        return; // computed on demand, no need for threads
+    }
+
+    QtConcurrent::blockingMap(chunks, [](Chunk &chunk) {
+        chunk.sortKeys.reserve(chunk.strings.count());
+        for (const QString &string : qAsConst(chunk.strings)) {
+            chunk.sortKeys.append(chunk.collator.sortKey(string));
+        }
+    });
+
+    if (sortKeys.size() + strings.count() > s_maxSortKeys) {
+        sortKeys.clear();
+    }
+    for (const Chunk &chunk : qAsConst(chunks)) {
+        for (int i = 0; i < chunk.strings.count(); ++i) {
+            sortKeys.insert(chunk.strings.at(i), chunk.sortKeys.at(i));
+        }
+    }
+}
+
 void KDirSortFilterProxyModel::KDirSortFilterProxyModelPrivate::slotNaturalSortingChanged()
 {
     KConfigGroup g(KSharedConfig::openConfig(), "KDE");
     m_naturalSorting = g.readEntry("NaturalSorting", true);
     m_collator.setNumericMode(m_naturalSorting);
+    m_sortKeys[Qt::CaseInsensitive].clear();
+    m_sortKeys[Qt::CaseSensitive].clear();
 }
 
 KDirSortFilterProxyModel::KDirSortFilterProxyModel(QObject *parent)
@@ -88,6 +164,29 @@ KDirSortFilterProxyModel::~KDirSortFilterProxyModel()
     delete d;
 }
 
+void KDirSortFilterProxyModel::setSourceModel(QAbstractItemModel *model)
+{
+    disconnect(d->m_rowsInsertedConnection);
+    if (model) {
+        // Connected before the sorting of the new rows by the base class,
+        // which then finds the sort keys of their names ready
+        d->m_rowsInsertedConnection = connect(model, &QAbstractItemModel::rowsInserted, this,
+                                              [this, model](const QModelIndex &parent, int first, int last) {
+            if (!d->m_naturalSorting || sortColumn() < 0 || last - first < s_sortKeysChunkSize) {
+                return;
+            }
+            KDirModel *dirModel = static_cast<KDirModel *>(model);
+            QStringList texts;
+            texts.reserve(last - first + 1);
+            for (int row = first; row <= last; ++row) {
+                texts.append(dirModel->itemForIndex(dirModel->index(row, 0, parent)).text());
+            }
+            d->computeSortKeys(texts, sortCaseSensitivity());
+        });
+    }
+    KCategorizedSortFilterProxyModel::setSourceModel(model);
+}
+
 bool KDirSortFilterProxyModel::hasChildren(const QModelIndex &parent) const
 {
     const QModelIndex sourceParent = mapToSource(parent);
@@ -46,6 +46,12 @@ public:
     explicit KDirSortFilterProxyModel(QObject *parent = nullptr);
     ~KDirSortFilterProxyModel() override;
 
+    /**
+     * Reimplemented from QAbstractProxyModel.
+     * @since 5.78
+     */
+    void setSourceModel(QAbstractItemModel *model) override;
+
     /** Reimplemented from QAbstractItemModel. Returns true for directories. */
     bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
 
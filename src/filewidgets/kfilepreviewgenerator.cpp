@@ -13,6 +13,7 @@
 #include <kfileitem.h>
 #include <KIconEffect>
 #include <kio/previewjob.h>
+#include <KIO/DetermineMimeTypesJob>
 #include <kio/paste.h>
 #include <kdirlister.h>
 #include <kdirmodel.h>
@@ -31,9 +32,13 @@
 #include <QPainter>
 #include <QPixmap>
 #include <QPointer>
+#include <QSet>
 #include <QTimer>
 #include <QIcon>
 
+#include <algorithm>
+#include <climits>
+
 #if HAVE_X11 && HAVE_XRENDER
 #  include <QX11Info>
 #  include <X11/Xlib.h>
@@ -215,16 +220,29 @@ public:
     void resumeIconUpdates();
 
     /**
-     * Starts the resolving of the MIME types from
-     * the m_pendingItems queue.
+     * Starts the resolving of the MIME types of the items \a items
+     * from the m_pendingItems queue, in the background.
+     */
+    void startMimeTypeResolving(const KFileItemList &items);
+
+    /**
+     * Is invoked when a MIME type job resolved the MIME types of
+     * the items \a items. The items are moved from the m_pendingItems
+     * queue to the m_resolvedMimeTypes queue.
      */
-    void startMimeTypeResolving();
+    void slotMimeTypesDetermined(const KFileItemList &items);
 
     /**
-     * Resolves the MIME type for exactly one item of the
-     * m_pendingItems queue.
+     * Is invoked when a MIME type job has been finished and
+     * removes the job from the m_mimeTypeJobs list.
      */
-    void resolveMimeType();
+    void slotMimeTypeJobFinished(KJob *job);
+
+    /** Kills all ongoing MIME type jobs. */
+    void killMimeTypeJobs();
+
+    /** Removes the items \a items from the m_pendingItems queue. */
+    void removePendingItems(const KFileItemList &items);
 
     /**
      * Returns true, if the item \a item has been cut into
@@ -267,10 +285,11 @@ public:
     void killPreviewJobs();
 
     /**
-     * Orders the items \a items in a way that the visible items
-     * are moved to the front of the list. When passing this
-     * list to a preview job, the visible items will get generated
-     * first.
+     * Orders the items \a items by their distance to the visible area,
+     * so that the visible items are at the front of the list, followed
+     * by the ones which are the closest to be scrolled into view. When
+     * passing this list to a preview job, the visible items will get
+     * generated first.
      */
     void orderItems(KFileItemList &items);
 
@@ -291,6 +310,18 @@ public:
      */
     void rowsAboutToBeRemoved(const QModelIndex &parent, int start, int end);
 
+    /**
+     * Updates the icons of the new items of the dir lister,
+     * unless the model inserts them incrementally.
+     */
+    void newItems(const KFileItemList &items);
+
+    /**
+     * Updates the icons of the items inserted into the model,
+     * if it inserts the new items incrementally.
+     */
+    void rowsInserted(const QModelIndex &parent, int start, int end);
+
     /** Remembers the pixmap for an item specified by an URL. */
     struct ItemInfo {
         QUrl url;
@@ -350,6 +381,9 @@ public:
     QTimer *m_iconUpdateTimer;
     QTimer *m_scrollAreaTimer;
     QList<KJob *> m_previewJobs;
+    QList<KJob *> m_mimeTypeJobs;
+    // Preview size of the jobs in m_previewJobs which new items get appended to
+    QHash<KJob *, QSize> m_previewJobSizes;
     QPointer<KDirModel> m_dirModel;
     QAbstractProxyModel *m_proxyModel;
 
@@ -410,6 +444,7 @@ KFilePreviewGenerator::Private::Private(KFilePreviewGenerator *parent,
     m_iconUpdateTimer(nullptr),
     m_scrollAreaTimer(nullptr),
     m_previewJobs(),
+    m_mimeTypeJobs(),
     m_proxyModel(nullptr),
     m_cutItemsCache(),
     m_previews(),
@@ -436,8 +471,12 @@ KFilePreviewGenerator::Private::Private(KFilePreviewGenerator *parent,
         m_previewShown = false;
     } else {
         KDirModel *dirModel = m_dirModel.data();
+        // The model may insert the new items a chunk at a time, later than
+        // newItems() (see KDirModel::setIncrementalInsertion())
         connect(dirModel->dirLister(), SIGNAL(newItems(KFileItemList)),
-                q, SLOT(updateIcons(KFileItemList)));
+                q, SLOT(newItems(KFileItemList)));
+        connect(dirModel, SIGNAL(rowsInserted(QModelIndex,int,int)),
+                q, SLOT(rowsInserted(QModelIndex,int,int)));
         connect(dirModel, SIGNAL(dataChanged(QModelIndex,QModelIndex)),
                 q, SLOT(updateIcons(QModelIndex,QModelIndex)));
         connect(dirModel, SIGNAL(needSequenceIcon(QModelIndex,int)),
@@ -539,7 +578,7 @@ void KFilePreviewGenerator::Private::updateIcons(const KFileItemList &items)
     if (m_previewShown) {
         createPreviews(orderedItems);
     } else {
-        startMimeTypeResolving();
+        startMimeTypeResolving(orderedItems);
     }
 }
 
@@ -668,6 +707,7 @@ void KFilePreviewGenerator::Private::slotPreviewJobFinished(KJob *job)
 {
     const int index = m_previewJobs.indexOf(job);
     m_previewJobs.removeAt(index);
+    m_previewJobSizes.remove(job);
 
     if (m_previewJobs.isEmpty()) {
         for (const KFileItem &item : qAsConst(m_pendingItems)) {
@@ -759,11 +799,13 @@ void KFilePreviewGenerator::Private::dispatchIconUpdateQueue()
             m_previews.clear();
         }
 
-        // dispatch MIME type queue
+        // dispatch MIME type queue, as ranges of rows rather than item by item
+        QModelIndexList changedIndexes;
+        changedIndexes.reserve(m_resolvedMimeTypes.count());
         for (const KFileItem &item : qAsConst(m_resolvedMimeTypes)) {
-            const QModelIndex idx = dirModel->indexForItem(item);
-            dirModel->itemChanged(idx);
+            changedIndexes.append(dirModel->indexForItem(item));
         }
+        dirModel->itemsChanged(changedIndexes);
         m_resolvedMimeTypes.clear();
 
         m_pendingVisibleIconUpdates -= count;
@@ -787,6 +829,9 @@ void KFilePreviewGenerator::Private::pauseIconUpdates()
         Q_ASSERT(job != nullptr);
         job->suspend();
     }
+    for (KJob *job : qAsConst(m_mimeTypeJobs)) {
+        job->suspend();
+    }
     m_scrollAreaTimer->start();
 }
 
@@ -819,67 +864,120 @@ void KFilePreviewGenerator::Private::resumeIconUpdates()
         KFileItemList orderedItems = m_pendingItems;
         orderItems(orderedItems);
 
-        // Kill all suspended preview jobs. Usually when a preview job
-        // has been finished, slotPreviewJobFinished() clears all item queues.
-        // This is not wanted in this case, as a new job is created afterwards
-        // for m_pendingItems.
-        m_clearItemQueues = false;
-        killPreviewJobs();
-        m_clearItemQueues = true;
-
-        createPreviews(orderedItems);
+        if (m_previewJobs.isEmpty()) {
+            createPreviews(orderedItems);
+        } else {
+            // The suspended preview jobs still hold m_pendingItems: let them
+            // continue with the items which are now the closest to the view,
+            // instead of restarting them.
+            const QList<QUrl> urls = orderedItems.urlList();
+            for (KJob *job : qAsConst(m_previewJobs)) {
+                static_cast<KIO::PreviewJob *>(job)->prioritizeItems(urls);
+                job->resume();
+            }
+            m_iconUpdateTimer->start();
+        }
     } else {
+        // Restart the resolving with the items which are
+        // now the closest to the visible area first
+        killMimeTypeJobs();
         orderItems(m_pendingItems);
-        startMimeTypeResolving();
+        startMimeTypeResolving(m_pendingItems);
     }
 }
 
-void KFilePreviewGenerator::Private::startMimeTypeResolving()
+void KFilePreviewGenerator::Private::startMimeTypeResolving(const KFileItemList &items)
 {
-    resolveMimeType();
-    m_iconUpdateTimer->start();
-}
-
-void KFilePreviewGenerator::Private::resolveMimeType()
-{
-    if (m_pendingItems.isEmpty()) {
-        return;
-    }
-
-    // resolve at least one MIME type
-    bool resolved = false;
-    do {
-        KFileItem item = m_pendingItems.takeFirst();
+    KFileItemList unknownItems;
+    KFileItemList knownItems;
+    for (const KFileItem &item : items) {
         if (item.isMimeTypeKnown()) {
+            knownItems.append(item);
             if (m_pendingVisibleIconUpdates > 0) {
                 // The item is visible and the MIME type already known.
                 // Decrease the update counter for dispatchIconUpdateQueue():
                 --m_pendingVisibleIconUpdates;
             }
         } else {
-            // The MIME type is unknown and must get resolved. The
-            // directory model is not informed yet, as a single update
-            // would be very expensive. Instead the item is remembered in
-            // m_resolvedMimeTypes and will be dispatched later
-            // by dispatchIconUpdateQueue().
-            item.determineMimeType();
-            m_resolvedMimeTypes.append(item);
-            resolved = true;
+            unknownItems.append(item);
         }
-    } while (!resolved && !m_pendingItems.isEmpty());
+    }
+    removePendingItems(knownItems);
+
+    if (unknownItems.isEmpty()) {
+        if (m_mimeTypeJobs.isEmpty()) {
+            dispatchIconUpdateQueue();
+        }
+        return;
+    }
+
+    // The MIME types are resolved in the background. The directory
+    // model is not informed for each item, as a single update would
+    // be very expensive. Instead the items are remembered in
+    // m_resolvedMimeTypes and will be dispatched later
+    // by dispatchIconUpdateQueue().
+    KIO::DetermineMimeTypesJob *job = new KIO::DetermineMimeTypesJob(unknownItems);
+    connect(job, SIGNAL(mimeTypesDetermined(KFileItemList)),
+            q, SLOT(slotMimeTypesDetermined(KFileItemList)));
+    connect(job, SIGNAL(finished(KJob*)),
+            q, SLOT(slotMimeTypeJobFinished(KJob*)));
+    m_mimeTypeJobs.append(job);
+    if (m_iconUpdatesPaused) {
+        job->suspend();
+    }
+    job->start();
+
+    m_iconUpdateTimer->start();
+}
+
+void KFilePreviewGenerator::Private::slotMimeTypesDetermined(const KFileItemList &items)
+{
+    removePendingItems(items);
+    m_resolvedMimeTypes += items;
+
+    if (!m_iconUpdateTimer->isActive()) {
+        m_iconUpdateTimer->start();
+    }
+}
 
-    if (m_pendingItems.isEmpty()) {
+void KFilePreviewGenerator::Private::slotMimeTypeJobFinished(KJob *job)
+{
+    m_mimeTypeJobs.removeOne(job);
+    if (m_mimeTypeJobs.isEmpty()) {
         // All MIME types have been resolved now. Assure
         // that the directory model gets informed about
         // this, so that an update of the icons is done.
         dispatchIconUpdateQueue();
-    } else if (!m_iconUpdatesPaused) {
-        // assure that the MIME type of the next
-        // item will be resolved asynchronously
-        QMetaObject::invokeMethod(q, "resolveMimeType", Qt::QueuedConnection);
     }
 }
 
+void KFilePreviewGenerator::Private::killMimeTypeJobs()
+{
+    // kill() emits finished(), and slotMimeTypeJobFinished() must neither
+    // modify the list while iterating over it nor dispatch the icon updates
+    QList<KJob *> jobs;
+    jobs.swap(m_mimeTypeJobs);
+    for (KJob *job : qAsConst(jobs)) {
+        job->disconnect(q);
+        job->kill();
+    }
+}
+
+void KFilePreviewGenerator::Private::removePendingItems(const KFileItemList &items)
+{
+    if (items.isEmpty()) {
+        return;
+    }
+    QSet<QUrl> urls;
+    urls.reserve(items.count());
+    for (const KFileItem &item : items) {
+        urls.insert(item.url());
+    }
+    m_pendingItems.erase(std::remove_if(m_pendingItems.begin(), m_pendingItems.end(), [&urls](const KFileItem &item) {
+        return urls.contains(item.url());
+    }), m_pendingItems.end());
+}
+
 bool KFilePreviewGenerator::Private::isCutItem(const KFileItem &item) const
 {
     const QMimeData *mimeData = QApplication::clipboard()->mimeData();
@@ -1043,22 +1141,42 @@ void KFilePreviewGenerator::Private::createPreviews(const KFileItemList &items)
 void KFilePreviewGenerator::Private::startPreviewJob(const KFileItemList &items, int width, int height)
 {
     if (!items.isEmpty()) {
-        KIO::PreviewJob *job = KIO::filePreview(items, QSize(width, height), &m_enabledPlugins);
+        const QSize size(width, height);
 
         // Set the sequence index to the target. We only need to check if items.count() == 1,
         // because requestSequenceIcon(..) creates exactly such a request.
+        int sequenceIndex = 0;
         if (!m_sequenceIndices.isEmpty() && (items.count() == 1)) {
             QMap<QUrl, int>::iterator it = m_sequenceIndices.find(items[0].url());
             if (it != m_sequenceIndices.end()) {
-                job->setSequenceIndex(*it);
+                sequenceIndex = *it;
             }
         }
 
+        if (sequenceIndex == 0) {
+            // Append to a running job of the same size rather than starting
+            // another one, which would compete with it for the thumbnail slaves
+            for (auto it = m_previewJobSizes.constBegin(); it != m_previewJobSizes.constEnd(); ++it) {
+                if (it.value() == size) {
+                    static_cast<KIO::PreviewJob *>(it.key())->addItems(items);
+                    return;
+                }
+            }
+        }
+
+        KIO::PreviewJob *job = KIO::filePreview(items, size, &m_enabledPlugins);
+        if (sequenceIndex != 0) {
+            job->setSequenceIndex(sequenceIndex);
+        }
+
         connect(job, SIGNAL(gotPreview(KFileItem,QPixmap)),
                 q, SLOT(addToPreviewQueue(KFileItem,QPixmap)));
         connect(job, SIGNAL(finished(KJob*)),
                 q, SLOT(slotPreviewJobFinished(KJob*)));
         m_previewJobs.append(job);
+        if (sequenceIndex == 0) {
+            m_previewJobSizes.insert(job, size);
+        }
     }
 }
 
@@ -1068,7 +1186,9 @@ void KFilePreviewGenerator::Private::killPreviewJobs()
         Q_ASSERT(job != nullptr);
         job->kill();
     }
+    killMimeTypeJobs();
     m_previewJobs.clear();
+    m_previewJobSizes.clear();
     m_sequenceIndices.clear();
 
     m_iconUpdateTimer->stop();
@@ -1085,13 +1205,16 @@ void KFilePreviewGenerator::Private::orderItems(KFileItemList &items)
 
     // Order the items in a way that the preview for the visible items
     // is generated first, as this improves the felt performance a lot.
+    // The other items follow by their distance to the visible area, so
+    // that scrolling a bit further finds their previews already done.
     const bool hasProxy = (m_proxyModel != nullptr);
     const int itemCount = items.count();
     const QRect visibleArea = m_viewAdapter->visibleArea();
 
+    QVector<QPair<int, KFileItem> > distances;
+    distances.reserve(itemCount);
     QModelIndex dirIndex;
     QRect itemRect;
-    int insertPos = 0;
     for (int i = 0; i < itemCount; ++i) {
         dirIndex = dirModel->indexForItem(items.at(i)); // O(n) (n = number of rows)
         if (hasProxy) {
@@ -1101,15 +1224,25 @@ void KFilePreviewGenerator::Private::orderItems(KFileItemList &items)
             itemRect = m_viewAdapter->visualRect(dirIndex);
         }
 
+        int distance = 0;
         if (itemRect.intersects(visibleArea)) {
-            // The current item is (at least partly) visible. Move it
-            // to the front of the list, so that the preview is
-            // generated earlier.
-            items.insert(insertPos, items.at(i));
-            items.removeAt(i + 1);
-            ++insertPos;
+            // The current item is (at least partly) visible
             ++m_pendingVisibleIconUpdates;
+        } else if (!itemRect.isValid()) {
+            distance = INT_MAX;
+        } else {
+            const int dx = qMax(0, qMax(visibleArea.left() - itemRect.right(), itemRect.left() - visibleArea.right()));
+            const int dy = qMax(0, qMax(visibleArea.top() - itemRect.bottom(), itemRect.top() - visibleArea.bottom()));
+            distance = dx + dy;
         }
+        distances.append(qMakePair(distance, items.at(i)));
+    }
+
+    std::stable_sort(distances.begin(), distances.end(), [](const QPair<int, KFileItem> &a, const QPair<int, KFileItem> &b) {
+        return a.first < b.first;
+    });
+    for (int i = 0; i < itemCount; ++i) {
+        items[i] = distances.at(i).second;
     }
 }
 
@@ -1186,6 +1319,32 @@ void KFilePreviewGenerator::Private::rowsAboutToBeRemoved(const QModelIndex &par
     }
 }
 
+void KFilePreviewGenerator::Private::newItems(const KFileItemList &items)
+{
+    KDirModel *dirModel = m_dirModel.data();
+    if (dirModel && !dirModel->incrementalInsertion()) {
+        updateIcons(items);
+    }
+}
+
+void KFilePreviewGenerator::Private::rowsInserted(const QModelIndex &parent, int start, int end)
+{
+    KDirModel *dirModel = m_dirModel.data();
+    if (!dirModel || !dirModel->incrementalInsertion()) {
+        return;
+    }
+
+    KFileItemList itemList;
+    itemList.reserve(end - start + 1);
+    for (int row = start; row <= end; ++row) {
+        const KFileItem item = dirModel->itemForIndex(dirModel->index(row, 0, parent));
+        if (!item.isNull()) {
+            itemList.append(item);
+        }
+    }
+    updateIcons(itemList);
+}
+
 KFilePreviewGenerator::KFilePreviewGenerator(QAbstractItemView *parent) :
     QObject(parent),
     d(new Private(this, new KIO::DefaultViewAdapter(parent, this), parent->model()))
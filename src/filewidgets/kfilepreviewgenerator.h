@@ -123,10 +123,13 @@ private:
     Q_PRIVATE_SLOT(d, void dispatchIconUpdateQueue())
     Q_PRIVATE_SLOT(d, void pauseIconUpdates())
     Q_PRIVATE_SLOT(d, void resumeIconUpdates())
-    Q_PRIVATE_SLOT(d, void resolveMimeType())
+    Q_PRIVATE_SLOT(d, void slotMimeTypesDetermined(const KFileItemList &))
+    Q_PRIVATE_SLOT(d, void slotMimeTypeJobFinished(KJob *))
     Q_PRIVATE_SLOT(d, void requestSequenceIcon(const QModelIndex &, int))
     Q_PRIVATE_SLOT(d, void delayedIconUpdate())
     Q_PRIVATE_SLOT(d, void rowsAboutToBeRemoved(const QModelIndex &, int, int))
+    Q_PRIVATE_SLOT(d, void newItems(const KFileItemList &))
+    Q_PRIVATE_SLOT(d, void rowsInserted(const QModelIndex &, int, int))
 };
 
 #endif
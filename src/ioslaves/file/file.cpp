@@ -15,6 +15,7 @@
 
 #include <KDiskFreeSpaceInfo>
 
+#include "copytree_p.h"
 #include "kioglobal_p.h"
 
 #ifdef Q_OS_UNIX
@@ -101,6 +102,14 @@ extern "C" Q_DECL_EXPORT int kdemain(int argc, char **argv)
     return 0;
 }
 
+// Creates the slave in a thread of the application (see KIO::SlaveThread),
+// where the application already set up its QCoreApplication
+extern "C" Q_DECL_EXPORT KIO::SlaveBase *kdecreateslave(const char *protocol, const char *pool_socket, const char *app_socket)
+{
+    Q_UNUSED(protocol);
+    return new FileProtocol(pool_socket, app_socket);
+}
+
 static QFile::Permissions modeToQFilePermissions(int mode)
 {
     QFile::Permissions perms;
@@ -783,6 +792,14 @@ void FileProtocol::special(const QByteArray &data)
         }
     }
     break;
+#ifdef Q_OS_UNIX
+    case 3: {
+        QUrl url;
+        stream >> url;
+        directorySize(url);
+    }
+    break;
+#endif
 
     default:
         break;
@@ -1191,6 +1208,12 @@ void FileProtocol::virtual_hook(int id, void *data)
         auto length = static_cast<KIO::filesize_t *>(data);
         truncate(*length);
     } break;
+#ifdef Q_OS_UNIX
+    case SlaveBase::CopyTree: {
+        auto args = static_cast<KIO::CopyTreeArgs *>(data);
+        copyTree(args->src, args->dest);
+    } break;
+#endif
     default: {
         SlaveBase::virtual_hook(id, data);
     } break;
@@ -66,6 +66,9 @@ public:
      * Special commands supported by this slave:
      * 1 - mount
      * 2 - unmount
+     * 3 - directory size: sends the totals for the tree below the url,
+     *     as quint64 size, files and subdirectories, regularly while walking it
+     *     and once more at the end (see KIO::DirectorySizeJob)
      */
     void special(const QByteArray &data) override;
     void unmount(const QString &point);
@@ -86,6 +89,8 @@ private:
     QString getGroupName(KGroupId gid) const;
     bool deleteRecursive(const QString &path);
 
+    void directorySize(const QUrl &url);
+    void copyTree(const QUrl &src, const QUrl &dest);  // KF6 TODO: Turn into virtual method in SlaveBase
     void fileSystemFreeSpace(const QUrl &url);  // KF6 TODO: Turn into virtual method in SlaveBase
 
     bool privilegeOperationUnitTestMode();
@@ -15,22 +15,32 @@
 
 #include <QFile>
 #include <QDir>
+#include <QElapsedTimer>
 #include <qplatformdefs.h>
 #include <QStandardPaths>
+#include <QMutex>
+#include <QRunnable>
+#include <QSet>
 #include <QThread>
+#include <QThreadPool>
+#include <QtConcurrentMap>
 
 #include <QDebug>
 #include <KConfigGroup>
 #include <KLocalizedString>
 #include <kmountpoint.h>
 
+#include <atomic>
 #include <errno.h>
 #include <stdint.h>
 #include <utime.h>
 
 #include <KAuth>
+#include <KDiskFreeSpaceInfo>
+#include <KFileSystemType>
 #include <KRandom>
 
+#include "copytree_p.h"
 #include "fdreceiver.h"
 #include "statjob.h"
 
@@ -50,6 +60,12 @@
 #include <sys/sendfile.h>
 #endif
 
+#if HAVE_COPY_FILE_RANGE && defined Q_OS_LINUX
+#define USE_COPY_FILE_RANGE 1
+/* copy_file_range can work on much bigger chunks, 16 MB still gives smooth progress */
+#define COPY_FILE_RANGE_CHUNK (1024*1024*16)
+#endif
+
 #if HAVE_SYS_XATTR_H
 #include <sys/xattr.h>
 //BSD uses a different include
@@ -200,6 +216,8 @@ static void appendACLAtoms(const QByteArray &path, UDSEntry &entry, mode_t type)
 }
 #endif
 
+// Shared by the slaves running in threads of the same application
+static QMutex staticCacheMutex;
 static QHash<KUserId, QString> staticUserCache;
 static QHash<KGroupId, QString> staticGroupCache;
 
@@ -208,6 +226,7 @@ static QString getUserName(KUserId uid)
     if (Q_UNLIKELY(!uid.isValid())) {
         return QString();
     }
+    QMutexLocker locker(&staticCacheMutex);
     auto it = staticUserCache.find(uid);
     if (it == staticUserCache.end()) {
         KUser user(uid);
@@ -225,6 +244,7 @@ static QString getGroupName(KGroupId gid)
     if (Q_UNLIKELY(!gid.isValid())) {
         return QString();
     }
+    QMutexLocker locker(&staticCacheMutex);
     auto it = staticGroupCache.find(gid);
     if (it == staticGroupCache.end()) {
         KUserGroup group(gid);
@@ -239,7 +259,7 @@ static QString getGroupName(KGroupId gid)
 
 #if HAVE_STATX
 // statx syscall is available
-inline int LSTAT(const char* path, struct statx * buff, KIO::StatDetails details) {
+inline int LSTAT(int dirFd, const char* path, struct statx * buff, KIO::StatDetails details) {
     uint32_t mask = 0;
     if (details & KIO::StatBasic) {
         // filename, access, type, size, linkdest
@@ -257,9 +277,9 @@ inline int LSTAT(const char* path, struct statx * buff, KIO::StatDetails details
         // dev, inode
         mask |= STATX_INO;
     }
-    return statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, mask, buff);
+    return statx(dirFd, path, AT_SYMLINK_NOFOLLOW, mask, buff);
 }
-inline int STAT(const char* path, struct statx * buff, KIO::StatDetails details) {
+inline int STAT(int dirFd, const char* path, struct statx * buff, KIO::StatDetails details) {
     uint32_t mask = 0;
     // KIO::StatAcl needs type
     if (details & (KIO::StatBasic | KIO::StatAcl | KIO::StatResolveSymlink)) {
@@ -279,7 +299,7 @@ inline int STAT(const char* path, struct statx * buff, KIO::StatDetails details)
         mask |= STATX_ATIME | STATX_MTIME | STATX_BTIME;
     }
     // KIO::Inode is ignored as when STAT is called, the entry inode field has already been filled
-    return statx(AT_FDCWD, path, AT_STATX_SYNC_AS_STAT, mask, buff);
+    return statx(dirFd, path, AT_STATX_SYNC_AS_STAT, mask, buff);
 }
 inline static uint16_t stat_mode(struct statx &buf) { return buf.stx_mode; }
 inline static dev_t stat_dev(struct statx &buf) { return makedev(buf.stx_dev_major, buf.stx_dev_minor); }
@@ -291,13 +311,19 @@ inline static int64_t stat_atime(struct statx &buf) { return buf.stx_atime.tv_se
 inline static int64_t stat_mtime(struct statx &buf) { return buf.stx_mtime.tv_sec; }
 #else
 // regular stat struct
-inline int LSTAT(const char* path, QT_STATBUF * buff, KIO::StatDetails details) {
+inline int LSTAT(int dirFd, const char* path, QT_STATBUF * buff, KIO::StatDetails details) {
     Q_UNUSED(details)
-    return QT_LSTAT(path, buff);
+    if (dirFd == AT_FDCWD) {
+        return QT_LSTAT(path, buff);
+    }
+    return ::fstatat(dirFd, path, buff, AT_SYMLINK_NOFOLLOW);
 }
-inline int STAT(const char* path, QT_STATBUF * buff, KIO::StatDetails details) {
+inline int STAT(int dirFd, const char* path, QT_STATBUF * buff, KIO::StatDetails details) {
     Q_UNUSED(details)
-    return QT_STAT(path, buff);
+    if (dirFd == AT_FDCWD) {
+        return QT_STAT(path, buff);
+    }
+    return ::fstatat(dirFd, path, buff, 0);
 }
 inline static mode_t stat_mode(QT_STATBUF &buf) { return buf.st_mode; }
 inline static dev_t stat_dev(QT_STATBUF &buf) { return buf.st_dev; }
@@ -309,8 +335,12 @@ inline static time_t stat_atime(QT_STATBUF &buf) { return buf.st_atime; }
 inline static time_t stat_mtime(QT_STATBUF &buf) { return buf.st_mtime; }
 #endif
 
+/*
+ * @p path is relative to @p dirFd, @p dirPath is only needed then, for the
+ * calls that don't take a directory fd (ACLs)
+ */
 static bool createUDSEntry(const QString &filename, const QByteArray &path, UDSEntry &entry,
-                                  KIO::StatDetails details)
+                                  KIO::StatDetails details, int dirFd = AT_FDCWD, const QByteArray &dirPath = QByteArray())
 {
     assert(entry.count() == 0); // by contract :-)
     int entries = 0;
@@ -342,7 +372,7 @@ static bool createUDSEntry(const QString &filename, const QByteArray &path, UDSE
 
     bool isBrokenSymLink = false;
 #if HAVE_POSIX_ACL
-    QByteArray targetPath = path;
+    QByteArray targetPath = dirPath.isEmpty() ? path : dirPath + '/' + path;
 #endif
 
 #if HAVE_STATX
@@ -352,7 +382,7 @@ static bool createUDSEntry(const QString &filename, const QByteArray &path, UDSE
     QT_STATBUF buff;
 #endif
 
-    if (LSTAT(path.data(), &buff, details) == 0)  {
+    if (LSTAT(dirFd, path.data(), &buff, details) == 0)  {
 
         if ((stat_mode(buff) & QT_STAT_MASK) == QT_STAT_LNK) {
 
@@ -379,7 +409,7 @@ static bool createUDSEntry(const QString &filename, const QByteArray &path, UDSE
                 SizeType bufferSize = qBound(lowerBound, size +1, higherBound);
                 linkTargetBuffer.resize(bufferSize);
                 while (true) {
-                    ssize_t n = readlink(path.constData(), linkTargetBuffer.data(), bufferSize);
+                    ssize_t n = readlinkat(dirFd, path.constData(), linkTargetBuffer.data(), bufferSize);
                     if (n < 0 && errno != ERANGE) {
                         qCWarning(KIO_FILE) << "readlink failed!" << path;
                         return false;
@@ -398,13 +428,16 @@ static bool createUDSEntry(const QString &filename, const QByteArray &path, UDSE
 
             // A symlink
             if (details & KIO::StatResolveSymlink) {
-                if (STAT(path.constData(), &buff, details) == -1) {
+                if (STAT(dirFd, path.constData(), &buff, details) == -1) {
                     isBrokenSymLink = true;
                 } else {
 #if HAVE_POSIX_ACL
                     if (details & KIO::StatAcl) {
                         // valid symlink, will get the ACLs of the destination
                         targetPath = linkTargetBuffer;
+                        if (!dirPath.isEmpty() && !targetPath.startsWith('/')) {
+                            targetPath = dirPath + '/' + targetPath;
+                        }
                     }
 #endif
                 }
@@ -775,40 +808,92 @@ void FileProtocol::copy(const QUrl &srcUrl, const QUrl &destUrl,
     } else {
         // if fs does not support reflinking, files are on different devices...
 #endif
-        KIO::filesize_t processed_size = 0;
         char buffer[ MAX_IPC_SIZE ];
         ssize_t n = 0;
+#ifdef USE_COPY_FILE_RANGE
+        // copy_file_range returns 0 for pseudo files reporting a size of 0 (e.g. in /proc)
+        bool use_copy_file_range = buff_src.st_size > 0;
+#endif
 #ifdef USE_SENDFILE
         bool use_sendfile = true;
 #endif
         bool existing_dest_delete_attempted = false;
+
+        // Source and destination offset. Only the data regions of sparse files
+        // are copied, the holes are recreated by seeking over them.
+        off_t pos = 0;
+        off_t data_end = -1; // end of the current data region, -1: read until EOF
+        bool sparse = false;
+#ifdef SEEK_HOLE
+        if (buff_src.st_size > 0 && off_t(buff_src.st_blocks) * 512 < buff_src.st_size) {
+            const off_t first_hole = ::lseek(src_file.handle(), 0, SEEK_HOLE);
+            sparse = first_hole != -1 && first_hole < buff_src.st_size;
+            data_end = sparse ? 0 : -1;
+        }
+#endif
         while (!wasKilled()) {
 
             if (testMode && dest_file.fileName().contains(QLatin1String("slow"))) {
                 QThread::msleep(50);
             }
 
+#ifdef SEEK_HOLE
+            if (sparse && pos >= data_end) {
+                const off_t data = ::lseek(src_file.handle(), pos, SEEK_DATA);
+                if (data == -1) {
+                    break;  // Finished, only a hole left (ENXIO)
+                }
+                pos = data;
+                data_end = ::lseek(src_file.handle(), data, SEEK_HOLE);
+                if (data_end == -1) {
+                    data_end = buff_src.st_size;
+                }
+            }
+#endif
+            const size_t remaining = data_end == -1 ? SIZE_MAX : size_t(data_end - pos);
+
+            bool copied_in_kernel = false;
+#ifdef USE_COPY_FILE_RANGE
+            if (use_copy_file_range) {
+                // Lets the filesystem do the copy, e.g. server side on NFS 4.2 and SMB,
+                // or by sharing extents where FICLONE isn't available for the whole file
+                loff_t in_off = pos;
+                loff_t out_off = pos;
+                n = ::copy_file_range(src_file.handle(), &in_off, dest_file.handle(), &out_off,
+                                      qMin<size_t>(remaining, COPY_FILE_RANGE_CHUNK), 0);
+                if ((n == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+                        || (n == 0 && pos < buff_src.st_size)) {
+                    // qDebug() << "copy_file_range() not supported, falling back ";
+                    use_copy_file_range = false;
+                    continue;
+                }
+                copied_in_kernel = true;
+            }
+#endif
 #ifdef USE_SENDFILE
-            if (use_sendfile) {
-                off_t sf = processed_size;
-                n = ::sendfile(dest_file.handle(), src_file.handle(), &sf, MAX_IPC_SIZE);
-                processed_size = sf;
+            if (!copied_in_kernel && use_sendfile) {
+                off_t sf = pos;
+                // sendfile writes at the current offset of the destination
+                ::lseek(dest_file.handle(), pos, SEEK_SET);
+                n = ::sendfile(dest_file.handle(), src_file.handle(), &sf, qMin<size_t>(remaining, MAX_IPC_SIZE));
                 if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {     //not all filesystems support sendfile()
                     // qDebug() << "sendfile() not supported, falling back ";
                     use_sendfile = false;
+                } else {
+                    copied_in_kernel = true;
                 }
             }
-            if (!use_sendfile)
 #endif
-                n = ::read(src_file.handle(), buffer, MAX_IPC_SIZE);
+            if (!copied_in_kernel) {
+                n = ::pread(src_file.handle(), buffer, qMin<size_t>(remaining, MAX_IPC_SIZE), pos);
+            }
 
             if (n == -1) {
                 if (errno == EINTR) {
                     continue;
                 }
-#ifdef USE_SENDFILE
-                if (use_sendfile) {
-                    // qDebug() << "sendfile() error:" << strerror(errno);
+                if (copied_in_kernel) {
+                    // qDebug() << "copy_file_range()/sendfile() error:" << strerror(errno);
                     if (errno == ENOSPC) { // disk full
                         if (!_dest_backup.isEmpty() && !existing_dest_delete_attempted) {
                             ::unlink(_dest_backup.constData());
@@ -821,9 +906,9 @@ void FileProtocol::copy(const QUrl &srcUrl, const QUrl &destUrl,
                               i18n("Cannot copy file from %1 to %2. (Errno: %3)",
                                    src, dest, errno));
                     }
-                } else
-#endif
+                } else {
                     error(KIO::ERR_CANNOT_READ, src);
+                }
                 src_file.close();
                 dest_file.close();
 #if HAVE_POSIX_ACL
@@ -839,10 +924,8 @@ void FileProtocol::copy(const QUrl &srcUrl, const QUrl &destUrl,
             if (n == 0) {
                 break;    // Finished
             }
-#ifdef USE_SENDFILE
-            if (!use_sendfile) {
-#endif
-                if (dest_file.write(buffer, n) != n) {
+            if (!copied_in_kernel) {
+                if (!dest_file.seek(pos) || dest_file.write(buffer, n) != n) {
                     if (dest_file.error() == QFileDevice::ResourceError) {  // disk full
                         if (!_dest_backup.isEmpty() && !existing_dest_delete_attempted) {
                             ::unlink(_dest_backup.constData());
@@ -864,11 +947,17 @@ void FileProtocol::copy(const QUrl &srcUrl, const QUrl &destUrl,
                     }
                     return;
                 }
-                processed_size += n;
-#ifdef USE_SENDFILE
             }
-#endif
-            processedSize(processed_size);
+            pos += n;
+            processedSize(pos);
+        }
+
+        if (sparse && !wasKilled()) {
+            // Recreate a trailing hole
+            dest_file.flush();
+            if (::ftruncate(dest_file.handle(), buff_src.st_size) == 0) {
+                processedSize(buff_src.st_size);
+            }
         }
 #ifdef FICLONE
     }
@@ -1047,9 +1136,28 @@ void FileProtocol::listDir(const QUrl &url)
     }
     const QString path(url.toLocalFile());
     const QByteArray _path(QFile::encodeName(path));
-    DIR *dp = opendir(_path.data());
+
+    /* Entries are stat'ed relative to the directory fd, which avoids
+       resolving the whole path again for each entry, without having to
+       make it the current directory of the process (the kernel wouldn't
+       unmount or delete a directory we keep as active directory) */
+    int dirFd = QT_OPEN(_path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    // Reading a directory only needs read permission, but its entries
+    // can't be stat'ed without search permission either, as it was when
+    // the directory was made the current one: keep refusing to enter it
+    if (dirFd != -1 && ::faccessat(dirFd, ".", X_OK, AT_EACCESS) == -1) {
+        const int errCode = errno;
+        QT_CLOSE(dirFd);
+        dirFd = -1;
+        errno = errCode;
+    }
+    DIR *dp = dirFd == -1 ? nullptr : fdopendir(dirFd);
     if (dp == nullptr) {
-        switch (errno) {
+        const int errCode = errno;
+        if (dirFd != -1) {
+            QT_CLOSE(dirFd);
+        }
+        switch (errCode) {
         case ENOENT:
             error(KIO::ERR_DOES_NOT_EXIST, path);
             return;
@@ -1069,20 +1177,6 @@ void FileProtocol::listDir(const QUrl &url)
         return;
     }
 
-    /* set the current dir to the path to speed up
-       in not having to pass an absolute path.
-       We restore the path later to get out of the
-       path - the kernel wouldn't unmount or delete
-       directories we keep as active directory. And
-       as the slave runs in the background, it's hard
-       to see for the user what the problem would be */
-    const QString pathBuffer(QDir::currentPath());
-    if (!QDir::setCurrent(path)) {
-        closedir(dp);
-        error(ERR_CANNOT_ENTER_DIRECTORY, path);
-        return;
-    }
-
     const KIO::StatDetails details = getStatDetails();
     //qDebug() << "========= LIST " << url << "details=" << details << " =========";
     UDSEntry entry;
@@ -1091,30 +1185,24 @@ void FileProtocol::listDir(const QUrl &url)
     QT_STATBUF st;
 #endif
     QT_DIRENT *ep;
-    while ((ep = QT_READDIR(dp)) != nullptr) {
-        entry.clear();
-
-        const QString filename = QFile::decodeName(ep->d_name);
-
-        /*
-         * details == 0 (if statement) is the fast code path.
-         * We only get the file name and type. After that we emit
-         * the result.
-         *
-         * The else statement is the slow path that requests all
-         * file information in file.cpp. It executes a stat call
-         * for every entry thus becoming slower.
-         *
-         */
-        if (details == KIO::StatBasic) {
-            entry.fastInsert(KIO::UDSEntry::UDS_NAME, filename);
+
+    if (details == KIO::StatBasic) {
+        while ((ep = QT_READDIR(dp)) != nullptr) {
+            entry.clear();
+
+            /*
+             * details == 0 is the fast code path.
+             * We only get the file name and type. After that we emit
+             * the result.
+             */
+            entry.fastInsert(KIO::UDSEntry::UDS_NAME, QFile::decodeName(ep->d_name));
 #ifdef HAVE_DIRENT_D_TYPE
             entry.fastInsert(KIO::UDSEntry::UDS_FILE_TYPE,
                          (ep->d_type == DT_DIR) ? S_IFDIR : S_IFREG);
             const bool isSymLink = (ep->d_type == DT_LNK);
 #else
             // oops, no fast way, we need to stat (e.g. on Solaris)
-            if (QT_LSTAT(ep->d_name, &st) == -1) {
+            if (::fstatat(dirFd, ep->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
                 continue; // how can stat fail?
             }
             entry.fastInsert(KIO::UDSEntry::UDS_FILE_TYPE,
@@ -1127,18 +1215,69 @@ void FileProtocol::listDir(const QUrl &url)
                 entry.fastInsert(KIO::UDSEntry::UDS_LINK_DEST, QStringLiteral("Dummy Link Target"));
             }
             listEntry(entry);
+        }
+        closedir(dp);
+        finished();
+        return;
+    }
 
-        } else {
-            if (createUDSEntry(filename, QByteArray(ep->d_name), entry, details)) {
+    /*
+     * The slow path requests all file information in file.cpp. It
+     * executes a stat call for every entry thus becoming slower.
+     *
+     * On network filesystems every stat is a round trip to the server,
+     * so a batch of entries is stat'ed in parallel first; the stat calls
+     * done to create the entries are then answered from the attribute
+     * cache of the client.
+     */
+    const KFileSystemType::Type fsType = KFileSystemType::fileSystemType(path);
+    const bool prefetchStat = fsType == KFileSystemType::Nfs || fsType == KFileSystemType::Smb;
+    const int batchSize = prefetchStat ? 256 : 1;
+
+    struct DirEntry {
+        QByteArray name;
+        uchar type;
+    };
+    QVector<DirEntry> batch;
+    batch.reserve(batchSize);
+
+    bool atEnd = false;
+    while (!atEnd) {
+        batch.clear();
+        while (batch.size() < batchSize) {
+            ep = QT_READDIR(dp);
+            if (!ep) {
+                atEnd = true;
+                break;
+            }
+#ifdef HAVE_DIRENT_D_TYPE
+            batch.append(DirEntry{QByteArray(ep->d_name), ep->d_type});
+#else
+            batch.append(DirEntry{QByteArray(ep->d_name), 0});
+#endif
+        }
+
+        if (prefetchStat && batch.size() > 1) {
+            QtConcurrent::blockingMap(batch, [dirFd](const DirEntry &dirEntry) {
+                QT_STATBUF buff;
+                ::fstatat(dirFd, dirEntry.name.constData(), &buff, AT_SYMLINK_NOFOLLOW);
+            });
+        }
+
+        for (const DirEntry &dirEntry : qAsConst(batch)) {
+            entry.clear();
+            const QString filename = QFile::decodeName(dirEntry.name);
+            if (createUDSEntry(filename, dirEntry.name, entry, details, dirFd, _path)) {
 #if HAVE_SYS_XATTR_H
-                if (isNtfsHidden(filename)) {
+                const QString fullFilePath = path + QLatin1Char('/') + filename;
+                if (isNtfsHidden(fullFilePath)) {
                     bool ntfsHidden = true;
 
                     // Bug 392913: NTFS root volume is always "hidden", ignore this
-                    if (ep->d_type == DT_DIR || ep->d_type == DT_UNKNOWN || ep->d_type == DT_LNK) {
-                        const QString fullFilePath = QDir(filename).canonicalPath();
-                        auto mountPoint = KMountPoint::currentMountPoints().findByPath(fullFilePath);
-                        if (mountPoint && mountPoint->mountPoint() == fullFilePath) {
+                    if (dirEntry.type == DT_DIR || dirEntry.type == DT_UNKNOWN || dirEntry.type == DT_LNK) {
+                        const QString canonicalPath = QDir(fullFilePath).canonicalPath();
+                        auto mountPoint = KMountPoint::currentMountPoints().findByPath(canonicalPath);
+                        if (mountPoint && mountPoint->mountPoint() == canonicalPath) {
                             ntfsHidden = false;
                         }
                     }
@@ -1155,9 +1294,719 @@ void FileProtocol::listDir(const QUrl &url)
 
     closedir(dp);
 
-    // Restore the path
-    QDir::setCurrent(pathBuffer);
+    finished();
+}
+
+namespace {
+/*
+ * Sums up the sizes in a directory tree, same rules as KIO::DirectorySizeJob
+ * applies to a recursive listing: symlinks are counted (as directory or file,
+ * depending on their target) but not followed and don't add to the size,
+ * hard links are only counted once.
+ *
+ * Each directory is read by a task of its own, so that several directories
+ * are stat'ed at once; most of the time goes into waiting for the disk or
+ * the server, not into the walk itself.
+ */
+class DirectorySizeWalker
+{
+public:
+    DirectorySizeWalker()
+    {
+        m_pool.setMaxThreadCount(qBound(2, QThread::idealThreadCount(), 8));
+    }
+
+    ~DirectorySizeWalker()
+    {
+        cancel();
+        m_pool.waitForDone();
+    }
+
+    // @p size is the size of the directory itself
+    void start(const QByteArray &path, quint64 size)
+    {
+        m_size += size;
+        m_dirSize += size;
+        schedule(path);
+    }
+
+    bool waitForDone(int msecs)
+    {
+        return m_pool.waitForDone(msecs);
+    }
+
+    void cancel()
+    {
+        m_cancelled = true;
+    }
+
+    QByteArray totals() const
+    {
+        QByteArray data;
+        QDataStream stream(&data, QIODevice::WriteOnly);
+        stream << quint64(m_size) << quint64(m_files) << quint64(m_subdirs);
+        return data;
+    }
+
+    // Without the size of the directories themselves
+    quint64 fileSize() const
+    {
+        return m_size - m_dirSize;
+    }
+
+    quint64 files() const
+    {
+        return m_files;
+    }
+
+    quint64 subdirs() const
+    {
+        return m_subdirs;
+    }
+
+private:
+    class DirectoryTask : public QRunnable
+    {
+    public:
+        DirectoryTask(DirectorySizeWalker *walker, const QByteArray &path)
+            : m_walker(walker), m_path(path)
+        {
+        }
+        void run() override
+        {
+            m_walker->walkDirectory(m_path);
+        }
+
+    private:
+        DirectorySizeWalker *m_walker;
+        const QByteArray m_path;
+    };
+
+    void schedule(const QByteArray &path)
+    {
+        m_pool.start(new DirectoryTask(this, path));
+    }
+
+    // @return false if the inode was already counted
+    bool countInode(dev_t device, ino_t inode)
+    {
+        QMutexLocker locker(&m_inodesMutex);
+        QSet<ino_t> &inodes = m_visitedInodes[device];
+        if (inodes.contains(inode)) {
+            return false;
+        }
+        inodes.insert(inode);
+        return true;
+    }
+
+    void walkDirectory(const QByteArray &path)
+    {
+        const int dirFd = QT_OPEN(path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *dp = dirFd == -1 ? nullptr : fdopendir(dirFd);
+        if (dp == nullptr) {
+            // Like a recursive listing, unreadable subdirectories are skipped
+            if (dirFd != -1) {
+                QT_CLOSE(dirFd);
+            }
+            return;
+        }
+
+        quint64 size = 0;
+        quint64 dirSize = 0;
+        quint64 files = 0;
+        quint64 subdirs = 0;
+        QT_DIRENT *ep;
+        while (!m_cancelled && (ep = QT_READDIR(dp)) != nullptr) {
+            if (qstrcmp(ep->d_name, ".") == 0 || qstrcmp(ep->d_name, "..") == 0) {
+                continue;
+            }
+            QT_STATBUF buff;
+            if (::fstatat(dirFd, ep->d_name, &buff, AT_SYMLINK_NOFOLLOW) == -1) {
+                continue;
+            }
+            if ((buff.st_mode & QT_STAT_MASK) == QT_STAT_LNK) {
+                QT_STATBUF target;
+                if (::fstatat(dirFd, ep->d_name, &target, 0) == 0 && (target.st_mode & QT_STAT_MASK) == QT_STAT_DIR) {
+                    ++subdirs;
+                } else {
+                    ++files;
+                }
+                continue;
+            }
+            if ((buff.st_mode & QT_STAT_MASK) == QT_STAT_DIR) {
+                ++subdirs;
+                size += buff.st_size;
+                dirSize += buff.st_size;
+                schedule(path + '/' + ep->d_name);
+                continue;
+            }
+            // Hard-link detection (#67939), an inode with a single link can't show up twice
+            if (buff.st_nlink > 1 && !countInode(buff.st_dev, buff.st_ino)) {
+                continue;
+            }
+            size += buff.st_size;
+            ++files;
+        }
+        closedir(dp);
+
+        m_size += size;
+        m_dirSize += dirSize;
+        m_files += files;
+        m_subdirs += subdirs;
+    }
+
+    QThreadPool m_pool;
+    std::atomic<bool> m_cancelled{false};
+    std::atomic<quint64> m_size{0};
+    std::atomic<quint64> m_dirSize{0};
+    std::atomic<quint64> m_files{0};
+    std::atomic<quint64> m_subdirs{0};
+    QMutex m_inodesMutex;
+    QHash<dev_t, QSet<ino_t>> m_visitedInodes;
+};
+}
+
+void FileProtocol::directorySize(const QUrl &url)
+{
+    const QString path(url.toLocalFile());
+    const QByteArray _path(QFile::encodeName(path));
+
+    QT_STATBUF buff;
+    if (QT_STAT(_path.constData(), &buff) == -1) {
+        if (errno == EACCES) {
+            error(KIO::ERR_ACCESS_DENIED, path);
+        } else {
+            error(KIO::ERR_DOES_NOT_EXIST, path);
+        }
+        return;
+    }
+    if ((buff.st_mode & QT_STAT_MASK) != QT_STAT_DIR) {
+        error(KIO::ERR_IS_FILE, path);
+        return;
+    }
+    if (QT_ACCESS(_path.constData(), R_OK | X_OK) == -1) {
+        error(KIO::ERR_CANNOT_ENTER_DIRECTORY, path);
+        return;
+    }
+
+    DirectorySizeWalker walker;
+    walker.start(_path, buff.st_size);
+    // Partial totals every half second, so that the application can show progress
+    while (!walker.waitForDone(500)) {
+        if (wasKilled()) {
+            walker.cancel();
+            walker.waitForDone(-1);
+            error(KIO::ERR_USER_CANCELED, path);
+            return;
+        }
+        data(walker.totals());
+    }
+    data(walker.totals());
+    finished();
+}
+
+namespace {
+/**
+ * Copies a directory tree for FileProtocol::copyTree(), item by item through
+ * the fds of the directories (openat and friends), so that no path gets
+ * resolved more than once. See copytree_p.h for what it sends to the job.
+ */
+class TreeCopier
+{
+public:
+    TreeCopier(FileProtocol *slave, const QString &src, const QString &dest)
+        : m_slave(slave), m_src(src), m_dest(dest), m_buffer(MAX_IPC_SIZE, Qt::Uninitialized)
+    {
+        m_flushTimer.start();
+    }
+
+    int error() const
+    {
+        return m_error;
+    }
+
+    QString errorText() const
+    {
+        return m_errorText;
+    }
 
+    KIO::filesize_t processedSize() const
+    {
+        return m_processedSize;
+    }
+
+    void addTotals(quint64 size, quint64 files, quint64 subdirs)
+    {
+        QDataStream stream(&m_records, QIODevice::WriteOnly | QIODevice::Append);
+        stream << quint8(KIO::CopyTreeTotals) << size << files << subdirs;
+    }
+
+    void addCopied(const QByteArray &path, const QT_STATBUF &buff)
+    {
+        const bool isDir = (buff.st_mode & QT_STAT_MASK) == QT_STAT_DIR;
+        QDataStream stream(&m_records, QIODevice::WriteOnly | QIODevice::Append);
+        stream << quint8(KIO::CopyTreeCopied) << QFile::decodeName(path) << qint8(isDir)
+               << qint64(buff.st_mtime) << quint64(isDir ? 0 : buff.st_size);
+        flushIfDue();
+    }
+
+    void addLinked(const QByteArray &path, const QByteArray &target)
+    {
+        QDataStream stream(&m_records, QIODevice::WriteOnly | QIODevice::Append);
+        stream << quint8(KIO::CopyTreeLinked) << QFile::decodeName(path) << QFile::decodeName(target);
+        flushIfDue();
+    }
+
+    // For the job to copy, with its usual error and conflict handling
+    void addLeftOver(int srcDirFd, const char *name, const QByteArray &path, const QT_STATBUF &buff)
+    {
+        qCDebug(KIO_FILE) << "Leaving" << path << "to the job";
+        UDSEntry entry;
+        entry.reserve(6);
+        entry.fastInsert(KIO::UDSEntry::UDS_NAME, QFile::decodeName(path));
+        entry.fastInsert(KIO::UDSEntry::UDS_FILE_TYPE, buff.st_mode & QT_STAT_MASK);
+        entry.fastInsert(KIO::UDSEntry::UDS_ACCESS, buff.st_mode & 07777);
+        entry.fastInsert(KIO::UDSEntry::UDS_SIZE, buff.st_size);
+        entry.fastInsert(KIO::UDSEntry::UDS_MODIFICATION_TIME, buff.st_mtime);
+        if ((buff.st_mode & QT_STAT_MASK) == QT_STAT_LNK) {
+            const ssize_t n = ::readlinkat(srcDirFd, name, m_buffer.data(), m_buffer.size());
+            if (n > 0) {
+                entry.fastInsert(KIO::UDSEntry::UDS_LINK_DEST, QFile::decodeName(QByteArray(m_buffer.constData(), n)));
+            }
+        }
+        QDataStream stream(&m_records, QIODevice::WriteOnly | QIODevice::Append);
+        stream << quint8(KIO::CopyTreeLeftOver) << entry;
+        flushIfDue();
+    }
+
+    void flush()
+    {
+        if (!m_records.isEmpty()) {
+            m_slave->data(m_records);
+            m_records.clear();
+        }
+        m_flushTimer.start();
+    }
+
+    // Takes ownership of the fds. @return false if the copy must stop, see error()
+    bool copyTree(int srcFd, int destFd, const QT_STATBUF &dirBuff)
+    {
+        QT_STATBUF buff;
+        if (QT_FSTAT(destFd, &buff) == 0) {
+            m_destDevice = buff.st_dev;
+            m_destInode = buff.st_ino;
+        }
+        addCopied(QByteArray(), dirBuff);
+        return copyDir(srcFd, destFd, QByteArray(), dirBuff);
+    }
+
+private:
+    bool copyDir(int srcFd, int destFd, const QByteArray &path, const QT_STATBUF &dirBuff)
+    {
+        DIR *dp = fdopendir(srcFd);
+        if (dp == nullptr) {
+            QT_CLOSE(srcFd);
+            QT_CLOSE(destFd);
+            return true;
+        }
+
+        bool ok = true;
+        QT_DIRENT *ep;
+        while (ok && (ep = QT_READDIR(dp)) != nullptr) {
+            if (m_slave->wasKilled()) {
+                setError(KIO::ERR_USER_CANCELED, path);
+                ok = false;
+                break;
+            }
+            if (qstrcmp(ep->d_name, ".") == 0 || qstrcmp(ep->d_name, "..") == 0) {
+                continue;
+            }
+            QT_STATBUF buff;
+            if (::fstatat(srcFd, ep->d_name, &buff, AT_SYMLINK_NOFOLLOW) == -1) {
+                continue; // removed meanwhile
+            }
+            const QByteArray childPath = path.isEmpty() ? QByteArray(ep->d_name) : path + '/' + ep->d_name;
+            switch (buff.st_mode & QT_STAT_MASK) {
+            case QT_STAT_DIR:
+                if (buff.st_dev == m_destDevice && buff.st_ino == m_destInode) {
+                    // Copying a directory into itself, the copy isn't part of the source
+                    break;
+                }
+                ok = copySubdir(srcFd, destFd, ep->d_name, childPath, buff);
+                break;
+            case QT_STAT_REG:
+                ok = copyFile(srcFd, destFd, ep->d_name, childPath, buff);
+                break;
+            case QT_STAT_LNK:
+                copySymlink(srcFd, destFd, ep->d_name, childPath, buff);
+                break;
+            default:
+                // FIFOs, sockets and devices
+                addLeftOver(srcFd, ep->d_name, childPath, buff);
+                break;
+            }
+        }
+
+        setTimes(destFd, dirBuff);
+        closedir(dp);
+        QT_CLOSE(destFd);
+        return ok;
+    }
+
+    void setError(int error, const QByteArray &path)
+    {
+        m_error = error;
+        m_errorText = path.isEmpty() ? m_dest : m_dest + QLatin1Char('/') + QFile::decodeName(path);
+    }
+
+    void flushIfDue()
+    {
+        // Few messages, but often enough for the progress of the job
+        if (m_records.size() > 65536 || m_flushTimer.hasExpired(200)) {
+            flush();
+        }
+    }
+
+    void addProcessedSize(KIO::filesize_t size)
+    {
+        m_processedSize += size;
+        m_slave->processedSize(m_processedSize);
+    }
+
+    static void setTimes(int fd, const QT_STATBUF &buff)
+    {
+#ifdef Q_OS_LINUX
+        struct timespec ut[2];
+        ut[0] = buff.st_atim;
+        ut[1] = buff.st_mtim;
+        ::futimens(fd, ut);
+#else
+        struct timeval ut[2];
+        ut[0].tv_sec = buff.st_atime;
+        ut[0].tv_usec = 0;
+        ut[1].tv_sec = buff.st_mtime;
+        ut[1].tv_usec = 0;
+        ::futimes(fd, ut);
+#endif
+    }
+
+    bool copySubdir(int srcDirFd, int destDirFd, const char *name, const QByteArray &path, const QT_STATBUF &buff)
+    {
+        // Default permissions, like the directories created by CopyJob
+        if (::mkdirat(destDirFd, name, 0777) == -1) {
+            if (errno == ENOSPC) {
+                setError(KIO::ERR_DISK_FULL, path);
+                return false;
+            }
+            // The job gets to create it, and to copy all of its contents
+            leaveOverTree(srcDirFd, name, path, buff);
+            return true;
+        }
+        addCopied(path, buff);
+
+        const int srcFd = ::openat(srcDirFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (srcFd == -1) {
+            // Like a recursive listing, unreadable subdirectories are skipped with a warning
+            m_slave->warning(KIO::buildErrorString(KIO::ERR_CANNOT_ENTER_DIRECTORY, m_src + QLatin1Char('/') + QFile::decodeName(path)));
+            return true;
+        }
+        const int destFd = ::openat(destDirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (destFd == -1) {
+            QT_CLOSE(srcFd);
+            setError(KIO::ERR_CANNOT_ENTER_DIRECTORY, path);
+            return false;
+        }
+        return copyDir(srcFd, destFd, path, buff);
+    }
+
+    void leaveOverTree(int srcDirFd, const char *name, const QByteArray &path, const QT_STATBUF &buff)
+    {
+        addLeftOver(srcDirFd, name, path, buff);
+        const int srcFd = ::openat(srcDirFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        DIR *dp = srcFd == -1 ? nullptr : fdopendir(srcFd);
+        if (dp == nullptr) {
+            if (srcFd != -1) {
+                QT_CLOSE(srcFd);
+            }
+            return;
+        }
+        QT_DIRENT *ep;
+        while ((ep = QT_READDIR(dp)) != nullptr) {
+            if (qstrcmp(ep->d_name, ".") == 0 || qstrcmp(ep->d_name, "..") == 0) {
+                continue;
+            }
+            QT_STATBUF childBuff;
+            if (::fstatat(srcFd, ep->d_name, &childBuff, AT_SYMLINK_NOFOLLOW) == -1) {
+                continue;
+            }
+            const QByteArray childPath = path + '/' + ep->d_name;
+            if ((childBuff.st_mode & QT_STAT_MASK) == QT_STAT_DIR) {
+                if (childBuff.st_dev != m_destDevice || childBuff.st_ino != m_destInode) {
+                    leaveOverTree(srcFd, ep->d_name, childPath, childBuff);
+                }
+            } else {
+                addLeftOver(srcFd, ep->d_name, childPath, childBuff);
+            }
+        }
+        closedir(dp);
+    }
+
+    void copySymlink(int srcDirFd, int destDirFd, const char *name, const QByteArray &path, const QT_STATBUF &buff)
+    {
+        const ssize_t n = ::readlinkat(srcDirFd, name, m_buffer.data(), m_buffer.size());
+        if (n <= 0) {
+            addLeftOver(srcDirFd, name, path, buff);
+            return;
+        }
+        const QByteArray target(m_buffer.constData(), n);
+        if (::symlinkat(target.constData(), destDirFd, name) == -1) {
+            addLeftOver(srcDirFd, name, path, buff);
+            return;
+        }
+        addLinked(path, target);
+    }
+
+    bool copyFile(int srcDirFd, int destDirFd, const char *name, const QByteArray &path, const QT_STATBUF &buff)
+    {
+        // FileProtocol::copy() keeps the holes of sparse files, let it do that
+        if (buff.st_size > 0 && off_t(buff.st_blocks) * 512 < buff.st_size) {
+            addLeftOver(srcDirFd, name, path, buff);
+            return true;
+        }
+        const int srcFd = ::openat(srcDirFd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (srcFd == -1) {
+            addLeftOver(srcDirFd, name, path, buff);
+            return true;
+        }
+        // nobody shall be allowed to peek into the file during creation
+        const int destFd = ::openat(destDirFd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (destFd == -1) {
+            QT_CLOSE(srcFd);
+            addLeftOver(srcDirFd, name, path, buff);
+            return true;
+        }
+#if HAVE_FADVISE
+        posix_fadvise(srcFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        const KIO::filesize_t processedSize = m_processedSize;
+        int err = copyData(srcFd, destFd);
+        if (err == 0) {
+            copyAttributes(srcFd, destFd, buff);
+        }
+        QT_CLOSE(srcFd);
+        if (QT_CLOSE(destFd) == -1 && err == 0) {
+            err = errno;
+        }
+        if (err != 0) {
+            // don't keep partly copied files
+            ::unlinkat(destDirFd, name, 0);
+            m_processedSize = processedSize;
+            if (err == ECANCELED) {
+                setError(KIO::ERR_USER_CANCELED, path);
+                return false;
+            }
+            if (err == ENOSPC) {
+                setError(KIO::ERR_DISK_FULL, path);
+                return false;
+            }
+            addLeftOver(srcDirFd, name, path, buff);
+            return true;
+        }
+        addCopied(path, buff);
+        return true;
+    }
+
+    // @return 0, or the errno of the failure
+    int copyData(int srcFd, int destFd)
+    {
+#ifdef FICLONE
+        // Share data blocks ("reflink") on supporting filesystems, like brfs and XFS
+        if (::ioctl(destFd, FICLONE, srcFd) != -1) {
+            QT_STATBUF buff;
+            if (QT_FSTAT(destFd, &buff) == 0) {
+                addProcessedSize(buff.st_size);
+            }
+            return 0;
+        }
+#endif
+        off_t pos = 0;
+#ifdef USE_COPY_FILE_RANGE
+        // Lets the filesystem do the copy, see FileProtocol::copy()
+        while (true) {
+            if (m_slave->wasKilled()) {
+                return ECANCELED;
+            }
+            loff_t in_off = pos;
+            loff_t out_off = pos;
+            const ssize_t n = ::copy_file_range(srcFd, &in_off, destFd, &out_off, COPY_FILE_RANGE_CHUNK, 0);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF) {
+                    break; // read and write the rest
+                }
+                return errno;
+            }
+            if (n == 0) {
+                // Pseudo files (e.g. in /proc) report a size of 0 and need reading
+                if (pos == 0) {
+                    break;
+                }
+                return 0;
+            }
+            pos += n;
+            addProcessedSize(n);
+        }
+#endif
+        while (true) {
+            if (m_slave->wasKilled()) {
+                return ECANCELED;
+            }
+            const ssize_t n = ::pread(srcFd, m_buffer.data(), m_buffer.size(), pos);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno;
+            }
+            if (n == 0) {
+                return 0;
+            }
+            ssize_t written = 0;
+            while (written < n) {
+                const ssize_t w = ::pwrite(destFd, m_buffer.constData() + written, n - written, pos + written);
+                if (w == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return errno;
+                }
+                written += w;
+            }
+            pos += n;
+            addProcessedSize(n);
+        }
+    }
+
+    // Like FileProtocol::copy(), without asking for privileges
+    void copyAttributes(int srcFd, int destFd, const QT_STATBUF &buff)
+    {
+#if HAVE_SYS_XATTR_H || HAVE_SYS_EXTATTR_H
+        if (!m_slave->copyXattrs(srcFd, destFd)) {
+            qCDebug(KIO_FILE) << "cant copy Extended attributes";
+        }
+#endif
+        ::fchmod(destFd, buff.st_mode & 07777);
+#if HAVE_POSIX_ACL
+        acl_t acl = acl_get_fd(srcFd);
+        if (acl) {
+            if (FileProtocol::isExtendedACL(acl)) {
+                acl_set_fd(destFd, acl);
+            }
+            acl_free(acl);
+        }
+#endif
+        // as we are the owner of the new file, we can always change the group, but
+        // we might not be allowed to change the owner
+        if (::fchown(destFd, -1, buff.st_gid) == 0) {
+            (void)::fchown(destFd, buff.st_uid, -1);
+        }
+        setTimes(destFd, buff);
+    }
+
+    FileProtocol *const m_slave;
+    const QString m_src;
+    const QString m_dest;
+    QByteArray m_buffer;
+    QByteArray m_records;
+    QElapsedTimer m_flushTimer;
+    KIO::filesize_t m_processedSize = 0;
+    dev_t m_destDevice = 0;
+    ino_t m_destInode = 0;
+    int m_error = 0;
+    QString m_errorText;
+};
+}
+
+void FileProtocol::copyTree(const QUrl &srcUrl, const QUrl &destUrl)
+{
+    const QString src = srcUrl.toLocalFile();
+    const QString dest = destUrl.toLocalFile();
+    const QByteArray _src(QFile::encodeName(src));
+    const QByteArray _dest(QFile::encodeName(dest));
+
+    QT_STATBUF buff_src;
+    if (QT_STAT(_src.constData(), &buff_src) == -1) {
+        if (errno == EACCES) {
+            error(KIO::ERR_ACCESS_DENIED, src);
+        } else {
+            error(KIO::ERR_DOES_NOT_EXIST, src);
+        }
+        return;
+    }
+    if ((buff_src.st_mode & QT_STAT_MASK) != QT_STAT_DIR) {
+        error(KIO::ERR_IS_FILE, src);
+        return;
+    }
+    const int srcFd = QT_OPEN(_src.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (srcFd == -1) {
+        error(KIO::ERR_CANNOT_ENTER_DIRECTORY, src);
+        return;
+    }
+
+    // The totals first, for the progress and to fail before copying anything
+    // if the tree doesn't fit
+    DirectorySizeWalker walker;
+    walker.start(_src, buff_src.st_size);
+    while (!walker.waitForDone(500)) {
+        if (wasKilled()) {
+            walker.cancel();
+            walker.waitForDone(-1);
+            QT_CLOSE(srcFd);
+            error(KIO::ERR_USER_CANCELED, src);
+            return;
+        }
+    }
+    const QString destParent = destUrl.adjusted(QUrl::RemoveFilename | QUrl::StripTrailingSlash).toLocalFile();
+    const KDiskFreeSpaceInfo freeSpaceInfo = KDiskFreeSpaceInfo::freeSpaceInfo(destParent);
+    if (freeSpaceInfo.isValid() && freeSpaceInfo.available() < walker.fileSize()) {
+        QT_CLOSE(srcFd);
+        error(KIO::ERR_DISK_FULL, dest);
+        return;
+    }
+
+    // Copying into an existing directory needs the conflict handling of the job
+    if (::mkdir(_dest.constData(), 0777) == -1) {
+        const int errCode = errno;
+        QT_CLOSE(srcFd);
+        if (errCode == EEXIST) {
+            error(KIO::ERR_DIR_ALREADY_EXIST, dest);
+        } else if (errCode == EACCES || errCode == EPERM || errCode == EROFS) {
+            error(KIO::ERR_WRITE_ACCESS_DENIED, dest);
+        } else {
+            error(KIO::ERR_CANNOT_MKDIR, dest);
+        }
+        return;
+    }
+    const int destFd = QT_OPEN(_dest.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (destFd == -1) {
+        QT_CLOSE(srcFd);
+        ::rmdir(_dest.constData());
+        error(KIO::ERR_CANNOT_ENTER_DIRECTORY, dest);
+        return;
+    }
+
+    TreeCopier copier(this, src, dest);
+    copier.addTotals(walker.fileSize(), walker.files(), walker.subdirs());
+    const bool ok = copier.copyTree(srcFd, destFd, buff_src);
+    copier.flush();
+    if (!ok) {
+        error(copier.error(), copier.errorText());
+        return;
+    }
+    processedSize(copier.processedSize());
     finished();
 }
 
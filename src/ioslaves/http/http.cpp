@@ -16,6 +16,7 @@
 
 #include <config-kioslave-http.h>
 
+#include <atomic>
 #include <limits>
 #include <qplatformdefs.h> // must be explicitly included for MacOSX
 
@@ -41,7 +42,8 @@
 #include <KConfigGroup>
 #include <KLocalizedString>
 
-#include <QDBusInterface>
+#include <QDBusConnection>
+#include <QDBusMessage>
 #include <QSslSocket>
 #include <kremoteencoding.h>
 
@@ -66,6 +68,13 @@ Q_LOGGING_CATEGORY(KIO_HTTP, "kf.kio.slaves.http", QtWarningMsg) // disable debu
 //string parsing helpers and HeaderTokenizer implementation
 #include "parsinghelpers.cpp"
 
+// Requests sent ahead on a keep-alive connection by multiGet()
+static const int s_maxPipelineDepth = 8;
+// How many times a pipelined request is sent again before giving up
+static const int s_maxPipelineRetries = 3;
+// Beyond that, the cookie cache is cleared rather than grown
+static const int s_maxCachedCookies = 256;
+
 // Pseudo plugin class to embed meta data
 class KIOPluginForMetaData : public QObject
 {
@@ -345,6 +354,21 @@ static void changeProtocolToHttp(QUrl* url)
     }
 }
 
+static QUrl storableUrl(const QUrl &url)
+{
+    QUrl ret(url);
+    ret.setPassword(QString());
+    ret.setFragment(QString());
+    return ret;
+}
+
+static QByteArray cacheKeyFromUrl(const QUrl &url)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(storableUrl(url).toEncoded());
+    return hash.result();
+}
+
 #define NO_SIZE ((KIO::filesize_t) -1)
 
 #if HAVE_STRTOLL
@@ -375,6 +399,7 @@ HTTPProtocol::HTTPProtocol(const QByteArray &protocol, const QByteArray &pool,
     , m_isLoadingErrorPage(false)
     , m_remoteRespTimeout(DEFAULT_RESPONSE_TIMEOUT)
     , m_iEOFRetryCount(0)
+    , m_cookieCacheGeneration(0)
 {
     reparseConfiguration();
     setBlocking(true);
@@ -1941,6 +1966,8 @@ void HTTPProtocol::multiGet(const QByteArray &data)
 
         m_request.method = HTTP_GET;
         m_request.isKeepAlive = true;   //readResponseHeader clears it if necessary
+        // the MultiGetJob uses it to tell the responses apart
+        m_request.id = metaData(QStringLiteral("request-id"));
 
         QString tmp = metaData(QStringLiteral("cache"));
         if (!tmp.isEmpty()) {
@@ -1957,39 +1984,96 @@ void HTTPProtocol::multiGet(const QByteArray &data)
     }
     if (!m_isBusy) {
         m_isBusy = true;
-        QMutableListIterator<HTTPRequest> it(m_requestQueue);
-        // send the requests
-        while (it.hasNext()) {
-            m_request = it.next();
-            sendQuery();
-            // save the request state so we can pick it up again in the collection phase
-            it.setValue(m_request);
-            qCDebug(KIO_HTTP) << "check one: isKeepAlive =" << m_request.isKeepAlive;
+        if (processRequestQueue()) {
+            finished();
+        }
+        m_requestQueue.clear();
+        m_isBusy = false;
+    }
+}
+
+bool HTTPProtocol::processRequestQueue()
+{
+    // Pipelining: keep up to s_maxPipelineDepth requests on the wire, the server
+    // answers them in order. Servers known to break it get one request at a time.
+    const QString serverKey = m_request.url.host() + QLatin1Char(':') + QString::number(m_request.url.port(defaultPort()));
+    int depth = m_noPipeliningServers.contains(serverKey) ? 1 : s_maxPipelineDepth;
+    int sent = 0; // the requests before this one were written to the connection
+    int answeredOnConnection = 0;
+    int retries = 0;
+
+    // the queue can grow meanwhile, see multiGet()
+    for (int i = 0; i < m_requestQueue.size(); ++i) {
+        while (sent < m_requestQueue.size() && sent - i < depth) {
+            m_request = m_requestQueue.at(sent);
+            const bool wasConnected = isConnected();
+            if (!sendQuery()) {
+                return false;
+            }
+            if (!wasConnected) {
+                answeredOnConnection = 0;
+            }
+            // save the request state so we can pick it up again when reading the response
+            m_requestQueue[sent] = m_request;
             if (m_request.cacheTag.ioMode != ReadFromCache) {
                 m_server.initFrom(m_request);
             }
+            ++sent;
         }
-        // collect the responses
-        //### for the moment we use a hack: instead of saving and restoring request-id
-        //    we just count up like ParallelGetJobs does.
-        int requestId = 0;
-        for (const HTTPRequest &r : qAsConst(m_requestQueue)) {
-            m_request = r;
-            qCDebug(KIO_HTTP) << "check two: isKeepAlive =" << m_request.isKeepAlive;
-            setMetaData(QStringLiteral("request-id"), QString::number(requestId++));
-            sendAndKeepMetaData();
-            if (!(readResponseHeader() && readBody())) {
-                return;
+
+        m_request = m_requestQueue.at(i);
+        qCDebug(KIO_HTTP) << "reading response" << i << "of" << m_requestQueue.size() << ", in flight:" << sent - i;
+        if (!readResponseHeader()) {
+            if (m_kioError) {
+                return false;
+            }
+            // The server closed the connection, or wants credentials. Either way, what
+            // follows on this connection is of no use: send the unanswered requests again.
+            if (answeredOnConnection > 0 && sent - i > 1 && !isAuthenticationRequired(m_request.responseCode)) {
+                qCDebug(KIO_HTTP) << "Pipelining broken by" << serverKey << ", sending one request at a time";
+                m_noPipeliningServers.insert(serverKey);
+                depth = 1;
             }
-            // the "next job" signal for ParallelGetJob is data of size zero which
-            // readBody() sends without our intervention.
-            qCDebug(KIO_HTTP) << "check three: isKeepAlive =" << m_request.isKeepAlive;
-            httpClose(m_request.isKeepAlive);  //actually keep-alive is mandatory for pipelining
+            if (++retries > s_maxPipelineRetries) {
+                error(ERR_CONNECTION_BROKEN, m_request.url.host());
+                return false;
+            }
+            httpCloseConnection();
+            m_requestQueue[i] = m_request;
+            resetRequestsToResend(i, sent);
+            m_request.cacheTag.file = nullptr;
+            sent = i;
+            --i;
+            continue;
+        }
+        sendAndKeepMetaData();
+        if (!readBody()) {
+            return false;
         }
+        // the "next job" signal for MultiGetJob is data of size zero which
+        // readBody() sends without our intervention.
+        retries = 0;
+        m_iEOFRetryCount = 0;
+        ++answeredOnConnection;
 
-        finished();
-        m_requestQueue.clear();
-        m_isBusy = false;
+        if (!m_request.isKeepAlive && sent > i + 1) {
+            // the server closes the connection after this response
+            resetRequestsToResend(i + 1, sent);
+            sent = i + 1;
+        }
+        httpClose(m_request.isKeepAlive);
+    }
+    return true;
+}
+
+void HTTPProtocol::resetRequestsToResend(int first, int end)
+{
+    for (int j = first; j < end; ++j) {
+        HTTPRequest &request = m_requestQueue[j];
+        // sendQuery() opens the cache files again
+        delete request.cacheTag.file;
+        request.cacheTag.file = nullptr;
+        request.isKeepAlive = true;
     }
 }
 
@@ -4049,6 +4133,9 @@ void HTTPProtocol::special(const QByteArray &data)
             // this is an unimportant performance issue.
             // FIXME on Windows we may be unable to delete the file if open
             QFile::remove(filename);
+            if (HttpCacheIndex *index = cacheIndex()) {
+                index->remove(cacheKeyFromUrl(url));
+            }
             finished();
             break;
         }
@@ -4549,20 +4636,117 @@ void HTTPProtocol::error(int _err, const QString &_text)
     m_kioError = _err;
 }
 
+static QDBusMessage kcookiejarCall(const QString &method)
+{
+    return QDBusMessage::createMethodCall(QStringLiteral("org.kde.kcookiejar5"), QStringLiteral("/modules/kcookiejar"),
+                                          QStringLiteral("org.kde.KCookieServer"), method);
+}
+
+// Counter bumped by kcookiejar whenever its cookies or policies change, see
+// KCookieServer::findHostCookies(), nullptr if kcookiejar doesn't run (yet)
+static const std::atomic<quint64> *cookieJarGeneration()
+{
+    static QFile file(QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) + QLatin1String("/kcookiejar5-generation"));
+    static uchar *map = nullptr;
+    if (!map && file.open(QIODevice::ReadOnly)) {
+        if (file.size() >= qint64(sizeof(quint64))) {
+            map = file.map(0, sizeof(quint64));
+        }
+        file.close();
+    }
+    return reinterpret_cast<const std::atomic<quint64> *>(map);
+}
+
 void HTTPProtocol::addCookies(const QString &url, const QByteArray &cookieHeader)
 {
     qlonglong windowId = m_request.windowId.toLongLong();
-    QDBusInterface kcookiejar(QStringLiteral("org.kde.kcookiejar5"), QStringLiteral("/modules/kcookiejar"), QStringLiteral("org.kde.KCookieServer"));
-    (void)kcookiejar.call(QDBus::NoBlock, QStringLiteral("addCookies"), url,
-                          cookieHeader, windowId);
+    QDBusMessage call = kcookiejarCall(QStringLiteral("addCookies"));
+    call << url << cookieHeader << windowId;
+    QDBusConnection::sessionBus().call(call, QDBus::NoBlock);
+    // Don't wait for kcookiejar to bump the generation
+    m_cookieCache.clear();
+}
+
+// Same as the path check of KHttpCookie::match() in kcookiejar
+static bool cookiePathMatches(const QString &cookiePath, const QString &path)
+{
+    return path.startsWith(cookiePath)
+           && (path.length() == cookiePath.length() || cookiePath.endsWith(QLatin1Char('/'))
+               || path.at(cookiePath.length()) == QLatin1Char('/'));
 }
 
 QString HTTPProtocol::findCookies(const QString &url)
 {
     qlonglong windowId = m_request.windowId.toLongLong();
-    QDBusInterface kcookiejar(QStringLiteral("org.kde.kcookiejar5"), QStringLiteral("/modules/kcookiejar"), QStringLiteral("org.kde.KCookieServer"));
-    QDBusReply<QString> reply = kcookiejar.call(QStringLiteral("findCookies"), url, windowId);
 
+    const QUrl u(url);
+    const bool secureRequest = (u.scheme() == QLatin1String("https") || u.scheme() == QLatin1String("webdavs"));
+    // Which cookies apply to the host only depends on the host and the port
+    const QString cacheKey = m_request.windowId + QLatin1Char(' ') + u.host().toLower()
+                             + QLatin1Char(':') + QString::number(u.port(secureRequest ? 443 : 80));
+    const std::atomic<quint64> *generation = cookieJarGeneration();
+    // Read before asking kcookiejar, so that a change made meanwhile invalidates the answer
+    const quint64 currentGeneration = generation ? generation->load(std::memory_order_acquire) : 0;
+    if (generation && currentGeneration != m_cookieCacheGeneration) {
+        m_cookieCache.clear();
+        m_cookieCacheGeneration = currentGeneration;
+    }
+
+    auto it = m_cookieCache.find(cacheKey);
+    if (it != m_cookieCache.end() && it->validUntil != 0 && it->validUntil <= QDateTime::currentSecsSinceEpoch()) {
+        m_cookieCache.erase(it);
+        it = m_cookieCache.end();
+    }
+
+    if (it == m_cookieCache.end() && generation) {
+        QDBusMessage call = kcookiejarCall(QStringLiteral("findHostCookies"));
+        call << url << windowId;
+        const QDBusMessage reply = QDBusConnection::sessionBus().call(call);
+        // A kcookiejar without findHostCookies() maybe, or one waiting for the user
+        const qint64 validUntil = reply.arguments().value(1, -1).toLongLong();
+        if (reply.type() == QDBusMessage::ReplyMessage && validUntil >= 0) {
+            const QStringList fields = reply.arguments().at(0).toStringList();
+            CachedCookies hostCookies;
+            hostCookies.validUntil = validUntil;
+            hostCookies.cookies.reserve(fields.count() / 4);
+            for (int i = 0; i + 3 < fields.count(); i += 4) {
+                hostCookies.cookies.append({fields.at(i), fields.at(i + 1) == QLatin1String("1"), fields.at(i + 2).toInt(), fields.at(i + 3)});
+            }
+            if (m_cookieCache.size() >= s_maxCachedCookies) {
+                m_cookieCache.clear();
+            }
+            it = m_cookieCache.insert(cacheKey, hostCookies);
+        }
+    }
+
+    if (it != m_cookieCache.end()) {
+        // Select them like KCookieJar::findCookies() does
+        QString path = u.path();
+        if (path.isEmpty()) {
+            path = QStringLiteral("/");
+        }
+        QString cookieStr;
+        int protVersion = 0;
+        for (const CachedCookie &cookie : qAsConst(it->cookies)) {
+            if ((cookie.isSecure && !secureRequest) || !cookiePathMatches(cookie.path, path)) {
+                continue;
+            }
+            protVersion = qMax(protVersion, cookie.protocolVersion);
+            cookieStr += cookie.cookie + QLatin1String("; ");
+        }
+        if (cookieStr.isEmpty()) {
+            return cookieStr;
+        }
+        cookieStr.chop(2); // Remove the trailing '; '
+        if (protVersion > 0) {
+            cookieStr.prepend(QLatin1String("$Version=") + QString::number(protVersion) + QLatin1String("; "));
+        }
+        return QLatin1String("Cookie: ") + cookieStr;
+    }
+
+    QDBusMessage call = kcookiejarCall(QStringLiteral("findCookies"));
+    call << url << windowId;
+    QDBusReply<QString> reply = QDBusConnection::sessionBus().call(call);
     if (!reply.isValid()) {
         qCWarning(KIO_HTTP) << "Can't communicate with kded_kcookiejar!";
         return QString();
@@ -4711,14 +4895,6 @@ header line\n
 \n
 */
 
-static QUrl storableUrl(const QUrl &url)
-{
-    QUrl ret(url);
-    ret.setPassword(QString());
-    ret.setFragment(QString());
-    return ret;
-}
-
 static void writeLine(QIODevice *dev, const QByteArray &line)
 {
     static const char linefeed = '\n';
@@ -4807,9 +4983,7 @@ bool HTTPProtocol::cacheFileReadTextHeader2()
 
 static QString filenameFromUrl(const QUrl &url)
 {
-    QCryptographicHash hash(QCryptographicHash::Sha1);
-    hash.addData(storableUrl(url).toEncoded());
-    return toQString(hash.result().toHex());
+    return HttpCacheIndex::baseNameFromKey(cacheKeyFromUrl(url));
 }
 
 QString HTTPProtocol::cacheFilePathFromUrl(const QUrl &url) const
@@ -4822,9 +4996,24 @@ QString HTTPProtocol::cacheFilePathFromUrl(const QUrl &url) const
     return filePath;
 }
 
+HttpCacheIndex *HTTPProtocol::cacheIndex()
+{
+    if (!m_cacheIndex.isOpen()) {
+        // the cache cleaner creates it, and might not have done so yet
+        m_cacheIndex.open(m_strCacheDir);
+    }
+    return m_cacheIndex.isOpen() ? &m_cacheIndex : nullptr;
+}
+
 bool HTTPProtocol::cacheFileOpenRead()
 {
     qCDebug(KIO_HTTP);
+    HttpCacheIndex *index = cacheIndex();
+    if (index && index->isComplete() && !index->find(cacheKeyFromUrl(m_request.url))) {
+        // A complete index knows about every cache file, no need to look for one
+        qCDebug(KIO_HTTP) << "Not in the cache index.";
+        return false;
+    }
     QString filename = cacheFilePathFromUrl(m_request.url);
 
     QFile *&file = m_request.cacheTag.file;
@@ -4953,6 +5142,14 @@ void HTTPProtocol::cacheFileClose()
                 qCDebug(KIO_HTTP) << "Renaming temporary file failed, deleting it instead.";
                 QFile::remove(oldName);
                 ccCommand.clear();  // we have nothing of value to tell the cache cleaner
+            } else if (HttpCacheIndex *index = cacheIndex()) {
+                // Make the new file visible to the other slaves right away, without
+                // waiting for the cache cleaner to process the command
+                HttpCacheIndex::Entry entry;
+                entry.lastUsedDate = QDateTime::currentSecsSinceEpoch();
+                entry.size = QFileInfo(newName).size();
+                entry.useCount = m_request.cacheTag.fileUseCount;
+                index->insert(HttpCacheIndex::keyFromBaseName(newName.mid(basenameStart)), entry);
             }
         } else {
             // oh, we've never written payload data to the cache file.
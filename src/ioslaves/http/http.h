@@ -12,14 +12,18 @@
 #ifndef HTTP_H
 #define HTTP_H
 
+#include <QHash>
 #include <QList>
+#include <QSet>
 #include <QStringList>
 #include <QDateTime>
 #include <QLocalSocket>
 #include <QUrl>
+#include <QVector>
 
 #include "kio/tcpslavebase.h"
 #include "httpmethod_p.h"
+#include "httpcacheindex.h"
 
 class QDomNodeList;
 class QFile;
@@ -328,6 +332,17 @@ protected:
      * Close transfer
      */
     void httpClose(bool keepAlive);
+    /**
+     * Sends the requests of m_requestQueue, pipelined where possible, and
+     * reads their responses.
+     * @return false if an error was emitted
+     */
+    bool processRequestQueue();
+    /**
+     * Prepares the queued requests from @p first up to @p end (excluded),
+     * which were sent on a connection now closed, to be sent again.
+     */
+    void resetRequestsToResend(int first, int end);
     /**
      * Open connection
      */
@@ -398,13 +413,15 @@ protected:
     void addCookies(const QString &url, const QByteArray &cookieHeader);
 
     /**
-     * Look for cookies in the cookiejar
+     * Look for cookies in the cookiejar, or in the cookies of the host it
+     * sent before, as long as its generation counter didn't change
      */
     QString findCookies(const QString &url);
 
     void cacheParseResponseHeader(const HeaderTokenizer &tokenizer);
 
     QString cacheFilePathFromUrl(const QUrl &url) const;
+    HttpCacheIndex *cacheIndex();
     bool cacheFileOpenRead();
     bool cacheFileOpenWrite();
     void cacheFileClose();
@@ -520,6 +537,7 @@ protected:
     HTTPServerState m_server;
     HTTPRequest m_request;
     QList<HTTPRequest> m_requestQueue;
+    QSet<QString> m_noPipeliningServers; ///< "host:port" of the servers that broke pipelined requests
 
     // Processing related
     KIO::filesize_t m_iSize; ///< Expected size of message
@@ -567,6 +585,7 @@ protected:
     long m_maxCacheSize; ///< Maximum cache size in Kb.
     QString m_strCacheDir; ///< Location of the cache.
     QLocalSocket m_cacheCleanerConnection; ///< Connection to the cache cleaner process
+    HttpCacheIndex m_cacheIndex; ///< Index of the cache, maintained by the cache cleaner
 
     // Operation mode
     QByteArray m_protocol;
@@ -593,6 +612,20 @@ protected:
     // EOF Retry count
     quint8 m_iEOFRetryCount;
 
+    // Cookies of a host got from kcookiejar, keyed by window id, host and port
+    struct CachedCookie {
+        QString path;
+        bool isSecure;
+        int protocolVersion;
+        QString cookie; ///< As sent in the Cookie header
+    };
+    struct CachedCookies {
+        QVector<CachedCookie> cookies;
+        qint64 validUntil; ///< Expiration of the first cookie to expire, 0 if none does
+    };
+    QHash<QString, CachedCookies> m_cookieCache;
+    quint64 m_cookieCacheGeneration; ///< kcookiejar's generation the cache belongs to
+
     QByteArray m_unreadBuf;
     void clearUnreadBuffer();
     void unread(char *buf, size_t size);
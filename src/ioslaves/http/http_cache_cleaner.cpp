@@ -30,6 +30,9 @@
 #include <QCryptographicHash>
 #include <QDBusError>
 #include <QDataStream>
+#include <QSet>
+
+#include "httpcacheindex.h"
 
 QDateTime g_currentDate;
 int g_maxCacheAge;
@@ -68,7 +71,7 @@ struct SerializedCacheFileInfo {
 };
 
 struct MiniCacheFileInfo {
-// data from cache entry file, or from scoreboard file
+// data from cache entry file, or from the cache index
     qint32 useCount;
 // from filesystem
     QDateTime lastUsedDate;
@@ -262,90 +265,6 @@ static bool readCacheFile(const QString &baseName, CacheFileInfo *fi, OperationM
     return true;
 }
 
-class Scoreboard;
-
-class CacheIndex
-{
-public:
-    explicit CacheIndex(const QString &baseName)
-    {
-        QByteArray ba = baseName.toLatin1();
-        const int sz = ba.size();
-        const char *input = ba.constData();
-        Q_ASSERT(sz == s_hashedUrlNibbles);
-
-        int translated = 0;
-        for (int i = 0; i < sz; i++) {
-            int c = input[i];
-
-            if (c >= '0' && c <= '9') {
-                translated |= c - '0';
-            } else if (c >= 'a' && c <= 'f') {
-                translated |= c - 'a' + 10;
-            } else {
-                Q_ASSERT(false);
-            }
-
-            if (i & 1) {
-                // odd index
-                m_index[i >> 1] = translated;
-                translated = 0;
-            } else  {
-                translated = translated << 4;
-            }
-        }
-
-        computeHash();
-    }
-
-    bool operator==(const CacheIndex &other) const
-    {
-        const bool isEqual = memcmp(m_index, other.m_index, s_hashedUrlBytes) == 0;
-        if (isEqual) {
-            Q_ASSERT(m_hash == other.m_hash);
-        }
-        return isEqual;
-    }
-
-private:
-    explicit CacheIndex(const QByteArray &index)
-    {
-        Q_ASSERT(index.length() >= s_hashedUrlBytes);
-        memcpy(m_index, index.constData(), s_hashedUrlBytes);
-        computeHash();
-    }
-
-    void computeHash()
-    {
-        uint hash = 0;
-        const int ints = s_hashedUrlBytes / sizeof(uint);
-        for (int i = 0; i < ints; i++) {
-            hash ^= reinterpret_cast<uint *>(&m_index[0])[i];
-        }
-        if (const int bytesLeft = s_hashedUrlBytes % sizeof(uint)) {
-            // dead code until a new url hash algorithm or architecture with sizeof(uint) != 4 appears.
-            // we have the luxury of ignoring endianness because the hash is never written to disk.
-            // just merge the bits into the hash in some way.
-            const int offset = ints * sizeof(uint);
-            for (int i = 0; i < bytesLeft; i++) {
-                hash ^= static_cast<uint>(m_index[offset + i]) << (i * 8);
-            }
-        }
-        m_hash = hash;
-    }
-
-    friend uint qHash(const CacheIndex &);
-    friend class Scoreboard;
-
-    quint8 m_index[s_hashedUrlBytes]; // packed binary version of the hexadecimal name
-    uint m_hash;
-};
-
-uint qHash(const CacheIndex &ci)
-{
-    return ci.m_hash;
-}
-
 static CacheCleanerCommand readCommand(const QByteArray &cmd, CacheFileInfo *fi)
 {
     readBinaryHeader(cmd, fi);
@@ -365,213 +284,76 @@ static CacheCleanerCommand readCommand(const QByteArray &cmd, CacheFileInfo *fi)
     return static_cast<CacheCleanerCommand>(ret);
 }
 
-// never instantiated, on-disk format only
-struct ScoreboardEntry {
-// from scoreboard file
-    quint8 index[s_hashedUrlBytes];
-    static const int indexSize = s_hashedUrlBytes;
-    qint32 useCount;
-// from scoreboard file, but compared with filesystem to see if scoreboard has current data
-    qint64 lastUsedDate;
-    qint32 sizeOnDisk;
-    static const int size = 36;
-    // we want to delete the least "useful" files and we'll have to sort a list for that...
-    bool operator<(const MiniCacheFileInfo &other) const;
-};
-
-class Scoreboard
+static HttpCacheIndex::Entry indexEntry(const CacheFileInfo &fi)
 {
-public:
-    Scoreboard()
-    {
-        // read in the scoreboard...
-        QFile sboard(filePath(QStringLiteral("scoreboard")));
-        if (sboard.open(QIODevice::ReadOnly)) {
-            while (true) {
-                QByteArray baIndex = sboard.read(ScoreboardEntry::indexSize);
-                QByteArray baRest = sboard.read(ScoreboardEntry::size - ScoreboardEntry::indexSize);
-                if (baIndex.size() + baRest.size() != ScoreboardEntry::size) {
-                    break;
-                }
-
-                const QString entryBasename = QString::fromLatin1(baIndex.toHex());
-                MiniCacheFileInfo mcfi;
-                if (readAndValidateMcfi(baRest, entryBasename, &mcfi)) {
-                    m_scoreboard.insert(CacheIndex(baIndex), mcfi);
-                }
-            }
-        }
-    }
+    HttpCacheIndex::Entry entry;
+    entry.lastUsedDate = fi.lastUsedDate.toSecsSinceEpoch();
+    entry.size = fi.sizeOnDisk;
+    entry.useCount = fi.useCount;
+    return entry;
+}
 
-    void writeOut()
-    {
-        // write out the scoreboard
-        QFile sboard(filePath(QStringLiteral("scoreboard")));
-        if (!sboard.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-            return;
+// execute the command; return number of bytes if a new file was created, zero otherwise.
+static qint64 runCommand(const QByteArray &cmd, HttpCacheIndex::Item *item)
+{
+    Q_ASSERT(cmd.size() == 80);
+    CacheFileInfo fi;
+    const CacheCleanerCommand ccc = readCommand(cmd, &fi);
+    QString fileName = filePath(fi.baseName);
+
+    switch (ccc) {
+    case CreateFileNotificationCommand:
+        // qDebug() << "CreateNotificationCommand for" << fi.baseName;
+        if (!readBinaryHeader(cmd, &fi)) {
+            return 0;
         }
-        QDataStream stream(&sboard);
+        break;
 
-        QHash<CacheIndex, MiniCacheFileInfo>::ConstIterator it = m_scoreboard.constBegin();
-        for (; it != m_scoreboard.constEnd(); ++it) {
-            const char *indexData = reinterpret_cast<const char *>(it.key().m_index);
-            stream.writeRawData(indexData, s_hashedUrlBytes);
+    case UpdateFileCommand: {
+        // qDebug() << "UpdateFileCommand for" << fi.baseName;
+        QFile file(fileName);
+        file.open(QIODevice::ReadWrite);
 
-            stream << it.value().useCount;
-            stream << it.value().lastUsedDate.toSecsSinceEpoch();
-            stream << qint32(it.value().sizeOnDisk);
+        CacheFileInfo fiFromDisk;
+        QByteArray header = file.read(SerializedCacheFileInfo::size);
+        if (!readBinaryHeader(header, &fiFromDisk) || fiFromDisk.bytesCached != fi.bytesCached) {
+            return 0;
         }
-    }
 
-    bool fillInfo(const QString &baseName, MiniCacheFileInfo *mcfi)
-    {
-        QHash<CacheIndex, MiniCacheFileInfo>::ConstIterator it =
-            m_scoreboard.constFind(CacheIndex(baseName));
-        if (it == m_scoreboard.constEnd()) {
-            return false;
+        // adjust the use count, to make sure that we actually count up. (slaves read the file
+        // asynchronously...)
+        const quint32 newUseCount = fiFromDisk.useCount + 1;
+        QByteArray newHeader = cmd.mid(0, SerializedCacheFileInfo::size);
+        {
+            QDataStream stream(&newHeader, QIODevice::ReadWrite);
+            stream.skipRawData(SerializedCacheFileInfo::useCountOffset);
+            stream << newUseCount;
         }
-        *mcfi = it.value();
-        return true;
-    }
 
-    qint64 runCommand(const QByteArray &cmd)
-    {
-        // execute the command; return number of bytes if a new file was created, zero otherwise.
-        Q_ASSERT(cmd.size() == 80);
-        CacheFileInfo fi;
-        const CacheCleanerCommand ccc = readCommand(cmd, &fi);
-        QString fileName = filePath(fi.baseName);
-
-        switch (ccc) {
-        case CreateFileNotificationCommand:
-            // qDebug() << "CreateNotificationCommand for" << fi.baseName;
-            if (!readBinaryHeader(cmd, &fi)) {
-                return 0;
-            }
-            break;
-
-        case UpdateFileCommand: {
-            // qDebug() << "UpdateFileCommand for" << fi.baseName;
-            QFile file(fileName);
-            file.open(QIODevice::ReadWrite);
-
-            CacheFileInfo fiFromDisk;
-            QByteArray header = file.read(SerializedCacheFileInfo::size);
-            if (!readBinaryHeader(header, &fiFromDisk) || fiFromDisk.bytesCached != fi.bytesCached) {
-                return 0;
-            }
-
-            // adjust the use count, to make sure that we actually count up. (slaves read the file
-            // asynchronously...)
-            const quint32 newUseCount = fiFromDisk.useCount + 1;
-            QByteArray newHeader = cmd.mid(0, SerializedCacheFileInfo::size);
-            {
-                QDataStream stream(&newHeader, QIODevice::ReadWrite);
-                stream.skipRawData(SerializedCacheFileInfo::useCountOffset);
-                stream << newUseCount;
-            }
+        file.seek(0);
+        file.write(newHeader);
+        file.close();
 
-            file.seek(0);
-            file.write(newHeader);
-            file.close();
-
-            if (!readBinaryHeader(newHeader, &fi)) {
-                return 0;
-            }
-            break;
-        }
-
-        default:
-            // qDebug() << "received invalid command";
+        if (!readBinaryHeader(newHeader, &fi)) {
             return 0;
         }
-
-        QFileInfo fileInfo(fileName);
-        fi.lastUsedDate = fileInfo.lastModified();
-        fi.sizeOnDisk = fileInfo.size();
-        fi.debugPrint();
-        // a CacheFileInfo is-a MiniCacheFileInfo which enables the following assignment...
-        add(fi);
-        // finally, return cache dir growth (only relevant if a file was actually created!)
-        return ccc == CreateFileNotificationCommand ? fi.sizeOnDisk : 0;
-    }
-
-    void add(const CacheFileInfo &fi)
-    {
-        m_scoreboard[CacheIndex(fi.baseName)] = fi;
-    }
-
-    void remove(const QString &basename)
-    {
-        m_scoreboard.remove(CacheIndex(basename));
-    }
-
-    // keep memory usage reasonably low - otherwise entries of nonexistent files don't hurt.
-    void maybeRemoveStaleEntries(const QList<CacheFileInfo *> &fiList)
-    {
-        // don't bother when there are a few bogus entries
-        if (m_scoreboard.count() < fiList.count() + 100) {
-            return;
-        }
-        // qDebug() << "we have too many fake/stale entries, cleaning up...";
-        QSet<CacheIndex> realFiles;
-        for (CacheFileInfo *fi : fiList) {
-            realFiles.insert(CacheIndex(fi->baseName));
-        }
-        QHash<CacheIndex, MiniCacheFileInfo>::Iterator it = m_scoreboard.begin();
-        while (it != m_scoreboard.end()) {
-            if (realFiles.contains(it.key())) {
-                ++it;
-            } else {
-                it = m_scoreboard.erase(it);
-            }
-        }
+        break;
     }
 
-private:
-    bool readAndValidateMcfi(const QByteArray &rawData, const QString &basename, MiniCacheFileInfo *mcfi)
-    {
-        QDataStream stream(rawData);
-        stream >> mcfi->useCount;
-        // check those against filesystem
-        qint64 lastUsedDate;
-        stream >> lastUsedDate; mcfi->lastUsedDate.setSecsSinceEpoch(lastUsedDate);
-
-        qint32 sizeOnDisk;
-        stream >> sizeOnDisk; mcfi->sizeOnDisk = sizeOnDisk;
-        //qDebug() << basename << "sizeOnDisk" << mcfi->sizeOnDisk;
-
-        QFileInfo fileInfo(filePath(basename));
-        if (!fileInfo.exists()) {
-            return false;
-        }
-        bool ok = true;
-        ok = ok && fileInfo.lastModified() == mcfi->lastUsedDate;
-        ok = ok && fileInfo.size() == mcfi->sizeOnDisk;
-        if (!ok) {
-            // size or last-modified date not consistent with entry file; reload useCount
-            // note that avoiding to open the file is the whole purpose of the scoreboard - we only
-            // open the file if we really have to.
-            QFile entryFile(fileInfo.absoluteFilePath());
-            if (!entryFile.open(QIODevice::ReadOnly)) {
-                return false;
-            }
-            if (entryFile.size() < SerializedCacheFileInfo::size) {
-                return false;
-            }
-            QDataStream stream(&entryFile);
-            stream.skipRawData(SerializedCacheFileInfo::useCountOffset);
-
-            stream >> mcfi->useCount;
-            mcfi->lastUsedDate = fileInfo.lastModified();
-            mcfi->sizeOnDisk = fileInfo.size();
-            ok = true;
-        }
-        return ok;
+    default:
+        // qDebug() << "received invalid command";
+        return 0;
     }
 
-    QHash<CacheIndex, MiniCacheFileInfo> m_scoreboard;
-};
+    QFileInfo fileInfo(fileName);
+    fi.lastUsedDate = fileInfo.lastModified();
+    fi.sizeOnDisk = fileInfo.size();
+    fi.debugPrint();
+    item->key = HttpCacheIndex::keyFromBaseName(fi.baseName);
+    item->entry = indexEntry(fi);
+    // finally, return cache dir growth (only relevant if a file was actually created!)
+    return ccc == CreateFileNotificationCommand ? fi.sizeOnDisk : 0;
+}
 
 // Keep the above in sync with the cache code in http.cpp
 // !END OF SYNC!
@@ -587,21 +369,65 @@ static void removeOldFiles()
         QDir(cacheRootDir + dirName).removeRecursively();
     }
     QFile::remove(cacheRootDir + QLatin1String("cleaned"));
+    // replaced by the index
+    QFile::remove(cacheRootDir + QLatin1String("scoreboard"));
 }
 
 class CacheCleaner
 {
 public:
-    CacheCleaner(const QDir &cacheDir)
-        : m_totalSizeOnDisk(0)
+    // Reads the header of every file in the cache directory, then replaces
+    // @p index by one built from them.
+    CacheCleaner(const QDir &cacheDir, HttpCacheIndex *index)
+        : m_index(index)
+        , m_rebuildIndex(true)
+        , m_scanStart(g_currentDate.toSecsSinceEpoch())
+        , m_totalSizeOnDisk(0)
     {
         // qDebug();
         m_fileNameList = cacheDir.entryList(QDir::Files);
     }
 
+    // Takes the cache files from @p index, the directory is only listed
+    // for leftover temporary files.
+    explicit CacheCleaner(HttpCacheIndex *index)
+        : m_index(index)
+        , m_rebuildIndex(false)
+        , m_scanStart(0)
+        , m_totalSizeOnDisk(0)
+    {
+        const QVector<HttpCacheIndex::Item> items = index->items();
+        for (const HttpCacheIndex::Item &item : items) {
+            CacheFileInfo *fi = new CacheFileInfo();
+            fi->baseName = HttpCacheIndex::baseNameFromKey(item.key);
+            fi->useCount = item.entry.useCount;
+            fi->lastUsedDate.setSecsSinceEpoch(item.entry.lastUsedDate);
+            fi->sizeOnDisk = item.entry.size;
+            m_fiList.append(fi);
+            m_totalSizeOnDisk += fi->sizeOnDisk;
+        }
+        const QStringList fileNames = QDir(cacheDir()).entryList(QDir::Files);
+        for (const QString &fileName : fileNames) {
+            if (fileName.length() > s_hashedUrlNibbles) {
+                m_fileNameList.append(fileName);
+            }
+        }
+        if (m_fileNameList.isEmpty()) {
+            std::sort(m_fiList.begin(), m_fiList.end(), CacheFileInfoPtrLessThan);
+        }
+    }
+
+    // A slave told us about this entry while we were going through the directory
+    void noteEntry(const HttpCacheIndex::Item &item)
+    {
+        if (m_rebuildIndex && !m_fileNameList.isEmpty()) {
+            m_lateItems.append(item);
+        }
+    }
+
     // Delete some of the files that need to be deleted. Return true when done, false otherwise.
     // This makes interleaved cleaning / serving ioslaves possible.
-    bool processSlice(Scoreboard *scoreboard = nullptr)
+    bool processSlice()
     {
         QElapsedTimer t;
         t.start();
@@ -631,19 +457,7 @@ public:
                 }
 
                 CacheFileInfo *fi = new CacheFileInfo();
-                fi->baseName = baseName;
-
-                bool gotInfo = false;
-                if (scoreboard) {
-                    gotInfo = scoreboard->fillInfo(baseName, fi);
-                }
-                if (!gotInfo) {
-                    gotInfo = readCacheFile(baseName, fi, CleanCache);
-                    if (gotInfo && scoreboard) {
-                        scoreboard->add(*fi);
-                    }
-                }
-                if (gotInfo) {
+                if (readCacheFile(baseName, fi, CleanCache)) {
                     m_fiList.append(fi);
                     m_totalSizeOnDisk += fi->sizeOnDisk;
                 } else {
@@ -654,6 +468,9 @@ public:
 
             if (m_fileNameList.isEmpty()) {
                 // final step of phase one
+                if (m_rebuildIndex) {
+                    rebuildIndex();
+                }
                 std::sort(m_fiList.begin(), m_fiList.end(), CacheFileInfoPtrLessThan);
             }
             return false;
@@ -665,21 +482,16 @@ public:
         while (t.elapsed() < 100) {
             if (m_totalSizeOnDisk <= g_maxCacheSize || m_fiList.isEmpty()) {
                 // qDebug() << "total size of cache files after cleaning is" << m_totalSizeOnDisk;
-                if (scoreboard) {
-                    scoreboard->maybeRemoveStaleEntries(m_fiList);
-                    scoreboard->writeOut();
-                }
                 qDeleteAll(m_fiList);
                 m_fiList.clear();
                 return true;
             }
             CacheFileInfo *fi = m_fiList.takeFirst();
             QString filename = filePath(fi->baseName);
-            if (QFile::remove(filename)) {
+            // the index may still list files that are gone already
+            if (QFile::remove(filename) || !QFile::exists(filename)) {
                 m_totalSizeOnDisk -= fi->sizeOnDisk;
-                if (scoreboard) {
-                    scoreboard->remove(fi->baseName);
-                }
+                m_index->remove(HttpCacheIndex::keyFromBaseName(fi->baseName));
             }
             delete fi;
         }
@@ -687,8 +499,50 @@ public:
     }
 
 private:
+    void rebuildIndex()
+    {
+        QVector<HttpCacheIndex::Item> items;
+        items.reserve(m_fiList.size() + m_lateItems.size());
+        QSet<QByteArray> keys;
+        // entries from the commands we got meanwhile are the most recent ones
+        for (const HttpCacheIndex::Item &item : qAsConst(m_lateItems)) {
+            if (!item.key.isEmpty() && !keys.contains(item.key)) {
+                keys.insert(item.key);
+                items.append(item);
+            }
+        }
+        for (const CacheFileInfo *fi : qAsConst(m_fiList)) {
+            HttpCacheIndex::Item item;
+            item.key = HttpCacheIndex::keyFromBaseName(fi->baseName);
+            item.entry = indexEntry(*fi);
+            if (!keys.contains(item.key)) {
+                keys.insert(item.key);
+                items.append(item);
+            }
+        }
+        // and slaves may have added files to the old index since the directory was listed
+        if (m_index->isOpen()) {
+            const QVector<HttpCacheIndex::Item> indexItems = m_index->items();
+            for (const HttpCacheIndex::Item &item : indexItems) {
+                if (item.entry.lastUsedDate >= m_scanStart && !keys.contains(item.key)) {
+                    keys.insert(item.key);
+                    items.append(item);
+                }
+            }
+        }
+        m_lateItems.clear();
+
+        if (!m_index->rebuild(cacheDir(), items.size() * 2, &items)) {
+            qWarning() << "Could not write the HTTP cache index in" << cacheDir();
+        }
+    }
+
+    HttpCacheIndex *m_index;
     QStringList m_fileNameList;
     QList<CacheFileInfo *> m_fiList;
+    QVector<HttpCacheIndex::Item> m_lateItems;
+    bool m_rebuildIndex;
+    qint64 m_scanStart;
     qint64 m_totalSizeOnDisk;
 };
 
@@ -762,9 +616,10 @@ int main(int argc, char **argv)
         t.start();
         cacheDir.refresh();
         //qDebug() << "time to refresh the cacheDir QDir:" << t.elapsed();
-        CacheCleaner cleaner(cacheDir);
+        HttpCacheIndex index;
+        index.open(cacheDirName);
+        CacheCleaner cleaner(cacheDir, &index);
         while (!cleaner.processSlice()) { }
-        QFile::remove(filePath(QStringLiteral("scoreboard")));
         return 0;
     }
 
@@ -778,7 +633,9 @@ int main(int argc, char **argv)
     QList<QLocalSocket *> sockets;
     qint64 newBytesCounter = LLONG_MAX;  // force cleaner run on startup
 
-    Scoreboard scoreboard;
+    HttpCacheIndex index;
+    // a missing or incomplete index means one scan of the cache directory
+    index.open(cacheDirName);
     CacheCleaner *cleaner = nullptr;
     while (QDBusConnection::sessionBus().isConnected()) {
         g_currentDate = QDateTime::currentDateTime();
@@ -811,20 +668,36 @@ int main(int argc, char **argv)
                     break;
                 }
                 Q_ASSERT(recv.size() == 80);
-                newBytesCounter += scoreboard.runCommand(recv);
+                HttpCacheIndex::Item item;
+                newBytesCounter += runCommand(recv, &item);
+                if (!item.key.isEmpty()) {
+                    index.insert(item.key, item.entry);
+                    if (cleaner) {
+                        cleaner->noteEntry(item);
+                    }
+                }
             }
         }
 
+        // keep the probe sequences short; this also drops the removed entries
+        if (index.isOpen() && !cleaner && index.usedSlots() > index.capacity() / 2) {
+            index.rebuild(cacheDirName, qMax(index.capacity(), index.count() * 4));
+        }
+
         // interleave cleaning with serving ioslaves to reduce "garbage collection pauses"
         if (cleaner) {
-            if (cleaner->processSlice(&scoreboard)) {
+            if (cleaner->processSlice()) {
                 // that was the last slice, done
                 delete cleaner;
                 cleaner = nullptr;
             }
         } else if (newBytesCounter > (g_maxCacheSize / 8)) {
-            cacheDir.refresh();
-            cleaner = new CacheCleaner(cacheDir);
+            if (index.isComplete()) {
+                cleaner = new CacheCleaner(&index);
+            } else {
+                cacheDir.refresh();
+                cleaner = new CacheCleaner(cacheDir, &index);
+            }
             newBytesCounter = 0;
         }
     }
@@ -0,0 +1,582 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "httpcacheindex.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSaveFile>
+#include <QThread>
+#include <QtEndian>
+
+#include <atomic>
+#include <string.h>
+
+// The file is only shared between processes of the same machine, everything is in host byte order.
+struct HttpCacheIndex::Header {
+    quint32 magic;
+    quint32 version;
+    quint32 capacity;
+    std::atomic<quint32> flags;
+    std::atomic<quint32> count; // entries
+    std::atomic<quint32> usedSlots; // entries and removed entries
+};
+
+struct HttpCacheIndex::Slot {
+    std::atomic<quint32> seq; // odd while a writer owns the slot
+    quint32 state;
+    quint8 key[KeySize];
+    qint32 useCount;
+    qint64 lastUsedDate;
+    qint64 size;
+};
+
+static const quint32 s_indexMagic = 0x4b484349; // "KHCI"
+static const quint32 s_indexVersion = 2;
+static const int s_headerSize = 64;
+static const int s_minCapacity = 1024;
+static const int s_maxAttempts = 100; // while the cleaner replaces the index
+// Writers hold a slot for a few stores; one holding it longer than that died
+static const int s_maxSlotWait = 100; // ms
+
+enum SlotState : quint32 {
+    EmptySlot = 0,
+    UsedSlot,
+    RemovedSlot, // keeps the probe sequences of the following entries intact
+    MovedSlot, // the index was replaced
+    StuckSlot, // never stored: held by a writer which died
+};
+
+enum IndexFlag : quint32 {
+    IncompleteFlag = 0x1,
+    ReplacedFlag = 0x2,
+};
+
+HttpCacheIndex::HttpCacheIndex()
+{
+}
+
+HttpCacheIndex::~HttpCacheIndex()
+{
+    close();
+}
+
+HttpCacheIndex::Header *HttpCacheIndex::header() const
+{
+    return reinterpret_cast<Header *>(m_map);
+}
+
+HttpCacheIndex::Slot *HttpCacheIndex::slot(quint32 index) const
+{
+    return reinterpret_cast<Slot *>(m_map + s_headerSize) + index;
+}
+
+quint32 HttpCacheIndex::firstSlot(const QByteArray &key) const
+{
+    // the key is a SHA1 already, any part of it is a good hash
+    return qFromUnaligned<quint32>(key.constData()) % m_capacity;
+}
+
+bool HttpCacheIndex::open(const QString &cacheDir)
+{
+    Q_STATIC_ASSERT(sizeof(Header) <= s_headerSize);
+    Q_STATIC_ASSERT(sizeof(Slot) == 48);
+    Q_STATIC_ASSERT(sizeof(std::atomic<quint32>) == sizeof(quint32));
+
+    close();
+    m_cacheDir = cacheDir;
+    m_file.setFileName(cacheDir + QLatin1String("/index"));
+    // ReadWrite would create it
+    if (!m_file.exists() || !m_file.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+    const qint64 size = m_file.size();
+    if (size < s_headerSize) {
+        m_file.close();
+        return false;
+    }
+    m_map = m_file.map(0, size);
+    m_file.close(); // the mapping stays valid
+    if (!m_map) {
+        return false;
+    }
+
+    const Header *h = header();
+    if (h->magic != s_indexMagic || h->version != s_indexVersion || h->capacity == 0
+        || size != s_headerSize + qint64(h->capacity) * qint64(sizeof(Slot))) {
+        close();
+        return false;
+    }
+    m_capacity = h->capacity;
+    return true;
+}
+
+bool HttpCacheIndex::isOpen() const
+{
+    return m_map;
+}
+
+void HttpCacheIndex::close()
+{
+    if (m_map) {
+        m_file.unmap(m_map);
+        m_map = nullptr;
+    }
+    m_capacity = 0;
+}
+
+bool HttpCacheIndex::reopen()
+{
+    // give the cleaner a moment to put the new index in place
+    QThread::msleep(10);
+    const QString cacheDir = m_cacheDir;
+    return open(cacheDir);
+}
+
+bool HttpCacheIndex::isComplete() const
+{
+    return m_map && !(header()->flags.load(std::memory_order_acquire) & (IncompleteFlag | ReplacedFlag));
+}
+
+int HttpCacheIndex::count() const
+{
+    return m_map ? int(header()->count.load(std::memory_order_relaxed)) : 0;
+}
+
+int HttpCacheIndex::capacity() const
+{
+    return int(m_capacity);
+}
+
+int HttpCacheIndex::usedSlots() const
+{
+    return m_map ? int(header()->usedSlots.load(std::memory_order_relaxed)) : 0;
+}
+
+// Waits for the writer owning a slot. @return false if it doesn't let go of it
+static bool waitForSlot(QElapsedTimer *timer)
+{
+    if (!timer->isValid()) {
+        timer->start();
+    } else if (timer->hasExpired(s_maxSlotWait)) {
+        return false;
+    }
+    QThread::yieldCurrentThread();
+    return true;
+}
+
+bool HttpCacheIndex::lockSlot(Slot *slot, quint32 *seq)
+{
+    QElapsedTimer timer;
+    *seq = slot->seq.load(std::memory_order_relaxed);
+    for (;;) {
+        if (*seq & 1) {
+            if (!waitForSlot(&timer)) {
+                return false;
+            }
+            *seq = slot->seq.load(std::memory_order_relaxed);
+        } else if (slot->seq.compare_exchange_weak(*seq, *seq + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+void HttpCacheIndex::unlockSlot(Slot *slot, quint32 seq)
+{
+    slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+void HttpCacheIndex::writeEntry(Slot *slot, const Entry &entry)
+{
+    slot->useCount = entry.useCount;
+    slot->lastUsedDate = entry.lastUsedDate;
+    slot->size = entry.size;
+}
+
+quint32 HttpCacheIndex::readSlot(Slot *slot, const QByteArray &key, bool *matches, Entry *entry)
+{
+    QElapsedTimer timer;
+    for (;;) {
+        const quint32 seq = slot->seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            if (!waitForSlot(&timer)) {
+                *matches = false;
+                return StuckSlot;
+            }
+            continue;
+        }
+        const quint32 state = slot->state;
+        *matches = state == UsedSlot && (key.isEmpty() || memcmp(slot->key, key.constData(), KeySize) == 0);
+        if (*matches && entry) {
+            entry->useCount = slot->useCount;
+            entry->lastUsedDate = slot->lastUsedDate;
+            entry->size = slot->size;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->seq.load(std::memory_order_relaxed) == seq) {
+            return state;
+        }
+    }
+}
+
+template<typename Operation>
+bool HttpCacheIndex::retry(Operation operation)
+{
+    if (!m_map) {
+        return false;
+    }
+    for (int attempt = 0; attempt < s_maxAttempts; ++attempt) {
+        if (!m_map && !reopen()) {
+            continue;
+        }
+        switch (operation()) {
+        case Done:
+            return true;
+        case NotDone:
+            return false;
+        case Moved:
+            close();
+            break;
+        case Stuck:
+            // The entries behind the slot can't be trusted anymore,
+            // until the cleaner rebuilds the index from the cache files
+            qWarning() << "A slot of the HTTP cache index is stuck, marking the index as incomplete";
+            header()->flags.fetch_or(IncompleteFlag, std::memory_order_release);
+            return false;
+        }
+    }
+    return false;
+}
+
+HttpCacheIndex::Result HttpCacheIndex::tryFind(const QByteArray &key, Entry *entry)
+{
+    quint32 index = firstSlot(key);
+    for (quint32 probes = 0; probes < m_capacity; ++probes, index = (index + 1) % m_capacity) {
+        bool matches;
+        switch (readSlot(slot(index), key, &matches, entry)) {
+        case EmptySlot:
+            return NotDone;
+        case MovedSlot:
+            return Moved;
+        case StuckSlot:
+            return Stuck;
+        default:
+            if (matches) {
+                return Done;
+            }
+        }
+    }
+    return NotDone;
+}
+
+bool HttpCacheIndex::find(const QByteArray &key, Entry *entry)
+{
+    if (key.size() != KeySize) {
+        return false;
+    }
+    return retry([&]() {
+        return tryFind(key, entry);
+    });
+}
+
+HttpCacheIndex::Result HttpCacheIndex::tryInsert(const QByteArray &key, const Entry &entry)
+{
+    quint32 index = firstSlot(key);
+    quint32 freeSlot = m_capacity;
+    for (quint32 probes = 0; probes < m_capacity; ++probes, index = (index + 1) % m_capacity) {
+        Slot *s = slot(index);
+        quint32 seq;
+        if (!lockSlot(s, &seq)) {
+            return Stuck;
+        }
+        const quint32 state = s->state;
+        if (state == MovedSlot) {
+            unlockSlot(s, seq);
+            return Moved;
+        }
+        if (state == UsedSlot && memcmp(s->key, key.constData(), KeySize) == 0) {
+            writeEntry(s, entry);
+            unlockSlot(s, seq);
+            return Done;
+        }
+        if (state == RemovedSlot && freeSlot == m_capacity) {
+            // reuse it, unless the key shows up further on
+            freeSlot = index;
+        } else if (state == EmptySlot) {
+            if (freeSlot == m_capacity) {
+                memcpy(s->key, key.constData(), KeySize);
+                writeEntry(s, entry);
+                s->state = UsedSlot;
+                unlockSlot(s, seq);
+                header()->count.fetch_add(1, std::memory_order_relaxed);
+                header()->usedSlots.fetch_add(1, std::memory_order_relaxed);
+                return Done;
+            }
+            unlockSlot(s, seq);
+            break;
+        }
+        unlockSlot(s, seq);
+    }
+
+    if (freeSlot == m_capacity) {
+        header()->flags.fetch_or(IncompleteFlag, std::memory_order_release);
+        return NotDone;
+    }
+    Slot *s = slot(freeSlot);
+    quint32 seq;
+    if (!lockSlot(s, &seq)) {
+        return Stuck;
+    }
+    if (s->state != RemovedSlot) {
+        // somebody else took it meanwhile, start over
+        const bool moved = s->state == MovedSlot;
+        unlockSlot(s, seq);
+        return moved ? Moved : tryInsert(key, entry);
+    }
+    memcpy(s->key, key.constData(), KeySize);
+    writeEntry(s, entry);
+    s->state = UsedSlot;
+    unlockSlot(s, seq);
+    header()->count.fetch_add(1, std::memory_order_relaxed);
+    return Done;
+}
+
+bool HttpCacheIndex::insert(const QByteArray &key, const Entry &entry)
+{
+    if (key.size() != KeySize) {
+        return false;
+    }
+    return retry([&]() {
+        return tryInsert(key, entry);
+    });
+}
+
+HttpCacheIndex::Result HttpCacheIndex::tryTouch(const QByteArray &key, qint64 lastUsedDate)
+{
+    quint32 index = firstSlot(key);
+    for (quint32 probes = 0; probes < m_capacity; ++probes, index = (index + 1) % m_capacity) {
+        Slot *s = slot(index);
+        quint32 seq;
+        if (!lockSlot(s, &seq)) {
+            return Stuck;
+        }
+        const quint32 state = s->state;
+        if (state == UsedSlot && memcmp(s->key, key.constData(), KeySize) == 0) {
+            s->useCount++;
+            s->lastUsedDate = lastUsedDate;
+        }
+        unlockSlot(s, seq);
+        if (state == EmptySlot) {
+            return NotDone;
+        } else if (state == MovedSlot) {
+            return Moved;
+        } else if (state == UsedSlot && memcmp(s->key, key.constData(), KeySize) == 0) {
+            return Done;
+        }
+    }
+    return NotDone;
+}
+
+bool HttpCacheIndex::touch(const QByteArray &key, qint64 lastUsedDate)
+{
+    if (key.size() != KeySize) {
+        return false;
+    }
+    return retry([&]() {
+        return tryTouch(key, lastUsedDate);
+    });
+}
+
+HttpCacheIndex::Result HttpCacheIndex::tryRemove(const QByteArray &key)
+{
+    quint32 index = firstSlot(key);
+    for (quint32 probes = 0; probes < m_capacity; ++probes, index = (index + 1) % m_capacity) {
+        Slot *s = slot(index);
+        quint32 seq;
+        if (!lockSlot(s, &seq)) {
+            return Stuck;
+        }
+        const quint32 state = s->state;
+        const bool matches = state == UsedSlot && memcmp(s->key, key.constData(), KeySize) == 0;
+        if (matches) {
+            s->state = RemovedSlot;
+        }
+        unlockSlot(s, seq);
+        if (matches) {
+            header()->count.fetch_sub(1, std::memory_order_relaxed);
+            return Done;
+        } else if (state == EmptySlot) {
+            return NotDone;
+        } else if (state == MovedSlot) {
+            return Moved;
+        }
+    }
+    return NotDone;
+}
+
+bool HttpCacheIndex::remove(const QByteArray &key)
+{
+    if (key.size() != KeySize) {
+        return false;
+    }
+    return retry([&]() {
+        return tryRemove(key);
+    });
+}
+
+QVector<HttpCacheIndex::Item> HttpCacheIndex::items()
+{
+    QVector<Item> result;
+    retry([&]() {
+        result.clear();
+        result.reserve(count());
+        for (quint32 index = 0; index < m_capacity; ++index) {
+            Slot *s = slot(index);
+            Item item;
+            bool used;
+            const quint32 state = readSlot(s, QByteArray(), &used, &item.entry);
+            if (state == MovedSlot) {
+                return Moved;
+            } else if (state == StuckSlot) {
+                // skip it, but have the index rebuilt
+                header()->flags.fetch_or(IncompleteFlag, std::memory_order_release);
+            } else if (used) {
+                item.key = QByteArray(reinterpret_cast<const char *>(s->key), KeySize);
+                if (readSlot(s, item.key, &used, nullptr) == UsedSlot && used) {
+                    result.append(item);
+                }
+            }
+        }
+        return Done;
+    });
+    return result;
+}
+
+bool HttpCacheIndex::rebuild(const QString &cacheDir, int capacity, const QVector<Item> *items)
+{
+    QVector<Item> current;
+    // to put the current index back in use if the new one can't be saved
+    QVector<quint32> retiredStates;
+    // only the entries of the current index are known to be missing some
+    bool incomplete = false;
+    bool stuck = false;
+    const bool replacing = m_map && m_cacheDir == cacheDir;
+    if (replacing) {
+        retiredStates.reserve(int(m_capacity));
+        incomplete = !items && (header()->flags.load(std::memory_order_acquire) & IncompleteFlag);
+        // Retire the slots while collecting them, so that nothing written
+        // to the old index after this point can get lost
+        for (quint32 index = 0; index < m_capacity; ++index) {
+            Slot *s = slot(index);
+            quint32 seq;
+            const bool locked = lockSlot(s, &seq);
+            if (!locked) {
+                // its writer died: take the slot over, without trusting its contents
+                seq = s->seq.load(std::memory_order_relaxed) - 1;
+                incomplete = incomplete || !items;
+                stuck = true;
+            }
+            if (locked && !items && s->state == UsedSlot) {
+                Item item;
+                item.key = QByteArray(reinterpret_cast<const char *>(s->key), KeySize);
+                item.entry.useCount = s->useCount;
+                item.entry.lastUsedDate = s->lastUsedDate;
+                item.entry.size = s->size;
+                current.append(item);
+            }
+            // what a dead writer left can't be trusted, but keeps the probe sequences intact
+            retiredStates.append(locked || s->state != UsedSlot ? s->state : quint32(RemovedSlot));
+            s->state = MovedSlot;
+            unlockSlot(s, seq);
+        }
+    }
+    if (!items) {
+        items = &current;
+    }
+
+    // keep the load factor at 50% at most
+    const quint32 newCapacity = quint32(qMax(qMax(capacity, s_minCapacity), items->size() * 2));
+    QByteArray data(s_headerSize + int(newCapacity * sizeof(Slot)), '\0');
+    Header *h = reinterpret_cast<Header *>(data.data());
+    h->magic = s_indexMagic;
+    h->version = s_indexVersion;
+    h->capacity = newCapacity;
+    h->flags.store(incomplete ? IncompleteFlag : 0, std::memory_order_relaxed);
+    h->count.store(0, std::memory_order_relaxed);
+    h->usedSlots.store(0, std::memory_order_relaxed);
+    Slot *slots = reinterpret_cast<Slot *>(data.data() + s_headerSize);
+    quint32 count = 0;
+    for (const Item &item : *items) {
+        if (item.key.size() != KeySize) {
+            continue;
+        }
+        quint32 index = qFromUnaligned<quint32>(item.key.constData()) % newCapacity;
+        while (slots[index].state == UsedSlot && memcmp(slots[index].key, item.key.constData(), KeySize) != 0) {
+            index = (index + 1) % newCapacity;
+        }
+        if (slots[index].state != UsedSlot) {
+            ++count;
+        }
+        Slot *s = slots + index;
+        memcpy(s->key, item.key.constData(), KeySize);
+        writeEntry(s, item.entry);
+        s->state = UsedSlot;
+    }
+    h->count.store(count, std::memory_order_relaxed);
+    h->usedSlots.store(count, std::memory_order_relaxed);
+
+    QSaveFile file(cacheDir + QLatin1String("/index"));
+    const bool saved = file.open(QIODevice::WriteOnly) && file.write(data) == data.size() && file.commit();
+    if (!saved) {
+        if (replacing) {
+            restoreSlots(retiredStates, stuck);
+        }
+        return false;
+    }
+    if (replacing) {
+        // the processes still using the old index will have to reopen it
+        header()->flags.fetch_or(ReplacedFlag, std::memory_order_release);
+    }
+    return open(cacheDir);
+}
+
+void HttpCacheIndex::restoreSlots(const QVector<quint32> &states, bool stuck)
+{
+    // Otherwise everybody would keep finding moved slots, and no index to move to
+    quint32 count = 0;
+    for (quint32 index = 0; index < m_capacity; ++index) {
+        Slot *s = slot(index);
+        quint32 seq;
+        if (!lockSlot(s, &seq)) {
+            // a writer took it after we retired it, and died
+            seq = s->seq.load(std::memory_order_relaxed) - 1;
+            s->state = RemovedSlot;
+            stuck = true;
+        } else {
+            s->state = states.at(int(index));
+        }
+        if (s->state == UsedSlot) {
+            ++count;
+        }
+        unlockSlot(s, seq);
+    }
+    header()->count.store(count, std::memory_order_relaxed);
+    if (stuck) {
+        header()->flags.fetch_or(IncompleteFlag, std::memory_order_release);
+    }
+}
+
+QByteArray HttpCacheIndex::keyFromBaseName(const QString &baseName)
+{
+    const QByteArray key = QByteArray::fromHex(baseName.toLatin1());
+    return key.size() == KeySize ? key : QByteArray();
+}
+
+QString HttpCacheIndex::baseNameFromKey(const QByteArray &key)
+{
+    return QString::fromLatin1(key.toHex());
+}
@@ -0,0 +1,150 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef HTTPCACHEINDEX_H
+#define HTTPCACHEINDEX_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+/**
+ * Index of the HTTP cache directory, shared by the http slaves and
+ * kio_http_cache_cleaner through a memory mapped file ("index" in the
+ * cache directory).
+ *
+ * It maps the SHA1 of a URL, which is also the name of its cache file,
+ * to what the cleaner needs to decide which files to clean up first, so
+ * that it doesn't have to open or stat the cache files for that. The slaves
+ * use it to know that there is no cache file for a URL without looking for
+ * one; whether a cached copy can be used depends on the headers stored in
+ * its file, which has to be read anyway.
+ *
+ * The index is an open addressing hash table of fixed size slots. Every
+ * slot has a sequence counter, odd while the slot is being written: writers
+ * take it with a compare-and-swap, readers retry when it changed under them.
+ * A slot left odd by a writer which died is given up on after a while: the
+ * index is marked as incomplete, for the cleaner to rebuild it.
+ * Only the cleaner creates the index and replaces it with a bigger one
+ * (see rebuild()); the slots of a replaced index are marked as moved, and
+ * whoever finds such a slot maps the new index again.
+ */
+class HttpCacheIndex
+{
+public:
+    struct Entry {
+        qint64 lastUsedDate = 0; // in seconds since the epoch
+        qint64 size = 0; // of the cache file
+        qint32 useCount = 0;
+    };
+
+    struct Item {
+        QByteArray key;
+        Entry entry;
+    };
+
+    static const int KeySize = 20; // SHA1
+
+    HttpCacheIndex();
+    ~HttpCacheIndex();
+
+    /**
+     * Maps the index of the cache in @p cacheDir.
+     * @return false if there is no valid index (yet)
+     */
+    bool open(const QString &cacheDir);
+    bool isOpen() const;
+    void close();
+
+    /**
+     * @return true if every file in the cache has an entry, so that a
+     * missing entry means that there is no cache file either
+     */
+    bool isComplete() const;
+
+    /**
+     * @param entry may be nullptr, to only check for the key
+     */
+    bool find(const QByteArray &key, Entry *entry = nullptr);
+
+    /**
+     * Adds or replaces the entry for @p key. If the index is full, it is
+     * marked as incomplete, for the cleaner to rebuild it.
+     */
+    bool insert(const QByteArray &key, const Entry &entry);
+
+    /**
+     * Counts one more use of the entry for @p key.
+     */
+    bool touch(const QByteArray &key, qint64 lastUsedDate);
+
+    bool remove(const QByteArray &key);
+
+    /**
+     * @return all the entries
+     */
+    QVector<Item> items();
+
+    int count() const;
+    int capacity() const;
+    /**
+     * @return the slots that are or were used; removed entries keep their
+     * slot until the next rebuild()
+     */
+    int usedSlots() const;
+
+    /**
+     * Cleaner only: replaces the index of the cache in @p cacheDir by a new
+     * one with room for @p capacity entries, holding @p items if given,
+     * else the entries of the current index.
+     * If the new index can't be saved, the current one stays in use.
+     */
+    bool rebuild(const QString &cacheDir, int capacity, const QVector<Item> *items = nullptr);
+
+    static QByteArray keyFromBaseName(const QString &baseName);
+    static QString baseNameFromKey(const QByteArray &key);
+
+private:
+    struct Header;
+    struct Slot;
+
+    enum Result {
+        Done,
+        NotDone,
+        Moved, // the index was replaced, map the new one and try again
+        Stuck, // a slot is held by a writer which died, the index is incomplete
+    };
+
+    Header *header() const;
+    Slot *slot(quint32 index) const;
+    // @return false if the slot stays locked, see Stuck
+    static bool lockSlot(Slot *slot, quint32 *seq);
+    static void unlockSlot(Slot *slot, quint32 seq);
+    static void writeEntry(Slot *slot, const Entry &entry);
+    // puts back the slots retired by a rebuild() which failed
+    void restoreSlots(const QVector<quint32> &states, bool stuck);
+    // @return the state of the slot, @p matches tells whether it has @p key
+    static quint32 readSlot(Slot *slot, const QByteArray &key, bool *matches, Entry *entry);
+
+    Result tryFind(const QByteArray &key, Entry *entry);
+    Result tryInsert(const QByteArray &key, const Entry &entry);
+    Result tryTouch(const QByteArray &key, qint64 lastUsedDate);
+    Result tryRemove(const QByteArray &key);
+    template<typename Operation>
+    bool retry(Operation operation);
+
+    quint32 firstSlot(const QByteArray &key) const;
+    bool reopen();
+
+    QString m_cacheDir;
+    QFile m_file;
+    uchar *m_map = nullptr;
+    quint32 m_capacity = 0;
+};
+
+#endif
@@ -31,6 +31,10 @@
 #include <QTextStream>
 #include <QLocale>
 #include <QUrl>
+#include <qplatformdefs.h>
+
+#include <algorithm>
+#include <functional>
 
 Q_LOGGING_CATEGORY(KIO_COOKIEJAR, "kf.kio.slaves.http.cookiejar")
 
@@ -44,6 +48,7 @@ Q_LOGGING_CATEGORY(KIO_COOKIEJAR, "kf.kio.slaves.http.cookiejar")
 
 #define MAX_COOKIES_PER_HOST 25
 #define READ_BUFFER_SIZE 8192
+#define MAX_JOURNAL_LINES 4096
 #define IP_ADDRESS_EXPRESSION "(?:(?:25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)\\.){3}(?:25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)"
 
 // Note with respect to QLatin1String( )....
@@ -121,6 +126,43 @@ static qint64 epoch()
     return toEpochSecs(QDateTime::currentDateTimeUtc());
 }
 
+static QString hostWithPort(const KHttpCookie *cookie)
+{
+    const QList<int> &ports = cookie->ports();
+
+    if (ports.isEmpty()) {
+        return cookie->host();
+    }
+
+    QStringList portList;
+    for (int port : ports) {
+        portList << QString::number(port);
+    }
+
+    return (cookie->host() + QL1C(':') + portList.join(QLatin1Char(',')));
+}
+
+//
+// Returns the line saving @p cookie in the cookie file
+//
+static QByteArray cookieFileLine(const KHttpCookie &cookie)
+{
+    const QString path = QL1C('"') + cookie.path() + QL1C('"');
+    const QString domain = QL1C('"') + cookie.domain() + QL1C('"');
+    const QString host = hostWithPort(&cookie);
+
+    // TODO: replace with direct QTextStream output ?
+    const QString str = QString::asprintf("%-20s %-20s %-12s %10lld  %3d %-20s %-4i %s\n",
+              host.toLatin1().constData(), domain.toLatin1().constData(),
+              path.toLatin1().constData(), cookie.expireDate(),
+              cookie.protocolVersion(),
+              cookie.name().isEmpty() ? cookie.value().toLatin1().constData() : cookie.name().toLatin1().constData(),
+              (cookie.isSecure() ? 1 : 0) + (cookie.isHttpOnly() ? 2 : 0) +
+              (cookie.hasExplicitPath() ? 4 : 0) + (cookie.name().isEmpty() ? 8 : 0),
+              cookie.value().toLatin1().constData());
+    return str.toLatin1();
+}
+
 QString KCookieJar::adviceToStr(KCookieAdvice _advice)
 {
     switch (_advice) {
@@ -292,6 +334,8 @@ KCookieJar::KCookieJar()
     m_globalAdvice = KCookieDunno;
     m_configChanged = false;
     m_cookiesChanged = false;
+    m_journalLines = 0;
+    m_compactionNeeded = true;
 
     KConfig cfg(QStringLiteral("kf5/kcookiejar/domain_info"), KConfig::NoGlobals, QStandardPaths::GenericDataLocation);
     KConfigGroup group(&cfg, QString());
@@ -314,7 +358,8 @@ KCookieJar::~KCookieJar()
 }
 
 // cookiePtr is modified: the window ids of the existing cookie in the list are added to it
-static void removeDuplicateFromList(KHttpCookieList *list, KHttpCookie &cookiePtr, bool nameMatchOnly = false, bool updateWindowId = false)
+// Returns whether a cookie was removed
+static bool removeDuplicateFromList(KHttpCookieList *list, KHttpCookie &cookiePtr, bool nameMatchOnly = false, bool updateWindowId = false)
 {
     QString domain1 = cookiePtr.domain();
     if (domain1.isEmpty()) {
@@ -339,9 +384,10 @@ static void removeDuplicateFromList(KHttpCookieList *list, KHttpCookie &cookiePt
                 }
             }
             cookieIterator.remove();
-            break;
+            return true;
         }
     }
+    return false;
 }
 
 //
@@ -359,6 +405,8 @@ QString KCookieJar::findCookies(const QString &_url, bool useDOMFormat, WId wind
         return cookieStr;
     }
 
+    eatExpiredCookies();
+
     const bool secureRequest = (_url.startsWith(QL1S("https://"), Qt::CaseInsensitive) ||
                                 _url.startsWith(QL1S("webdavs://"), Qt::CaseInsensitive));
     if (port == -1) {
@@ -367,6 +415,8 @@ QString KCookieJar::findCookies(const QString &_url, bool useDOMFormat, WId wind
 
     extractDomains(fqdn, domains);
 
+    // Most cookies of a domain come from the same few hosts
+    QHash<QString, KCookieAdvice> hostAdvices;
     KHttpCookieList allCookies;
     for (QStringList::ConstIterator it = domains.constBegin(), itEnd = domains.constEnd();; ++it) {
         KHttpCookieList *cookieList = nullptr;
@@ -391,7 +441,7 @@ QString KCookieJar::findCookies(const QString &_url, bool useDOMFormat, WId wind
         QMutableListIterator<KHttpCookie> cookieIt(*cookieList);
         while (cookieIt.hasNext()) {
             KHttpCookie &cookie = cookieIt.next();
-            if (cookieAdvice(cookie) == KCookieReject) {
+            if (cookieAdvice(cookie, &hostAdvices) == KCookieReject) {
                 continue;
             }
 
@@ -459,6 +509,74 @@ QString KCookieJar::findCookies(const QString &_url, bool useDOMFormat, WId wind
     return cookieStr;
 }
 
+//
+// Looks for the cookies in the cookie jar which are appropriate for the host
+// of _url, whatever their path and whether they are secure, for callers
+// which cache them per host and select them per request themselves.
+//
+KHttpCookieList KCookieJar::findHostCookies(const QString &_url, WId windowId, qint64 *validUntil)
+{
+    KHttpCookieList hostCookies;
+    QString fqdn, path;
+    QStringList domains;
+    int port = -1;
+    if (validUntil) {
+        *validUntil = 0;
+    }
+
+    if (!parseUrl(_url, fqdn, path, &port)) {
+        return hostCookies;
+    }
+
+    eatExpiredCookies();
+
+    if (port == -1) {
+        const bool secureRequest = (_url.startsWith(QL1S("https://"), Qt::CaseInsensitive) ||
+                                    _url.startsWith(QL1S("webdavs://"), Qt::CaseInsensitive));
+        port = (secureRequest ? 443 : 80);
+    }
+
+    extractDomains(fqdn, domains);
+
+    QHash<QString, KCookieAdvice> hostAdvices;
+    for (const QString &domain : qAsConst(domains)) {
+        KHttpCookieList *cookieList = m_cookieDomains.value(domain.isNull() ? QStringLiteral("") : domain);
+        if (!cookieList) {
+            continue;    // No cookies for this domain
+        }
+
+        QMutableListIterator<KHttpCookie> cookieIt(*cookieList);
+        while (cookieIt.hasNext()) {
+            KHttpCookie &cookie = cookieIt.next();
+            if (cookieAdvice(cookie, &hostAdvices) == KCookieReject) {
+                continue;
+            }
+
+            // Any path of the host will do, the caller matches the paths
+            const QString cookiePath = cookie.path().isEmpty() ? QStringLiteral("/") : cookie.path();
+            if (!cookie.match(fqdn, domains, cookiePath, port)) {
+                continue;
+            }
+
+            if (cookie.isExpired()) {
+                m_cookiesChanged = true;
+                continue;
+            }
+
+            if (windowId && (cookie.windowIds().indexOf(windowId) == -1)) {
+                cookie.windowIds().append(windowId);
+            }
+
+            if (validUntil && cookie.expireDate() > 0 && (*validUntil == 0 || cookie.expireDate() < *validUntil)) {
+                *validUntil = cookie.expireDate();
+            }
+            hostCookies.append(cookie);
+        }
+    }
+
+    return hostCookies;
+}
+
 //
 // This function parses a string like 'my_name="my_value";' and returns
 // 'my_name' in Name and 'my_value' in Value.
@@ -956,6 +1074,7 @@ void KCookieJar::addCookie(KHttpCookie &cookie)
         }
     }
 
+    bool replaced = false;
     for (const QString &key : qAsConst(domains)) {
         KHttpCookieList *list;
 
@@ -965,8 +1084,8 @@ void KCookieJar::addCookie(KHttpCookie &cookie)
             list = m_cookieDomains.value(key);
         }
 
-        if (list) {
-            removeDuplicateFromList(list, cookie, false, true);
+        if (list && removeDuplicateFromList(list, cookie, false, true)) {
+            replaced = true;
         }
     }
 
@@ -1007,6 +1126,22 @@ void KCookieJar::addCookie(KHttpCookie &cookie)
         std::stable_sort(cookieList->begin(), cookieList->end(), compareCookies);
 
         m_cookiesChanged = true;
+        if (cookie.expireDate() > 0) {
+            scheduleExpiry(domain, cookie.expireDate());
+        }
+        if (cookieIsPersistent(cookie)) {
+            // No need to journal what the next save rewrites anyway
+            if (!m_compactionNeeded) {
+                m_journal.append("+ " + cookieFileLine(cookie));
+            }
+            return;
+        }
+    }
+
+    if (replaced) {
+        // The cookie saved before is gone
+        m_cookiesChanged = true;
+        journalRemoval(cookie);
     }
 }
 
@@ -1015,6 +1150,15 @@ void KCookieJar::addCookie(KHttpCookie &cookie)
 // be added to the cookie jar.
 //
 KCookieAdvice KCookieJar::cookieAdvice(const KHttpCookie &cookie) const
+{
+    return cookieAdvice(cookie, nullptr);
+}
+
+//
+// @p hostAdvices, if given, keeps the advice of the domains of each host
+// across calls.
+//
+KCookieAdvice KCookieJar::cookieAdvice(const KHttpCookie &cookie, QHash<QString, KCookieAdvice> *hostAdvices) const
 {
     if (m_rejectCrossDomainCookies && cookie.isCrossDomain()) {
         return KCookieReject;
@@ -1028,6 +1172,13 @@ KCookieAdvice KCookieJar::cookieAdvice(const KHttpCookie &cookie) const
         return KCookieAccept;
     }
 
+    if (hostAdvices) {
+        const auto it = hostAdvices->constFind(cookie.host());
+        if (it != hostAdvices->constEnd()) {
+            return it.value();
+        }
+    }
+
     QStringList domains;
     extractDomains(cookie.host(), domains);
 
@@ -1047,6 +1198,9 @@ KCookieAdvice KCookieJar::cookieAdvice(const KHttpCookie &cookie) const
         advice = m_globalAdvice;
     }
 
+    if (hostAdvices) {
+        hostAdvices->insert(cookie.host(), advice);
+    }
     return advice;
 }
 
@@ -1099,6 +1253,7 @@ void KCookieJar::setDomainAdvice(const QString &domain, KCookieAdvice _advice)
     if (cookieList) {
         if (cookieList->getAdvice() != _advice) {
             m_configChanged = true;
+            m_compactionNeeded = true;
             // domain is already known
             cookieList->setAdvice(_advice);
         }
@@ -1113,6 +1268,7 @@ void KCookieJar::setDomainAdvice(const QString &domain, KCookieAdvice _advice)
         if (_advice != KCookieDunno) {
             // We should create a domain entry
             m_configChanged = true;
+            m_compactionNeeded = true;
             // Make a new cookie list
             cookieList = new KHttpCookieList();
             cookieList->setAdvice(_advice);
@@ -1141,6 +1297,7 @@ void KCookieJar::setGlobalAdvice(KCookieAdvice _advice)
 {
     if (m_globalAdvice != _advice) {
         m_configChanged = true;
+        m_compactionNeeded = true;
     }
     m_globalAdvice = _advice;
 }
@@ -1181,6 +1338,8 @@ void KCookieJar::eatCookie(const KHttpCookieList::iterator &cookieIterator)
     KHttpCookieList *cookieList = m_cookieDomains.value(domain);
 
     if (cookieList) {
+        journalRemoval(cookie);
+        m_cookiesChanged = true;
         // This deletes cookie!
         cookieList->erase(cookieIterator);
 
@@ -1207,6 +1366,7 @@ void KCookieJar::eatCookiesForDomain(const QString &domain)
         m_domainList.removeAll(domain);
     }
     m_cookiesChanged = true;
+    m_compactionNeeded = true;
 }
 
 void KCookieJar::eatSessionCookies(long windowId)
@@ -1220,6 +1380,64 @@ void KCookieJar::eatSessionCookies(long windowId)
     }
 }
 
+void KCookieJar::eatExpiredCookies()
+{
+    const qint64 currentTime = epoch();
+    const std::greater<QPair<qint64, QString>> laterFirst;
+    while (!m_expiryHeap.isEmpty() && m_expiryHeap.first().first < currentTime) {
+        std::pop_heap(m_expiryHeap.begin(), m_expiryHeap.end(), laterFirst);
+        const QPair<qint64, QString> entry = m_expiryHeap.takeLast();
+        const auto expiryIt = m_domainExpiry.find(entry.second);
+        if (expiryIt == m_domainExpiry.end() || expiryIt.value() != entry.first) {
+            continue; // Outdated entry
+        }
+        m_domainExpiry.erase(expiryIt);
+
+        KHttpCookieList *cookieList = m_cookieDomains.value(entry.second);
+        if (!cookieList) {
+            continue;
+        }
+        qint64 nextExpiry = 0;
+        QMutableListIterator<KHttpCookie> cookieIterator(*cookieList);
+        while (cookieIterator.hasNext()) {
+            const KHttpCookie &cookie = cookieIterator.next();
+            if (cookie.isExpired(currentTime)) {
+                // Expired cookies are not loaded again, no need to journal their removal
+                cookieIterator.remove();
+                m_cookiesChanged = true;
+            } else if (cookie.expireDate() > 0 && (nextExpiry == 0 || cookie.expireDate() < nextExpiry)) {
+                nextExpiry = cookie.expireDate();
+            }
+        }
+        if (nextExpiry > 0) {
+            scheduleExpiry(entry.second, nextExpiry);
+        } else if (cookieList->isEmpty() && cookieList->getAdvice() == KCookieDunno) {
+            // This deletes cookieList!
+            delete m_cookieDomains.take(entry.second);
+            m_domainList.removeAll(entry.second);
+        }
+    }
+}
+
+//
+// Makes eatExpiredCookies() visit @p domain at @p expireDate, unless
+// it will already do so earlier
+//
+void KCookieJar::scheduleExpiry(const QString &domain, qint64 expireDate)
+{
+    auto it = m_domainExpiry.find(domain);
+    if (it != m_domainExpiry.end()) {
+        if (it.value() <= expireDate) {
+            return;
+        }
+        it.value() = expireDate; // The previous entry becomes outdated
+    } else {
+        m_domainExpiry.insert(domain, expireDate);
+    }
+    m_expiryHeap.append(qMakePair(expireDate, domain));
+    std::push_heap(m_expiryHeap.begin(), m_expiryHeap.end(), std::greater<QPair<qint64, QString>>());
+}
+
 void KCookieJar::eatAllCookies()
 {
     // we need a copy as eatCookiesForDomain() might remove domain from m_domainList
@@ -1269,28 +1487,41 @@ void KCookieJar::eatSessionCookies(const QString &fqdn, WId windowId,
     }
 }
 
-static QString hostWithPort(const KHttpCookie *cookie)
-{
-    const QList<int> &ports = cookie->ports();
-
-    if (ports.isEmpty()) {
-        return cookie->host();
-    }
-
-    QStringList portList;
-    for (int port : ports) {
-        portList << QString::number(port);
-    }
-
-    return (cookie->host() + QL1C(':') + portList.join(QLatin1Char(',')));
-}
-
 //
 // Saves all cookies to the file '_filename'.
 // On success 'true' is returned.
 // On failure 'false' is returned.
 bool KCookieJar::saveCookies(const QString &_filename)
 {
+    eatExpiredCookies();
+
+    const QString journalName = _filename + QL1S(".journal");
+    if (!m_compactionNeeded && _filename == m_cookieFile
+            && m_journalLines + m_journal.count() <= MAX_JOURNAL_LINES && QFile::exists(_filename)) {
+        if (m_journal.isEmpty()) {
+            m_cookiesChanged = false;
+            return true;
+        }
+        // Created readable by the user only from the start, the cookies
+        // must not be readable by others even for a moment
+        QFile journal(journalName);
+        const int fd = QT_OPEN(QFile::encodeName(journalName).constData(), QT_OPEN_WRONLY | QT_OPEN_APPEND | QT_OPEN_CREAT, 0600);
+        if (fd != -1 && journal.open(fd, QIODevice::WriteOnly | QIODevice::Append, QFileDevice::AutoCloseHandle)) {
+            QByteArray changes;
+            for (const QByteArray &line : qAsConst(m_journal)) {
+                changes += line;
+            }
+            if (journal.write(changes) == changes.size() && journal.flush()) {
+                m_journalLines += m_journal.count();
+                m_journal.clear();
+                m_cookiesChanged = false;
+                return true;
+            }
+        }
+        qCWarning(KIO_COOKIEJAR) << "Could not append to" << journalName << journal.errorString();
+        // Rewrite everything instead
+    }
+
     QSaveFile cookieFile(_filename);
 
     if (!cookieFile.open(QIODevice::WriteOnly)) {
@@ -1332,26 +1563,19 @@ bool KCookieJar::saveCookies(const QString &_filename)
                     ts << '[' << domainName.toLocal8Bit().data() << "]\n";
                 }
                 // Store persistent cookies
-                const QString path = QL1C('"') + cookie.path() + QL1C('"');
-                const QString domain = QL1C('"') + cookie.domain() + QL1C('"');
-                const QString host = hostWithPort(&cookie);
-
-                // TODO: replace with direct QTextStream output ?
-                const QString str = QString::asprintf("%-20s %-20s %-12s %10lld  %3d %-20s %-4i %s\n",
-                          host.toLatin1().constData(), domain.toLatin1().constData(),
-                          path.toLatin1().constData(), cookie.expireDate(),
-                          cookie.protocolVersion(),
-                          cookie.name().isEmpty() ? cookie.value().toLatin1().constData() : cookie.name().toLatin1().constData(),
-                          (cookie.isSecure() ? 1 : 0) + (cookie.isHttpOnly() ? 2 : 0) +
-                          (cookie.hasExplicitPath() ? 4 : 0) + (cookie.name().isEmpty() ? 8 : 0),
-                          cookie.value().toLatin1().constData());
-                ts << str.toLatin1();
+                ts << cookieFileLine(cookie);
             }
         }
     }
 
     if (cookieFile.commit()) {
         QFile::setPermissions(_filename, QFile::ReadUser | QFile::WriteUser);
+        QFile::remove(journalName);
+        m_cookieFile = _filename;
+        m_journal.clear();
+        m_journalLines = 0;
+        m_compactionNeeded = false;
+        m_cookiesChanged = false;
         return true;
     }
     return false;
@@ -1414,6 +1638,75 @@ static QString extractHostAndPorts(const QString &str, QList<int> *ports = nullp
     return host;
 }
 
+//
+// Parses a line of the cookie file into @p cookie.
+// Returns false for lines which are not cookies, or expired ones.
+//
+bool KCookieJar::readCookieLine(char *line, int version, qint64 currentTime, KHttpCookie *cookie) const
+{
+    // Skip lines which begin with '#' or '['
+    if ((line[0] == '#') || (line[0] == '[')) {
+        return false;
+    }
+
+    QList<int> ports;
+    const QString host = extractHostAndPorts(QL1S(parseField(line)), &ports);
+    const QString domain = QL1S(parseField(line));
+    if (host.isEmpty() && domain.isEmpty()) {
+        return false;
+    }
+    const QString path = QL1S(parseField(line));
+    const QString expStr = QL1S(parseField(line));
+    if (expStr.isEmpty()) {
+        return false;
+    }
+    const qint64 expDate = expStr.toLongLong();
+    const QString verStr = QL1S(parseField(line));
+    if (verStr.isEmpty()) {
+        return false;
+    }
+    int protVer  = verStr.toInt();
+    QString name = QL1S(parseField(line));
+    bool keepQuotes = false;
+    bool secure = false;
+    bool httpOnly = false;
+    bool explicitPath = false;
+    const char *value = nullptr;
+    if ((version == 2) || (protVer >= 200)) {
+        if (protVer >= 200) {
+            protVer -= 200;
+        }
+        int i = atoi(parseField(line));
+        secure = i & 1;
+        httpOnly = i & 2;
+        explicitPath = i & 4;
+        if (i & 8) {
+            name = QLatin1String("");
+        }
+        line[strlen(line) - 1] = '\0'; // Strip LF.
+        value = line;
+    } else {
+        if (protVer >= 100) {
+            protVer -= 100;
+            keepQuotes = true;
+        }
+        value = parseField(line, keepQuotes);
+        secure = QByteArray(parseField(line)).toShort();
+    }
+
+    // Expired or parse error
+    if (!value || expDate == 0 || expDate < currentTime) {
+        return false;
+    }
+
+    *cookie = KHttpCookie(host, domain, path, name, QString::fromUtf8(value), expDate,
+                          protVer, secure, httpOnly, explicitPath);
+    if (!ports.isEmpty()) {
+        cookie->mPorts = ports;
+    }
+    return true;
+}
+
 //
 // Reloads all cookies from the file '_filename'.
 // On success 'true' is returned.
@@ -1446,76 +1739,82 @@ bool KCookieJar::loadCookies(const QString &_filename)
 
     if (success) {
         const qint64 currentTime = epoch();
-        QList<int> ports;
 
         while (cookieFile.readLine(buffer, READ_BUFFER_SIZE - 1) != -1) {
-            char *line = buffer;
-            // Skip lines which begin with '#' or '['
-            if ((line[0] == '#') || (line[0] == '[')) {
-                continue;
+            KHttpCookie cookie;
+            if (readCookieLine(buffer, version, currentTime, &cookie)) {
+                addCookie(cookie);
             }
+        }
 
-            const QString host = extractHostAndPorts(QL1S(parseField(line)), &ports);
-            const QString domain = QL1S(parseField(line));
-            if (host.isEmpty() && domain.isEmpty()) {
-                continue;
+        m_journalLines = 0;
+        replayJournal(_filename + QL1S(".journal"));
+        m_cookieFile = _filename;
+        m_compactionNeeded = false;
+    }
+
+    delete [] buffer;
+    m_journal.clear();
+    m_cookiesChanged = false;
+    return success;
+}
+
+//
+// Applies the changes saved to the journal '_filename' by saveCookies().
+//
+void KCookieJar::replayJournal(const QString &_filename)
+{
+    QFile journal(_filename);
+    if (!journal.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    const qint64 currentTime = epoch();
+    char *buffer = new char[READ_BUFFER_SIZE];
+    qint64 len;
+    while ((len = journal.readLine(buffer, READ_BUFFER_SIZE - 1)) > 0) {
+        ++m_journalLines;
+        // Skip a last line cut short
+        if (len < 3 || buffer[len - 1] != '\n') {
+            continue;
+        }
+        char *line = buffer + 2;
+        if (buffer[0] == '+') {
+            KHttpCookie cookie;
+            if (readCookieLine(line, 2, currentTime, &cookie)) {
+                addCookie(cookie);
             }
+        } else if (buffer[0] == '-') {
+            const QString host = extractHostAndPorts(QL1S(parseField(line)));
+            const QString domain = QL1S(parseField(line));
             const QString path = QL1S(parseField(line));
-            const QString expStr = QL1S(parseField(line));
-            if (expStr.isEmpty()) {
-                continue;
-            }
-            const qint64 expDate = expStr.toLongLong();
-            const QString verStr = QL1S(parseField(line));
-            if (verStr.isEmpty()) {
-                continue;
-            }
-            int protVer  = verStr.toInt();
-            QString name = QL1S(parseField(line));
-            bool keepQuotes = false;
-            bool secure = false;
-            bool httpOnly = false;
-            bool explicitPath = false;
-            const char *value = nullptr;
-            if ((version == 2) || (protVer >= 200)) {
-                if (protVer >= 200) {
-                    protVer -= 200;
+            const QString name = QL1S(parseField(line));
+            KHttpCookie cookie(host, domain, path, name);
+            // Same lookup as addCookie()
+            QStringList domains;
+            extractDomains(host, domains);
+            for (const QString &key : qAsConst(domains)) {
+                KHttpCookieList *list = m_cookieDomains.value(key.isNull() ? QL1S("") : key);
+                if (list) {
+                    removeDuplicateFromList(list, cookie);
                 }
-                int i = atoi(parseField(line));
-                secure = i & 1;
-                httpOnly = i & 2;
-                explicitPath = i & 4;
-                if (i & 8) {
-                    name = QLatin1String("");
-                }
-                line[strlen(line) - 1] = '\0'; // Strip LF.
-                value = line;
-            } else {
-                if (protVer >= 100) {
-                    protVer -= 100;
-                    keepQuotes = true;
-                }
-                value = parseField(line, keepQuotes);
-                secure = QByteArray(parseField(line)).toShort();
-            }
-
-            // Expired or parse error
-            if (!value || expDate == 0 || expDate < currentTime) {
-                continue;
             }
-
-            KHttpCookie cookie(host, domain, path, name, QString::fromUtf8(value), expDate,
-                               protVer, secure, httpOnly, explicitPath);
-            if (!ports.isEmpty()) {
-                cookie.mPorts = ports;
-            }
-            addCookie(cookie);
         }
     }
-
     delete [] buffer;
-    m_cookiesChanged = false;
-    return success;
+}
+
+//
+// Notes for the journal that the saved cookie matching @p cookie is gone
+//
+void KCookieJar::journalRemoval(const KHttpCookie &cookie)
+{
+    if (m_compactionNeeded) {
+        return;
+    }
+    const QString line = QL1S("- ") + hostWithPort(&cookie) + QL1S(" \"") + cookie.domain()
+                         + QL1S("\" \"") + cookie.path() + QL1S("\" \"") + cookie.name() + QL1S("\"\n");
+    m_journal.append(line.toLatin1());
 }
 
 //
@@ -1562,6 +1861,8 @@ void KCookieJar::loadConfig(KConfig *_config, bool reparse)
     m_preferredPolicy = static_cast<KCookieDefaultPolicy>(dlgGroup.readEntry("PreferredPolicy", 0));
 
     KConfigGroup policyGroup(_config, "Cookie Policy");
+    // Which cookies get saved depends on the policy
+    m_compactionNeeded = true;
     const QStringList domainSettings = policyGroup.readEntry("CookieDomainAdvice", QStringList());
     // Warning: those default values are duplicated in the kcm (kio/kcookiespolicies.cpp)
     m_rejectCrossDomainCookies = policyGroup.readEntry("RejectCrossDomainCookies", true);
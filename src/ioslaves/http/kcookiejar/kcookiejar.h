@@ -13,7 +13,9 @@
 #include <QString>
 #include <QStringList>
 #include <QHash>
+#include <QPair>
 #include <QSet>
+#include <QVector>
 #include <qwindowdefs.h> //WId
 
 #include <QLoggingCategory>
@@ -201,11 +203,18 @@ public:
 
     /**
      * Store all the cookies in a safe(?) place
+     *
+     * When saving again to the file the jar was loaded from or last saved to,
+     * only the changes since are appended to a journal next to it
+     * ("<_filename>.journal"). The whole file is rewritten, and the journal
+     * removed, once the journal grew too long or when the cookie policy
+     * changed, which decides which cookies are saved at all.
      */
     bool saveCookies(const QString &_filename);
 
     /**
-     * Load all the cookies from file and add them to the cookie jar.
+     * Load all the cookies from file and add them to the cookie jar,
+     * then apply the changes saved to its journal.
      */
     bool loadCookies(const QString &_filename);
 
@@ -232,6 +241,15 @@ public:
      */
     QString findCookies(const QString &_url, bool useDOMFormat, WId windowId, KHttpCookieList *pendingCookies = nullptr);
 
+    /**
+     * Looks for all the cookies which may be sent to the host of @p _url,
+     * whatever their path and whether they are secure, in the order
+     * findCookies() would send them.
+     * If @p validUntil is given, it is set to the earliest expiration date of
+     * the returned cookies (seconds since the epoch), or 0 if none of them expires.
+     */
+    KHttpCookieList findHostCookies(const QString &_url, WId windowId, qint64 *validUntil = nullptr);
+
     /**
      * This function parses cookie_headers and returns a linked list of
      * valid KHttpCookie objects for all cookies found in cookie_headers.
@@ -385,6 +403,12 @@ public:
      */
     void eatSessionCookies(long windowId);
 
+    /**
+     * Removes the cookies which expired. Only the domains holding
+     * such cookies are visited.
+     */
+    void eatExpiredCookies();
+
     /**
      * Removes all end of session cookies set by the
      * session @p windId.
@@ -444,6 +468,11 @@ public:
 protected:
     void stripDomain(const QString &_fqdn, QString &_domain) const;
     QString stripDomain(const KHttpCookie &cookie) const;
+    KCookieAdvice cookieAdvice(const KHttpCookie &cookie, QHash<QString, KCookieAdvice> *hostAdvices) const;
+    void scheduleExpiry(const QString &domain, qint64 expireDate);
+    bool readCookieLine(char *line, int version, qint64 currentTime, KHttpCookie *cookie) const;
+    void replayJournal(const QString &_filename);
+    void journalRemoval(const KHttpCookie &cookie);
 
 protected:
     QStringList m_domainList;
@@ -459,5 +488,15 @@ protected:
     bool m_autoAcceptSessionCookies;
 
     KCookieDefaultPolicy m_preferredPolicy;
+
+    // Min-heap of (expiration date, domain), at most one valid entry per
+    // domain: the one with the date in m_domainExpiry
+    QVector<QPair<qint64, QString>> m_expiryHeap;
+    QHash<QString, qint64> m_domainExpiry;
+
+    QString m_cookieFile; // loaded from or last saved to, the journal goes next to it
+    QList<QByteArray> m_journal; // changes not saved yet
+    int m_journalLines;
+    bool m_compactionNeeded;
 };
 #endif
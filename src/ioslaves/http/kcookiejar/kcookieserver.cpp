@@ -17,6 +17,8 @@
 #include <KConfig>
 #include <QDebug>
 
+#include <atomic>
+
 #include <KPluginFactory>
 #include <KLocalizedString>
 #include <kwindowsystem.h>
@@ -98,6 +100,23 @@ KCookieServer::KCookieServer(QObject *parent, const QList<QVariant> &)
     mCookieJar->loadCookies(mFilename);
     connect(this, &KDEDModule::windowUnregistered,
             this, &KCookieServer::slotDeleteSessionCookies);
+
+    // The http slaves cache the cookies they got from us, the generation
+    // counter tells them when to drop them, without asking us over D-Bus.
+    // Keep the file name in sync with http.cpp.
+    mGeneration = nullptr;
+    mGenerationFile.setFileName(QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) + QLatin1String("/kcookiejar5-generation"));
+    if (mGenerationFile.open(QIODevice::ReadWrite)) {
+        if (mGenerationFile.size() >= qint64(sizeof(quint64)) || mGenerationFile.resize(sizeof(quint64))) {
+            mGeneration = mGenerationFile.map(0, sizeof(quint64));
+        }
+        mGenerationFile.close();
+    }
+    if (!mGeneration) {
+        qCWarning(KIO_COOKIEJAR) << "Could not map" << mGenerationFile.fileName() << mGenerationFile.errorString();
+    }
+    // Whatever was cached from a previous instance is stale
+    cookiesChanged();
 }
 
 KCookieServer::~KCookieServer()
@@ -147,6 +166,8 @@ void KCookieServer::addCookies(const QString &url, const QByteArray &cookieHeade
         cookieList = mCookieJar->makeCookies(url, cookieHeader, windowId);
     }
 
+    const bool hasCookies = !cookieList.isEmpty();
+
     checkCookies(&cookieList, windowId);
 
     *mPendingCookies += cookieList;
@@ -158,6 +179,10 @@ void KCookieServer::addCookies(const QString &url, const QByteArray &cookieHeade
         }
         mAdvicePending = false;
     }
+
+    if (hasCookies) {
+        cookiesChanged();
+    }
 }
 
 void KCookieServer::checkCookies(KHttpCookieList *cookieList)
@@ -286,6 +311,13 @@ void KCookieServer::slotSave()
     }
 }
 
+void KCookieServer::cookiesChanged()
+{
+    if (mGeneration) {
+        reinterpret_cast<std::atomic<quint64> *>(mGeneration)->fetch_add(1, std::memory_order_release);
+    }
+}
+
 void KCookieServer::saveCookieJar()
 {
     if (mTimer->isActive()) {
@@ -365,6 +397,30 @@ QString KCookieServer::findCookies(const QString &url, qlonglong windowId)
     return cookies;
 }
 
+// DBUS function
+QStringList KCookieServer::findHostCookies(const QString &url, qlonglong windowId, qlonglong &validUntil)
+{
+    QStringList result;
+    if (!mGeneration || cookiesPending(url)) {
+        // Must be asked for through findCookies(), which waits for the user
+        validUntil = -1;
+        return result;
+    }
+
+    qint64 expireDate;
+    const KHttpCookieList cookies = mCookieJar->findHostCookies(url, windowId, &expireDate);
+    validUntil = expireDate;
+    result.reserve(cookies.count() * 4);
+    for (const KHttpCookie &cookie : cookies) {
+        result << (cookie.path().isEmpty() ? QStringLiteral("/") : cookie.path())
+               << (cookie.isSecure() ? QStringLiteral("1") : QStringLiteral("0"))
+               << QString::number(cookie.protocolVersion())
+               << cookie.cookieStr(false);
+    }
+    saveCookieJar();
+    return result;
+}
+
 // DBUS function
 QStringList
 KCookieServer::findDomains()
@@ -466,6 +522,7 @@ KCookieServer::deleteCookie(const QString &domain, const QString &fqdn,
             if (cookieMatches(*it, domain, fqdn, path, name)) {
                 mCookieJar->eatCookie(it);
                 saveCookieJar();
+                cookiesChanged();
                 break;
             }
         }
@@ -478,6 +535,7 @@ KCookieServer::deleteCookiesFromDomain(const QString &domain)
 {
     mCookieJar->eatCookiesForDomain(domain);
     saveCookieJar();
+    cookiesChanged();
 }
 
 // Qt function
@@ -493,6 +551,7 @@ KCookieServer::deleteSessionCookies(qlonglong windowId)
 {
     mCookieJar->eatSessionCookies(windowId);
     saveCookieJar();
+    cookiesChanged();
 }
 
 void
@@ -500,6 +559,7 @@ KCookieServer::deleteSessionCookiesFor(const QString &fqdn, qlonglong windowId)
 {
     mCookieJar->eatSessionCookies(fqdn, windowId);
     saveCookieJar();
+    cookiesChanged();
 }
 
 // DBUS function
@@ -508,6 +568,7 @@ KCookieServer::deleteAllCookies()
 {
     mCookieJar->eatAllCookies();
     saveCookieJar();
+    cookiesChanged();
 }
 
 // DBUS function
@@ -531,6 +592,7 @@ KCookieServer::setDomainAdvice(const QString &url, const QString &advice)
                                     KCookieJar::strToAdvice(advice));
         // Save the cookie config if it has changed
         mCookieJar->saveConfig(mConfig);
+        cookiesChanged();
         return true;
     }
     return false;
@@ -569,6 +631,7 @@ void
 KCookieServer::reloadPolicy()
 {
     mCookieJar->loadConfig(mConfig, true);
+    cookiesChanged();
 }
 
 // DBUS function
@@ -10,6 +10,7 @@
 #ifndef KCOOKIESERVER_H
 #define KCOOKIESERVER_H
 
+#include <QFile>
 #include <QStringList>
 #include <KDEDModule>
 #include <QDBusConnection>
@@ -42,6 +43,19 @@ public Q_SLOTS:
     // KDE5 TODO: don't overload names here, it prevents calling e.g. findCookies from the command-line using qdbus.
     QString listCookies(const QString &url);
     QString findCookies(const QString &url, qlonglong windowId);
+    /**
+     * For callers that cache the cookies of a host and match their paths
+     * themselves: returns all the cookies which may be sent to the host of
+     * @p url, as four strings each: the path, "1" if the cookie is secure
+     * else "0", the protocol version and the cookie as findCookies() sends it.
+     * @p validUntil is set to the time (seconds since the epoch) at which the
+     * first of the returned cookies expires, 0 if none does, or -1 if the
+     * cookies must be asked for with findCookies() instead.
+     * A cached result also becomes invalid as soon as the generation counter
+     * in the "kcookiejar5-generation" file of the runtime directory changes.
+     * @since 5.78
+     */
+    QStringList findHostCookies(const QString &url, qlonglong windowId, qlonglong &validUntil);
     QStringList findDomains();
     // KDE5: rename
     QStringList findCookies(const QList<int> &fields, const QString &domain, const QString &fqdn, const QString &path, const QString &name);
@@ -86,11 +100,14 @@ private:
     bool mAdvicePending;
     KConfig *mConfig;
     QString mFilename;
+    QFile mGenerationFile;
+    uchar *mGeneration;
 
 private:
     bool cookieMatches(const KHttpCookie &, const QString &, const QString &, const QString &, const QString &);
     void putCookie(QStringList &, const KHttpCookie &, const QList<int> &);
     void saveCookieJar();
+    void cookiesChanged();
 };
 
 #endif
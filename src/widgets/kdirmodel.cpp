@@ -23,11 +23,13 @@
 #include <QBitArray>
 #include <QDebug>
 #include <QDirIterator>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
 #include <QIcon>
 #include <QLoggingCategory>
+#include <QTimer>
 #include <qplatformdefs.h>
 
 #include <algorithm>
@@ -43,6 +45,14 @@ class KDirModelDirNode;
 
 static QUrl cleanupUrl(const QUrl &url)
 {
+    // The urls of listed items are clean already, avoid detaching them
+    if (!url.hasQuery() && !url.hasFragment()) {
+        const QString path = url.path();
+        if (!path.endsWith(QLatin1Char('/')) && !path.startsWith(QLatin1Char('.'))
+                && !path.contains(QLatin1String("//")) && !path.contains(QLatin1String("/."))) {
+            return url;
+        }
+    }
     QUrl u = url;
     u.setPath(QDir::cleanPath(u.path())); // remove double slashes in the path, simplify "foo/." to "foo/", etc.
     u = u.adjusted(QUrl::StripTrailingSlash); // KDirLister does this too, so we remove the slash before comparing with the root node url.
@@ -59,7 +69,8 @@ public:
     KDirModelNode(KDirModelDirNode *parent, const KFileItem &item) :
         m_item(item),
         m_parent(parent),
-        m_preview()
+        m_preview(),
+        m_rowNumber(-1)
     {
     }
     virtual ~KDirModelNode()
@@ -79,8 +90,13 @@ public:
     {
         return m_parent;
     }
-    // linear search
-    int rowNumber() const; // O(n)
+    // cached, renumbers all the siblings after rows were inserted or removed before this one
+    int rowNumber() const; // O(1) amortized
+    // for nodes added at a known position, saves the renumbering
+    void setRowNumber(int row)
+    {
+        m_rowNumber = row;
+    }
     QIcon preview() const
     {
         return m_preview;
@@ -99,6 +115,8 @@ private:
     KFileItem m_item;
     KDirModelDirNode *const m_parent;
     QIcon m_preview;
+    mutable int m_rowNumber;
+    friend class KDirModelDirNode;
 };
 
 // Specialization for directory nodes
@@ -139,6 +157,13 @@ public:
         return item().isSlow();
     }
 
+    void renumberChildNodes() const
+    {
+        for (int row = 0; row < m_childNodes.count(); ++row) {
+            m_childNodes.at(row)->m_rowNumber = row;
+        }
+    }
+
     // For removing all child urls from the global hash.
     void collectAllChildUrls(QList<QUrl> &urls) const
     {
@@ -162,7 +187,15 @@ int KDirModelNode::rowNumber() const
     if (!m_parent) {
         return 0;
     }
-    return m_parent->m_childNodes.indexOf(const_cast<KDirModelNode *>(this));
+    const QList<KDirModelNode *> &siblings = m_parent->m_childNodes;
+    if (m_rowNumber < 0 || m_rowNumber >= siblings.count() || siblings.at(m_rowNumber) != this) {
+        // Rows were inserted or removed before this node since it was numbered
+        m_parent->renumberChildNodes();
+        if (m_rowNumber < 0 || m_rowNumber >= siblings.count() || siblings.at(m_rowNumber) != this) {
+            return -1; // not a child (anymore)
+        }
+    }
+    return m_rowNumber;
 }
 
 ////
@@ -182,7 +215,12 @@ public:
     }
 
     void _k_slotNewItems(const QUrl &directoryUrl, const KFileItemList &);
+    void insertItems(const QUrl &directoryUrl, const KFileItemList &);
+    void insertPendingItems();
+    void flushPendingItems();
+    void flushPendingItems(const QList<QUrl> &urls);
     void _k_slotCompleted(const QUrl &directoryUrl);
+    void directoryCompleted(const QUrl &directoryUrl);
     void _k_slotDeleteItems(const KFileItemList &);
     void _k_slotRefreshItems(const QList<QPair<KFileItem, KFileItem> > &);
     void _k_slotClear();
@@ -191,6 +229,7 @@ public:
 
     void clear()
     {
+        m_pendingItems.clear();
         delete m_rootNode;
         m_rootNode = new KDirModelDirNode(nullptr, KFileItem());
         m_showNodeForListedUrl = false;
@@ -256,8 +295,22 @@ public:
     QMap<KDirModelNode *, QList<QUrl> > m_urlsBeingFetched;
     QHash<QUrl, KDirModelNode *> m_nodeHash; // global node hash: url -> node
     QStringList m_allCurrentDestUrls; //list of all dest urls that have jobs on them (e.g. copy, download)
+
+    // For setIncrementalInsertion
+    struct PendingItems {
+        QUrl directoryUrl;
+        KFileItemList items; // empty for the completed() of the directory
+    };
+    bool m_incrementalInsertion = false;
+    QList<PendingItems> m_pendingItems; // in the order of the lister's signals
+    QTimer *m_pendingItemsTimer = nullptr;
 };
 
+// Rows inserted at once by setIncrementalInsertion, about a screenful in a big view
+static const int s_insertChunkSize = 500;
+// Time spent inserting rows before getting back to the event loop
+static const int s_insertTimeBudget = 10; // ms
+
 KDirModelNode *KDirModelPrivate::nodeForUrl(const QUrl &_url) const // O(1), well, O(length of url as a string)
 {
     QUrl url = cleanupUrl(_url);
@@ -358,7 +411,7 @@ void KDirModelPrivate::dump()
 }
 #endif
 
-// node -> index. If rowNumber is set (or node is root): O(1). Otherwise: O(n).
+// node -> index. O(1), amortized if rowNumber isn't set.
 QModelIndex KDirModelPrivate::indexForNode(KDirModelNode *node, int rowNumber) const
 {
     if (node == m_rootNode) {
@@ -477,6 +530,97 @@ KDirLister *KDirModel::dirLister() const
 }
 
 void KDirModelPrivate::_k_slotNewItems(const QUrl &directoryUrl, const KFileItemList &items)
+{
+    if (!m_incrementalInsertion || (m_pendingItems.isEmpty() && items.count() <= s_insertChunkSize)) {
+        insertItems(directoryUrl, items);
+        return;
+    }
+
+    KFileItemList remainingItems = items;
+    if (m_pendingItems.isEmpty()) {
+        // Show the first rows right away
+        insertItems(directoryUrl, remainingItems.mid(0, s_insertChunkSize));
+        remainingItems.erase(remainingItems.begin(), remainingItems.begin() + s_insertChunkSize);
+    }
+    m_pendingItems.append({directoryUrl, remainingItems});
+    if (!m_pendingItemsTimer) {
+        m_pendingItemsTimer = new QTimer(q);
+        m_pendingItemsTimer->setSingleShot(true);
+        QObject::connect(m_pendingItemsTimer, &QTimer::timeout, q, [this]() {
+            insertPendingItems();
+        });
+    }
+    m_pendingItemsTimer->start(0);
+}
+
+void KDirModelPrivate::insertPendingItems()
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!m_pendingItems.isEmpty() && !timer.hasExpired(s_insertTimeBudget)) {
+        PendingItems &pending = m_pendingItems.first();
+        if (pending.items.isEmpty()) {
+            const QUrl directoryUrl = pending.directoryUrl;
+            m_pendingItems.removeFirst();
+            directoryCompleted(directoryUrl);
+        } else if (pending.items.count() <= s_insertChunkSize) {
+            const PendingItems chunk = m_pendingItems.takeFirst();
+            insertItems(chunk.directoryUrl, chunk.items);
+        } else {
+            const KFileItemList chunk = pending.items.mid(0, s_insertChunkSize);
+            pending.items.erase(pending.items.begin(), pending.items.begin() + s_insertChunkSize);
+            insertItems(pending.directoryUrl, chunk);
+        }
+    }
+    if (!m_pendingItems.isEmpty()) {
+        m_pendingItemsTimer->start(0);
+    }
+}
+
+// Before changing or looking up the nodes, which have to exist for all the listed items
+void KDirModelPrivate::flushPendingItems()
+{
+    if (m_pendingItems.isEmpty()) {
+        return;
+    }
+    m_pendingItemsTimer->stop();
+    while (!m_pendingItems.isEmpty()) {
+        const PendingItems pending = m_pendingItems.takeFirst();
+        if (pending.items.isEmpty()) {
+            directoryCompleted(pending.directoryUrl);
+        } else {
+            insertItems(pending.directoryUrl, pending.items);
+        }
+    }
+}
+
+// Same, but only for the pending items the nodes for @p urls depend on: the
+// items of the directories containing them, and of the directories above
+void KDirModelPrivate::flushPendingItems(const QList<QUrl> &urls)
+{
+    if (m_pendingItems.isEmpty()) {
+        return;
+    }
+    QList<PendingItems> needed;
+    for (auto it = m_pendingItems.begin(); it != m_pendingItems.end();) {
+        const QUrl directoryUrl = cleanupUrl(it->directoryUrl);
+        const bool isNeeded = !it->items.isEmpty() && std::any_of(urls.cbegin(), urls.cend(), [&](const QUrl &url) {
+            return directoryUrl.isParentOf(url) || directoryUrl == cleanupUrl(url);
+        });
+        if (isNeeded) {
+            needed.append(*it);
+            it = m_pendingItems.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // In the order of the lister's signals, which lists the directories above first
+    for (const PendingItems &pending : qAsConst(needed)) {
+        insertItems(pending.directoryUrl, pending.items);
+    }
+}
+
+void KDirModelPrivate::insertItems(const QUrl &directoryUrl, const KFileItemList &items)
 {
     //qDebug() << "directoryUrl=" << directoryUrl;
 
@@ -499,7 +643,7 @@ void KDirModelPrivate::_k_slotNewItems(const QUrl &directoryUrl, const KFileItem
     Q_ASSERT(isDir(result));
     KDirModelDirNode *dirNode = static_cast<KDirModelDirNode *>(result);
 
-    const QModelIndex index = indexForNode(dirNode); // O(n)
+    const QModelIndex index = indexForNode(dirNode); // O(1)
     const int newItemsCount = items.count();
     const int newRowCount = dirNode->m_childNodes.count() + newItemsCount;
 
@@ -533,6 +677,7 @@ void KDirModelPrivate::_k_slotNewItems(const QUrl &directoryUrl, const KFileItem
         //    abort();
         //}
 #endif
+        node->setRowNumber(dirNode->m_childNodes.count());
         dirNode->m_childNodes.append(node);
         const QUrl url = it->url();
         m_nodeHash.insert(cleanupUrl(url), node);
@@ -564,6 +709,16 @@ void KDirModelPrivate::_k_slotNewItems(const QUrl &directoryUrl, const KFileItem
 }
 
 void KDirModelPrivate::_k_slotCompleted(const QUrl &directoryUrl)
+{
+    if (!m_pendingItems.isEmpty()) {
+        // Keep expanding to the urls being fetched until the items are inserted
+        m_pendingItems.append({directoryUrl, KFileItemList()});
+        return;
+    }
+    directoryCompleted(directoryUrl);
+}
+
+void KDirModelPrivate::directoryCompleted(const QUrl &directoryUrl)
 {
     KDirModelNode *result = nodeForUrl(directoryUrl); // O(depth)
     Q_ASSERT(isDir(result));
@@ -573,6 +728,7 @@ void KDirModelPrivate::_k_slotCompleted(const QUrl &directoryUrl)
 
 void KDirModelPrivate::_k_slotDeleteItems(const KFileItemList &items)
 {
+    flushPendingItems(items.urlList());
     qCDebug(category) << items.count() << "items";
 
     // I assume all items are from the same directory.
@@ -591,7 +747,7 @@ void KDirModelPrivate::_k_slotDeleteItems(const KFileItemList &items)
         return;
     }
 
-    QModelIndex parentIndex = indexForNode(dirNode); // O(n)
+    QModelIndex parentIndex = indexForNode(dirNode); // O(1)
 
     // Short path for deleting a single item
     if (items.count() == 1) {
@@ -621,7 +777,7 @@ void KDirModelPrivate::_k_slotDeleteItems(const KFileItemList &items)
                 return;
             }
         }
-        rowNumbers.setBit(node->rowNumber(), 1); // O(n)
+        rowNumbers.setBit(node->rowNumber(), 1); // O(1)
         removeFromNodeHash(node, url);
         node = nullptr;
     }
@@ -640,10 +796,11 @@ void KDirModelPrivate::_k_slotDeleteItems(const KFileItemList &items)
             start = val ? i : i + 1;
             //qDebug() << "beginRemoveRows" << start << end;
             q->beginRemoveRows(parentIndex, start, end);
-            for (int r = end; r >= start; --r) { // reverse because takeAt changes indexes ;)
-                //qDebug() << "Removing from m_childNodes at" << r;
-                delete dirNode->m_childNodes.takeAt(r);
-            }
+            // the whole range at once, the following rows move only once
+            const auto first = dirNode->m_childNodes.begin() + start;
+            const auto last = dirNode->m_childNodes.begin() + end + 1;
+            qDeleteAll(first, last);
+            dirNode->m_childNodes.erase(first, last);
             q->endRemoveRows();
         }
         lastVal = val;
@@ -652,6 +809,12 @@ void KDirModelPrivate::_k_slotDeleteItems(const KFileItemList &items)
 
 void KDirModelPrivate::_k_slotRefreshItems(const QList<QPair<KFileItem, KFileItem> > &items)
 {
+    QList<QUrl> oldUrls;
+    oldUrls.reserve(items.count());
+    for (const auto &pair : items) {
+        oldUrls.append(pair.first.url());
+    }
+    flushPendingItems(oldUrls);
     QModelIndex topLeft, bottomRight;
 
     // Solution 1: we could emit dataChanged for one row (if items.size()==1) or all rows
@@ -661,7 +824,7 @@ void KDirModelPrivate::_k_slotRefreshItems(const QList<QPair<KFileItem, KFileIte
         Q_ASSERT(!fit->second.isNull());
         const QUrl oldUrl = fit->first.url();
         const QUrl newUrl = fit->second.url();
-        KDirModelNode *node = nodeForUrl(oldUrl); // O(n); maybe we could look up to the parent only once
+        KDirModelNode *node = nodeForUrl(oldUrl); // O(1)
         //qDebug() << "in model for" << m_dirLister->url() << ":" << oldUrl << "->" << newUrl << "node=" << node;
         if (!node) { // not found [can happen when renaming a dir, redirection was emitted already]
             continue;
@@ -677,6 +840,7 @@ void KDirModelPrivate::_k_slotRefreshItems(const QList<QPair<KFileItem, KFileIte
                 delete dirNode->m_childNodes.takeAt(r); // i.e. "delete node"
                 node = fit->second.isDir() ? new KDirModelDirNode(dirNode, fit->second)
                        : new KDirModelNode(dirNode, fit->second);
+                node->setRowNumber(r);
                 dirNode->m_childNodes.insert(r, node); // same position!
                 hasNewNode = true;
             } else {
@@ -712,6 +876,7 @@ void KDirModelPrivate::_k_slotRefreshItems(const QList<QPair<KFileItem, KFileIte
 // and when renaming a directory.
 void KDirModelPrivate::_k_slotRedirection(const QUrl &oldUrl, const QUrl &newUrl)
 {
+    flushPendingItems();
     KDirModelNode *node = nodeForUrl(oldUrl);
     if (!node) {
         return;
@@ -803,6 +968,52 @@ void KDirModel::itemChanged(const QModelIndex &index)
     emit dataChanged(index, index);
 }
 
+void KDirModel::itemsChanged(const QModelIndexList &indexes)
+{
+    QModelIndexList sortedIndexes;
+    sortedIndexes.reserve(indexes.count());
+    for (const QModelIndex &index : indexes) {
+        KDirModelNode *node = d->nodeForIndex(index);
+        if (node && index.isValid()) {
+            node->setPreview(QIcon());
+            sortedIndexes.append(index);
+        }
+    }
+
+    // Rows of the same directory and column next to each other, in order
+    auto parentNode = [](const QModelIndex &index) {
+        return static_cast<KDirModelNode *>(index.internalPointer())->parent();
+    };
+    std::sort(sortedIndexes.begin(), sortedIndexes.end(), [&](const QModelIndex &a, const QModelIndex &b) {
+        if (parentNode(a) != parentNode(b)) {
+            return parentNode(a) < parentNode(b);
+        }
+        if (a.column() != b.column()) {
+            return a.column() < b.column();
+        }
+        return a.row() < b.row();
+    });
+
+    // One dataChanged per range of adjacent rows
+    int first = 0;
+    while (first < sortedIndexes.count()) {
+        const QModelIndex &topLeft = sortedIndexes.at(first);
+        int last = first;
+        while (last + 1 < sortedIndexes.count()) {
+            const QModelIndex &next = sortedIndexes.at(last + 1);
+            if (parentNode(next) != parentNode(topLeft) || next.column() != topLeft.column()
+                    || next.row() > sortedIndexes.at(last).row() + 1) {
+                break;
+            }
+            ++last;
+        }
+        const QModelIndex &bottomRight = sortedIndexes.at(last);
+        qCDebug(category) << "dataChanged(" << debugIndex(topLeft) << " - " << debugIndex(bottomRight) << ")";
+        emit dataChanged(topLeft, bottomRight);
+        first = last + 1;
+    }
+}
+
 int KDirModel::columnCount(const QModelIndex &) const
 {
     return ColumnCount;
@@ -1011,11 +1222,11 @@ QModelIndex KDirModel::parent(const QModelIndex &index) const
     Q_ASSERT(childNode);
     KDirModelNode *parentNode = childNode->parent();
     Q_ASSERT(parentNode);
-    return d->indexForNode(parentNode); // O(n)
+    return d->indexForNode(parentNode); // O(1)
 }
 
 // Reimplemented to avoid the default implementation which calls parent
-// (O(n) for finding the parent's row number for nothing). This implementation is O(1).
+// (finding the parent's row number for nothing). This implementation is O(1).
 QModelIndex KDirModel::sibling(int row, int column, const QModelIndex &index) const
 {
     if (!index.isValid()) {
@@ -1056,6 +1267,20 @@ bool KDirModel::jobTransfersVisible() const
     return d->m_jobTransfersVisible;
 }
 
+void KDirModel::setIncrementalInsertion(bool enable)
+{
+    if (!enable) {
+        // Still inserted incrementally, as far as rowsInserted() is concerned
+        d->flushPendingItems();
+    }
+    d->m_incrementalInsertion = enable;
+}
+
+bool KDirModel::incrementalInsertion() const
+{
+    return d->m_incrementalInsertion;
+}
+
 QList<QUrl> KDirModel::simplifiedUrlList(const QList<QUrl> &urls)
 {
     if (urls.isEmpty()) {
@@ -1131,7 +1356,7 @@ QModelIndex KDirModel::indexForItem(const KFileItem *item) const
 {
     // Note that we can only use the URL here, not the pointer.
     // KFileItems can be copied.
-    return indexForUrl(item->url()); // O(n)
+    return indexForUrl(item->url()); // O(1)
 }
 #endif
 
@@ -1139,18 +1364,20 @@ QModelIndex KDirModel::indexForItem(const KFileItem &item) const
 {
     // Note that we can only use the URL here, not the pointer.
     // KFileItems can be copied.
-    return indexForUrl(item.url()); // O(n)
+    return indexForUrl(item.url()); // O(1)
 }
 
-// url -> index. O(n)
+// url -> index. O(1)
 QModelIndex KDirModel::indexForUrl(const QUrl &url) const
 {
+    // No flushPendingItems(): views look up items all the time, which would
+    // insert everything at once again. The items not inserted yet have no index.
     KDirModelNode *node = d->nodeForUrl(url); // O(depth)
     if (!node) {
         //qDebug() << url << "not found";
         return QModelIndex();
     }
-    return d->indexForNode(node); // O(n)
+    return d->indexForNode(node); // O(1)
 }
 
 QModelIndex KDirModel::index(int row, int column, const QModelIndex &parent) const
@@ -1332,6 +1559,7 @@ void KDirModel::setDropsAllowed(DropsAllowed dropsAllowed)
 
 void KDirModel::expandToUrl(const QUrl &url)
 {
+    d->flushPendingItems();
     // emit expand for each parent and return last parent
     KDirModelNode *result = d->expandAllParentsUntil(url); // O(depth)
 
@@ -1356,7 +1584,7 @@ void KDirModel::expandToUrl(const QUrl &url)
     qCDebug(category) << "Remembering to emit expand after listing" << result->item().url();
 
     // start a new fetch to look for the next level down the URL
-    const QModelIndex parentIndex = d->indexForNode(result); // O(n)
+    const QModelIndex parentIndex = d->indexForNode(result); // O(1)
     Q_ASSERT(parentIndex.isValid());
     fetchMore(parentIndex);
 }
@@ -102,11 +102,13 @@ public:
 
     /**
      * Return the index for a given kfileitem. This can be slow.
+     * The index is invalid for an item not inserted yet, see setIncrementalInsertion().
      */
     QModelIndex indexForItem(const KFileItem &) const;
 
     /**
      * Return the index for a given url. This can be slow.
+     * The index is invalid for an item not inserted yet, see setIncrementalInsertion().
      */
     QModelIndex indexForUrl(const QUrl &url) const;
 
@@ -133,6 +135,16 @@ public:
      */
     void itemChanged(const QModelIndex &index);
 
+    /**
+     * Notify the model that the items at these indexes have changed,
+     * like itemChanged() does for one item.
+     * The dataChanged signal is emitted once per range of adjacent rows
+     * rather than once per item, which is much cheaper for the views
+     * when, e.g., the MIME types of many items have been determined.
+     * @since 5.78
+     */
+    void itemsChanged(const QModelIndexList &indexes);
+
     /**
      * Forget all previews (optimization for turning previews off).
      * The items will again have their default appearance (not controlled by the model).
@@ -267,6 +279,35 @@ public:
      */
     bool jobTransfersVisible() const;
 
+    /**
+     * Enable or disable the incremental insertion of listed items.
+     *
+     * When enabled, big batches of items emitted by the dir lister are
+     * inserted a chunk of rows at a time, from the event loop, each time for
+     * at most a few milliseconds. The first rows appear right away and the
+     * view stays responsive while a directory with a huge number of entries
+     * is being listed. The items not inserted yet are inserted at once when
+     * needed: those of the directory of items getting deleted or refreshed,
+     * or all of them by expandToUrl().
+     *
+     * Note that rowCount() doesn't include the items not inserted yet, even
+     * after the dir lister emitted completed(), and that indexForUrl() and
+     * indexForItem() return an invalid index for them: use rowsInserted()
+     * rather than the newItems() signal of the dir lister to know about them.
+     *
+     * Default is disabled.
+     *
+     * @since 5.78
+     */
+    void setIncrementalInsertion(bool enable);
+
+    /**
+     * Returns whether listed items are inserted incrementally.
+     * @see setIncrementalInsertion
+     * @since 5.78
+     */
+    bool incrementalInsertion() const;
+
     Qt::DropActions supportedDropActions() const override;
 
 Q_SIGNALS:
@@ -26,12 +26,15 @@
 
 #include <QDir>
 #include <QFile>
+#include <QHash>
 #include <QImage>
+#include <QImageReader>
 #include <QPixmap>
 #include <QTimer>
 #include <QRegularExpression>
 #include <QTemporaryFile>
 #include <QSaveFile>
+#include <QThread>
 
 #include <QCryptographicHash>
 
@@ -72,41 +75,60 @@ public:
           bSave(true),
           ignoreMaximumSize(false),
           sequenceIndex(0),
-          succeeded(false),
           maximumLocalSize(0),
           maximumRemoteSize(0),
           iconSize(0),
           iconAlpha(70),
-          shmid(-1),
-          shmaddr(nullptr)
+          maxTasks(1),
+          started(false)
     {
         // http://specifications.freedesktop.org/thumbnail-spec/thumbnail-spec-latest.html#DIRECTORY
         thumbRoot = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/thumbnails/");
     }
 
-    enum { STATE_STATORIG, // if the thumbnail exists
-           STATE_GETORIG, // if we create it
-           STATE_CREATETHUMB // thumbnail:/ slave
-         } state;
+    enum State { STATE_STATORIG, // if the thumbnail exists
+                 STATE_GETORIG, // if we create it
+                 STATE_CREATETHUMB // thumbnail:/ slave
+               };
+
+    // Shared memory segment the thumbnail slave writes the image to
+    struct ShmSegment {
+        int id = -1;
+        uchar *addr = nullptr;
+    };
+
+    // An item being worked on, several of them are in flight at once
+    struct Task {
+        PreviewItem item;
+        State state = STATE_STATORIG;
+        // The modification time of that URL
+        QDateTime tOrig;
+        // Original URL of the item in RFC2396 format
+        // (file:///path/to/a%20file instead of file:/path/to/a file)
+        QByteArray origName;
+        // Thumbnail file name for the item
+        QString thumbName;
+        // If the file to create a thumb for was a temp file, this is its name
+        QString tempName;
+        bool succeeded = false;
+        ShmSegment shm;
+    };
 
     KFileItemList initialItems;
     QStringList enabledPlugins;
+    // The plugins handling each MIME type
+    QMap<QString, KService::Ptr> mimeMap;
+    // Plugins handling remote URLs, <protocol, <mimetype, plugin>>
+    QHash<QString, QHash<QString, KService::Ptr> > protocolMap;
     // Some plugins support remote URLs, <protocol, mimetypes>
     QHash<QString, QStringList> m_remoteProtocolPlugins;
     // Our todo list :)
     // We remove the first item at every step, so use std::list
     std::list<PreviewItem> items;
-    // The current item
-    PreviewItem currentItem;
-    // The modification time of that URL
-    QDateTime tOrig;
+    // The task each subjob works for
+    QHash<KJob *, Task *> jobTasks;
     // Path to thumbnail cache for the current size
     QString thumbPath;
-    // Original URL of current item in RFC2396 format
-    // (file:///path/to/a%20file instead of file:/path/to/a file)
-    QByteArray origName;
-    // Thumbnail file name for current item
-    QString thumbName;
     // Size of thumbnail
     int width;
     int height;
@@ -119,31 +141,36 @@ public:
     bool bSave;
     bool ignoreMaximumSize;
     int sequenceIndex;
-    bool succeeded;
-    // If the file to create a thumb for was a temp file, this is its name
-    QString tempName;
     KIO::filesize_t maximumLocalSize;
     KIO::filesize_t maximumRemoteSize;
     // the size for the icon overlay
     int iconSize;
     // the transparency of the blended MIME type icon
     int iconAlpha;
-    // Shared memory segment Id. The segment is allocated to a size
-    // of extent x extent x 4 (32 bit image) on first need.
-    int shmid;
-    // And the data area
-    uchar *shmaddr;
+    // How many items are worked on at once
+    int maxTasks;
+    // Whether startPreview() ran, initialItems are moved to items then
+    bool started;
+    // Segments of finished tasks, allocated to a size of
+    // extent x extent x 4 (32 bit image) on first need.
+    QVector<ShmSegment> freeShmSegments;
     // Root of thumbnail cache
     QString thumbRoot;
     // List of encrypted mount points for checking if we should save thumbnail
     KMountPoint::List encryptedMountsList;
 
-    void getOrCreateThumbnail();
-    bool statResultThumbnail();
-    void createThumbnail(const QString &);
-    void cleanupTempFile();
-    void determineNextFile();
-    void emitPreview(const QImage &thumb);
+    void appendItems(const KFileItemList &fileItems);
+    void setupThumbPath();
+    void getOrCreateThumbnail(Task *task);
+    bool statResultThumbnail(Task *task);
+    void createThumbnail(Task *task, const QString &);
+    void cleanupTempFile(Task *task);
+    void startNextFiles();
+    void startJob(Task *task, KIO::Job *job);
+    void finishTask(Task *task);
+    void emitPreview(Task *task, const QImage &thumb);
+    ShmSegment takeShmSegment();
+    static void freeShmSegment(const ShmSegment &segment);
 
     void startPreview();
     void slotThumbData(KIO::Job *, const QByteArray &);
@@ -164,7 +191,7 @@ PreviewJob::PreviewJob(const KFileItemList &items, int width, int height,
     d->bScale = scale;
     d->bSave = save && scale;
 
-    // Return to event loop first, determineNextFile() might delete this;
+    // Return to event loop first, startNextFiles() might delete this;
     QTimer::singleShot(0, this, SLOT(startPreview()));
 }
 #endif
@@ -186,19 +213,21 @@ PreviewJob::PreviewJob(const KFileItemList &items,
                                                                   QStringLiteral("jpegthumbnail")});
     }
 
-    // Return to event loop first, determineNextFile() might delete this;
+    // Return to event loop first, startNextFiles() might delete this;
     QTimer::singleShot(0, this, SLOT(startPreview()));
 }
 
 PreviewJob::~PreviewJob()
 {
-#if WITH_SHM
     Q_D(PreviewJob);
-    if (d->shmaddr) {
-        shmdt((char *)d->shmaddr);
-        shmctl(d->shmid, IPC_RMID, nullptr);
+    for (auto it = d->jobTasks.constBegin(); it != d->jobTasks.constEnd(); ++it) {
+        d->cleanupTempFile(it.value());
+        PreviewJobPrivate::freeShmSegment(it.value()->shm);
+        delete it.value();
+    }
+    for (const PreviewJobPrivate::ShmSegment &segment : qAsConst(d->freeShmSegments)) {
+        PreviewJobPrivate::freeShmSegment(segment);
     }
-#endif
 }
 
 void PreviewJob::setOverlayIconSize(int size)
@@ -257,11 +286,8 @@ PreviewJob::ScaleType PreviewJob::scaleType() const
 
 void PreviewJobPrivate::startPreview()
 {
-    Q_Q(PreviewJob);
     // Load the list of plugins to determine which MIME types are supported
     const KService::List plugins = KServiceTypeTrader::self()->query(QStringLiteral("ThumbCreator"));
-    QMap<QString, KService::Ptr> mimeMap;
-    QHash<QString, QHash<QString, KService::Ptr> > protocolMap;
 
     for (KService::List::ConstIterator it = plugins.constBegin(); it != plugins.constEnd(); ++it) {
         QStringList protocols = (*it)->property(QStringLiteral("X-KDE-Protocols")).toStringList();
@@ -304,13 +330,26 @@ void PreviewJobPrivate::startPreview()
                              mount->mountType() == QLatin1String("fuse.encfs"));
                  });
 
+    KConfigGroup cg(KSharedConfig::openConfig(), "PreviewSettings");
+    maximumLocalSize = cg.readEntry("MaximumSize", std::numeric_limits<KIO::filesize_t>::max());
+    maximumRemoteSize = cg.readEntry("MaximumRemoteSize", 0);
+
+    // More thumbnail jobs than slaves would only wait in the scheduler
+    maxTasks = qMax(1, qMin(KProtocolInfo::maxSlaves(QStringLiteral("thumbnail")), QThread::idealThreadCount()));
+
+    started = true;
+    appendItems(initialItems);
+    initialItems.clear();
+    startNextFiles();
+}
+
+void PreviewJobPrivate::appendItems(const KFileItemList &fileItems)
+{
+    Q_Q(PreviewJob);
     // Look for images and store the items in our todo list :)
-    bool bNeedCache = false;
-    KFileItemList::const_iterator kit = initialItems.constBegin();
-    const KFileItemList::const_iterator kend = initialItems.constEnd();
-    for (; kit != kend; ++kit) {
+    for (const KFileItem &fileItem : fileItems) {
         PreviewItem item;
-        item.item = *kit;
+        item.item = fileItem;
 
         const QString mimeType = item.item.mimetype();
         KService::Ptr plugin(nullptr);
@@ -352,41 +391,34 @@ void PreviewJobPrivate::startPreview()
         if (plugin) {
             item.plugin = plugin;
             items.push_back(item);
-            if (!bNeedCache && bSave && plugin->property(QStringLiteral("CacheThumbnail")).toBool()) {
-                const QUrl url = (*kit).url();
+            if (thumbPath.isEmpty() && bSave && plugin->property(QStringLiteral("CacheThumbnail")).toBool()) {
+                const QUrl url = fileItem.url();
                 if (!url.isLocalFile() ||
                         !url.adjusted(QUrl::RemoveFilename).toLocalFile().startsWith(thumbRoot)) {
-                    bNeedCache = true;
+                    setupThumbPath();
                 }
             }
         } else {
-            emit q->failed(*kit);
+            emit q->failed(fileItem);
         }
     }
+}
 
-    KConfigGroup cg(KSharedConfig::openConfig(), "PreviewSettings");
-    maximumLocalSize = cg.readEntry("MaximumSize", std::numeric_limits<KIO::filesize_t>::max());
-    maximumRemoteSize = cg.readEntry("MaximumRemoteSize", 0);
-
-    if (bNeedCache) {
-        if (width <= 128 && height <= 128) {
-            cacheWidth = cacheHeight = 128;
-        } else {
-            cacheWidth = cacheHeight = 256;
-        }
-        thumbPath = thumbRoot + QLatin1String(cacheWidth == 128 ? "normal/" : "large/");
-        if (!QDir(thumbPath).exists()) {
-            if (QDir().mkpath(thumbPath)) { // Qt5 TODO: mkpath(dirPath, permissions)
-                QFile f(thumbPath);
-                f.setPermissions(QFile::ReadUser | QFile::WriteUser | QFile::ExeUser); // 0700
-            }
-        }
+// Called once the first item whose thumbnail gets cached shows up
+void PreviewJobPrivate::setupThumbPath()
+{
+    if (width <= 128 && height <= 128) {
+        cacheWidth = cacheHeight = 128;
     } else {
-        bSave = false;
+        cacheWidth = cacheHeight = 256;
+    }
+    thumbPath = thumbRoot + QLatin1String(cacheWidth == 128 ? "normal/" : "large/");
+    if (!QDir(thumbPath).exists()) {
+        if (QDir().mkpath(thumbPath)) { // Qt5 TODO: mkpath(dirPath, permissions)
+            QFile f(thumbPath);
+            f.setPermissions(QFile::ReadUser | QFile::WriteUser | QFile::ExeUser); // 0700
+        }
     }
-
-    initialItems.clear();
-    determineNextFile();
 }
 
 void PreviewJob::removeItem(const QUrl &url)
@@ -402,12 +434,59 @@ void PreviewJob::removeItem(const QUrl &url)
         ++it;
     }
 
-    if (d->currentItem.item.url() == url) {
-        KJob *job = subjobs().first();
-        job->kill();
-        removeSubjob(job);
-        d->determineNextFile();
+    const QList<KJob *> jobs = d->jobTasks.keys();
+    for (KJob *job : jobs) {
+        PreviewJobPrivate::Task *task = d->jobTasks.value(job);
+        if (task->item.item.url() == url) {
+            d->jobTasks.remove(job);
+            job->kill();
+            removeSubjob(job);
+            d->finishTask(task);
+            break;
+        }
+    }
+}
+
+void PreviewJob::addItems(const KFileItemList &items)
+{
+    Q_D(PreviewJob);
+    if (!d->started) {
+        d->initialItems += items;
+        return;
+    }
+    d->appendItems(items);
+    d->startNextFiles();
+}
+
+void PreviewJob::prioritizeItems(const QList<QUrl> &urls)
+{
+    Q_D(PreviewJob);
+    QHash<QUrl, int> ranks;
+    ranks.reserve(urls.count());
+    for (int i = 0; i < urls.count(); ++i) {
+        ranks.insert(urls.at(i), i);
+    }
+    const int last = urls.count();
+
+    if (!d->started) {
+        std::stable_sort(d->initialItems.begin(), d->initialItems.end(), [&](const KFileItem &a, const KFileItem &b) {
+            return ranks.value(a.url(), last) < ranks.value(b.url(), last);
+        });
+        return;
+    }
+
+    std::list<PreviewItem> first;
+    for (auto it = d->items.begin(); it != d->items.end();) {
+        auto next = std::next(it);
+        if (ranks.contains(it->item.url())) {
+            first.splice(first.end(), d->items, it);
+        }
+        it = next;
     }
+    first.sort([&](const PreviewItem &a, const PreviewItem &b) {
+        return ranks.value(a.item.url()) < ranks.value(b.item.url());
+    });
+    d->items.splice(d->items.begin(), first);
 }
 
 void KIO::PreviewJob::setSequenceIndex(int index)
@@ -425,63 +504,84 @@ void PreviewJob::setIgnoreMaximumSize(bool ignoreSize)
     d_func()->ignoreMaximumSize = ignoreSize;
 }
 
-void PreviewJobPrivate::cleanupTempFile()
+void PreviewJobPrivate::cleanupTempFile(Task *task)
 {
-    if (!tempName.isEmpty()) {
-        Q_ASSERT((!QFileInfo(tempName).isDir() && QFileInfo(tempName).isFile()) || QFileInfo(tempName).isSymLink());
-        QFile::remove(tempName);
-        tempName.clear();
+    if (!task->tempName.isEmpty()) {
+        Q_ASSERT((!QFileInfo(task->tempName).isDir() && QFileInfo(task->tempName).isFile()) || QFileInfo(task->tempName).isSymLink());
+        QFile::remove(task->tempName);
+        task->tempName.clear();
     }
 }
 
-void PreviewJobPrivate::determineNextFile()
+void PreviewJobPrivate::startNextFiles()
 {
     Q_Q(PreviewJob);
-    if (!currentItem.item.isNull()) {
-        if (!succeeded) {
-            emit q->failed(currentItem.item);
-        }
-    }
-    // No more items ?
-    if (items.empty()) {
-        q->emitResult();
-        return;
-    } else {
+    // The items come in the order the caller wants them, usually the
+    // visible ones first; each one is started as soon as there is room
+    // and delivered as soon as it is ready.
+    while (!items.empty() && jobTasks.count() < maxTasks) {
         // First, stat the orig file
-        state = PreviewJobPrivate::STATE_STATORIG;
-        currentItem = items.front();
+        Task *task = new Task;
+        task->item = items.front();
         items.pop_front();
-        succeeded = false;
-        KIO::Job *job = KIO::stat(currentItem.item.url(), KIO::HideProgressInfo);
+        KIO::Job *job = KIO::stat(task->item.item.url(), KIO::HideProgressInfo);
         job->addMetaData(QStringLiteral("thumbnail"), QStringLiteral("1"));
         job->addMetaData(QStringLiteral("no-auth-prompt"), QStringLiteral("true"));
-        q->addSubjob(job);
+        startJob(task, job);
+    }
+    // No more items ?
+    if (items.empty() && jobTasks.isEmpty()) {
+        q->emitResult();
     }
 }
 
+void PreviewJobPrivate::startJob(Task *task, KIO::Job *job)
+{
+    Q_Q(PreviewJob);
+    jobTasks.insert(job, task);
+    q->addSubjob(job);
+}
+
+void PreviewJobPrivate::finishTask(Task *task)
+{
+    Q_Q(PreviewJob);
+    if (!task->succeeded) {
+        emit q->failed(task->item.item);
+    }
+    cleanupTempFile(task);
+    if (task->shm.addr) {
+        freeShmSegments.append(task->shm);
+    }
+    delete task;
+    startNextFiles();
+}
+
 void PreviewJob::slotResult(KJob *job)
 {
     Q_D(PreviewJob);
 
     removeSubjob(job);
-    Q_ASSERT(!hasSubjobs());    // We should have only one job at a time ...
-    switch (d->state) {
+    PreviewJobPrivate::Task *task = d->jobTasks.take(job);
+    if (!task) {
+        return;
+    }
+    switch (task->state) {
     case PreviewJobPrivate::STATE_STATORIG: {
         if (job->error()) { // that's no good news...
             // Drop this one and move on to the next one
-            d->determineNextFile();
+            d->finishTask(task);
             return;
         }
         const KIO::UDSEntry entry = static_cast<KIO::StatJob *>(job)->statResult();
-        d->tOrig = QDateTime::fromSecsSinceEpoch(entry.numberValue(KIO::UDSEntry::UDS_MODIFICATION_TIME, 0));
+        task->tOrig = QDateTime::fromSecsSinceEpoch(entry.numberValue(KIO::UDSEntry::UDS_MODIFICATION_TIME, 0));
 
         bool skipCurrentItem = false;
         const KIO::filesize_t size = (KIO::filesize_t)entry.numberValue(KIO::UDSEntry::UDS_SIZE, 0);
-        const QUrl itemUrl = d->currentItem.item.mostLocalUrl();
+        const QUrl itemUrl = task->item.item.mostLocalUrl();
 
         if (itemUrl.isLocalFile() || KProtocolInfo::protocolClass(itemUrl.scheme()) == QLatin1String(":local")) {
             skipCurrentItem = !d->ignoreMaximumSize && size > d->maximumLocalSize
-                              && !d->currentItem.plugin->property(QStringLiteral("IgnoreMaximumSize")).toBool();
+                              && !task->item.plugin->property(QStringLiteral("IgnoreMaximumSize")).toBool();
         } else {
             // For remote items the "IgnoreMaximumSize" plugin property is not respected
             skipCurrentItem = !d->ignoreMaximumSize && size > d->maximumRemoteSize;
@@ -490,91 +590,93 @@ void PreviewJob::slotResult(KJob *job)
             if (!skipCurrentItem) {
                 // TODO update item.mimeType from the UDS entry, in case it wasn't set initially
                 // But we don't use the MIME type anymore, we just use isDir().
-                if (d->currentItem.item.isDir()) {
+                if (task->item.item.isDir()) {
                     skipCurrentItem = true;
                 }
             }
         }
         if (skipCurrentItem) {
-            d->determineNextFile();
+            d->finishTask(task);
             return;
         }
 
-        bool pluginHandlesSequences = d->currentItem.plugin->property(QStringLiteral("HandleSequences"), QVariant::Bool).toBool();
-        if (!d->currentItem.plugin->property(QStringLiteral("CacheThumbnail")).toBool()  || (d->sequenceIndex && pluginHandlesSequences)) {
+        bool pluginHandlesSequences = task->item.plugin->property(QStringLiteral("HandleSequences"), QVariant::Bool).toBool();
+        if (!task->item.plugin->property(QStringLiteral("CacheThumbnail")).toBool()  || (d->sequenceIndex && pluginHandlesSequences)) {
             // This preview will not be cached, no need to look for a saved thumbnail
             // Just create it, and be done
-            d->getOrCreateThumbnail();
+            d->getOrCreateThumbnail(task);
             return;
         }
 
-        if (d->statResultThumbnail()) {
+        if (d->statResultThumbnail(task)) {
             return;
         }
 
-        d->getOrCreateThumbnail();
+        d->getOrCreateThumbnail(task);
         return;
     }
     case PreviewJobPrivate::STATE_GETORIG: {
         if (job->error()) {
-            d->cleanupTempFile();
-            d->determineNextFile();
+            d->finishTask(task);
             return;
         }
 
-        d->createThumbnail(static_cast<KIO::FileCopyJob *>(job)->destUrl().toLocalFile());
+        d->createThumbnail(task, static_cast<KIO::FileCopyJob *>(job)->destUrl().toLocalFile());
         return;
     }
     case PreviewJobPrivate::STATE_CREATETHUMB: {
-        d->cleanupTempFile();
-        d->determineNextFile();
+        d->finishTask(task);
         return;
     }
     }
 }
 
-bool PreviewJobPrivate::statResultThumbnail()
+bool PreviewJobPrivate::statResultThumbnail(Task *task)
 {
     if (thumbPath.isEmpty()) {
         return false;
     }
 
     bool isLocal;
-    const QUrl url = currentItem.item.mostLocalUrl(&isLocal);
+    const QUrl url = task->item.item.mostLocalUrl(&isLocal);
     if (isLocal) {
         const QFileInfo localFile(url.toLocalFile());
         const QString canonicalPath = localFile.canonicalFilePath();
-        origName = QUrl::fromLocalFile(canonicalPath).toEncoded(QUrl::RemovePassword | QUrl::FullyEncoded);
-        if (origName.isEmpty()) {
+        task->origName = QUrl::fromLocalFile(canonicalPath).toEncoded(QUrl::RemovePassword | QUrl::FullyEncoded);
+        if (task->origName.isEmpty()) {
             qCWarning(KIO_WIDGETS) << "Failed to convert" << url << "to canonical path";
             return false;
         }
     } else {
         // Don't include the password if any
-        origName = url.toEncoded(QUrl::RemovePassword);
+        task->origName = url.toEncoded(QUrl::RemovePassword);
     }
 
     QCryptographicHash md5(QCryptographicHash::Md5);
-    md5.addData(origName);
-    thumbName = QString::fromLatin1(md5.result().toHex()) + QLatin1String(".png");
+    md5.addData(task->origName);
+    task->thumbName = QString::fromLatin1(md5.result().toHex()) + QLatin1String(".png");
 
-    QImage thumb;
-    QFile thumbFile(thumbPath + thumbName);
-    if (!thumbFile.open(QIODevice::ReadOnly) || !thumb.load(&thumbFile, "png")) {
+    QFile thumbFile(thumbPath + task->thumbName);
+    if (!thumbFile.open(QIODevice::ReadOnly)) {
         return false;
     }
 
-    if (thumb.text(QStringLiteral("Thumb::URI")) != QString::fromUtf8(origName) ||
-            thumb.text(QStringLiteral("Thumb::MTime")).toLongLong() != tOrig.toSecsSinceEpoch()) {
+    // Until the thumbnail is known to be up to date, only read the PNG header
+    // and the text chunks before the image data, which is where the thumbnail
+    // spec properties are written. No need to decode stale thumbnails.
+    QImageReader reader(&thumbFile, "png");
+    if (reader.text(QStringLiteral("Thumb::URI")) != QString::fromUtf8(task->origName) ||
+            reader.text(QStringLiteral("Thumb::MTime")).toLongLong() != task->tOrig.toSecsSinceEpoch()) {
         return false;
     }
 
-    QString thumbnailerVersion = currentItem.plugin->property(QStringLiteral("ThumbnailerVersion"), QVariant::String).toString();
+    QString thumbnailerVersion = task->item.plugin->property(QStringLiteral("ThumbnailerVersion"), QVariant::String).toString();
 
-    if (!thumbnailerVersion.isEmpty() && thumb.text(QStringLiteral("Software")).startsWith(QLatin1String("KDE Thumbnail Generator"))) {
+    const QString software = reader.text(QStringLiteral("Software"));
+    if (!thumbnailerVersion.isEmpty() && software.startsWith(QLatin1String("KDE Thumbnail Generator"))) {
         //Check if the version matches
         //The software string should read "KDE Thumbnail Generator pluginName (vX)"
-        QString softwareString = thumb.text(QStringLiteral("Software")).remove(QStringLiteral("KDE Thumbnail Generator")).trimmed();
+        QString softwareString = QString(software).remove(QStringLiteral("KDE Thumbnail Generator")).trimmed();
         if (softwareString.isEmpty()) {
             // The thumbnail has been created with an older version, recreating
             return false;
@@ -593,21 +695,25 @@ bool PreviewJobPrivate::statResultThumbnail()
         }
     }
 
+    QImage thumb;
+    if (!reader.read(&thumb)) {
+        return false;
+    }
+
     // Found it, use it
-    emitPreview(thumb);
-    succeeded = true;
-    determineNextFile();
+    emitPreview(task, thumb);
+    task->succeeded = true;
+    finishTask(task);
     return true;
 }
 
-void PreviewJobPrivate::getOrCreateThumbnail()
+void PreviewJobPrivate::getOrCreateThumbnail(Task *task)
 {
-    Q_Q(PreviewJob);
     // We still need to load the orig file ! (This is getting tedious) :)
-    const KFileItem &item = currentItem.item;
+    const KFileItem &item = task->item.item;
     const QString localPath = item.localPath();
     if (!localPath.isEmpty()) {
-        createThumbnail(localPath);
+        createThumbnail(task, localPath);
     } else {
         const QUrl fileUrl = item.url();
         // heuristics for remote URL support
@@ -622,94 +728,114 @@ void PreviewJobPrivate::getOrCreateThumbnail()
         }
 
         if (supportsProtocol) {
-            createThumbnail(fileUrl.toString());
+            createThumbnail(task, fileUrl.toString());
             return;
         }
         if (item.isDir()) {
             // Skip remote dirs (bug 208625)
-            cleanupTempFile();
-            determineNextFile();
+            finishTask(task);
             return;
         }
         // No plugin support access to this remote content, copy the file
         // to the local machine, then create the thumbnail
-        state = PreviewJobPrivate::STATE_GETORIG;
+        task->state = PreviewJobPrivate::STATE_GETORIG;
         QTemporaryFile localFile;
         localFile.setAutoRemove(false);
         localFile.open();
-        tempName = localFile.fileName();
+        task->tempName = localFile.fileName();
         const QUrl currentURL = item.mostLocalUrl();
-        KIO::Job *job = KIO::file_copy(currentURL, QUrl::fromLocalFile(tempName), -1, KIO::Overwrite | KIO::HideProgressInfo /* No GUI */);
+        KIO::Job *job = KIO::file_copy(currentURL, QUrl::fromLocalFile(task->tempName), -1, KIO::Overwrite | KIO::HideProgressInfo /* No GUI */);
         job->addMetaData(QStringLiteral("thumbnail"), QStringLiteral("1"));
-        q->addSubjob(job);
+        startJob(task, job);
     }
 }
 
-void PreviewJobPrivate::createThumbnail(const QString &pixPath)
+void PreviewJobPrivate::createThumbnail(Task *task, const QString &pixPath)
 {
     Q_Q(PreviewJob);
-    state = PreviewJobPrivate::STATE_CREATETHUMB;
+    task->state = PreviewJobPrivate::STATE_CREATETHUMB;
     QUrl thumbURL;
     thumbURL.setScheme(QStringLiteral("thumbnail"));
     thumbURL.setPath(pixPath);
     KIO::TransferJob *job = KIO::get(thumbURL, NoReload, HideProgressInfo);
-    q->addSubjob(job);
     q->connect(job, SIGNAL(data(KIO::Job*,QByteArray)), SLOT(slotThumbData(KIO::Job*,QByteArray)));
-    bool save = bSave && currentItem.plugin->property(QStringLiteral("CacheThumbnail")).toBool() && !sequenceIndex;
-    job->addMetaData(QStringLiteral("mimeType"), currentItem.item.mimetype());
+    bool save = bSave && !thumbPath.isEmpty() && task->item.plugin->property(QStringLiteral("CacheThumbnail")).toBool() && !sequenceIndex;
+    job->addMetaData(QStringLiteral("mimeType"), task->item.item.mimetype());
     job->addMetaData(QStringLiteral("width"), QString().setNum(save ? cacheWidth : width));
     job->addMetaData(QStringLiteral("height"), QString().setNum(save ? cacheHeight : height));
     job->addMetaData(QStringLiteral("iconSize"), QString().setNum(save ? 64 : iconSize));
     job->addMetaData(QStringLiteral("iconAlpha"), QString().setNum(iconAlpha));
-    job->addMetaData(QStringLiteral("plugin"), currentItem.plugin->library());
+    job->addMetaData(QStringLiteral("plugin"), task->item.plugin->library());
     job->addMetaData(QStringLiteral("enabledPlugins"), enabledPlugins.join(QLatin1Char(',')));
     if (sequenceIndex) {
         job->addMetaData(QStringLiteral("sequence-index"), QString().setNum(sequenceIndex));
     }
 
+    // Each thumbnail job in flight needs its own segment
+    if (!task->shm.addr) {
+        task->shm = takeShmSegment();
+    }
+    if (task->shm.addr) {
+        job->addMetaData(QStringLiteral("shmid"), QString().setNum(task->shm.id));
+    }
+    startJob(task, job);
+}
+
+PreviewJobPrivate::ShmSegment PreviewJobPrivate::takeShmSegment()
+{
+    if (!freeShmSegments.isEmpty()) {
+        return freeShmSegments.takeLast();
+    }
+    ShmSegment segment;
 #if WITH_SHM
-    if (shmid == -1) {
-        if (shmaddr) {
-            shmdt((char *)shmaddr);
-            shmctl(shmid, IPC_RMID, nullptr);
-        }
-        auto size = std::max(cacheWidth * cacheHeight, width * height);
-        shmid = shmget(IPC_PRIVATE, size * 4, IPC_CREAT | 0600);
-        if (shmid != -1) {
-            shmaddr = (uchar *)(shmat(shmid, nullptr, SHM_RDONLY));
-            if (shmaddr == (uchar *) - 1) {
-                shmctl(shmid, IPC_RMID, nullptr);
-                shmaddr = nullptr;
-                shmid = -1;
-            }
-        } else {
-            shmaddr = nullptr;
+    auto size = std::max(cacheWidth * cacheHeight, width * height);
+    segment.id = shmget(IPC_PRIVATE, size * 4, IPC_CREAT | 0600);
+    if (segment.id != -1) {
+        segment.addr = (uchar *)(shmat(segment.id, nullptr, SHM_RDONLY));
+        if (segment.addr == (uchar *) - 1) {
+            shmctl(segment.id, IPC_RMID, nullptr);
+            segment.addr = nullptr;
+            segment.id = -1;
         }
     }
-    if (shmid != -1) {
-        job->addMetaData(QStringLiteral("shmid"), QString().setNum(shmid));
+#endif
+    return segment;
+}
+
+void PreviewJobPrivate::freeShmSegment(const ShmSegment &segment)
+{
+#if WITH_SHM
+    if (segment.addr) {
+        shmdt((char *)segment.addr);
+        shmctl(segment.id, IPC_RMID, nullptr);
     }
+#else
+    Q_UNUSED(segment)
 #endif
 }
 
-void PreviewJobPrivate::slotThumbData(KIO::Job *, const QByteArray &data)
+void PreviewJobPrivate::slotThumbData(KIO::Job *job, const QByteArray &data)
 {
-    const bool isEncrypted = encryptedMountsList.findByPath(currentItem.item.url().toLocalFile());
-    bool save = bSave &&
+    Task *task = jobTasks.value(job);
+    if (!task) {
+        return;
+    }
+    const bool isEncrypted = encryptedMountsList.findByPath(task->item.item.url().toLocalFile());
+    bool save = bSave && !thumbPath.isEmpty() &&
                 !sequenceIndex && !isEncrypted &&
-                currentItem.plugin->property(QStringLiteral("CacheThumbnail")).toBool() &&
-                (!currentItem.item.url().isLocalFile() ||
-                 !currentItem.item.url().adjusted(QUrl::RemoveFilename).toLocalFile().startsWith(thumbRoot));
+                task->item.plugin->property(QStringLiteral("CacheThumbnail")).toBool() &&
+                (!task->item.item.url().isLocalFile() ||
+                 !task->item.item.url().adjusted(QUrl::RemoveFilename).toLocalFile().startsWith(thumbRoot));
     QImage thumb;
 #if WITH_SHM
-    if (shmaddr) {
+    if (task->shm.addr) {
         // Keep this in sync with kdebase/kioslave/thumbnail.cpp
         QDataStream str(data);
         int width, height;
         quint8 iFormat;
         str >> width >> height >> iFormat;
         QImage::Format format = static_cast<QImage::Format>(iFormat);
-        thumb = QImage(shmaddr, width, height, format).copy();
+        thumb = QImage(task->shm.addr, width, height, format).copy();
     } else
 #endif
         thumb.loadFromData(data);
@@ -720,28 +846,28 @@ void PreviewJobPrivate::slotThumbData(KIO::Job *, const QByteArray &data)
     }
 
     if (save) {
-        thumb.setText(QStringLiteral("Thumb::URI"), QString::fromUtf8(origName));
-        thumb.setText(QStringLiteral("Thumb::MTime"), QString::number(tOrig.toSecsSinceEpoch()));
-        thumb.setText(QStringLiteral("Thumb::Size"), number(currentItem.item.size()));
-        thumb.setText(QStringLiteral("Thumb::Mimetype"), currentItem.item.mimetype());
-        QString thumbnailerVersion = currentItem.plugin->property(QStringLiteral("ThumbnailerVersion"), QVariant::String).toString();
-        QString signature = QLatin1String("KDE Thumbnail Generator ") + currentItem.plugin->name();
+        thumb.setText(QStringLiteral("Thumb::URI"), QString::fromUtf8(task->origName));
+        thumb.setText(QStringLiteral("Thumb::MTime"), QString::number(task->tOrig.toSecsSinceEpoch()));
+        thumb.setText(QStringLiteral("Thumb::Size"), number(task->item.item.size()));
+        thumb.setText(QStringLiteral("Thumb::Mimetype"), task->item.item.mimetype());
+        QString thumbnailerVersion = task->item.plugin->property(QStringLiteral("ThumbnailerVersion"), QVariant::String).toString();
+        QString signature = QLatin1String("KDE Thumbnail Generator ") + task->item.plugin->name();
         if (!thumbnailerVersion.isEmpty()) {
             signature.append(QLatin1String(" (v") + thumbnailerVersion + QLatin1Char(')'));
         }
         thumb.setText(QStringLiteral("Software"), signature);
-        QSaveFile saveFile(thumbPath + thumbName);
+        QSaveFile saveFile(thumbPath + task->thumbName);
         if (saveFile.open(QIODevice::WriteOnly)) {
             if (thumb.save(&saveFile, "PNG")) {
                 saveFile.commit();
             }
         }
     }
-    emitPreview(thumb);
-    succeeded = true;
+    emitPreview(task, thumb);
+    task->succeeded = true;
 }
 
-void PreviewJobPrivate::emitPreview(const QImage &thumb)
+void PreviewJobPrivate::emitPreview(Task *task, const QImage &thumb)
 {
     Q_Q(PreviewJob);
     QPixmap pix;
@@ -750,7 +876,7 @@ void PreviewJobPrivate::emitPreview(const QImage &thumb)
     } else {
         pix = QPixmap::fromImage(thumb);
     }
-    emit q->gotPreview(currentItem.item, pix);
+    emit q->gotPreview(task->item.item, pix);
 }
 
 QStringList PreviewJob::availablePlugins()
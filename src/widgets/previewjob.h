@@ -24,6 +24,11 @@ class PreviewJobPrivate;
  * @class KIO::PreviewJob previewjob.h <KIO/PreviewJob>
  *
  * This class catches a preview (thumbnail) for files.
+ *
+ * The items are started in the order they were given, several at once
+ * (as many as there are thumbnail slaves and CPU cores), so put the most
+ * wanted ones first; gotPreview() and failed() are emitted as soon as
+ * each one is done, which is not necessarily in that order.
  * @short KIO Job to get a thumbnail picture
  */
 class KIOWIDGETS_EXPORT PreviewJob : public KIO::Job
@@ -151,6 +156,25 @@ public:
      */
     void removeItem(const QUrl &url);
 
+    /**
+     * Adds items to the preview processing, behind the ones not started yet.
+     * This must be called before the job emitted its result.
+     *
+     * @param items the files to create previews for
+     * @since 5.78
+     */
+    void addItems(const KFileItemList &items);
+
+    /**
+     * Moves the items with the given URLs, in that order, in front of the
+     * items not started yet, e.g. the ones which became visible in a view.
+     * Items in progress or unknown to the job are not affected.
+     *
+     * @param urls the urls of the items to process first
+     * @since 5.78
+     */
+    void prioritizeItems(const QList<QUrl> &urls);
+
     /**
      * If @p ignoreSize is true, then the preview is always
      * generated regardless of the settings
@@ -0,0 +1,109 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2020 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <QCollator>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <qplatformdefs.h>
+
+#include <kdirlister.h>
+#include <kdirmodel.h>
+#include <kdirsortfilterproxymodel.h>
+
+/*
+   Natural sorting of the names of a huge directory, when it gets listed
+   and when the sort order changes.
+*/
+
+static const int s_itemCount = 200000;
+
+class ItemsDirLister : public KDirLister
+{
+public:
+    void emitItemsAdded(const QUrl &directoryUrl, const KFileItemList &items)
+    {
+        emit itemsAdded(directoryUrl, items);
+    }
+};
+
+class KDirSortFilterProxyModelBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void benchmarkSortListedItems();
+    void benchmarkChangeSortOrder();
+
+private:
+    void verifySorted(Qt::SortOrder order);
+
+    QTemporaryDir m_tempDir;
+    KDirModel m_dirModel;
+    KDirSortFilterProxyModel m_proxyModel;
+    ItemsDirLister *m_dirLister = nullptr;
+    KFileItemList m_items;
+};
+
+void KDirSortFilterProxyModelBenchmark::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+
+    m_dirLister = new ItemsDirLister;
+    m_dirModel.setDirLister(m_dirLister);
+    m_proxyModel.setSourceModel(&m_dirModel);
+    QSignalSpy spyCompleted(m_dirLister, QOverload<>::of(&KCoreDirLister::completed));
+    m_dirLister->openUrl(QUrl::fromLocalFile(m_tempDir.path()), KDirLister::NoFlags);
+    if (spyCompleted.isEmpty()) {
+        QVERIFY(spyCompleted.wait(10000));
+    }
+
+    // Shuffled, with numbers for the natural sorting; the items don't exist
+    m_items.reserve(s_itemCount);
+    for (int i = 0; i < s_itemCount; ++i) {
+        const int number = (i * 7919) % s_itemCount;
+        const QString name = QStringLiteral("Photo %1.jpg").arg(number);
+        m_items.append(KFileItem(QUrl::fromLocalFile(m_tempDir.path() + QLatin1Char('/') + name), QStringLiteral("image/jpeg"), QT_STAT_REG));
+    }
+}
+
+void KDirSortFilterProxyModelBenchmark::verifySorted(Qt::SortOrder order)
+{
+    QCOMPARE(m_proxyModel.rowCount(), s_itemCount);
+    QCollator collator;
+    collator.setNumericMode(true);
+    collator.setCaseSensitivity(Qt::CaseInsensitive);
+    QString previous = m_proxyModel.index(0, 0).data().toString();
+    for (int row = 1; row < s_itemCount; ++row) {
+        const QString name = m_proxyModel.index(row, 0).data().toString();
+        const int result = collator.compare(previous, name);
+        QVERIFY2(order == Qt::AscendingOrder ? result <= 0 : result >= 0, qPrintable(previous + QLatin1String(" vs ") + name));
+        previous = name;
+    }
+}
+
+void KDirSortFilterProxyModelBenchmark::benchmarkSortListedItems()
+{
+    QBENCHMARK_ONCE {
+        m_dirLister->emitItemsAdded(m_dirLister->url(), m_items);
+    }
+    verifySorted(Qt::AscendingOrder);
+}
+
+void KDirSortFilterProxyModelBenchmark::benchmarkChangeSortOrder()
+{
+    QBENCHMARK_ONCE {
+        m_proxyModel.sort(KDirModel::Name, Qt::DescendingOrder);
+    }
+    verifySorted(Qt::DescendingOrder);
+}
+
+QTEST_MAIN(KDirSortFilterProxyModelBenchmark)
+
+#include "kdirsortfilterproxymodelbenchmark.moc"